@@ -7,12 +7,31 @@
 
 
 #build tx_raw for air pi
-g++ -Isrc/ -o air/tx_raw src/tx_raw.cpp src/connection.cpp src/h264.cpp src/h264TXFraming.cpp src/h264UDPPackage.cpp
+g++ -Isrc/ -o air/tx_raw src/tx_raw.cpp src/connection.cpp src/sha256.cpp src/pathMtu.cpp src/uplinkQueue.cpp src/linkMonitor.cpp src/mavlinkFrameParser.cpp src/mavlinkFrameRing.cpp src/mavlinkFilter.cpp src/mavlinkCompression.cpp src/txScheduler.cpp src/serialPort.cpp src/shmMetrics.cpp src/mp4Recorder.cpp src/recordIndex.cpp src/mavlinkLog.cpp src/h264.cpp src/h264TXFraming.cpp src/h264UDPPackage.cpp -lrt -pthread
 
 #build rx_raw for ground pi OpenHD (ground-OpenHD)
-g++ -Isrc/ -o ground-OpenHD/rx_raw src/rx_raw.cpp src/connection.cpp src/h264.cpp src/h264RXFraming.cpp src/h264UDPPackage.cpp
+g++ -Isrc/ -o ground-OpenHD/rx_raw src/rx_raw.cpp src/rxCapture.cpp src/pathMtu.cpp src/mavlinkLog.cpp src/rtspServer.cpp src/videoFanout.cpp src/connection.cpp src/sha256.cpp src/mavlinkFrameParser.cpp src/mavlinkCompression.cpp src/shmMetrics.cpp src/h264.cpp src/h264RXFraming.cpp src/h264UDPPackage.cpp -lrt -pthread
 
 #build videoRecord for ground pi (ground-VideoRecord)
-g++ -Isrc/ -o ground-VideoRecord/videoRecord src/videoRecord.cpp src/connection.cpp
+g++ -Isrc/ -o ground-VideoRecord/videoRecord src/videoRecord.cpp src/connection.cpp src/mavlinkFrameParser.cpp src/mp4Recorder.cpp src/recordIndex.cpp
 
+#build relay for a server with a public IP, when the drone is behind carrier-grade NAT (relay)
+g++ -Isrc/ -o relay/relay src/relay.cpp src/udpRelay.cpp src/sha256.cpp -pthread
 
+
+
+#build benchmark (development tool, not deployed)
+mkdir -p tools
+g++ -Isrc/ -o tools/benchmark src/benchmark.cpp src/mavlinkFrameParser.cpp src/mavlinkFrameRing.cpp src/txScheduler.cpp src/mavlinkCompression.cpp src/serialPort.cpp src/connection.cpp src/rtspServer.cpp src/udpRelay.cpp src/sha256.cpp src/h264.cpp src/h264TXFraming.cpp src/h264RXFraming.cpp src/h264UDPPackage.cpp -pthread
+
+#build metricsReader (reads the live tx_raw / rx_raw metrics in /dev/shm)
+g++ -Isrc/ -o tools/metricsReader src/metricsReader.cpp src/shmMetrics.cpp -lrt
+
+#build lteEmulator (UDP proxy emulating the LTE link between tx_raw and rx_raw on one machine)
+g++ -Isrc/ -o tools/lteEmulator src/lteEmulator.cpp src/linkEmulator.cpp src/connection.cpp
+
+#build indexReader (reads the .idx keyframe / telemetry sidecar of a recording)
+g++ -Isrc/ -o tools/indexReader src/indexReader.cpp src/recordIndex.cpp
+
+#build tlogReader (time / msgid range queries on the tx_raw / rx_raw -L Mavlink log)
+g++ -Isrc/ -o tools/tlogReader src/tlogReader.cpp src/mavlinkLog.cpp src/mavlinkFrameParser.cpp -pthread
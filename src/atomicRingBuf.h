@@ -0,0 +1,224 @@
+/*
+	atomicRingBuf.h
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+
+#ifndef ATOMICRINGBUF_H_
+#define ATOMICRINGBUF_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+
+// Ring buffers for passing data between threads (e.g. the socket, framing and output stages of tx_raw / rx_raw),
+// the companion of RingBuf.h which is for one thread only (its locked push / pop do nothing on Linux).
+// The size is a power of two, the indices run freely and are masked. The index each side writes has its own cache
+// line, and each side keeps a copy of the other index so it only reads the shared one when it looks full / empty.
+// Besides push / pop by copy, prepareWrite / prepareRead give the free / filled slots in one piece to work on in
+// place (e.g. recvmmsg() straight into the ring), made visible with commitWrite / commitRead.
+
+#define ATOMIC_RING_CACHE_LINE 64
+
+// One producer thread and one consumer thread.
+template <typename ET, size_t S>
+class SpscRingBuf
+{
+	static_assert(S >= 2 && (S & (S - 1)) == 0, "SpscRingBuf size must be a power of two");
+
+	public:
+	SpscRingBuf() : mWriteIndex(0), mCachedReadIndex(0), mReadIndex(0), mCachedWriteIndex(0) {}
+
+	// Producer thread:
+	bool push(const ET &inElement){ // returns false if full.
+		size_t write = this->mWriteIndex.load(std::memory_order_relaxed);
+		if(write - this->mCachedReadIndex == S){
+			this->mCachedReadIndex = this->mReadIndex.load(std::memory_order_acquire);
+			if(write - this->mCachedReadIndex == S){
+				return false;
+			}
+		}
+		this->mBuffer[write & MASK] = inElement;
+		this->mWriteIndex.store(write + 1, std::memory_order_release);
+		return true;
+	}
+
+	size_t pushBulk(const ET *inElements, size_t count){ // returns the number pushed, less than count when it got full.
+		size_t pushed = 0;
+		for(int part=0;part<2 && pushed < count;part++){ // the free slots can wrap around the end once.
+			ET *span;
+			size_t length = std::min(this->prepareWrite(span), count - pushed);
+			std::copy(inElements + pushed, inElements + pushed + length, span);
+			this->commitWrite(length);
+			pushed += length;
+		}
+		return pushed;
+	}
+
+	size_t prepareWrite(ET *&span){ // free slots in one piece (up to the end of the ring), 0 if full.
+		size_t write = this->mWriteIndex.load(std::memory_order_relaxed);
+		size_t contiguous = S - (write & MASK);
+		if(S - (write - this->mCachedReadIndex) < contiguous){
+			this->mCachedReadIndex = this->mReadIndex.load(std::memory_order_acquire);
+		}
+		span = &this->mBuffer[write & MASK];
+		return std::min(contiguous, S - (write - this->mCachedReadIndex));
+	}
+
+	void commitWrite(size_t count){ // count slots written after prepareWrite.
+		this->mWriteIndex.store(this->mWriteIndex.load(std::memory_order_relaxed) + count, std::memory_order_release);
+	}
+
+	// Consumer thread:
+	bool pop(ET &outElement){ // returns false if empty.
+		size_t read = this->mReadIndex.load(std::memory_order_relaxed);
+		if(read == this->mCachedWriteIndex){
+			this->mCachedWriteIndex = this->mWriteIndex.load(std::memory_order_acquire);
+			if(read == this->mCachedWriteIndex){
+				return false;
+			}
+		}
+		outElement = this->mBuffer[read & MASK];
+		this->mReadIndex.store(read + 1, std::memory_order_release);
+		return true;
+	}
+
+	size_t popBulk(ET *outElements, size_t count){ // returns the number popped.
+		size_t popped = 0;
+		for(int part=0;part<2 && popped < count;part++){
+			ET *span;
+			size_t length = std::min(this->prepareRead(span), count - popped);
+			std::copy(span, span + length, outElements + popped);
+			this->commitRead(length);
+			popped += length;
+		}
+		return popped;
+	}
+
+	size_t prepareRead(ET *&span){ // filled slots in one piece (up to the end of the ring), 0 if empty.
+		size_t read = this->mReadIndex.load(std::memory_order_relaxed);
+		size_t contiguous = S - (read & MASK);
+		if(this->mCachedWriteIndex - read < contiguous){
+			this->mCachedWriteIndex = this->mWriteIndex.load(std::memory_order_acquire);
+		}
+		span = &this->mBuffer[read & MASK];
+		return std::min(contiguous, this->mCachedWriteIndex - read);
+	}
+
+	void commitRead(size_t count){ // count slots used after prepareRead, the producer can write them again.
+		this->mReadIndex.store(this->mReadIndex.load(std::memory_order_relaxed) + count, std::memory_order_release);
+	}
+
+	// Any thread, only a snapshot while the other side is running:
+	bool isFull()  { return this->size() == S; }
+	bool isEmpty() { return this->size() == 0; }
+	size_t size(){
+		size_t read = this->mReadIndex.load(std::memory_order_acquire); // first, it never passes the write index.
+		return this->mWriteIndex.load(std::memory_order_acquire) - read;
+	}
+	size_t maxSize() { return S; }
+
+	private:
+	static const size_t MASK = S - 1;
+	alignas(ATOMIC_RING_CACHE_LINE) std::atomic<size_t> mWriteIndex; // producer cache line.
+	size_t mCachedReadIndex;
+	alignas(ATOMIC_RING_CACHE_LINE) std::atomic<size_t> mReadIndex;  // consumer cache line.
+	size_t mCachedWriteIndex;
+	alignas(ATOMIC_RING_CACHE_LINE) ET mBuffer[S];
+};
+
+// Any number of producer threads and one consumer thread. A producer reserves its slots by moving the write index
+// (compare and swap) and marks each slot as written in its sequence, the consumer takes the slots in order and
+// stops at one still being written. The slots of one pushBulk are in a row, the elements of one producer are in order.
+template <typename ET, size_t S>
+class MpscRingBuf
+{
+	static_assert(S >= 2 && (S & (S - 1)) == 0, "MpscRingBuf size must be a power of two");
+
+	public:
+	MpscRingBuf() : mWriteIndex(0), mReadIndex(0) {
+		for(size_t a=0;a<S;a++){
+			this->mSequence[a].store(0, std::memory_order_relaxed); // slot a is written when it is index + 1.
+		}
+	}
+
+	// Producer threads:
+	bool push(const ET &inElement){ // returns false if full.
+		return this->pushBulk(&inElement, 1) == 1;
+	}
+
+	size_t pushBulk(const ET *inElements, size_t count){ // returns the number pushed, less than count when it got full.
+		size_t write = this->mWriteIndex.load(std::memory_order_relaxed);
+		size_t length;
+		do{
+			size_t read = this->mReadIndex.load(std::memory_order_acquire); // the consumer is done with the slots before it.
+			length = std::min(count, S - (write - read));
+			if(length == 0){
+				return 0;
+			}
+		}while(false == this->mWriteIndex.compare_exchange_weak(write, write + length, std::memory_order_relaxed));
+		for(size_t a=0;a<length;a++){
+			this->mBuffer[(write + a) & MASK] = inElements[a];
+			this->mSequence[(write + a) & MASK].store(write + a + 1, std::memory_order_release);
+		}
+		return length;
+	}
+
+	// Consumer thread:
+	bool pop(ET &outElement){ // returns false if empty (or the next slot is still being written).
+		size_t read = this->mReadIndex.load(std::memory_order_relaxed);
+		if(this->mSequence[read & MASK].load(std::memory_order_acquire) != read + 1){
+			return false;
+		}
+		outElement = this->mBuffer[read & MASK];
+		this->mReadIndex.store(read + 1, std::memory_order_release);
+		return true;
+	}
+
+	size_t popBulk(ET *outElements, size_t count){ // returns the number popped.
+		size_t popped = 0;
+		for(int part=0;part<2 && popped < count;part++){
+			ET *span;
+			size_t length = std::min(this->prepareRead(span), count - popped);
+			std::copy(span, span + length, outElements + popped);
+			this->commitRead(length);
+			popped += length;
+		}
+		return popped;
+	}
+
+	size_t prepareRead(ET *&span){ // written slots in one piece (up to the end of the ring or a slot still being written).
+		size_t read = this->mReadIndex.load(std::memory_order_relaxed);
+		size_t contiguous = S - (read & MASK);
+		size_t length = 0;
+		while(length < contiguous && this->mSequence[(read + length) & MASK].load(std::memory_order_acquire) == read + length + 1){
+			length++;
+		}
+		span = &this->mBuffer[read & MASK];
+		return length;
+	}
+
+	void commitRead(size_t count){
+		this->mReadIndex.store(this->mReadIndex.load(std::memory_order_relaxed) + count, std::memory_order_release);
+	}
+
+	// Any thread, only a snapshot (it counts reserved slots still being written):
+	bool isFull()  { return this->size() == S; }
+	bool isEmpty() { return this->size() == 0; }
+	size_t size(){
+		size_t read = this->mReadIndex.load(std::memory_order_acquire); // first, it never passes the write index.
+		return this->mWriteIndex.load(std::memory_order_acquire) - read;
+	}
+	size_t maxSize() { return S; }
+
+	private:
+	static const size_t MASK = S - 1;
+	alignas(ATOMIC_RING_CACHE_LINE) std::atomic<size_t> mWriteIndex; // shared by the producers.
+	alignas(ATOMIC_RING_CACHE_LINE) std::atomic<size_t> mReadIndex;  // consumer cache line.
+	alignas(ATOMIC_RING_CACHE_LINE) std::atomic<size_t> mSequence[S];
+	alignas(ATOMIC_RING_CACHE_LINE) ET mBuffer[S];
+};
+
+#endif /* ATOMICRINGBUF_H_ */
@@ -0,0 +1,1761 @@
+/*
+	benchmark.cpp
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+
+// Benchmarks for the hot paths in tx_raw / rx_raw / videoRecord.
+// Output is one JSON object per line, so results can be collected and compared between builds:
+// {"benchmark":"...","input":"...","bytes":N,"items":N,"seconds":S,"MBps":X,"nsPerItem":Y}
+// The synthetic Mavlink and H.264 inputs are deterministic, the same options give the same bytes on x86 and on the Pi.
+
+#include "mavlinkFrameParser.h" // first, for the ardupilotmega message tables.
+#include "mavlinkCompression.h"
+#include "mavlinkFrameRing.h"
+#include "txScheduler.h"
+#include "serialPort.h"
+#include "h264TXFraming.h"
+#include "h264RXFraming.h"
+#include "connection.h"
+#include "rtspServer.h"
+#include "udpRelay.h"
+#include "RingBuf.h"
+#include "atomicRingBuf.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define DEFAULT_CORPUS_MBYTES 8   // ~60 seconds of a 1.5Mbaud serial link.
+#define DEFAULT_RUNS 5            // best of N.
+#define DEFAULT_READ_SIZE 1400    // bytes per read(), as tx_raw did with MAXLINE.
+#define CORPUS_NOISE_INTERVAL 997 // one garbage byte every N frames, so resync is part of the test.
+#define BATCH_SIZE 1024           // tx_raw MAX_SERIAL_BUFFER_SIZE, batches are also cut at VFR_HUD like tx_raw does.
+#define MESSAGE_RING_SIZE 256     // mavlink_message_t kept by value, as tx_raw had it (FIFO_SIZE).
+#define LOSS_INTERVAL 50          // drop 1 of N compressed batches (random) in the loss test, 2% UDP loss.
+#define PTY_BAUDRATE 1500000      // set on the pty like tx_raw -r would, the pty itself is not rate limited.
+#define PTY_SLOW_CONSUMER 256     // bytes taken from the ring per loop in the overrun test.
+#define DEFAULT_H264_FRAMES 1800  // 60 seconds at 30fps.
+#define DEFAULT_H264_GOP 30
+#define DEFAULT_H264_KEYFRAME 60000
+#define DEFAULT_H264_FRAME 12000  // ~3Mbit at 30fps.
+#define DEFAULT_H264_SEED 2021
+#define RX_REORDER_DISTANCE 3     // packages, LTE reorders a few packages, not whole frames.
+#define BUFFER_SEARCH_ITERATIONS 100000
+#define BENCH_UDP_PORT 5699
+#define UDP_BURST 32              // packages sent before the receiver reads, well within the default socket buffer.
+#define BENCH_RTSP_PORT 5698
+#define RTSP_REPLY_TIMEOUT_MS 1000
+#define BENCH_RELAY_PORT 5700
+#define BENCH_RELAY_KEY "benchmark"
+#define RELAY_BENCH_PACKAGES 200000 // through the relay per run, spread over the drones.
+#define RELAY_BENCH_MIN_PACKAGES 200 // per drone.
+#define RELAY_BENCH_WINDOW 64       // packages on the way before the ground sockets read.
+#define RELAY_BENCH_TIMEOUT_MS 100  // a package not there after this is lost.
+#define RING_BENCH_SIZE 1024        // elements, the rings between the tx_raw / rx_raw stages are about this size.
+#define RING_BENCH_ITEMS 4000000    // through the ring per run, spread over the producers.
+#define RING_BENCH_BULK 32          // elements per pushBulk / popBulk, like a recvmmsg() batch.
+#define RING_LATENCY_SAMPLES 20000
+#define RING_LATENCY_INTERVAL_US 20
+
+int flagHelp = 0;
+
+void usage(void) {
+	printf("\nUsage: benchmark [options]\n"
+	"\n"
+	"Options:\n"
+	"-b  <list>     Benchmarks to run, comma separated: mavlink,compression,serial,h264,udp,rtsp,relay,ring (default all).\n"
+	"-m  <file>     Captured serial trace to use instead of the synthetic corpus (e.g. cat /dev/serial0 > trace.bin).\n"
+	"-s  <Mbytes>   Size of the synthetic high baud rate Mavlink corpus (default %d).\n"
+	"-r  <runs>     Number of runs, the best is reported (default %d).\n"
+	"-c  <bytes>    Bytes per read() fed to the parsers and the H.264 TX framing (default %d).\n"
+	"-D  <file>     Train a Mavlink compression dictionary from the input and write it to file (for tx_raw / rx_raw -x).\n"
+	"\n"
+	"Synthetic H.264 stream:\n"
+	"-n  <frames>   Number of frames (default %d).\n"
+	"-g  <frames>   GOP length, frames per IDR (default %d).\n"
+	"-k  <bytes>    Average IDR frame size (default %d).\n"
+	"-p  <bytes>    Average P frame size (default %d).\n"
+	"-l  <slices>   Slices per frame (default 1).\n"
+	"-B             Baseline profile SPS/PPS instead of high.\n"
+	"-H             SPS/PPS only at the start instead of before every IDR.\n"
+	"-A             Access unit delimiter before each frame.\n"
+	"-e  <seed>     Seed for the frame sizes and slice data (default %d).\n"
+	"-w  <file>     Write the stream to file (e.g. for cat stream.h264 | ./tx_raw ...).\n"
+	"-L  <permille> Random package loss for an extra RX framing run.\n"
+	"-O  <permille> Package reordering for an extra RX framing run.\n"
+	"\n"
+	"Example:\n"
+	"  ./benchmark\n"
+	"  ./benchmark -m trace.bin -r 10 > results.json\n"
+	"  ./benchmark -m trace.bin -D mavlink.dict\n"
+	"  ./benchmark -b h264 -g 60 -l 4 -L 20 -O 5\n"
+	"\n", DEFAULT_CORPUS_MBYTES, DEFAULT_RUNS, DEFAULT_READ_SIZE, DEFAULT_H264_FRAMES, DEFAULT_H264_GOP, DEFAULT_H264_KEYFRAME, DEFAULT_H264_FRAME, DEFAULT_H264_SEED);
+	exit(1);
+}
+
+double timeSeconds(void){
+	using namespace std::chrono;
+	return duration_cast<duration<double>>(steady_clock::now().time_since_epoch()).count();
+}
+
+void printResult(const char *name, const char *input, uint64_t bytes, uint64_t items, double seconds){
+	printf("{\"benchmark\":\"%s\",\"input\":\"%s\",\"bytes\":%llu,\"items\":%llu,\"seconds\":%.6f,\"MBps\":%.2f,\"nsPerItem\":%.1f}\n",
+		name, input, (unsigned long long)bytes, (unsigned long long)items, seconds,
+		(seconds > 0) ? (bytes / (1024.0*1024.0)) / seconds : 0,
+		(items > 0) ? (seconds * 1e9) / items : 0);
+	fflush(stdout);
+}
+
+////////// Mavlink corpus //////////
+
+uint64_t corpusFrames=0; // frames in the synthetic corpus, the parser must find all of them.
+
+void addMessage(std::vector<uint8_t> &corpus, mavlink_message_t &msg){
+	uint8_t buffer[MAVLINK_MAX_PACKET_LEN];
+	uint16_t length = mavlink_msg_to_send_buffer(buffer, &msg);
+	corpus.insert(corpus.end(), buffer, buffer + length);
+	corpusFrames++;
+}
+
+// Typical ArduPilot stream set at high rates (attitude 50Hz, position/HUD 10Hz...) with a bit of line noise.
+void buildMavlinkCorpus(std::vector<uint8_t> &corpus, uint32_t size){
+	mavlink_message_t msg;
+	char text[MAVLINK_MSG_STATUSTEXT_FIELD_TEXT_LEN] = "EKF3 IMU0 is using GPS"; // the pack copies the whole field.
+	uint32_t tick=0;
+	srand(1234);
+	while(corpus.size() < size){
+		tick++;
+		mavlink_msg_attitude_pack(1, 1, &msg, tick, 0.1f, -0.2f, 1.5f, 0.01f, 0.02f, 0.03f);
+		addMessage(corpus, msg);
+		if(tick % 5 == 0){
+			mavlink_msg_global_position_int_pack(1, 1, &msg, tick, 556000000 + tick, 125000000 - tick, 52000, 12000, 150, -20, 3, 18000);
+			addMessage(corpus, msg);
+			mavlink_msg_vfr_hud_pack(1, 1, &msg, 14.5f, 15.0f, 180, 45, 52.0f, 0.3f);
+			addMessage(corpus, msg);
+			mavlink_msg_raw_imu_pack(1, 1, &msg, tick, 10, -5, 1000, 1, 2, 3, 200, 100, -300);
+			addMessage(corpus, msg);
+		}
+		if(tick % 10 == 0){
+			mavlink_msg_gps_raw_int_pack(1, 1, &msg, tick, 3, 556000000, 125000000, 52000, 80, 120, 1450, 18000, 14);
+			addMessage(corpus, msg);
+			mavlink_msg_sys_status_pack(1, 1, &msg, 0x3f, 0x3f, 0x3f, 250, 16200, -1, 87, 0, 0, 0, 0, 0, 0);
+			addMessage(corpus, msg);
+		}
+		if(tick % 50 == 0){
+			mavlink_msg_heartbeat_pack(1, 1, &msg, MAV_TYPE_QUADROTOR, MAV_AUTOPILOT_ARDUPILOTMEGA, MAV_MODE_FLAG_SAFETY_ARMED, 0, MAV_STATE_ACTIVE);
+			addMessage(corpus, msg);
+			mavlink_msg_statustext_pack(1, 1, &msg, MAV_SEVERITY_INFO, text);
+			addMessage(corpus, msg);
+		}
+		if(tick % CORPUS_NOISE_INTERVAL == 0){
+			corpus.push_back((rand() & 1) ? MAVLINK_STX : (uint8_t)rand());
+		}
+	}
+}
+
+// The same frames as trimmed Mavlink 2, like tx_raw -m 2 sends them over LTE. Returns number of frames.
+uint64_t buildMavlink2Corpus(const std::vector<uint8_t> &corpus, std::vector<uint8_t> &corpus2){
+	MavlinkFrameParser parser;
+	MavlinkFrame_t frame;
+	uint8_t buffer[MAVLINK_PARSER_MAX_FRAME_LEN];
+	uint64_t frames=0;
+	for(size_t offset=0; offset<corpus.size(); offset+=DEFAULT_READ_SIZE){
+		uint32_t length = (uint32_t)std::min((size_t)DEFAULT_READ_SIZE, corpus.size() - offset);
+		parser.inputData(&corpus[offset], length);
+		while(parser.nextFrame(frame)){
+			uint16_t size = MavlinkFrameParser::toMavlink2(frame, buffer);
+			corpus2.insert(corpus2.end(), buffer, buffer + size);
+			frames++;
+		}
+	}
+	return frames;
+}
+
+bool loadFile(const char *filename, std::vector<uint8_t> &data){
+	FILE *fp = fopen(filename, "rb");
+	if(fp == NULL){
+		fprintf(stderr, "benchmark: Unable to open %s\n", filename);
+		return false;
+	}
+	uint8_t buffer[65536];
+	size_t n;
+	while((n = fread(buffer, 1, sizeof(buffer), fp)) > 0){
+		data.insert(data.end(), buffer, buffer + n);
+	}
+	fclose(fp);
+	return true;
+}
+
+////////// Mavlink benchmarks //////////
+
+// The old tx_raw path: mavlink_parse_char() per byte and mavlink_msg_to_send_buffer() into the UDP batch.
+uint64_t benchParseChar(const std::vector<uint8_t> &corpus, uint32_t readSize, uint32_t &checksum){
+	static uint8_t rxBuffer[65536];
+	uint8_t batch[MAVLINK_MAX_PACKET_LEN*4];
+	mavlink_status_t status;
+	mavlink_message_t msg;
+	bzero(&status, sizeof(status));
+	uint64_t frames=0;
+	checksum=0;
+	for(size_t offset=0; offset<corpus.size(); offset+=readSize){
+		uint32_t length = (uint32_t)std::min((size_t)readSize, corpus.size() - offset);
+		memcpy(rxBuffer, &corpus[offset], length); // read()
+		for(uint32_t a=0;a<length;a++){
+			if(mavlink_parse_char(MAVLINK_COMM_0, rxBuffer[a], &msg, &status)){
+				uint16_t size = mavlink_msg_to_send_buffer(batch, &msg);
+				checksum += batch[size-1] + msg.msgid;
+				frames++;
+			}
+		}
+	}
+	return frames;
+}
+
+// The new path: read() into the parser buffer, bulk validate and copy the frame span into the UDP batch.
+uint64_t benchFrameParser(const std::vector<uint8_t> &corpus, uint32_t readSize, uint32_t &checksum){
+	MavlinkFrameParser parser;
+	uint8_t batch[MAVLINK_PARSER_MAX_FRAME_LEN*4];
+	MavlinkFrame_t frame;
+	uint64_t frames=0;
+	checksum=0;
+	for(size_t offset=0; offset<corpus.size(); offset+=readSize){
+		uint32_t length = (uint32_t)std::min((size_t)readSize, corpus.size() - offset);
+		parser.inputData(&corpus[offset], length); // read()
+		while(parser.nextFrame(frame)){
+			memcpy(batch, frame.data, frame.length);
+			checksum += batch[frame.length-1] + frame.msgid;
+			frames++;
+		}
+	}
+	return frames;
+}
+
+uint64_t benchCRCPerByte(const std::vector<uint8_t> &corpus, uint32_t &checksum){
+	uint16_t crc = X25_INIT_CRC;
+	for(size_t a=0;a<corpus.size();a++){
+		crc_accumulate(corpus[a], &crc);
+	}
+	checksum = crc;
+	return corpus.size();
+}
+
+uint64_t benchCRCTable(const std::vector<uint8_t> &corpus, uint32_t &checksum){
+	checksum = MavlinkFrameParser::crc(&corpus[0], corpus.size(), X25_INIT_CRC);
+	return corpus.size();
+}
+
+typedef uint64_t (*mavlinkBench_t)(const std::vector<uint8_t> &corpus, uint32_t readSize, uint32_t &checksum);
+
+uint64_t runMavlinkBench(const char *name, const char *input, mavlinkBench_t bench, const std::vector<uint8_t> &corpus, uint32_t readSize, int runs, uint32_t &checksum){
+	double best=0;
+	uint64_t frames=0;
+	for(int run=0;run<runs;run++){
+		double start = timeSeconds();
+		frames = bench(corpus, readSize, checksum);
+		double elapsed = timeSeconds() - start;
+		if(run == 0 || elapsed < best){
+			best = elapsed;
+		}
+	}
+	printResult(name, input, corpus.size(), frames, best);
+	return frames;
+}
+
+// The CRC runs over the whole corpus, the read size of the parser benchmarks does not apply.
+uint64_t crcPerByteAdapter(const std::vector<uint8_t> &corpus, uint32_t, uint32_t &checksum){
+	return benchCRCPerByte(corpus, checksum);
+}
+
+uint64_t crcTableAdapter(const std::vector<uint8_t> &corpus, uint32_t, uint32_t &checksum){
+	return benchCRCTable(corpus, checksum);
+}
+
+// From the Mavlink frames to UDP batches in the TX scheduler, batches of up to BATCH_SIZE bytes.
+uint32_t flushMessageRing(RingBuf<mavlink_message_t, MESSAGE_RING_SIZE> &ring, TXScheduler &scheduler){
+	uint8_t batch[BATCH_SIZE];
+	mavlink_message_t msg;
+	uint16_t size=0;
+	while(ring.pop(msg)){
+		size += mavlink_msg_to_send_buffer(&batch[size], &msg);
+	}
+	if(size == 0){
+		return 0;
+	}
+	scheduler.enqueue(TX_CLASS_MAVLINK, batch, size, 0);
+	return size*31 + batch[size-1];
+}
+
+// The path before the frame ring: each frame decoded into a mavlink_message_t, kept by value in a RingBuf and
+// serialized again with mavlink_msg_to_send_buffer() into the batch, which is copied into the scheduler.
+uint64_t benchMessageRing(const std::vector<uint8_t> &corpus, uint32_t readSize, uint32_t &checksum){
+	static RingBuf<mavlink_message_t, MESSAGE_RING_SIZE> ring;
+	static TXScheduler scheduler;
+	MavlinkFrameParser parser;
+	MavlinkFrame_t frame;
+	mavlink_message_t msg;
+	uint32_t queued=0; // bytes on the wire of the messages in the ring.
+	uint64_t frames=0;
+	checksum=0;
+	for(size_t offset=0; offset<corpus.size(); offset+=readSize){
+		uint32_t length = (uint32_t)std::min((size_t)readSize, corpus.size() - offset);
+		parser.inputData(&corpus[offset], length); // read()
+		while(parser.nextFrame(frame)){
+			MavlinkFrameParser::decode(frame, &msg);
+			if(queued + frame.length > BATCH_SIZE || ring.isFull()){
+				checksum += flushMessageRing(ring, scheduler);
+				queued=0;
+			}
+			ring.push(msg);
+			queued += frame.length;
+			frames++;
+		}
+	}
+	checksum += flushMessageRing(ring, scheduler);
+	return frames;
+}
+
+uint32_t flushFrameRing(MavlinkFrameRing &ring, TXScheduler &scheduler, bool all){
+	struct iovec spans[2];
+	uint32_t frames;
+	uint32_t checksum=0;
+	while(ring.getFrames() > 0){
+		int spanCount = ring.peekBatch(BATCH_SIZE, spans, frames);
+		if(spanCount == 0 || (false == all && frames == ring.getFrames())){
+			break;
+		}
+		scheduler.enqueue(TX_CLASS_MAVLINK, spans, spanCount, 0);
+		uint32_t size = spans[0].iov_len + (spanCount > 1 ? spans[1].iov_len : 0);
+		checksum += size*31 + ((uint8_t*)spans[spanCount-1].iov_base)[spans[spanCount-1].iov_len-1];
+		ring.pop(frames);
+	}
+	return checksum;
+}
+
+// tx_raw now: the frames as on the wire in a MavlinkFrameRing, the full batches are cut after each read() and
+// gathered straight into the scheduler.
+uint64_t benchFrameRing(const std::vector<uint8_t> &corpus, uint32_t readSize, uint32_t &checksum){
+	static MavlinkFrameRing ring;
+	static TXScheduler scheduler;
+	MavlinkFrameParser parser;
+	MavlinkFrame_t frame;
+	uint64_t frames=0;
+	checksum=0;
+	ring.clear();
+	for(size_t offset=0; offset<corpus.size(); offset+=readSize){
+		uint32_t length = (uint32_t)std::min((size_t)readSize, corpus.size() - offset);
+		parser.inputData(&corpus[offset], length); // read()
+		while(parser.nextFrame(frame)){
+			if(ring.push(frame, 0)){
+				checksum += flushFrameRing(ring, scheduler, true);
+				ring.push(frame, 0);
+			}
+			frames++;
+		}
+		if(ring.getBytes() > BATCH_SIZE){
+			checksum += flushFrameRing(ring, scheduler, false);
+		}
+	}
+	checksum += flushFrameRing(ring, scheduler, true);
+	return frames;
+}
+
+////////// Mavlink compression benchmarks //////////
+
+typedef struct {
+	std::vector<uint8_t> data;   // validated frames, as tx_raw puts them in the batches.
+	std::vector<uint32_t> ends;  // end offset of each batch.
+} batches_t;
+
+// Split the frames of a corpus into UDP batches the way tx_raw does.
+void buildBatches(const std::vector<uint8_t> &corpus, batches_t &batches){
+	MavlinkFrameParser parser;
+	MavlinkFrame_t frame;
+	uint32_t batchStart=0;
+	for(size_t offset=0; offset<corpus.size(); offset+=DEFAULT_READ_SIZE){
+		uint32_t length = (uint32_t)std::min((size_t)DEFAULT_READ_SIZE, corpus.size() - offset);
+		parser.inputData(&corpus[offset], length);
+		while(parser.nextFrame(frame)){
+			if(batches.data.size() - batchStart + frame.length > BATCH_SIZE){
+				batchStart = batches.data.size();
+				batches.ends.push_back(batchStart);
+			}
+			batches.data.insert(batches.data.end(), frame.data, frame.data + frame.length);
+			if(frame.msgid == MAVLINK_MSG_ID_VFR_HUD){
+				batchStart = batches.data.size();
+				batches.ends.push_back(batchStart);
+			}
+		}
+	}
+	if(batches.data.size() > batchStart){
+		batches.ends.push_back(batches.data.size());
+	}
+}
+
+// Compress all batches, then decompress them and check the frames comes out exactly as they went in.
+// With lossInterval > 0 one of N compressed batches is dropped at random, the frames in the rest must still be valid.
+bool benchCompression(const char *name, const char *input, const batches_t &batches, const std::vector<uint8_t> &dictionary, int runs, uint32_t lossInterval){
+	std::vector<uint8_t> compressed;
+	std::vector<uint32_t> compressedEnds;
+	uint8_t output[MAVLINK_COMPRESSION_MAX_BATCH];
+	double bestCompress=0;
+	double bestDecompress=0;
+	uint64_t frameBytes=0;
+	uint32_t framesLost=0;
+	bool ok=true;
+	for(int run=0;run<runs;run++){
+		MavlinkCompressor compressor;
+		MavlinkDecompressor decompressor;
+		compressor.setDictionary(dictionary.data(), dictionary.size());
+		decompressor.setDictionary(dictionary.data(), dictionary.size());
+		compressed.clear();
+		compressedEnds.clear();
+
+		double start = timeSeconds();
+		uint32_t batchStart=0;
+		for(size_t a=0;a<batches.ends.size();a++){
+			uint16_t length = batches.ends[a] - batchStart;
+			uint16_t size = compressor.compress(&batches.data[batchStart], length, output, sizeof(output));
+			compressed.insert(compressed.end(), output, output + size);
+			compressedEnds.push_back(compressed.size());
+			batchStart = batches.ends[a];
+		}
+		double elapsed = timeSeconds() - start;
+		if(run == 0 || elapsed < bestCompress){
+			bestCompress = elapsed;
+		}
+
+		MavlinkFrameParser parser;
+		MavlinkFrame_t frame;
+		frameBytes=0;
+		start = timeSeconds();
+		batchStart=0;
+		uint32_t compressedStart=0;
+		srand(4321);
+		for(size_t a=0;a<compressedEnds.size();a++){
+			uint16_t length = batches.ends[a] - batchStart;
+			if(lossInterval == 0 || (rand() % lossInterval) != 0){
+				uint16_t size = decompressor.decompress(&compressed[compressedStart], compressedEnds[a] - compressedStart, output, sizeof(output));
+				frameBytes += size;
+				if(lossInterval == 0 && (size != length || memcmp(output, &batches.data[batchStart], length) != 0)){
+					ok = false;
+				}else if(lossInterval > 0){
+					parser.inputData(output, size);
+					while(parser.nextFrame(frame)){
+					}
+				}
+			}
+			batchStart = batches.ends[a];
+			compressedStart = compressedEnds[a];
+		}
+		elapsed = timeSeconds() - start;
+		if(run == 0 || elapsed < bestDecompress){
+			bestDecompress = elapsed;
+		}
+		framesLost = decompressor.getFramesLost();
+		if(decompressor.getErrors() > 0 || parser.getCRCErrors() > 0 || parser.getBytesSkipped() > 0){
+			ok = false;
+		}
+	}
+
+	char benchName[64];
+	if(lossInterval == 0){
+		snprintf(benchName, sizeof(benchName), "%s_compress", name);
+		printResult(benchName, input, batches.data.size(), batches.ends.size(), bestCompress);
+		snprintf(benchName, sizeof(benchName), "%s_decompress", name);
+		printResult(benchName, input, batches.data.size(), batches.ends.size(), bestDecompress);
+		fprintf(stderr, "benchmark: %s %u -> %u bytes (%.2f:1) in %u batches, dictionary %u bytes\n", name, (uint32_t)batches.data.size(), (uint32_t)compressed.size(), (double)batches.data.size() / compressed.size(), (uint32_t)batches.ends.size(), (uint32_t)dictionary.size());
+	}else{
+		fprintf(stderr, "benchmark: %s with 1/%u batches lost, %u frames lost because of a lost reference, %llu bytes delivered\n", name, lossInterval, framesLost, (unsigned long long)frameBytes);
+	}
+	if(!ok){
+		fprintf(stderr, "benchmark: Error! %s roundtrip does not give the original frames.\n", name);
+	}
+	return ok;
+}
+
+// tx_raw serial ingest through a pty instead of a UART: the corpus is written to the master side as fast as
+// the pty takes it, SerialPort reads the slave side into its ring and the parser takes it from there.
+// consumeSize 0 parses all that is buffered each loop (tx_raw), otherwise only consumeSize bytes so the ring overruns.
+bool benchSerialPty(const char *name, const char *input, const std::vector<uint8_t> &corpus, uint32_t consumeSize, uint64_t expectedFrames){
+	int master = posix_openpt(O_RDWR | O_NOCTTY);
+	if(master < 0 || grantpt(master) != 0 || unlockpt(master) != 0){
+		fprintf(stderr, "benchmark: Unable to create a pty (%s)\n", strerror(errno));
+		return false;
+	}
+	fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+	static SerialPort serialPort;
+	if(serialPort.openPort(ptsname(master), PTY_BAUDRATE)){
+		close(master);
+		return false;
+	}
+	MavlinkFrameParser parser;
+	MavlinkFrame_t frame;
+	uint64_t frames=0;
+	uint64_t ringOverruns=0;
+	uint32_t maxBuffered=0;
+	size_t written=0;
+	uint32_t idleLoops=0;
+
+	double start = timeSeconds();
+	double lastData = start;
+	while(idleLoops < 100){ // all written and nothing more coming for 100ms.
+		if(written < corpus.size()){
+			ssize_t result = write(master, &corpus[written], corpus.size() - written);
+			if(result > 0){
+				written += (size_t)result;
+			}
+		}
+		fd_set read_set;
+		FD_ZERO(&read_set);
+		FD_SET(serialPort.getFD(), &read_set);
+		struct timeval timeout;
+		timeout.tv_sec = 0;
+		timeout.tv_usec = (written < corpus.size()) ? 0 : 1000;
+		select(serialPort.getFD()+1, &read_set, NULL, NULL, &timeout);
+		int32_t result = serialPort.readAvailable();
+		if(result < 0){
+			break;
+		}
+		if(result > 0){
+			lastData = timeSeconds();
+		}
+		idleLoops = (result == 0 && written == corpus.size()) ? idleLoops+1 : 0;
+
+		uint32_t budget = (consumeSize == 0) ? serialPort.getBufferedSize() : consumeSize;
+		while(budget > 0 && serialPort.getBufferedSize() > 0){
+			uint32_t freeSize = parser.getInputBufferFreeSize();
+			uint32_t length = serialPort.read(parser.getInputBuffer(), (budget < freeSize) ? budget : freeSize);
+			parser.setData(length);
+			budget -= length;
+			while(parser.nextFrame(frame)){
+				frames++;
+			}
+		}
+	}
+	double seconds = lastData - start;
+	ringOverruns = serialPort.getRingOverruns();
+	maxBuffered = serialPort.getMaxBuffered();
+	serialPort.closePort();
+	close(master);
+
+	printResult(name, input, corpus.size(), frames, seconds);
+	printf("{\"benchmark\":\"%s\",\"input\":\"%s\",\"frames\":%llu,\"crcErrors\":%u,\"headerErrors\":%u,\"bytesSkipped\":%u,\"ringOverruns\":%llu,\"maxBuffered\":%u,\"errorRate\":%.6f}\n",
+		name, input, (unsigned long long)frames, parser.getCRCErrors(), parser.getHeaderErrors(), parser.getBytesSkipped(), (unsigned long long)ringOverruns, maxBuffered,
+		(frames > 0) ? (double)(parser.getCRCErrors() + parser.getHeaderErrors()) / frames : 0.0);
+	fflush(stdout);
+
+	if(consumeSize == 0 && (ringOverruns > 0 || (expectedFrames > 0 && frames != expectedFrames))){
+		fprintf(stderr, "benchmark: Error! %s got %llu frames of %llu, %llu bytes lost in the ring.\n", name, (unsigned long long)frames, (unsigned long long)expectedFrames, (unsigned long long)ringOverruns);
+		return false;
+	}
+	if(consumeSize > 0 && ringOverruns == 0){
+		fprintf(stderr, "benchmark: Warning %s did not overrun the ring (pty too slow?).\n", name);
+	}
+	return true;
+}
+
+////////// Synthetic H.264 stream //////////
+
+typedef struct {
+	uint32_t frames;
+	uint32_t gop;           // frames per IDR.
+	uint32_t keyFrameSize;  // average bytes per frame, they vary +-25%.
+	uint32_t frameSize;
+	uint32_t slices;        // NALs per frame, each starts a new UDP package on TX.
+	bool headersOnce;       // SPS/PPS only at the start, otherwise before every IDR (raspivid -ih).
+	bool baseline;          // baseline profile SPS/PPS instead of high.
+	bool aud;               // access unit delimiter before each frame.
+	uint32_t seed;
+} H264StreamConfig_t;
+
+// H264TXFraming takes 15 bytes of SPS and 4 bytes of PPS after the NAL header, as the Pi encoder makes them.
+const uint8_t spsHigh[] = {0x64, 0x00, 0x28, 0xac, 0x2b, 0x40, 0x28, 0x02, 0xdd, 0x80, 0xb5, 0x06, 0x06, 0x06, 0x40};
+const uint8_t ppsHigh[] = {0xee, 0x02, 0x5c, 0xb0};
+const uint8_t spsBaseline[] = {0x42, 0xc0, 0x28, 0xda, 0x01, 0x40, 0x16, 0xe8, 0x06, 0xd0, 0xa1, 0x35, 0x01, 0x01, 0x80};
+const uint8_t ppsBaseline[] = {0xce, 0x3c, 0x80, 0x10};
+
+// xorshift32, not rand(), so the stream is the same with any libc (x86 and Pi).
+uint32_t nextRandom(uint32_t &state){
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+void addNAL(std::vector<uint8_t> &stream, uint8_t header, const uint8_t *data, uint32_t length){
+	const uint8_t startCode[] = {0x00, 0x00, 0x00, 0x01};
+	stream.insert(stream.end(), startCode, startCode + sizeof(startCode));
+	stream.push_back(header);
+	stream.insert(stream.end(), data, data + length);
+}
+
+// Slice data: random with a zero every ~16 bytes so the start code search has work to do,
+// emulation prevention (0x03) like the encoder and a rbsp stop bit at the end.
+void addSlice(std::vector<uint8_t> &stream, uint8_t header, uint32_t length, uint32_t &random){
+	addNAL(stream, header, NULL, 0);
+	uint32_t zeros=0;
+	for(uint32_t a=1;a<length;a++){
+		uint32_t r = nextRandom(random);
+		uint8_t data = ((r >> 8) & 0x0f) == 0 ? 0x00 : (uint8_t)r;
+		if(zeros >= 2 && data <= 0x03){
+			stream.push_back(0x03);
+			zeros=0;
+		}
+		stream.push_back(data);
+		zeros = (data == 0x00) ? zeros+1 : 0;
+	}
+	stream.push_back(0x80);
+}
+
+void buildH264Stream(const H264StreamConfig_t &config, std::vector<uint8_t> &stream){
+	const uint8_t audData[] = {0xf0};
+	uint32_t random = config.seed;
+	for(uint32_t frame=0;frame<config.frames;frame++){
+		bool keyFrame = (frame % config.gop == 0);
+		if(config.aud){
+			addNAL(stream, 0x09, audData, sizeof(audData));
+		}
+		if(keyFrame && (frame == 0 || !config.headersOnce)){
+			addNAL(stream, 0x27, config.baseline ? spsBaseline : spsHigh, sizeof(spsHigh));
+			addNAL(stream, 0x28, config.baseline ? ppsBaseline : ppsHigh, sizeof(ppsHigh));
+		}
+		uint32_t size = keyFrame ? config.keyFrameSize : config.frameSize;
+		size = size*3/4 + nextRandom(random) % (size/2 + 1);
+		for(uint32_t slice=0;slice<config.slices;slice++){
+			addSlice(stream, keyFrame ? 0x25 : 0x21, size / config.slices + 2, random);
+		}
+	}
+}
+
+// FNV-1a, printed with the stream so runs on different machines can be checked to use the same input.
+uint32_t streamChecksum(const std::vector<uint8_t> &stream){
+	uint32_t hash = 2166136261u;
+	for(size_t a=0;a<stream.size();a++){
+		hash = (hash ^ stream[a]) * 16777619u;
+	}
+	return hash;
+}
+
+// H264TXFraming prints every SPS/PPS it finds, keep that out of the timed loops.
+int muteStderr(void){
+	fflush(stderr);
+	int saved = dup(STDERR_FILENO);
+	int null = open("/dev/null", O_WRONLY);
+	dup2(null, STDERR_FILENO);
+	close(null);
+	return saved;
+}
+
+void restoreStderr(int saved){
+	fflush(stderr);
+	dup2(saved, STDERR_FILENO);
+	close(saved);
+}
+
+////////// H.264 framing benchmarks //////////
+
+typedef struct {
+	std::vector<uint8_t> data;   // UDP packages with the 4 byte FrameID / PackageID header, as tx_raw sends them.
+	std::vector<uint32_t> ends;  // end offset of each package.
+} packages_t;
+
+// The tx_raw video path: read() size chunks into inputStream(), all packages ready are sent after each chunk.
+// The packages from the last run are kept for the RX and UDP benchmarks.
+bool benchH264TX(const char *input, std::vector<uint8_t> &stream, uint32_t readSize, int runs, packages_t &packages){
+	double best=0;
+	uint32_t dropped=0;
+	for(int run=0;run<runs;run++){
+		H264TXFraming *framing = new H264TXFraming(); // ~23MB, not on the stack.
+		packages.data.clear();
+		packages.ends.clear();
+		packages.data.reserve(stream.size() + stream.size()/16);
+		packages.ends.reserve(stream.size() / (UDP_PACKET_SIZE/2));
+		int saved = muteStderr();
+		double start = timeSeconds();
+		for(size_t offset=0; offset<stream.size(); offset+=readSize){
+			uint32_t length = (uint32_t)std::min((size_t)readSize, stream.size() - offset);
+			framing->inputStream(&stream[offset], length);
+			uint8_t *data;
+			uint16_t size;
+			while((size = framing->getTXPackage(data)) > 0){
+				packages.data.insert(packages.data.end(), data, data + size); // sendto()
+				packages.ends.push_back(packages.data.size());
+				framing->nextTXPackage();
+			}
+		}
+		double elapsed = timeSeconds() - start;
+		restoreStderr(saved);
+		if(run == 0 || elapsed < best){
+			best = elapsed;
+		}
+		dropped = framing->getBytesDropped();
+		delete framing;
+	}
+	printResult("h264_tx_framing", input, stream.size(), packages.ends.size(), best);
+	if(dropped > 0 || packages.ends.size() == 0){
+		fprintf(stderr, "benchmark: Error! H264TXFraming dropped %u bytes and made %u packages.\n", dropped, (uint32_t)packages.ends.size());
+		return false;
+	}
+	return true;
+}
+
+typedef struct {
+	const char *name;
+	uint32_t lossPermille;     // random loss.
+	uint32_t burstInterval;    // every N packages,
+	uint32_t burstLength;      // this many are lost in a row (LTE handover).
+	uint32_t reorderPermille;  // swapped with one of the next RX_REORDER_DISTANCE packages.
+	uint32_t seed;
+} LinkPattern_t;
+
+// Package order as it comes out of the link, deterministic for a given pattern.
+void applyLinkPattern(const LinkPattern_t &pattern, uint32_t count, std::vector<uint32_t> &order){
+	uint32_t random = pattern.seed;
+	order.clear();
+	for(uint32_t a=0;a<count;a++){
+		if(pattern.burstInterval > 0 && (a % pattern.burstInterval) < pattern.burstLength && a >= pattern.burstInterval){
+			continue;
+		}
+		if(pattern.lossPermille > 0 && nextRandom(random) % 1000 < pattern.lossPermille){
+			continue;
+		}
+		order.push_back(a);
+	}
+	for(size_t a=0;a+RX_REORDER_DISTANCE<order.size();a++){
+		if(pattern.reorderPermille > 0 && nextRandom(random) % 1000 < pattern.reorderPermille){
+			uint32_t distance = 1 + nextRandom(random) % RX_REORDER_DISTANCE;
+			std::swap(order[a], order[a+distance]);
+			a += distance;
+		}
+	}
+}
+
+// The rx_raw video path: each UDP package is read into getInputBuffer(), setData() and the output written to the decoder pipe.
+bool benchH264RX(const char *input, const packages_t &packages, const LinkPattern_t &pattern, int runs){
+	std::vector<uint32_t> order;
+	applyLinkPattern(pattern, packages.ends.size(), order);
+	int output = open("/dev/null", O_WRONLY);
+	double best=0;
+	uint64_t bytes=0;
+	uint32_t bufferFull=0;
+	H264RXFraming *framing = NULL;
+	for(int run=0;run<runs;run++){
+		delete framing;
+		framing = new H264RXFraming(); // ~23MB, not on the stack.
+		bytes=0;
+		bufferFull=0;
+		double start = timeSeconds();
+		for(size_t a=0;a<order.size();a++){
+			uint32_t begin = (order[a] == 0) ? 0 : packages.ends[order[a]-1];
+			uint16_t length = packages.ends[order[a]] - begin;
+			memcpy(framing->getInputBuffer(), &packages.data[begin], length); // recvfrom()
+			if(framing->setData(length)){
+				bufferFull++;
+			}
+			framing->writeAllOutputStreamTo(output);
+			bytes += length;
+		}
+		double elapsed = timeSeconds() - start;
+		if(run == 0 || elapsed < best){
+			best = elapsed;
+		}
+	}
+	close(output);
+
+	char name[64];
+	snprintf(name, sizeof(name), "h264_rx_framing_%s", pattern.name);
+	printResult(name, input, bytes, order.size(), best);
+	printf("{\"benchmark\":\"%s\",\"input\":\"%s\",\"packagesSent\":%u,\"received\":%u,\"lost\":%u,\"reordered\":%u,\"late\":%u,\"resyncs\":%u,\"framesDelivered\":%u,\"framesDropped\":%u,\"bytesOut\":%u,\"bytesDropped\":%u}\n",
+		name, input, (uint32_t)packages.ends.size(), framing->getPackagesReceived(), framing->getPackagesLost(), framing->getPackagesReordered(), framing->getPackagesLate(),
+		framing->getResyncs(), framing->getFramesDelivered(), framing->getFramesDropped(), framing->getBytesOutputted(), framing->getBytesDropped());
+	fflush(stdout);
+
+	bool ok = (bufferFull == 0 && framing->getFramesDelivered() > 0);
+	if(pattern.lossPermille == 0 && pattern.burstInterval == 0 && pattern.reorderPermille == 0){
+		ok &= (framing->getPackagesLost() == 0 && framing->getFramesDropped() == 0 && framing->getResyncs() == 0);
+	}
+	if(!ok){
+		fprintf(stderr, "benchmark: Error! %s delivered %u frames, %u dropped, %u resyncs, input buffer full %u times.\n", name, framing->getFramesDelivered(), framing->getFramesDropped(), framing->getResyncs(), bufferFull);
+	}
+	delete framing;
+	return ok;
+}
+
+// Gives access to the buffer pool the framing classes share.
+class H264BufferPool : public H264
+{
+	public:
+	bool next(void){ return this->setNextAvailableBuffer(); }
+	H264UDPPackage * current(void){ return this->currentBuffer; }
+};
+
+// setNextAvailableBuffer() with the pool part full. Packages are released oldest first (TX, in order RX)
+// or at random (RX waiting for missing packages), the search then has to step over used buffers.
+bool benchBufferSearch(uint32_t fillPercent, bool randomRelease, int runs){
+	uint32_t used = INPUT_BUFFER_SIZE * fillPercent / 100;
+	if(used < 1){
+		used = 1;
+	}
+	std::vector<H264UDPPackage *> packages(used);
+	double best=0;
+	uint32_t full=0;
+	for(int run=0;run<runs;run++){
+		H264BufferPool *pool = new H264BufferPool(); // ~23MB, not on the stack.
+		for(uint32_t a=0;a<used;a++){
+			pool->current()->setFrameID(1); // in use.
+			packages[a] = pool->current();
+			pool->next();
+		}
+		uint32_t random = 1234;
+		full=0;
+		double start = timeSeconds();
+		for(uint32_t a=0;a<BUFFER_SEARCH_ITERATIONS;a++){
+			uint32_t release = randomRelease ? nextRandom(random) % used : a % used;
+			packages[release]->setFrameID(0);
+			pool->current()->setFrameID(1);
+			packages[release] = pool->current();
+			if(pool->next()){
+				full++;
+			}
+		}
+		double elapsed = timeSeconds() - start;
+		if(run == 0 || elapsed < best){
+			best = elapsed;
+		}
+		delete pool;
+	}
+	char name[64];
+	snprintf(name, sizeof(name), "h264_buffer_search_%s_%u", randomRelease ? "random" : "fifo", fillPercent);
+	printResult(name, "pool", (uint64_t)BUFFER_SEARCH_ITERATIONS * UDP_PACKET_SIZE, BUFFER_SEARCH_ITERATIONS, best);
+	if(full > 0){
+		fprintf(stderr, "benchmark: Error! %s found no free buffer %u times.\n", name, full);
+		return false;
+	}
+	return true;
+}
+
+////////// RTSP benchmarks //////////
+
+typedef struct {
+	int fd;          // RTSP connection, with the interleaved RTP for TCP.
+	int rtpFd;       // UDP transport.
+	uint64_t bytes;  // RTP bytes (TCP: with the 4 byte interleave header and the replies).
+	uint64_t packets;
+} BenchRtspClient_t;
+
+// Services the server until the reply to the last request is in, the clients run in this process.
+bool rtspRequest(RtspServer &server, BenchRtspClient_t &client, const char *request){
+	if(send(client.fd, request, strlen(request), 0) < 0){
+		return false;
+	}
+	char reply[2048];
+	uint32_t size=0;
+	double end = timeSeconds() + RTSP_REPLY_TIMEOUT_MS/1000.0;
+	while(timeSeconds() < end){
+		fd_set readSet, writeSet;
+		FD_ZERO(&readSet);
+		FD_ZERO(&writeSet);
+		int maxFd = server.setFD_SET(&readSet, &writeSet);
+		struct timeval timeout = {0, 1000};
+		if(select(maxFd+1, &readSet, &writeSet, NULL, &timeout) > 0){
+			server.service(&readSet, &writeSet);
+		}
+		ssize_t result = recv(client.fd, &reply[size], sizeof(reply) - 1 - size, MSG_DONTWAIT);
+		if(result > 0){
+			size += result;
+			reply[size] = 0;
+			if(strstr(reply, "\r\n\r\n") != NULL){
+				char *body = strstr(reply, "Content-Length:");
+				if(body == NULL || size >= (uint32_t)(strstr(reply, "\r\n\r\n") - reply) + 4 + atoi(body + 15)){
+					return strncmp(reply, "RTSP/1.0 200", 12) == 0;
+				}
+			}
+		}
+	}
+	return false;
+}
+
+bool rtspConnect(RtspServer &server, BenchRtspClient_t &client, bool tcp){
+	bzero(&client, sizeof(client));
+	client.rtpFd = -1;
+	client.fd = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in address;
+	bzero(&address, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = inet_addr("127.0.0.1");
+	address.sin_port = htons(BENCH_RTSP_PORT);
+	if(client.fd < 0 || connect(client.fd, (struct sockaddr *)&address, sizeof(address)) < 0){
+		return false;
+	}
+	char request[512];
+	snprintf(request, sizeof(request), "DESCRIBE rtsp://127.0.0.1:%u/%s RTSP/1.0\r\nCSeq: 1\r\n\r\n", BENCH_RTSP_PORT, RTSP_DEFAULT_PATH);
+	if(!rtspRequest(server, client, request)){
+		return false;
+	}
+	if(tcp){
+		snprintf(request, sizeof(request), "SETUP rtsp://127.0.0.1:%u/%s/track1 RTSP/1.0\r\nCSeq: 2\r\nTransport: RTP/AVP/TCP;unicast;interleaved=0-1\r\n\r\n",
+			BENCH_RTSP_PORT, RTSP_DEFAULT_PATH);
+	}else{
+		client.rtpFd = socket(AF_INET, SOCK_DGRAM, 0);
+		address.sin_port = 0;
+		socklen_t length = sizeof(address);
+		int size = 4*1024*1024; // a keyframe to all clients before they read.
+		setsockopt(client.rtpFd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+		if(bind(client.rtpFd, (struct sockaddr *)&address, sizeof(address)) < 0 || getsockname(client.rtpFd, (struct sockaddr *)&address, &length) < 0){
+			return false;
+		}
+		snprintf(request, sizeof(request), "SETUP rtsp://127.0.0.1:%u/%s/track1 RTSP/1.0\r\nCSeq: 2\r\nTransport: RTP/AVP;unicast;client_port=%u-%u\r\n\r\n",
+			BENCH_RTSP_PORT, RTSP_DEFAULT_PATH, ntohs(address.sin_port), ntohs(address.sin_port)+1);
+	}
+	if(!rtspRequest(server, client, request)){
+		return false;
+	}
+	snprintf(request, sizeof(request), "PLAY rtsp://127.0.0.1:%u/%s RTSP/1.0\r\nCSeq: 3\r\nSession: 0\r\n\r\n", BENCH_RTSP_PORT, RTSP_DEFAULT_PATH);
+	return rtspRequest(server, client, request);
+}
+
+// Reads what the client has, returns the bytes read.
+uint64_t rtspDrain(BenchRtspClient_t &client){
+	static uint8_t buffer[256*1024];
+	uint64_t total=0;
+	ssize_t result;
+	if(client.rtpFd >= 0){
+		while((result = recv(client.rtpFd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0){
+			total += result;
+			client.packets++;
+		}
+	}else{
+		while((result = recv(client.fd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0){
+			total += result;
+		}
+	}
+	client.bytes += total;
+	return total;
+}
+
+// Fan-out of the stream to N local clients (rx_raw -S), frame by frame as H264RXFraming delivers it.
+// The time includes the clients reading, nsPerItem is per packet per client.
+bool benchRtspFanout(const char *input, const std::vector<uint8_t> &stream, uint32_t clientCount, bool tcp, int runs){
+	// The synthetic stream has 4 byte start codes, a frame ends after a slice NAL unit.
+	std::vector<uint32_t> flushAt;
+	uint32_t begin=0;
+	for(uint32_t a=4;a<=stream.size();a++){
+		if(a == stream.size() || (stream[a] == 0 && stream[a+1] == 0 && stream[a+2] == 0 && stream[a+3] == 1)){
+			uint8_t type = stream[begin+4] & 0x1F;
+			if(type == 1 || type == 5){
+				flushAt.push_back(a);
+			}
+			begin = a;
+		}
+	}
+
+	double best=0;
+	uint64_t delivered=0;
+	uint64_t bytes=0;
+	bool ok=true;
+	for(int run=0;run<runs && ok;run++){
+		RtspServer *server = new RtspServer(); // the clients array is large, not on the stack.
+		if(server->open(BENCH_RTSP_PORT, RTSP_DEFAULT_PATH)){
+			delete server;
+			return false;
+		}
+		std::vector<BenchRtspClient_t> clients(clientCount);
+		for(uint32_t a=0;a<clientCount && ok;a++){
+			ok = rtspConnect(*server, clients[a], tcp);
+		}
+		if(!ok){
+			fprintf(stderr, "benchmark: Error! RTSP client %u did not get to PLAY.\n", (uint32_t)clientCount);
+		}
+		uint64_t setupBytes=0;
+		for(uint32_t a=0;a<clientCount;a++){
+			setupBytes += clients[a].bytes;
+		}
+		double start = timeSeconds();
+		begin=0;
+		for(size_t a=0;a<flushAt.size() && ok;a++){
+			server->inputData(&stream[begin], flushAt[a] - begin, (uint64_t)(start*1000000) + a*33333);
+			server->flush();
+			begin = flushAt[a];
+			// Like rx_raw: select() and service until every client has the frame, the clients read it.
+			uint64_t target = server->getPackets() * clientCount;
+			uint32_t idle=0;
+			do{
+				fd_set readSet, writeSet;
+				FD_ZERO(&readSet);
+				FD_ZERO(&writeSet);
+				int maxFd = server->setFD_SET(&readSet, &writeSet);
+				struct timeval timeout = {0, 0};
+				uint64_t read=0;
+				for(uint32_t b=0;b<clientCount;b++){
+					read += rtspDrain(clients[b]);
+				}
+				if(select(maxFd+1, &readSet, &writeSet, NULL, &timeout) > 0){
+					server->service(&readSet, &writeSet);
+				}
+				if(read == 0){
+					idle++;
+				}
+				if(server->getPacketsSent() + clientCount*RTSP_RING_PACKETS < target){
+					target = server->getPacketsSent(); // before the first keyframe.
+				}
+			}while(server->getPacketsSent() < target && idle < 1000);
+		}
+		double elapsed = timeSeconds() - start;
+		for(uint32_t b=0;b<clientCount;b++){
+			rtspDrain(clients[b]);
+		}
+		delivered = server->getPacketsSent();
+		bytes = 0;
+		for(uint32_t b=0;b<clientCount;b++){
+			bytes += clients[b].bytes;
+		}
+		bytes -= setupBytes;
+		if(server->getOverflows() > 0){
+			fprintf(stderr, "benchmark: Warning rtsp fan-out, clients fell behind %u times.\n", server->getOverflows());
+		}
+		if(!tcp){
+			for(uint32_t b=0;b<clientCount;b++){
+				if(clients[b].packets * clientCount != delivered){
+					fprintf(stderr, "benchmark: Warning RTSP UDP client %u got %llu of %llu packets (socket buffer too small?).\n", b,
+						(unsigned long long)clients[b].packets, (unsigned long long)(delivered / clientCount));
+				}
+			}
+		}
+		for(uint32_t b=0;b<clientCount;b++){
+			close(clients[b].fd);
+			if(clients[b].rtpFd >= 0){
+				close(clients[b].rtpFd);
+			}
+		}
+		server->close();
+		delete server;
+		if(run == 0 || elapsed < best){
+			best = elapsed;
+		}
+	}
+	char name[64];
+	snprintf(name, sizeof(name), "rtsp_fanout_%s_%u", tcp ? "tcp" : "udp", clientCount);
+	printResult(name, input, bytes, delivered, best);
+	return ok && delivered > 0;
+}
+
+////////// UDP benchmarks //////////
+
+// Connection writeData() / readData() over loopback with the video packages, in bursts like tx_raw sends a frame.
+bool benchConnection(const char *input, packages_t &packages, int runs){
+	Connection receiver(BENCH_UDP_PORT, SOCK_DGRAM, O_NONBLOCK);
+	Connection sender("127.0.0.1", BENCH_UDP_PORT, SOCK_DGRAM, O_NONBLOCK);
+	uint8_t buffer[UDP_PACKET_SIZE];
+	double best=0;
+	uint64_t bytes=0;
+	uint64_t received=0;
+	for(int run=0;run<runs;run++){
+		bytes=0;
+		received=0;
+		double start = timeSeconds();
+		uint32_t begin=0;
+		for(size_t a=0;a<packages.ends.size();a++){
+			sender.writeData(&packages.data[begin], packages.ends[a] - begin);
+			begin = packages.ends[a];
+			if(a % UDP_BURST == UDP_BURST-1 || a == packages.ends.size()-1){
+				int16_t length;
+				while((length = receiver.readData(buffer, sizeof(buffer))) > 0){
+					bytes += length;
+					received++;
+				}
+			}
+		}
+		double elapsed = timeSeconds() - start;
+		if(run == 0 || elapsed < best){
+			best = elapsed;
+		}
+	}
+	printResult("udp_loopback_send_recv", input, bytes, received, best);
+	if(received != packages.ends.size()){
+		fprintf(stderr, "benchmark: Warning udp_loopback_send_recv received %llu of %u packages (socket buffer too small?).\n", (unsigned long long)received, (uint32_t)packages.ends.size());
+	}
+	return received > 0;
+}
+
+////////// Relay benchmarks //////////
+
+typedef struct {
+	int airFd;
+	int groundFd;
+	struct sockaddr_in ground;  // for the direct baseline.
+} BenchDrone_t;
+
+uint64_t timeNanosec(void){
+	using namespace std::chrono;
+	return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+int openRelayBenchSocket(struct sockaddr_in &address){
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if(fd < 0){
+		return -1;
+	}
+	int size = RELAY_SOCKET_BUFFER;
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+	bzero(&address, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t length = sizeof(address);
+	if(bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0 || getsockname(fd, (struct sockaddr*)&address, &length) < 0){
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+uint32_t getLatencyPercentile(std::vector<uint32_t> &latencies, uint32_t percent){
+	if(latencies.size() == 0){
+		return 0;
+	}
+	size_t index = std::min(latencies.size()-1, (latencies.size() * percent) / 100);
+	std::nth_element(latencies.begin(), latencies.begin() + index, latencies.end());
+	return latencies[index];
+}
+
+// Every drone sends a package in turn, RELAY_BENCH_WINDOW packages are on the way before the ground sockets read them
+// (the default socket buffers hold ~100 packages). Each package has the drone and the send time, so the latency is
+// measured and a package at the wrong ground station is found. Returns the packages received.
+uint64_t runRelayTraffic(std::vector<BenchDrone_t> &drones, const struct sockaddr_in *relay, uint32_t packagesPerDrone, std::vector<uint32_t> &latencies, uint64_t &misrouted){
+	uint8_t package[UDP_PACKET_SIZE];
+	uint8_t buffer[RELAY_MAX_PACKAGE];
+	memset(package, 0xA5, sizeof(package));
+	std::vector<struct pollfd> fds(drones.size());
+	for(size_t a=0;a<drones.size();a++){
+		fds[a].fd = drones[a].groundFd;
+		fds[a].events = POLLIN;
+	}
+	uint64_t received=0;
+	uint32_t inFlight=0;
+	uint64_t total = (uint64_t)packagesPerDrone * drones.size();
+	uint64_t sent=0;
+	for(uint32_t sequence=0;sequence<packagesPerDrone;sequence++){
+		for(uint32_t a=0;a<drones.size();a++){
+			uint64_t now = timeNanosec();
+			memcpy(&package[0], &a, sizeof(a));
+			memcpy(&package[4], &sequence, sizeof(sequence));
+			memcpy(&package[8], &now, sizeof(now));
+			const struct sockaddr_in *destination = (relay != NULL) ? relay : &drones[a].ground;
+			sendto(drones[a].airFd, package, sizeof(package), 0, (const struct sockaddr*)destination, sizeof(*destination));
+			inFlight++;
+			sent++;
+			if(inFlight < RELAY_BENCH_WINDOW && sent < total){
+				continue;
+			}
+			uint32_t got=0;
+			while(got < inFlight && poll(fds.data(), fds.size(), RELAY_BENCH_TIMEOUT_MS) > 0){
+				for(size_t b=0;b<fds.size();b++){
+					if((fds[b].revents & POLLIN) == 0){
+						continue;
+					}
+					ssize_t length;
+					while((length = recv(fds[b].fd, buffer, sizeof(buffer), 0)) >= 16){
+						uint64_t arrival = timeNanosec();
+						uint32_t drone;
+						uint64_t sendTime;
+						memcpy(&drone, &buffer[0], sizeof(drone));
+						memcpy(&sendTime, &buffer[8], sizeof(sendTime));
+						if(drone != b){
+							misrouted++;
+						}
+						latencies.push_back((uint32_t)((arrival - sendTime)/1000));
+						got++;
+					}
+				}
+			}
+			received += got;
+			inFlight = 0;
+		}
+	}
+	return received;
+}
+
+// UdpRelay with N drones and their ground stations on loopback, the throughput through the relay and the latency
+// it adds compared to sending the same packages directly from the drone to the ground socket.
+bool benchRelay(const char *input, uint32_t droneCount, int runs){
+	uint16_t ports[RELAY_CHANNEL_COUNT] = {BENCH_RELAY_PORT, 0, 0};
+	uint32_t threads = std::max(1u, std::min((uint32_t)std::thread::hardware_concurrency(), (uint32_t)RELAY_MAX_THREADS));
+	UdpRelay *relay = new UdpRelay(); // the session table is large, not on the stack.
+	relay->setKey(BENCH_RELAY_KEY);
+	relay->setSessionRate(0); // all drones come from 127.0.0.1.
+	if(relay->start(ports, threads)){
+		delete relay;
+		return false;
+	}
+	struct sockaddr_in relayAddress;
+	bzero(&relayAddress, sizeof(relayAddress));
+	relayAddress.sin_family = AF_INET;
+	relayAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	relayAddress.sin_port = htons(BENCH_RELAY_PORT);
+
+	bool ok = true;
+	std::vector<BenchDrone_t> drones(droneCount);
+	for(uint32_t a=0;a<droneCount && ok;a++){
+		struct sockaddr_in air;
+		drones[a].airFd = openRelayBenchSocket(air);
+		drones[a].groundFd = openRelayBenchSocket(drones[a].ground);
+		ok = (drones[a].airFd >= 0 && drones[a].groundFd >= 0);
+		uint8_t hello[sizeof(RelayHello_t)];
+		uint16_t size = RelayHello::build(hello, RELAY_ROLE_AIR, a+1, BENCH_RELAY_KEY, RelayHello::realtimeMs());
+		sendto(drones[a].airFd, hello, size, 0, (struct sockaddr*)&relayAddress, sizeof(relayAddress));
+		size = RelayHello::build(hello, RELAY_ROLE_GROUND, a+1, BENCH_RELAY_KEY, RelayHello::realtimeMs());
+		sendto(drones[a].groundFd, hello, size, 0, (struct sockaddr*)&relayAddress, sizeof(relayAddress));
+	}
+	// Wait for the workers to pair all of them.
+	uint32_t paired=0;
+	for(uint32_t wait=0;wait<100 && ok && paired < droneCount;wait++){
+		usleep(10000);
+		paired=0;
+		RelaySessionStats_t stats;
+		for(uint32_t a=0;a<RELAY_MAX_SESSIONS;a++){
+			if(relay->getSession(a, stats) && stats.endpoints[RELAY_CHANNEL_VIDEO][RELAY_ROLE_AIR] != 0 && stats.endpoints[RELAY_CHANNEL_VIDEO][RELAY_ROLE_GROUND] != 0){
+				paired++;
+			}
+		}
+	}
+	if(ok && paired < droneCount){
+		fprintf(stderr, "benchmark: Error! The relay paired %u of %u drones.\n", paired, droneCount);
+		ok = false;
+	}
+
+	uint32_t packagesPerDrone = std::max((uint32_t)RELAY_BENCH_MIN_PACKAGES, RELAY_BENCH_PACKAGES / droneCount);
+	uint64_t total = (uint64_t)packagesPerDrone * droneCount;
+	double best=0;
+	uint64_t received=0;
+	uint64_t misrouted=0;
+	std::vector<uint32_t> latencies;
+	std::vector<uint32_t> directLatencies;
+	for(int run=0;run<runs && ok;run++){
+		std::vector<uint32_t> runLatencies;
+		runLatencies.reserve(total);
+		double start = timeSeconds();
+		uint64_t got = runRelayTraffic(drones, &relayAddress, packagesPerDrone, runLatencies, misrouted);
+		double elapsed = timeSeconds() - start;
+		if(run == 0 || elapsed < best){
+			best = elapsed;
+			received = got;
+			latencies.swap(runLatencies);
+		}
+	}
+	if(ok){
+		directLatencies.reserve(total);
+		uint64_t direct = runRelayTraffic(drones, NULL, packagesPerDrone, directLatencies, misrouted);
+		if(received != total || direct != total){
+			fprintf(stderr, "benchmark: Warning relay_%u received %llu (direct %llu) of %llu packages (socket buffer too small?).\n", droneCount,
+				(unsigned long long)received, (unsigned long long)direct, (unsigned long long)total);
+		}
+		if(misrouted > 0){
+			fprintf(stderr, "benchmark: Error! relay_%u sent %llu packages to the wrong ground station.\n", droneCount, (unsigned long long)misrouted);
+			ok = false;
+		}
+		uint32_t p50 = getLatencyPercentile(latencies, 50);
+		uint32_t p99 = getLatencyPercentile(latencies, 99);
+		uint32_t directP50 = getLatencyPercentile(directLatencies, 50);
+		uint32_t directP99 = getLatencyPercentile(directLatencies, 99);
+		printf("{\"benchmark\":\"relay_%u\",\"input\":\"%s\",\"threads\":%u,\"packages\":%llu,\"received\":%llu,\"seconds\":%.6f,\"kpps\":%.1f,\"MBps\":%.2f,\"latencyP50Us\":%u,\"latencyP99Us\":%u,\"directP50Us\":%u,\"directP99Us\":%u,\"addedP50Us\":%d,\"addedP99Us\":%d}\n",
+			droneCount, input, threads, (unsigned long long)total, (unsigned long long)received, best, (best > 0) ? received / (1000.0*best) : 0,
+			(best > 0) ? (received * UDP_PACKET_SIZE) / (1024.0*1024.0*best) : 0, p50, p99, directP50, directP99, (int)p50 - (int)directP50, (int)p99 - (int)directP99);
+		fflush(stdout);
+	}
+
+	for(uint32_t a=0;a<droneCount;a++){
+		if(drones[a].airFd >= 0){
+			close(drones[a].airFd);
+		}
+		if(drones[a].groundFd >= 0){
+			close(drones[a].groundFd);
+		}
+	}
+	relay->stop();
+	delete relay;
+	return ok && received > 0;
+}
+
+////////// Ring buffer benchmarks //////////
+
+// RingBuf.h behind a mutex, what passing data between threads takes without the atomic rings.
+class MutexRingBuf
+{
+	public:
+	bool push(const uint64_t &inElement){
+		std::lock_guard<std::mutex> guard(this->lock);
+		return this->ring.push(inElement);
+	}
+	bool pop(uint64_t &outElement){
+		std::lock_guard<std::mutex> guard(this->lock);
+		return this->ring.pop(outElement);
+	}
+	size_t pushBulk(const uint64_t *inElements, size_t count){
+		std::lock_guard<std::mutex> guard(this->lock);
+		size_t pushed = 0;
+		while(pushed < count && this->ring.push(inElements[pushed])){
+			pushed++;
+		}
+		return pushed;
+	}
+	size_t popBulk(uint64_t *outElements, size_t count){
+		std::lock_guard<std::mutex> guard(this->lock);
+		size_t popped = 0;
+		while(popped < count && this->ring.pop(outElements[popped])){
+			popped++;
+		}
+		return popped;
+	}
+
+	private:
+	RingBuf<uint64_t, RING_BENCH_SIZE> ring;
+	std::mutex lock;
+};
+
+// Each producer pushes its number << 48 | sequence, the consumer (this thread) checks that every producer's elements
+// come in order and none is missing. bulk = 1 uses push / pop, else pushBulk / popBulk. Returns true if ok.
+template <typename Ring>
+bool runRingThroughput(Ring &ring, uint32_t producers, uint32_t bulk, uint64_t perProducer, double &seconds){
+	std::atomic<bool> go(false);
+	std::vector<std::thread> threads;
+	for(uint32_t p=0;p<producers;p++){
+		threads.push_back(std::thread([&ring, &go, p, bulk, perProducer](){
+			uint64_t batch[RING_BENCH_BULK];
+			while(false == go.load(std::memory_order_acquire)){
+				std::this_thread::yield();
+			}
+			uint64_t next = 0;
+			while(next < perProducer){
+				size_t count = std::min((uint64_t)bulk, perProducer - next);
+				for(size_t a=0;a<count;a++){
+					batch[a] = ((uint64_t)p << 48) | (next + a);
+				}
+				size_t pushed = (bulk == 1) ? (ring.push(batch[0]) ? 1 : 0) : ring.pushBulk(batch, count);
+				if(pushed == 0){
+					std::this_thread::yield(); // full.
+				}
+				next += pushed;
+			}
+		}));
+	}
+
+	bool ok = true;
+	std::vector<uint64_t> expected(producers, 0);
+	uint64_t total = perProducer * producers;
+	uint64_t received = 0;
+	uint64_t batch[RING_BENCH_BULK];
+	double start = timeSeconds();
+	go.store(true, std::memory_order_release);
+	while(received < total){
+		size_t count = (bulk == 1) ? (ring.pop(batch[0]) ? 1 : 0) : ring.popBulk(batch, bulk);
+		if(count == 0){
+			std::this_thread::yield(); // empty.
+		}
+		for(size_t a=0;a<count;a++){
+			uint32_t p = (uint32_t)(batch[a] >> 48);
+			if(p >= producers || (batch[a] & 0xFFFFFFFFFFFFULL) != expected[p]){
+				ok = false;
+			}else{
+				expected[p]++;
+			}
+		}
+		received += count;
+	}
+	seconds = timeSeconds() - start;
+	for(uint32_t p=0;p<producers;p++){
+		threads[p].join();
+	}
+	return ok;
+}
+
+template <typename Ring>
+bool benchRingThroughput(const char *name, uint32_t producers, uint32_t bulk, int runs){
+	uint64_t perProducer = RING_BENCH_ITEMS / producers;
+	double best = 0;
+	bool ok = true;
+	for(int run=0;run<runs && ok;run++){
+		Ring *ring = new Ring(); // over-aligned, not on the stack.
+		double seconds;
+		ok = runRingThroughput(*ring, producers, bulk, perProducer, seconds);
+		delete ring;
+		if(run == 0 || seconds < best){
+			best = seconds;
+		}
+	}
+	if(false == ok){
+		fprintf(stderr, "benchmark: Error! %s lost or reordered elements.\n", name);
+		return false;
+	}
+	char input[32];
+	snprintf(input, sizeof(input), "%u_producers_bulk_%u", producers, bulk);
+	printResult(name, input, perProducer * producers * sizeof(uint64_t), perProducer * producers, best);
+	return true;
+}
+
+// One producer pushes its clock every RING_LATENCY_INTERVAL_US, the consumer polls and takes the difference.
+// Both sides yield while waiting, as a pipeline stage sharing the CPUs of a Pi would.
+template <typename Ring>
+bool benchRingLatency(const char *name){
+	Ring *ring = new Ring();
+	std::vector<uint32_t> latencies;
+	latencies.reserve(RING_LATENCY_SAMPLES);
+	std::thread producer([ring](){
+		for(uint32_t a=0;a<RING_LATENCY_SAMPLES;a++){
+			uint64_t due = timeNanosec() + RING_LATENCY_INTERVAL_US * 1000;
+			while(timeNanosec() < due){
+				std::this_thread::yield();
+			}
+			while(false == ring->push(timeNanosec())){
+				std::this_thread::yield();
+			}
+		}
+	});
+	uint64_t sent;
+	while(latencies.size() < RING_LATENCY_SAMPLES){
+		if(ring->pop(sent)){
+			latencies.push_back((uint32_t)std::min(timeNanosec() - sent, (uint64_t)UINT32_MAX));
+		}else{
+			std::this_thread::yield();
+		}
+	}
+	producer.join();
+	delete ring;
+	uint32_t maxNs = *std::max_element(latencies.begin(), latencies.end());
+	uint32_t p50 = getLatencyPercentile(latencies, 50);
+	uint32_t p99 = getLatencyPercentile(latencies, 99);
+	printf("{\"benchmark\":\"%s\",\"input\":\"1_producer\",\"samples\":%u,\"latencyP50Ns\":%u,\"latencyP99Ns\":%u,\"latencyMaxNs\":%u}\n",
+		name, RING_LATENCY_SAMPLES, p50, p99, maxNs);
+	fflush(stdout);
+	return true;
+}
+
+// -b list, all when not given.
+bool isSelected(const char *benchmarks, const char *name){
+	return (benchmarks == NULL || strstr(benchmarks, name) != NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	char *traceFile=NULL;
+	uint32_t corpusSize = DEFAULT_CORPUS_MBYTES*1024*1024;
+	int runs = DEFAULT_RUNS;
+	uint32_t readSize = DEFAULT_READ_SIZE;
+	char *dictionaryFile=NULL;
+	char *benchmarks=NULL;
+	char *streamFile=NULL;
+	H264StreamConfig_t streamConfig = {DEFAULT_H264_FRAMES, DEFAULT_H264_GOP, DEFAULT_H264_KEYFRAME, DEFAULT_H264_FRAME, 1, false, false, false, DEFAULT_H264_SEED};
+	LinkPattern_t customPattern = {"custom", 0, 0, 0, 0, 99};
+
+	while (1) {
+		int nOptionIndex;
+		static const struct option optiona[] = {
+			{ "help", no_argument, &flagHelp, 1 },
+			{      0,           0,         0, 0 }
+		};
+		int c = getopt_long(argc, argv, "h:m:s:r:c:D:b:n:g:k:p:l:BHAe:w:L:O:", optiona, &nOptionIndex);
+		if (c == -1) {
+			break;
+		}
+
+		switch (c) {
+			case 0: {
+				// long option
+				break;
+			}
+			case 'm': {
+				traceFile = optarg;
+				break;
+			}
+			case 's': {
+				corpusSize = (uint32_t)atoi(optarg)*1024*1024;
+				break;
+			}
+			case 'r': {
+				runs = atoi(optarg);
+				break;
+			}
+			case 'c': {
+				readSize = (uint32_t)atoi(optarg);
+				break;
+			}
+			case 'D': {
+				dictionaryFile = optarg;
+				break;
+			}
+			case 'b': {
+				benchmarks = optarg;
+				break;
+			}
+			case 'n': {
+				streamConfig.frames = (uint32_t)atoi(optarg);
+				break;
+			}
+			case 'g': {
+				streamConfig.gop = (uint32_t)atoi(optarg);
+				break;
+			}
+			case 'k': {
+				streamConfig.keyFrameSize = (uint32_t)atoi(optarg);
+				break;
+			}
+			case 'p': {
+				streamConfig.frameSize = (uint32_t)atoi(optarg);
+				break;
+			}
+			case 'l': {
+				streamConfig.slices = (uint32_t)atoi(optarg);
+				break;
+			}
+			case 'B': {
+				streamConfig.baseline = true;
+				break;
+			}
+			case 'H': {
+				streamConfig.headersOnce = true;
+				break;
+			}
+			case 'A': {
+				streamConfig.aud = true;
+				break;
+			}
+			case 'e': {
+				streamConfig.seed = (uint32_t)atoi(optarg);
+				break;
+			}
+			case 'w': {
+				streamFile = optarg;
+				break;
+			}
+			case 'L': {
+				customPattern.lossPermille = (uint32_t)atoi(optarg);
+				break;
+			}
+			case 'O': {
+				customPattern.reorderPermille = (uint32_t)atoi(optarg);
+				break;
+			}
+			default: {
+				usage();
+				break;
+			}
+		}
+	}
+	if(runs < 1 || readSize < 1 || readSize > MAVLINK_PARSER_BUFFER_SIZE - MAVLINK_PARSER_MAX_FRAME_LEN){
+		usage();
+	}
+	if(streamConfig.frames < 1 || streamConfig.gop < 1 || streamConfig.slices < 1 || streamConfig.seed == 0 || customPattern.lossPermille > 1000 || customPattern.reorderPermille > 1000
+		|| streamConfig.keyFrameSize < 16*streamConfig.slices || streamConfig.frameSize < 16*streamConfig.slices){
+		usage();
+	}
+
+	std::vector<uint8_t> corpus;
+	const char *input = "synthetic";
+	if(traceFile != NULL){
+		if(!loadFile(traceFile, corpus) || corpus.size() == 0){
+			exit(EXIT_FAILURE);
+		}
+		input = traceFile;
+	}else{
+		buildMavlinkCorpus(corpus, corpusSize);
+	}
+	fprintf(stderr, "benchmark: Mavlink input %s, %u bytes, read size %u, best of %d runs\n", input, (uint32_t)corpus.size(), readSize, runs);
+
+	std::vector<uint8_t> corpus2;
+	uint64_t frames2 = buildMavlink2Corpus(corpus, corpus2);
+	if(isSelected(benchmarks, "mavlink")){
+		// mavlink_parse_char() loses the frame after a noise byte (it does not go back to search for STX inside a broken frame),
+		// so only the new parser is checked against the frames put in the corpus.
+		uint32_t checksumOld, checksumNew;
+		uint64_t framesOld = runMavlinkBench("mavlink_parse_char", input, benchParseChar, corpus, readSize, runs, checksumOld);
+		uint64_t framesNew = runMavlinkBench("mavlink_frame_parser", input, benchFrameParser, corpus, readSize, runs, checksumNew);
+		if((traceFile == NULL && framesNew != corpusFrames) || framesNew < framesOld){
+			fprintf(stderr, "benchmark: Error! MavlinkFrameParser found %llu frames, mavlink_parse_char %llu, corpus %llu.\n", (unsigned long long)framesNew, (unsigned long long)framesOld, (unsigned long long)corpusFrames);
+			exit(EXIT_FAILURE);
+		}
+
+		fprintf(stderr, "benchmark: Mavlink 2 trimming %u -> %u bytes (%.1f%% saved)\n", (uint32_t)corpus.size(), (uint32_t)corpus2.size(), 100.0 - (100.0 * corpus2.size()) / corpus.size());
+		if(runMavlinkBench("mavlink2_frame_parser", input, benchFrameParser, corpus2, readSize, runs, checksumNew) != frames2){
+			fprintf(stderr, "benchmark: Error! MavlinkFrameParser did not find all %llu Mavlink 2 frames.\n", (unsigned long long)frames2);
+			exit(EXIT_FAILURE);
+		}
+
+		// Mavlink 1 only, mavlink_msg_to_send_buffer() of the vendored library can not write Mavlink 2 frames.
+		fprintf(stderr, "benchmark: Mavlink batch store RingBuf<mavlink_message_t, %d> %u bytes, MavlinkFrameRing %u bytes\n", MESSAGE_RING_SIZE,
+			(uint32_t)sizeof(RingBuf<mavlink_message_t, MESSAGE_RING_SIZE>), (uint32_t)sizeof(MavlinkFrameRing));
+		runMavlinkBench("mavlink_message_ring", input, benchMessageRing, corpus, readSize, runs, checksumOld);
+		runMavlinkBench("mavlink_frame_ring", input, benchFrameRing, corpus, readSize, runs, checksumNew);
+		if(traceFile == NULL && checksumOld != checksumNew){
+			fprintf(stderr, "benchmark: Error! The batches from MavlinkFrameRing and the mavlink_message_t ring are not equal.\n");
+			exit(EXIT_FAILURE);
+		}
+
+		runMavlinkBench("crc_accumulate", input, crcPerByteAdapter, corpus, readSize, runs, checksumOld);
+		runMavlinkBench("crc_slice_by_4", input, crcTableAdapter, corpus, readSize, runs, checksumNew);
+		if(checksumOld != checksumNew){
+			fprintf(stderr, "benchmark: Error! crc_accumulate and MavlinkFrameParser::crc are not equal.\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	// Batch compression (tx_raw -c), on the link as Mavlink 1 and as trimmed Mavlink 2 (tx_raw -m 2).
+	batches_t batches1, batches2;
+	buildBatches(corpus, batches1);
+	buildBatches(corpus2, batches2);
+	std::vector<uint8_t> noDictionary;
+	std::vector<uint8_t> dictionary(MAVLINK_COMPRESSION_MAX_DICTIONARY);
+	dictionary.resize(MavlinkCompressor::trainDictionary(batches1.data.data(), batches1.data.size(), dictionary.data(), dictionary.size()));
+	if(isSelected(benchmarks, "compression")){
+		std::vector<uint8_t> dictionary2(MAVLINK_COMPRESSION_MAX_DICTIONARY);
+		dictionary2.resize(MavlinkCompressor::trainDictionary(batches2.data.data(), batches2.data.size(), dictionary2.data(), dictionary2.size()));
+		bool ok = benchCompression("mavlink1_batch", input, batches1, noDictionary, runs, 0);
+		ok &= benchCompression("mavlink1_batch_dict", input, batches1, dictionary, runs, 0);
+		ok &= benchCompression("mavlink2_batch", input, batches2, noDictionary, runs, 0);
+		ok &= benchCompression("mavlink2_batch_dict", input, batches2, dictionary2, runs, 0);
+		ok &= benchCompression("mavlink2_batch_dict", input, batches2, dictionary2, 1, LOSS_INTERVAL);
+		if(!ok){
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	// Serial ingest as tx_raw does it, and with a consumer too slow for the link to see the ring overrun detection.
+	if(isSelected(benchmarks, "serial")){
+		if(!benchSerialPty("serial_pty_ingest", input, corpus, 0, (traceFile == NULL) ? corpusFrames : 0)){
+			exit(EXIT_FAILURE);
+		}
+		benchSerialPty("serial_pty_ingest_overrun", input, corpus, PTY_SLOW_CONSUMER, 0);
+	}
+
+	// Video: TX framing of the synthetic stream, RX framing of the packages under loss and reordering, the buffer pool and UDP.
+	if(isSelected(benchmarks, "h264") || isSelected(benchmarks, "udp") || isSelected(benchmarks, "rtsp") || streamFile != NULL){
+		std::vector<uint8_t> stream;
+		buildH264Stream(streamConfig, stream);
+		char streamName[96];
+		snprintf(streamName, sizeof(streamName), "h264_n%u_g%u_k%u_p%u_l%u%s%s%s_e%u", streamConfig.frames, streamConfig.gop, streamConfig.keyFrameSize, streamConfig.frameSize,
+			streamConfig.slices, streamConfig.baseline ? "_baseline" : "_high", streamConfig.headersOnce ? "_once" : "_inline", streamConfig.aud ? "_aud" : "", streamConfig.seed);
+		printf("{\"stream\":\"%s\",\"bytes\":%u,\"frames\":%u,\"checksum\":\"%08x\"}\n", streamName, (uint32_t)stream.size(), streamConfig.frames, streamChecksum(stream));
+		fflush(stdout);
+
+		if(streamFile != NULL){
+			FILE *fp = fopen(streamFile, "wb");
+			if(fp == NULL || fwrite(stream.data(), 1, stream.size(), fp) != stream.size()){
+				fprintf(stderr, "benchmark: Unable to write H.264 stream %s\n", streamFile);
+				exit(EXIT_FAILURE);
+			}
+			fclose(fp);
+			fprintf(stderr, "benchmark: Wrote %u bytes H.264 stream to %s\n", (uint32_t)stream.size(), streamFile);
+		}
+
+		packages_t packages;
+		if(!benchH264TX(streamName, stream, readSize, (isSelected(benchmarks, "h264")) ? runs : 1, packages)){
+			exit(EXIT_FAILURE);
+		}
+		if(isSelected(benchmarks, "h264")){
+			const LinkPattern_t patterns[] = {
+				{"clean",        0,    0,  0,  0, 11},
+				{"loss_1pct",   10,    0,  0,  0, 12},
+				{"loss_5pct",   50,    0,  0,  0, 13},
+				{"burst_loss",   0, 1000, 25,  0, 14},
+				{"reorder_1pct", 0,    0,  0, 10, 15},
+				{"loss_reorder",10,    0,  0, 10, 16}
+			};
+			bool ok = true;
+			for(uint32_t a=0;a<sizeof(patterns)/sizeof(patterns[0]);a++){
+				ok &= benchH264RX(streamName, packages, patterns[a], runs);
+			}
+			if(customPattern.lossPermille > 0 || customPattern.reorderPermille > 0){
+				ok &= benchH264RX(streamName, packages, customPattern, runs);
+			}
+			ok &= benchBufferSearch(50, false, runs);
+			ok &= benchBufferSearch(50, true, runs);
+			ok &= benchBufferSearch(90, true, runs);
+			ok &= benchBufferSearch(99, true, runs);
+			if(!ok){
+				exit(EXIT_FAILURE);
+			}
+		}
+		if(isSelected(benchmarks, "udp")){
+			if(!benchConnection(streamName, packages, runs)){
+				exit(EXIT_FAILURE);
+			}
+		}
+		if(isSelected(benchmarks, "rtsp")){
+			const uint32_t clientCounts[] = {1, 2, 4, 8, 16};
+			int saved = muteStderr(); // connect / disconnect messages.
+			bool ok = true;
+			for(uint32_t a=0;a<sizeof(clientCounts)/sizeof(clientCounts[0]);a++){
+				ok &= benchRtspFanout(streamName, stream, clientCounts[a], true, runs);
+				ok &= benchRtspFanout(streamName, stream, clientCounts[a], false, runs);
+			}
+			restoreStderr(saved);
+			if(!ok){
+				fprintf(stderr, "benchmark: Error! RTSP fan-out failed.\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+
+	// Relay (relay/relay) for drones behind carrier-grade NAT, throughput and added latency with many drones.
+	if(isSelected(benchmarks, "relay")){
+		const uint32_t droneCounts[] = {1, 16, 64, 256};
+		int saved = muteStderr(); // a line per paired session.
+		bool ok = true;
+		for(uint32_t a=0;a<sizeof(droneCounts)/sizeof(droneCounts[0]);a++){
+			ok &= benchRelay("loopback", droneCounts[a], runs);
+		}
+		restoreStderr(saved);
+		if(!ok){
+			fprintf(stderr, "benchmark: Error! Relay benchmark failed.\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	// Rings between threads (atomicRingBuf.h), against RingBuf.h with a mutex.
+	if(isSelected(benchmarks, "ring")){
+		bool ok = true;
+		ok &= benchRingThroughput<MutexRingBuf>("ring_mutex", 1, 1, runs);
+		ok &= benchRingThroughput<MutexRingBuf>("ring_mutex", 1, RING_BENCH_BULK, runs);
+		ok &= benchRingThroughput<SpscRingBuf<uint64_t, RING_BENCH_SIZE> >("ring_spsc", 1, 1, runs);
+		ok &= benchRingThroughput<SpscRingBuf<uint64_t, RING_BENCH_SIZE> >("ring_spsc", 1, RING_BENCH_BULK, runs);
+		const uint32_t producerCounts[] = {1, 2, 4};
+		for(uint32_t a=0;a<sizeof(producerCounts)/sizeof(producerCounts[0]);a++){
+			ok &= benchRingThroughput<MpscRingBuf<uint64_t, RING_BENCH_SIZE> >("ring_mpsc", producerCounts[a], 1, runs);
+			ok &= benchRingThroughput<MpscRingBuf<uint64_t, RING_BENCH_SIZE> >("ring_mpsc", producerCounts[a], RING_BENCH_BULK, runs);
+		}
+		ok &= benchRingThroughput<MutexRingBuf>("ring_mutex", 4, RING_BENCH_BULK, runs);
+		ok &= benchRingLatency<MutexRingBuf>("ring_mutex_latency");
+		ok &= benchRingLatency<SpscRingBuf<uint64_t, RING_BENCH_SIZE> >("ring_spsc_latency");
+		ok &= benchRingLatency<MpscRingBuf<uint64_t, RING_BENCH_SIZE> >("ring_mpsc_latency");
+		if(!ok){
+			fprintf(stderr, "benchmark: Error! Ring benchmark failed.\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if(dictionaryFile != NULL){
+		// The records holds the same payloads for Mavlink 1 and trimmed Mavlink 2, so one dictionary works with and without tx_raw -m 2.
+		FILE *fp = fopen(dictionaryFile, "wb");
+		if(fp == NULL || fwrite(dictionary.data(), 1, dictionary.size(), fp) != dictionary.size()){
+			fprintf(stderr, "benchmark: Unable to write dictionary %s\n", dictionaryFile);
+			exit(EXIT_FAILURE);
+		}
+		fclose(fp);
+		fprintf(stderr, "benchmark: Wrote %u bytes Mavlink dictionary to %s\n", (uint32_t)dictionary.size(), dictionaryFile);
+	}
+	return 0;
+}
@@ -5,6 +5,10 @@
 	Not for commercial use
  */ 
 #include "connection.h"
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <linux/errqueue.h> // scm_timestamping
 
 // Constructor
 
@@ -36,12 +40,12 @@
 	this->_port=port;
 	this->_flags=flags;
 	
-	// send to hostname on Port.
-	this->_cliaddr.sin_family = AF_INET; 
-	this->_cliaddr.sin_addr.s_addr = inet_addr(hostname); 
-	this->_cliaddr.sin_port = htons(this->_port); 
-
-	this->isValid=true; // We can send right away because we know the receiver
+	// send to hostname on Port, IPv4 / IPv6 address or a name (the family answering first when it has both).
+	snprintf(this->_hostname, sizeof(this->_hostname), "%s", hostname);
+	this->_receiverPort=port;
+	this->followsReceiver=true;
+	this->isValid=this->selectReceiver(true); // We can send right away because we know the receiver
+	this->hasReceiver=true;
 	this->initConnection();
  }
 
@@ -51,22 +55,38 @@
 	this->_port=port;
 	this->_flags=0;
 	
-	// send to hostname on Port.
-	this->_cliaddr.sin_family = AF_INET; 
-	this->_cliaddr.sin_addr.s_addr = inet_addr(hostname); 
-	this->_cliaddr.sin_port = htons(this->_port); 
-	
-	this->isValid=true; // We can send right away because we know the receiver
+	// send to hostname on Port, IPv4 / IPv6 address or a name (the family answering first when it has both).
+	snprintf(this->_hostname, sizeof(this->_hostname), "%s", hostname);
+	this->_receiverPort=port;
+	this->followsReceiver=true;
+	this->isValid=this->selectReceiver(true); // We can send right away because we know the receiver
+	this->hasReceiver=true;
 	this->initConnection();
   }
 
 void Connection::clearAll(){
-	this->_fd=0;
+	this->_fd=-1;
 	this->_port=0;
 	this->_type=0;
 	this->_flags=0;
+	this->_family=AF_INET6; // dual-stack, IPv4 senders are ::ffff:a.b.c.d.
 	bzero(&this->_servaddr, sizeof(this->_servaddr));	
 	bzero(&this->_cliaddr, sizeof(this->_cliaddr));	
+	bzero(&this->_cliaddr4, sizeof(this->_cliaddr4));	
+	this->_servaddrLength=0;
+	this->_cliaddrLength=sizeof(struct sockaddr_in6);
+	this->isValid=false;
+	this->hasReceiver=false;
+	this->followsReceiver=false;
+	this->_hostname[0]=0;
+	this->_receiverPort=0;
+	this->_candidateCount=0;
+	this->_selected=-1;
+	this->timestamps=false;
+	this->_receiveTime=0;
+	this->_receiveDrops=0;
+	this->_receiveBuffer=0;
+	this->_sendBuffer=0;
   }
 
 
@@ -74,20 +94,17 @@ void Connection::clearAll(){
 void Connection::initConnection(){
 	int err = 0;	
 	
-	// Listen on port, from hostname IP.
-	this->_servaddr.sin_family = AF_INET; 
-	this->_servaddr.sin_addr.s_addr = INADDR_ANY; 
-	this->_servaddr.sin_port = htons(this->_port); 
+	// Listen on port, from hostname IP (set in openSocket, IPv6 sockets take IPv4 as well).
 	
 	if(this->_type == SOCK_STREAM && this->isValid == false){ // TCP server (listing for TCP connection)
 	    // create listening TCP socket 
-		if ( (this->_fd  = socket(AF_INET, SOCK_STREAM, 0)) < 0 ) {
+		if ( (this->_fd  = this->openSocket(SOCK_STREAM)) < 0 ) {
 			perror("Connection: TCP socket creation failed");
 			exit(EXIT_FAILURE);
 		}
 		// binding server addr structure to this->_fd 
 
-		if(bind(this->_fd, (struct sockaddr*)&this->_servaddr, sizeof(this->_servaddr)) < 0){
+		if(bind(this->_fd, (struct sockaddr*)&this->_servaddr, this->_servaddrLength) < 0){
 			err = errno; // save off errno, because because the printf statement might reset it
 			fprintf(stderr, "Connection: TCP Bind unable ERNO:%d\n", err);
 		} 
@@ -96,24 +113,24 @@ void Connection::initConnection(){
 			fprintf(stderr, "Connection: TCP Listen unable ERNO:%d\n", err);
 		} 
 		printf("Connection: initConection server: ");
-		this->print_ipv4((struct sockaddr*)&this->_servaddr);
+		this->print_address((struct sockaddr*)&this->_servaddr);
 		printf("\n");
 		
 		fprintf(stderr, "Connection: Listen for TCP connection\n");
 	}else if(this->_type == SOCK_STREAM && this->isValid == true){ // TCP client (connect to server)
 		
 		printf("Connection: initConection client: ");
-		this->print_ipv4((struct sockaddr*)&this->_cliaddr);
+		this->print_address((struct sockaddr*)&this->_cliaddr);
 		printf("\n");
 	
 		// connect to TCP socket 
-		if ( (this->_fd  = socket(AF_INET, SOCK_STREAM, 0)) < 0 ) {
+		if ( (this->_fd  = this->openSocket(SOCK_STREAM)) < 0 ) {
 				perror("Connection: TCP socket creation failed");
 				exit(EXIT_FAILURE);
 		}
 		// connect to server (here called client :-( )
 		int ress=0;
-		ress = connect(this->_fd, (struct sockaddr*)&this->_cliaddr, sizeof(this->_cliaddr));
+		ress = connect(this->_fd, (struct sockaddr*)&this->_cliaddr, this->_cliaddrLength);
 		if (ress < 0); 
 		
 		{
@@ -125,17 +142,18 @@ void Connection::initConnection(){
 		}
 	}else if(this->_type == SOCK_DGRAM){
 		// create UDP socket 
-		if ( (this->_fd  = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ) {
+		if ( (this->_fd  = this->openSocket(SOCK_DGRAM)) < 0 ) {
 			perror("Connection: UDP socket creation failed");
 			fprintf(stderr, "Connection: UDP socket creation failed");
 			exit(EXIT_FAILURE);
 		}
 		// binding server addr structure to this->_fd  
-		bind(this->_fd, (struct sockaddr*)&this->_servaddr, sizeof(this->_servaddr)); 	 
+		bind(this->_fd, (struct sockaddr*)&this->_servaddr, this->_servaddrLength); 	 
 	}else{
-		this->_fd=0;
+		this->_fd=-1;
 		// unknown
 	}
+	this->applySocketOptions();
 	
 	// Set to nonblocking / blocking
 	if(O_NONBLOCK == this->_flags){
@@ -148,15 +166,35 @@ void Connection::initConnection(){
 	}
  }
   
+ bool Connection::reopen(void){
+	if(this->_fd >= 0){
+		close(this->_fd);
+	}
+	this->_fd=-1;
+	this->_receiveDrops=0; // the counter of the new socket starts again.
+	this->isValid=this->hasReceiver; // a listening socket must wait for the sender again.
+	if(this->_hostname[0] != 0){
+		// Same receiver as before without probing, only resolved if DNS failed until now.
+		this->isValid=this->selectReceiver(false);
+	}
+	this->initConnection();
+
+	printf("Connection: reopened socket FD=%d for ", this->_fd);
+	this->print_address((struct sockaddr*)&this->_cliaddr);
+	printf("\n");
+	return (this->_fd >= 0);
+ }
+
  void Connection::startConnection(int fd){	
 	socklen_t len; 
 	len=sizeof(this->_cliaddr);
 	this->_fd = accept(fd, (struct sockaddr*)&this->_cliaddr, &len);
+	this->_cliaddrLength=len;
 /*	
 	printf("Connection: startconnection client: ");
-	this->print_ipv4((struct sockaddr*)&this->_cliaddr);
+	this->print_address((struct sockaddr*)&this->_cliaddr);
 	printf("Connection: startconnection server: ");
-	this->print_ipv4((struct sockaddr*)&this->_servaddr);
+	this->print_address((struct sockaddr*)&this->_servaddr);
 	printf("\n");
 	*/
 	this->isValid=true;
@@ -164,8 +202,15 @@ void Connection::initConnection(){
   
 
  void Connection::setFD_SET(fd_set* fdset){
+	if(this->_fd < 0){ // closed after an error, fd 0 is STDIN (the video pipe of tx_raw).
+		return;
+	}
 	FD_SET(this->_fd, fdset); 
  }
+
+ bool Connection::isFD_SET(fd_set* fdset){
+	return (this->_fd >= 0) && FD_ISSET(this->_fd, fdset);
+ }
   
  int Connection::getFD(){
 	return this->_fd;
@@ -180,6 +225,43 @@ void Connection::initConnection(){
 	return this->_type;
  }
  
+ const struct sockaddr_in* Connection::getClientAddress(void){
+	if(this->_cliaddr.ss_family == AF_INET6){
+		const struct sockaddr_in6 *address = (const struct sockaddr_in6 *)&this->_cliaddr;
+		if(!IN6_IS_ADDR_V4MAPPED(&address->sin6_addr)){
+			return NULL;
+		}
+		this->_cliaddr4.sin_family = AF_INET;
+		this->_cliaddr4.sin_port = address->sin6_port;
+		memcpy(&this->_cliaddr4.sin_addr, &address->sin6_addr.s6_addr[12], sizeof(this->_cliaddr4.sin_addr));
+		return &this->_cliaddr4;
+	}
+	if(this->_cliaddr.ss_family == AF_INET){
+		return (const struct sockaddr_in *)&this->_cliaddr;
+	}
+	return NULL; // nothing received yet.
+ }
+
+ void Connection::setReceiver(const char* hostname, int port){
+	snprintf(this->_hostname, sizeof(this->_hostname), "%s", hostname);
+	this->_receiverPort=port;
+	this->_candidateCount=0;
+	this->followsReceiver=false; // the socket is open already.
+	this->isValid=this->selectReceiver(true);
+	this->hasReceiver=true; // kept after a reopen, readData still replaces it with the last sender.
+ }
+
+ int Connection::getFamily(void){
+	return this->_family;
+ }
+
+ int Connection::getReceiverFamily(void){
+	if(this->_cliaddr.ss_family == AF_INET6 && IN6_IS_ADDR_V4MAPPED(&((struct sockaddr_in6 *)&this->_cliaddr)->sin6_addr)){
+		return AF_INET;
+	}
+	return this->_cliaddr.ss_family;
+ }
+ 
 
  int16_t Connection::readData(void *buffer, uint16_t maxLength){ // returns number of bytes read.
 	 int n;
@@ -187,16 +269,23 @@ void Connection::initConnection(){
 	 len=sizeof(this->_cliaddr);
 
 //	printf("Connection: readData client: ");
-//	this->print_ipv4((struct sockaddr*)&this->_cliaddr);
+//	this->print_address((struct sockaddr*)&this->_cliaddr);
 //	printf("Connection: readData server: ");
-//	this->print_ipv4((struct sockaddr*)&this->_servaddr);
+//	this->print_address((struct sockaddr*)&this->_servaddr);
 //	printf("\n");
 
 
 
 	 int err;
-	// this->print_ipv4((struct sockaddr*)&this->_cliaddr);
-	 n = recvfrom(this->_fd, buffer, maxLength, 0, (struct sockaddr*)&this->_cliaddr, &len); 
+	 if(this->_fd < 0){
+		 return 0; // no socket until reopen().
+	 }
+	// this->print_address((struct sockaddr*)&this->_cliaddr);
+	 if(this->timestamps){
+		 n = this->readMessage(buffer, maxLength, &len);
+	 }else{
+		 n = recvfrom(this->_fd, buffer, maxLength, 0, (struct sockaddr*)&this->_cliaddr, &len); 
+	 }
 	 err = errno; // save off errno, because because the printf statement might reset it
 	 if((n < 0)){ // Error
 		 if ((err == EAGAIN) || (err == EWOULDBLOCK))
@@ -226,10 +315,11 @@ void Connection::initConnection(){
 				 fprintf(stderr, "Connection: Unknown error - reading with result=%d, thus closing\n",(int)n);
 			 }	 
 			close(this->_fd);
-			this->_fd=0;
+			this->_fd=-1;
 			this->isValid=false;			
 		 }
 	 }else{
+		 this->_cliaddrLength=len;
 		 this->isValid=true;
 	 }
  
@@ -239,19 +329,19 @@ void Connection::initConnection(){
  int16_t Connection::writeData(void *buffer, uint16_t length){ // returns?
 	ssize_t n = 0;
 	socklen_t len; 
-	len=sizeof(this->_cliaddr);	
+	len=this->_cliaddrLength;	
 	
-	if(this->isValid){
+	if(this->isValid && this->_fd >= 0){
 		int err;
 
 //		printf("Connection: Sending %d bytes to ", length);
-//		this->print_ipv4((struct sockaddr*)&this->_cliaddr);
+//		this->print_address((struct sockaddr*)&this->_cliaddr);
 //		printf("\n");
 
 //		printf("Connection: writeData client: ");
-//		this->print_ipv4((struct sockaddr*)&this->_cliaddr);
+//		this->print_address((struct sockaddr*)&this->_cliaddr);
 //		printf("Connection: writeData server: ");
-//		this->print_ipv4((struct sockaddr*)&this->_servaddr);
+//		this->print_address((struct sockaddr*)&this->_servaddr);
 //		printf("\n");
 
 
@@ -283,7 +373,7 @@ void Connection::initConnection(){
 				fprintf(stderr, "Connection: writing length=%d in FD=%d with result=%d, thus closing\n",length,this->_fd,(int)n );		 
 			}
 			close(this->_fd);
-			this->_fd=0;
+			this->_fd=-1;
 			this->isValid=false;
 		}
 	}
@@ -291,15 +381,401 @@ void Connection::initConnection(){
  }
  
 
-void Connection::print_ipv4(struct sockaddr *s)
+void Connection::print_address(struct sockaddr *s)
 {
-	struct sockaddr_in *sin = (struct sockaddr_in *)s;
-	char ip[INET_ADDRSTRLEN];
+	char ip[INET6_ADDRSTRLEN];
 	uint16_t port;
 
+	if(s->sa_family == AF_INET6){
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)s;
+		inet_ntop(AF_INET6, &sin6->sin6_addr, ip, sizeof (ip));
+		port = htons(sin6->sin6_port);
+		printf ("[%s]:%d", ip, port);
+		return;
+	}
+	struct sockaddr_in *sin = (struct sockaddr_in *)s;
 	inet_ntop(AF_INET, &sin->sin_addr, ip, sizeof (ip));
 	port = htons(sin->sin_port);
 
 	printf ("%s:%d", ip, port);
 }
- 
\ No newline at end of file
+
+int Connection::openSocket(int type)
+{
+	int fd = socket(this->_family, type, 0);
+	if(fd < 0 && this->_family == AF_INET6 && errno == EAFNOSUPPORT && (false == this->followsReceiver || false == this->isValid)){
+		this->_family = AF_INET; // kernel without IPv6.
+		fd = socket(this->_family, type, 0);
+	}
+	if(fd < 0){
+		return fd;
+	}
+	bzero(&this->_servaddr, sizeof(this->_servaddr));
+	if(this->_family == AF_INET6){
+		int v6only = 0;
+		setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only)); // dual-stack, on some systems the default is IPv6 only.
+		struct sockaddr_in6 *address = (struct sockaddr_in6 *)&this->_servaddr;
+		address->sin6_family = AF_INET6;
+		address->sin6_addr = in6addr_any;
+		address->sin6_port = htons(this->_port);
+		this->_servaddrLength = sizeof(struct sockaddr_in6);
+	}else{
+		struct sockaddr_in *address = (struct sockaddr_in *)&this->_servaddr;
+		address->sin_family = AF_INET;
+		address->sin_addr.s_addr = INADDR_ANY;
+		address->sin_port = htons(this->_port);
+		this->_servaddrLength = sizeof(struct sockaddr_in);
+	}
+	return fd;
+}
+
+bool Connection::resolve(void)
+{
+	struct addrinfo hints;
+	struct addrinfo *result = NULL;
+	char service[8];
+	bzero(&hints, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = (this->_type == SOCK_STREAM) ? SOCK_STREAM : SOCK_DGRAM;
+	hints.ai_flags = AI_NUMERICSERV;
+	snprintf(service, sizeof(service), "%d", this->_receiverPort);
+
+	this->_candidateCount = 0;
+	this->_selected = -1;
+	int err = getaddrinfo(this->_hostname, service, &hints, &result);
+	if(err != 0){
+		fprintf(stderr, "Connection: Unable to resolve %s: %s\n", this->_hostname, gai_strerror(err));
+		return false;
+	}
+	for(struct addrinfo *entry = result; entry != NULL && this->_candidateCount < 2; entry = entry->ai_next){
+		if(entry->ai_family != AF_INET && entry->ai_family != AF_INET6){
+			continue;
+		}
+		if(this->_candidateCount == 1 && this->_candidates[0].ss_family == entry->ai_family){
+			continue; // one address per family.
+		}
+		memcpy(&this->_candidates[this->_candidateCount], entry->ai_addr, entry->ai_addrlen);
+		this->_candidateLengths[this->_candidateCount] = entry->ai_addrlen;
+		this->_candidateCount++;
+	}
+	freeaddrinfo(result);
+	return (this->_candidateCount > 0);
+}
+
+// A TCP connect to the port is answered after one round trip, accepted or refused (RST) when nothing listens on TCP,
+// so it works without anything running on the other side. The family answering first is used, if neither answers
+// (filtered) the getaddrinfo() order is kept.
+int Connection::probeCandidates(void)
+{
+	if(this->_candidateCount < 2){
+		return 0;
+	}
+	struct pollfd fds[2];
+	int64_t rttUs[2] = {-1, -1}; // -1 no answer.
+	bool failed[2] = {false, false};
+	struct timespec start, now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(int a=0;a<2;a++){
+		fds[a].fd = socket(this->_candidates[a].ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+		fds[a].events = POLLOUT;
+		fds[a].revents = 0;
+		if(fds[a].fd < 0){
+			failed[a] = true;
+			continue;
+		}
+		if(connect(fds[a].fd, (struct sockaddr*)&this->_candidates[a], this->_candidateLengths[a]) == 0 || errno == ECONNREFUSED){
+			rttUs[a] = 0;
+		}else if(errno != EINPROGRESS){
+			failed[a] = true; // no route for this family.
+		}
+		if(rttUs[a] >= 0 || failed[a]){
+			close(fds[a].fd);
+			fds[a].fd = -1; // ignored by poll().
+		}
+	}
+
+	int64_t elapsedMs = 0;
+	while(rttUs[0] < 0 && rttUs[1] < 0 && (fds[0].fd >= 0 || fds[1].fd >= 0) && elapsedMs < CONNECTION_PROBE_TIMEOUT_MS){
+		int ready = poll(fds, 2, CONNECTION_PROBE_TIMEOUT_MS - elapsedMs);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		int64_t elapsedUs = (now.tv_sec - start.tv_sec) * 1000000LL + (now.tv_nsec - start.tv_nsec) / 1000;
+		elapsedMs = elapsedUs / 1000;
+		for(int a=0;a<2 && ready > 0;a++){
+			if(fds[a].fd < 0 || fds[a].revents == 0){
+				continue;
+			}
+			int err = 0;
+			socklen_t len = sizeof(err);
+			getsockopt(fds[a].fd, SOL_SOCKET, SO_ERROR, &err, &len);
+			if(err == 0 || err == ECONNREFUSED){
+				rttUs[a] = elapsedUs;
+			}else{
+				failed[a] = true;
+			}
+			close(fds[a].fd);
+			fds[a].fd = -1;
+		}
+	}
+	for(int a=0;a<2;a++){
+		if(fds[a].fd >= 0){
+			close(fds[a].fd);
+		}
+	}
+
+	int selected = 0;
+	if(rttUs[1] >= 0 && (rttUs[0] < 0 || rttUs[1] < rttUs[0])){
+		selected = 1;
+	}else if(rttUs[0] < 0 && failed[0] && false == failed[1]){
+		selected = 1;
+	}
+	printf("Connection: %s", this->_hostname);
+	for(int a=0;a<2;a++){
+		printf(" %s ", (this->_candidates[a].ss_family == AF_INET6) ? "IPv6" : "IPv4");
+		this->print_address((struct sockaddr*)&this->_candidates[a]);
+		if(rttUs[a] >= 0){
+			printf(" %.1fms", rttUs[a] / 1000.0);
+		}else{
+			printf(" %s", failed[a] ? "unreachable" : "no answer");
+		}
+	}
+	printf(", using %s\n", (this->_candidates[selected].ss_family == AF_INET6) ? "IPv6" : "IPv4");
+	return selected;
+}
+
+bool Connection::setDestination(int candidate)
+{
+	struct sockaddr_storage &address = this->_candidates[candidate];
+	bzero(&this->_cliaddr, sizeof(this->_cliaddr));
+	if(address.ss_family == this->_family){
+		memcpy(&this->_cliaddr, &address, this->_candidateLengths[candidate]);
+		this->_cliaddrLength = this->_candidateLengths[candidate];
+		return true;
+	}
+	if(address.ss_family == AF_INET && this->_family == AF_INET6){ // IPv4 from a dual-stack socket.
+		struct sockaddr_in *v4 = (struct sockaddr_in *)&address;
+		struct sockaddr_in6 *v6 = (struct sockaddr_in6 *)&this->_cliaddr;
+		v6->sin6_family = AF_INET6;
+		v6->sin6_port = v4->sin_port;
+		v6->sin6_addr.s6_addr[10] = 0xFF;
+		v6->sin6_addr.s6_addr[11] = 0xFF;
+		memcpy(&v6->sin6_addr.s6_addr[12], &v4->sin_addr, sizeof(v4->sin_addr));
+		this->_cliaddrLength = sizeof(struct sockaddr_in6);
+		return true;
+	}
+	fprintf(stderr, "Connection: %s is IPv6, the socket is IPv4 only\n", this->_hostname);
+	return false;
+}
+
+// Resolves the receiver (again if it failed before) and picks the family answering first (with probe, else the first) once, returns true if ok.
+bool Connection::selectReceiver(bool probe)
+{
+	if(this->_candidateCount == 0 && false == this->resolve()){
+		return false;
+	}
+	if(this->_selected < 0){
+		// Without the probe the getaddrinfo() order, which already puts a family without a route last (RFC 6724).
+		this->_selected = probe ? this->probeCandidates() : 0;
+	}
+	if(this->followsReceiver){
+		this->_family = this->_candidates[this->_selected].ss_family;
+	}
+	return this->setDestination(this->_selected);
+}
+
+int Connection::writeProbe(void *buffer, uint16_t length)
+{
+	if(false == this->isValid || this->_fd < 0){
+		return -ENOTCONN;
+	}
+	// Probe only this package, the video keeps the kernel default (fragmented if the path MTU got smaller than our probe said).
+	int level = (this->_family == AF_INET6) ? IPPROTO_IPV6 : IPPROTO_IP;
+	int option = (this->_family == AF_INET6) ? IPV6_MTU_DISCOVER : IP_MTU_DISCOVER;
+	int probe = (this->_family == AF_INET6) ? IPV6_PMTUDISC_PROBE : IP_PMTUDISC_PROBE;
+	int previous;
+	socklen_t size = sizeof(previous);
+	if(getsockopt(this->_fd, level, option, &previous, &size) < 0 || setsockopt(this->_fd, level, option, &probe, sizeof(probe)) < 0){
+		return -errno;
+	}
+	ssize_t n = sendto(this->_fd, buffer, length, 0, (struct sockaddr *)&this->_cliaddr, this->_cliaddrLength);
+	int err = errno;
+	setsockopt(this->_fd, level, option, &previous, sizeof(previous));
+	if(n < 0){
+		return ((err == EAGAIN) || (err == EWOULDBLOCK)) ? 0 : -err;
+	}
+	return (int)n;
+}
+
+// For UDP the packages are counted until the NIC driver frees them, so this is the socket, the qdisc and the driver queue.
+int Connection::getSendQueue(void)
+{
+	int bytes = 0;
+	if(this->_fd < 0 || ioctl(this->_fd, SIOCOUTQ, &bytes) < 0){
+		return -1;
+	}
+	return bytes;
+}
+
+const struct sockaddr* Connection::getDestination(socklen_t &length)
+{
+	if(this->_cliaddr.ss_family != AF_INET && this->_cliaddr.ss_family != AF_INET6){
+		return NULL;
+	}
+	length = this->_cliaddrLength;
+	return (const struct sockaddr *)&this->_cliaddr;
+}
+
+bool Connection::enableTimestamps(void)
+{
+	this->timestamps=true;
+	this->_receiveTime=0;
+	this->applySocketOptions();
+	return (false == this->timestamps);
+}
+
+uint64_t Connection::getReceiveTime(void)
+{
+	return this->_receiveTime;
+}
+
+uint32_t Connection::getReceiveDrops(void)
+{
+	return this->_receiveDrops;
+}
+
+int Connection::tuneBuffer(int option, uint32_t bytesPerSecond, uint32_t burstBytes, uint32_t bufferMs)
+{
+	uint64_t size = (uint64_t)bytesPerSecond * bufferMs / 1000;
+	if(size < 2 * (uint64_t)burstBytes){
+		size = 2 * (uint64_t)burstBytes;
+	}
+	if(size < CONNECTION_MIN_BUFFER){
+		size = CONNECTION_MIN_BUFFER;
+	}
+	if(size > CONNECTION_MAX_BUFFER){
+		size = CONNECTION_MAX_BUFFER;
+	}
+	int current = this->getBuffer(option);
+	if(current <= 0){
+		return 0;
+	}
+	uint64_t usable = current / 2; // the kernel doubles the size set.
+	if(size <= usable && size * 4 >= usable){
+		return current;
+	}
+	if(false == this->setBuffer(option, (int)size)){
+		return 0;
+	}
+	int tuned = this->getBuffer(option);
+	if(option == SO_RCVBUF){
+		this->_receiveBuffer = (int)size;
+	}else{
+		this->_sendBuffer = (int)size;
+	}
+	fprintf(stderr, "Connection: %s buffer of FD=%d %dKB -> %dKB (%uKB/s, burst %uKB)\n", (option == SO_RCVBUF) ? "receive" : "send",
+		this->_fd, current / 1024, tuned / 1024, bytesPerSecond / 1024, burstBytes / 1024);
+	if(tuned / 2 < (int)size){
+		fprintf(stderr, "Connection: limited by net.core.%s, raise it or run as root\n", (option == SO_RCVBUF) ? "rmem_max" : "wmem_max");
+	}
+	return tuned;
+}
+
+int Connection::getBuffer(int option)
+{
+	int size = 0;
+	socklen_t len = sizeof(size);
+	if(this->_fd < 0 || getsockopt(this->_fd, SOL_SOCKET, option, &size, &len) < 0){
+		return 0;
+	}
+	return size;
+}
+
+// The FORCE options go beyond net.core.rmem_max / wmem_max, but only with CAP_NET_ADMIN.
+bool Connection::setBuffer(int option, int size)
+{
+	int force = (option == SO_RCVBUF) ? SO_RCVBUFFORCE : SO_SNDBUFFORCE;
+	if(setsockopt(this->_fd, SOL_SOCKET, force, &size, sizeof(size)) == 0){
+		return true;
+	}
+	if(setsockopt(this->_fd, SOL_SOCKET, option, &size, sizeof(size)) == 0){
+		return true;
+	}
+	int err = errno;
+	fprintf(stderr, "Connection: Unable to set the %s buffer of FD=%d ERNO:%d\n", (option == SO_RCVBUF) ? "receive" : "send", this->_fd, err);
+	return false;
+}
+
+void Connection::applySocketOptions(void)
+{
+	if(this->_fd < 0){
+		return;
+	}
+	if(this->_receiveBuffer > 0){
+		this->setBuffer(SO_RCVBUF, this->_receiveBuffer);
+	}
+	if(this->_sendBuffer > 0){
+		this->setBuffer(SO_SNDBUF, this->_sendBuffer);
+	}
+	if(false == this->timestamps){
+		return;
+	}
+	// Software stamps only, a hardware stamp is in the clock of the NIC and can't be compared to CLOCK_REALTIME.
+	int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+	if(setsockopt(this->_fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0){
+		int enable = 1;
+		if(setsockopt(this->_fd, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable)) < 0){
+			int err = errno;
+			fprintf(stderr, "Connection: Unable to enable receive timestamps on FD=%d ERNO:%d\n", this->_fd, err);
+			this->timestamps=false;
+			return;
+		}
+	}
+	int enable = 1;
+	if(setsockopt(this->_fd, SOL_SOCKET, SO_RXQ_OVFL, &enable, sizeof(enable)) < 0){
+		int err = errno;
+		fprintf(stderr, "Connection: Unable to count the receive drops on FD=%d ERNO:%d\n", this->_fd, err);
+	}
+}
+
+// The timestamp is from the software path of the NIC driver, before the package waits in the socket.
+// SO_RXQ_OVFL is only attached once the kernel has dropped something, it keeps the last count.
+int16_t Connection::readMessage(void *buffer, uint16_t maxLength, socklen_t *len)
+{
+	struct iovec iov;
+	struct msghdr message;
+	uint8_t control[CONNECTION_CONTROL_SIZE];
+	iov.iov_base = buffer;
+	iov.iov_len = maxLength;
+	bzero(&message, sizeof(message));
+	message.msg_name = &this->_cliaddr;
+	message.msg_namelen = *len;
+	message.msg_iov = &iov;
+	message.msg_iovlen = 1;
+	message.msg_control = control;
+	message.msg_controllen = sizeof(control);
+
+	ssize_t n = recvmsg(this->_fd, &message, 0);
+	if(n < 0){
+		return n; // errno is checked by readData.
+	}
+	*len = message.msg_namelen;
+	this->_receiveTime = 0;
+	for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg != NULL; cmsg = CMSG_NXTHDR(&message, cmsg)){
+		if(cmsg->cmsg_level != SOL_SOCKET){
+			continue;
+		}
+		if(cmsg->cmsg_type == SO_TIMESTAMPING){
+			struct scm_timestamping stamps;
+			memcpy(&stamps, CMSG_DATA(cmsg), sizeof(stamps));
+			this->_receiveTime = (uint64_t)stamps.ts[0].tv_sec * 1000000000ULL + stamps.ts[0].tv_nsec;
+		}else if(cmsg->cmsg_type == SO_TIMESTAMPNS){
+			struct timespec stamp;
+			memcpy(&stamp, CMSG_DATA(cmsg), sizeof(stamp));
+			this->_receiveTime = (uint64_t)stamp.tv_sec * 1000000000ULL + stamp.tv_nsec;
+		}else if(cmsg->cmsg_type == SO_RXQ_OVFL){
+			uint32_t drops;
+			memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+			this->_receiveDrops = drops;
+		}
+	}
+	return n;
+}
@@ -19,6 +19,17 @@
 #include <sys/types.h> 
 #include <unistd.h> 
 #include <fcntl.h>   
+#include <netdb.h>
+#include <stdint.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h> // SIOCOUTQ
+#include <sys/ioctl.h>
+
+#define CONNECTION_MAX_HOSTNAME 256
+#define CONNECTION_PROBE_TIMEOUT_MS 300 // IPv6 / IPv4 RTT probe, when a hostname has both.
+#define CONNECTION_MIN_BUFFER (128*1024)        // tuneBuffer() limits, the kernel default is ~208KB.
+#define CONNECTION_MAX_BUFFER (16*1024*1024)    // above net.core.rmem_max / wmem_max it needs root (SO_RCVBUFFORCE).
+#define CONNECTION_CONTROL_SIZE 256             // recvmsg() control data for the timestamp and drop counter.
 
 class Connection
 {
@@ -28,32 +39,81 @@ class Connection
 	Connection(); // need for array int.
     Connection(int port, int type); //constructor with port and type. This will run the startConnection(port, type)
 	Connection(int port, int type, int flags); 
-    Connection(const char* hostname, int port, int type, int flags); // IP for hostname and type=O_NONBLOCK or for blocking flags=0
+    Connection(const char* hostname, int port, int type, int flags); // IPv4 / IPv6 or hostname and type=O_NONBLOCK or for blocking flags=0
 	Connection(const char* hostname, int port, int type); // Default blocking.
 	//Connection(int fd, struct sockaddr_in); //constructor with file destriptor and client address (used when greated from TCP listen). 
 	
 	void startConnection(int fd);
-	void setFD_SET(fd_set* fdset);
+	void setFD_SET(fd_set* fdset); // nothing without a socket (-1 after an error until reopen()).
+	bool isFD_SET(fd_set* fdset); // false without a socket.
 	int getFD();
 	void setFD(int fd);
 	int16_t readData(void *buffer, uint16_t length);
 	int16_t writeData(void *buffer, uint16_t length);
 	int getType(void);
+	const struct sockaddr_in* getClientAddress(void); // sender of the last readData (UDP), or the receiver set at create. NULL for an IPv6 sender.
+	void setReceiver(const char* hostname, int port); // send to hostname:port before anything is received (rx_raw behind a relay).
+	int getFamily(void); // AF_INET6 (dual-stack when listening) or AF_INET.
+	int getReceiverFamily(void); // of the IP header on the way to the receiver, AF_INET for ::ffff:a.b.c.d on a dual-stack socket.
+
+	// Kernel receive time of each package (SO_TIMESTAMPING software stamp, SO_TIMESTAMPNS on older kernels) and the
+	// packages the kernel dropped because the receive buffer was full (SO_RXQ_OVFL). Kept after a reopen.
+	bool enableTimestamps(void); // returns true on error.
+	uint64_t getReceiveTime(void); // of the last readData (ns, CLOCK_REALTIME), 0 if not known.
+	uint32_t getReceiveDrops(void); // dropped by the kernel since the socket was opened (as of the last readData).
+	// Sets SO_RCVBUF or SO_SNDBUF to hold bufferMs at bytesPerSecond and at least two bursts, kept after a reopen.
+	// It grows right away but only shrinks below a quarter, returns the size now (0 on error).
+	int tuneBuffer(int option, uint32_t bytesPerSecond, uint32_t burstBytes, uint32_t bufferMs);
+	int getBuffer(int option); // SO_RCVBUF or SO_SNDBUF, what the kernel uses (twice the size set, for its bookkeeping).
+	// writeData with Don't Fragment set and the kernel path MTU ignored (IP_PMTUDISC_PROBE), for path MTU probing.
+	// Returns the bytes sent, 0 if the socket is full or -errno (-EMSGSIZE = larger than the interface MTU), the socket stays open.
+	int writeProbe(void *buffer, uint16_t length);
+	int getSendQueue(void); // bytes the kernel still holds for this socket (SIOCOUTQ, counted with its buffer overhead), -1 on error.
+	const struct sockaddr* getDestination(socklen_t &length); // where writeData sends to, NULL if not known yet.
 
 	void initConnection();
+	bool reopen(void); // close and create the socket again (used when the local IP changes), returns true if ok.
 	
 	protected:
 			
 	// Parameters only used on mother cl
 	
 	private:
-	int _fd, _port, _type, _flags;
-	struct sockaddr_in _servaddr;
-	struct sockaddr_in _cliaddr;
+	int _fd, _port, _type, _flags, _family;
+	struct sockaddr_storage _servaddr;
+	socklen_t _servaddrLength;
+	struct sockaddr_storage _cliaddr;
+	socklen_t _cliaddrLength;
+	struct sockaddr_in _cliaddr4; // _cliaddr as IPv4 for getClientAddress().
 	bool isValid = false;
+	bool hasReceiver = false; // true when created with a hostname, then we can send again right after a reopen.
+	bool followsReceiver = false; // created with a hostname, the socket is of the family of the receiver.
+
+	// The receiver by name, resolved again if it failed (no DNS before the modem is up). A reopen keeps the candidate
+	// in use, the probe would block the caller (recovering all its sockets) for up to CONNECTION_PROBE_TIMEOUT_MS each.
+	char _hostname[CONNECTION_MAX_HOSTNAME];
+	int _receiverPort;
+	struct sockaddr_storage _candidates[2]; // the first address of each family, in getaddrinfo() order.
+	socklen_t _candidateLengths[2];
+	int _candidateCount;
+	int _selected; // candidate in use, -1 = not chosen yet.
+
+	bool timestamps = false; // enableTimestamps(), readData uses recvmsg().
+	uint64_t _receiveTime;
+	uint32_t _receiveDrops;
+	int _receiveBuffer; // set by tuneBuffer(), 0 = kernel default.
+	int _sendBuffer;
 	
-	void print_ipv4(struct sockaddr *s);
+	void print_address(struct sockaddr *s);
 	void clearAll(void);
+	int openSocket(int type); // of _family, listening sockets are dual-stack.
+	bool resolve(void); // hostname -> candidates, returns true if ok.
+	int probeCandidates(void); // returns the candidate answering first.
+	bool setDestination(int candidate); // returns true if ok.
+	bool selectReceiver(bool probe); // resolve (if not done) and choose a candidate (once), returns true if ok.
+	void applySocketOptions(void); // timestamps and buffer sizes, again after a reopen.
+	bool setBuffer(int option, int size); // returns true if ok.
+	int16_t readMessage(void *buffer, uint16_t maxLength, socklen_t *len); // recvmsg() with timestamp and drop counter.
 };
 
 
@@ -6,8 +6,7 @@
 #include "h264.h" 
 
 H264::H264(){
-	// clear all memmory:
-	bzero(&this->InputBuffer, sizeof(this->InputBuffer));
+	// the buffers are cleared by their constructor, no bzero() over the objects (it would wipe the vtable pointer).
 	this->currentBuffer=&this->InputBuffer[0]; // start with index 0
 }
 
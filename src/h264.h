@@ -14,8 +14,6 @@
 #include <queue>
 #include "h264UDPPackage.h"
 
-#define UDP_PACKET_SIZE 1400
-#define UDP_PAYLOAD_SIZE UDP_PACKET_SIZE-4
 #define MAX_PACKAGEID 65535
 #define MAX_FRAMEID 65535
 #define INPUT_BUFFER_SIZE 16384 // total RAM size = UDP_PACKET_LENGTH * FRAME_BUFFER_SIZE = 1024 * 8192 = 8MB
@@ -22,9 +22,15 @@ uint16_t H264RXFraming::getPackageMaxSize(void){ // returns maximum data size.
 
 
 bool H264RXFraming::setData(uint16_t length){
+	return this->setData(length, 0);
+}
+
+
+bool H264RXFraming::setData(uint16_t length, uint64_t receiveTime){
 
 	// finish the current input buffer:
 	this->currentBuffer->setData(length);
+	this->currentBuffer->setReceiveTime(receiveTime);
 	
 	// Service the last data -> this->inputRXPackage.
 	this->serviceRXPackage();
@@ -45,14 +51,34 @@ uint32_t H264RXFraming::getOutputStreamFIFOSize(void){
 }
 
 
+uint32_t H264RXFraming::getWaitingPackages(void){
+	return (uint32_t)this->inputData.size();
+}
+
+
+uint32_t H264RXFraming::getFramePackages(void){
+	return (uint32_t)this->tempOutputFrame.size();
+}
+
+
 void H264RXFraming::writeAllOutputStreamTo(int fd){
 	bool moreData=false;
 	uint32_t numberOfBytes=0;
+	this->outputReceiveTime=0;
 	do{
 		if(this->outputPackages.size() > 0){		
-			write(fd, this->outputPackages.front()->getPayload(), this->outputPackages.front()->getPayloadSize());	
-			this->addBytesOutputted(this->outputPackages.front()->getPayloadSize());
-			this->outputPackages.front()->clear();
+			H264UDPPackage *package = this->outputPackages.front();
+			uint64_t receiveTime = package->getReceiveTime();
+			if(receiveTime != 0 && (this->outputReceiveTime == 0 || receiveTime < this->outputReceiveTime)){
+				this->outputReceiveTime = receiveTime; // the frame waited for a late or reordered package since then.
+			}
+			package->retain(); // the output FIFO's reference, the tap takes its own to keep the package.
+			write(fd, package->getPayload(), package->getPayloadSize());	
+			if(this->outputTap != NULL){
+				this->outputTap(this->outputTapContext, package);
+			}
+			this->addBytesOutputted(package->getPayloadSize());
+			package->release(); // back in the pool unless the tap kept it.
 			this->outputPackages.pop();
 			moreData=true;
 		}else{
@@ -62,11 +88,58 @@ void H264RXFraming::writeAllOutputStreamTo(int fd){
 }
 
 
+void H264RXFraming::setOutputTap(H264OutputTap_t tap, void *context){
+	this->outputTap = tap;
+	this->outputTapContext = context;
+}
+
+
+uint64_t H264RXFraming::getOutputReceiveTime(void){
+	return this->outputReceiveTime;
+}
+
+uint32_t H264RXFraming::getPackagesReceived(void){
+	return this->packagesReceived;
+}
+
+
+uint32_t H264RXFraming::getPackagesLost(void){
+	return this->packagesLost;
+}
+
+
+uint32_t H264RXFraming::getPackagesReordered(void){
+	return this->packagesReordered;
+}
+
+
+uint32_t H264RXFraming::getPackagesLate(void){
+	return this->packagesLate;
+}
+
+
+uint32_t H264RXFraming::getResyncs(void){
+	return this->resyncs;
+}
+
+
+uint32_t H264RXFraming::getFramesDelivered(void){
+	return this->framesDelivered;
+}
+
+
+uint32_t H264RXFraming::getFramesDropped(void){
+	return this->framesDropped;
+}
+
+
 //////////////////////////////////////////////////////////////////////////////
 ////////////////////////// Private Helper functions //////////////////////////
 //////////////////////////////////////////////////////////////////////////////
 
 bool H264RXFraming::serviceRXPackage(void){
+	this->updateLinkCounters(this->currentBuffer);
+
 //	fprintf(stderr, "H264_RX: Input Package with FrameID(%u) and PackageID(%u) and size (%u) received. InputBuffer size(%u), tempOutput size(%u), OutputFIFO size(%u)... ",this->currentBuffer->getFrameID(), this->currentBuffer->getPackageID(), this->currentBuffer->getSize(),this->inputData.size(), this->tempOutputFrame.size(), this->outputPackages.size());	
 
 	// Is this the next package we are expecting?
@@ -88,6 +161,13 @@ bool H264RXFraming::serviceRXPackage(void){
 		// If this frame has a keyframe start header, then we should resync to this:	
 		if(this->currentBuffer->isNewKeyFrame()){
 			// fprintf(stderr, "H264_RX: We are Stuck! - but new frame is keyframe with pacakgeID (%u) so lets sync on this. Input Data buffer size(%u) and TempOutputframe size(%u)\n",this->currentBuffer->getPackageID(), this->inputData.size(), this->tempOutputFrame.size());	
+			this->resyncs++;
+			if(this->frameDelivered){ // every frame since the last one delivered is lost, also the one in tempOutputFrame.
+				int32_t gap = frameDistance(this->lastFrameDelivered, this->currentBuffer->getFrameID()) - 1;
+				if(gap > 0){
+					this->framesDropped += gap;
+				}
+			}
 			this->clearOutputFrame();
 			this->clearInputDataWithPackagesOlderThan(this->currentBuffer);
 			this->buildOutputFrame(this->currentBuffer); //add data to tempOutputFrame.
@@ -132,6 +212,7 @@ void H264RXFraming::checkInputBufferForMoreData(void){
 	bool dataFound = false;
 	uint32_t size = 0;
 	do{
+		dataFound=false;
 		size = this->inputData.size();
 		if(size > 0){
 	//		fprintf(stderr, "H264_RX: Input Data buffer has (%u) elements, searching if they can be used...",size);	
@@ -140,7 +221,8 @@ void H264RXFraming::checkInputBufferForMoreData(void){
 	//				fprintf(stderr, "OK(%u)\n",element);					
 					this->buildOutputFrame(this->inputData[element]); // add the data from inputbuffer to output buffer.					
 					this->inputData.erase(this->inputData.begin() + element); // erease data.
-					dataFound=true; // will must search again.
+					dataFound=true; // will must search again, the vector has changed.
+					break;
 				}					
 			}
 		}
@@ -173,6 +255,11 @@ void H264RXFraming::clearOutputFrame(void){
 void H264RXFraming::finishOutputFrame(void){
 	uint32_t size = this->tempOutputFrame.size();
 //	fprintf(stderr, "H264_RX: Temp Output Frame with (%u) packages is complete, moving it to output FIFO\n",size);					
+	if(size > 0){
+		this->framesDelivered++;
+		this->frameDelivered=true;
+		this->lastFrameDelivered = this->tempOutputFrame.back()->getFrameID();
+	}
 	for(uint32_t i=0;i<size;i++){
 		this->outputPackages.push(this->tempOutputFrame.front());
 		this->tempOutputFrame.pop();
@@ -194,3 +281,46 @@ bool H264RXFraming::isNextPackage(H264UDPPackage *package){
 	return false;
 }
 
+
+// Gaps in the package sequence are counted as lost when they are seen, a package filling a gap later takes it back
+// and is either reordered (still used) or late (the output has moved past it).
+void H264RXFraming::updateLinkCounters(H264UDPPackage *package){
+	uint16_t packageID = package->getPackageID();
+	this->packagesReceived++;
+	if(false == this->sequenceStarted){
+		this->sequenceStarted = true;
+		this->highestPackageID = packageID;
+		return;
+	}
+	int32_t distance = packageDistance(this->highestPackageID, packageID);
+	if(distance > 0){
+		this->packagesLost += distance - 1;
+		this->highestPackageID = packageID;
+	}else if(distance < 0){
+		if(this->packagesLost > 0){
+			this->packagesLost--;
+		}
+		if(packageDistance(this->PackageID, packageID) > 0){
+			this->packagesReordered++;
+		}else{
+			this->packagesLate++;
+		}
+	}
+}
+
+
+int32_t H264RXFraming::packageDistance(uint16_t from, uint16_t to){
+	int32_t distance = ((int32_t)to - (int32_t)from + MAX_PACKAGEID) % MAX_PACKAGEID; // package IDs run 0..MAX_PACKAGEID-1.
+	if(distance > MAX_PACKAGEID/2){
+		distance -= MAX_PACKAGEID;
+	}
+	return distance;
+}
+
+int32_t H264RXFraming::frameDistance(uint16_t from, uint16_t to){
+	int32_t distance = ((int32_t)to - (int32_t)from + (MAX_FRAMEID-1)) % (MAX_FRAMEID-1); // frame IDs run 1..MAX_FRAMEID-1.
+	if(distance > (MAX_FRAMEID-1)/2){
+		distance -= (MAX_FRAMEID-1);
+	}
+	return distance;
+}
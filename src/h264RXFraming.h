@@ -11,6 +11,8 @@
 #include <unistd.h> // for write
 #include "h264.h"
 
+typedef void (*H264OutputTap_t)(void *context, H264UDPPackage *package); // retain() the package to keep it after the call.
+
 class H264RXFraming : public H264
 {
 	// Public functions
@@ -21,8 +23,22 @@ class H264RXFraming : public H264
 	uint8_t * getInputBuffer(void); // returns pointer to the an available input buffer.
 	uint16_t getPackageMaxSize(void); // returns maximum data size.
 	bool setData(uint16_t size); // this is used after data is inputted directly via getInputBuffer pointer with maxSize.
+	bool setData(uint16_t size, uint64_t receiveTime); // the same, with the arrival time of the package (us).
 	uint32_t getOutputStreamFIFOSize(void); // returns the number of packages ready in output FIFO
+	uint32_t getWaitingPackages(void); // packages received out of order, waiting for the missing ones.
+	uint32_t getFramePackages(void);   // packages of the frame being built.
 	void writeAllOutputStreamTo(int fd);
+	void setOutputTap(H264OutputTap_t tap, void *context); // also gets the packages writeAllOutputStreamTo writes (whole frames), NULL = none.
+	uint64_t getOutputReceiveTime(void); // arrival of the oldest package the last writeAllOutputStreamTo wrote, 0 if none (or not known).
+
+	// Link counters since start (like wifibroadcast, QOpenHD shows the totals):
+	uint32_t getPackagesReceived(void);
+	uint32_t getPackagesLost(void);      // gaps in the package sequence, minus the ones which came later.
+	uint32_t getPackagesReordered(void); // came out of order but in time to be used.
+	uint32_t getPackagesLate(void);      // came after the output had moved past it, not used.
+	uint32_t getResyncs(void);           // times the output was restarted on a keyframe.
+	uint32_t getFramesDelivered(void);
+	uint32_t getFramesDropped(void);     // frames not delivered because a package was missing.
 	
 	private:
 	bool serviceRXPackage(void);
@@ -35,6 +51,24 @@ class H264RXFraming : public H264
 	void clearOutputFrame(void);
 	void finishOutputFrame(void);
 	void clearInputDataWithPackagesOlderThan(H264UDPPackage *input);
+	void updateLinkCounters(H264UDPPackage *package);
+	static int32_t packageDistance(uint16_t from, uint16_t to); // >0 if to is after from, <0 if before.
+	static int32_t frameDistance(uint16_t from, uint16_t to);   // the same for FrameIDs, they wrap 65534 -> 1.
+
+	bool sequenceStarted=false;
+	uint16_t highestPackageID=0; // newest package seen on the link.
+	bool frameDelivered=false;
+	uint16_t lastFrameDelivered=0;
+	uint32_t packagesReceived=0;
+	uint32_t packagesLost=0;
+	uint32_t packagesReordered=0;
+	uint32_t packagesLate=0;
+	uint32_t resyncs=0;
+	uint32_t framesDelivered=0;
+	uint32_t framesDropped=0;
+	H264OutputTap_t outputTap=NULL;
+	void *outputTapContext=NULL;
+	uint64_t outputReceiveTime=0;
 };
 
 #endif /* H264RXFRAMING_H_ */
\ No newline at end of file
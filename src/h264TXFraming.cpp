@@ -4,10 +4,27 @@
 	Not for commercial use
  */ 
 #include "h264TXFraming.h" 
+#include <chrono>
+
+static uint64_t timeMillisec(void){
+	using namespace std::chrono;
+	return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
 
 
 H264TXFraming::H264TXFraming(){
+	this->currentBuffer->setPackageMaxSize(this->packageMaxSize);
+}
 
+void H264TXFraming::setPackageMaxSize(uint16_t size){
+	this->packageMaxSize = size;
+	if(this->currentBuffer->getPayloadSize() == 0){ // a package being filled keeps its size.
+		this->currentBuffer->setPackageMaxSize(size);
+	}
+}
+
+uint16_t H264TXFraming::getPackageMaxSize(void){
+	return this->packageMaxSize;
 }
  
 // input data with pointer to array and length of bytes to copy.
@@ -81,6 +98,7 @@ void H264TXFraming::inputStream(uint8_t *data, uint32_t length){
 				if(data[index] == 0x21){ // I frame:
 //					fprintf(stderr, "H264_TX: I-Frame Header found.\n");
 					this->startNewPackage(false); // split on I-frame.
+					this->keyFrameData=false;
 					this->addData(0x00);
 					this->addData(0x00);
 					this->addData(0x00);
@@ -90,6 +108,7 @@ void H264TXFraming::inputStream(uint8_t *data, uint32_t length){
 				}else if(data[index] == 0x25){ // Keyframe
 			//		fprintf(stderr, "H264_TX: Keyframe found in input stream, placed at (%u).\n", this->FifoState.InputPackageID);
 					this->startNewPackage(true); // split on keyframe.
+					this->keyFrameData=true;
 					this->savingStream=true;
 					this->addData(0x00);
 					this->addData(0x00);
@@ -190,6 +209,8 @@ void H264TXFraming::startNewPackage(bool keyframe){
 	}
 	this->currentBuffer->setFrameID(this->FrameID);
 	this->currentBuffer->setPackageID(this->PackageID);
+	this->currentBuffer->setKeyFrameData(this->keyFrameData); // type of the data in the package, the new header goes in the next.
+	this->currentBuffer->setQueuedTime(timeMillisec());
 
 /*	
 	fprintf(stderr, "H264_TX: TX Package complete - FrameID(%u) PackageID(%u) and size (%u) - is Keyframe(%u) : ",this->currentBuffer->getFrameID(),this->currentBuffer->getPackageID(),this->currentBuffer->getSize(),this->currentBuffer->isNewKeyFrame() );	
@@ -209,6 +230,7 @@ void H264TXFraming::startNewPackage(bool keyframe){
 		fprintf(stderr, "H264_TX: Error - Input buffer full\n");	
 			// clear all input and resync on next keyframe?
 	}
+	this->currentBuffer->setPackageMaxSize(this->packageMaxSize);
 }
 
 void H264TXFraming::trimOutputFIFO(void){
@@ -262,4 +284,22 @@ void H264TXFraming::nextTXPackage(void){
 
 //		fprintf(stderr, "After Size(%u)\n", this->outputPackages.size());
 	}
-}
\ No newline at end of file
+}
+
+bool H264TXFraming::isTXPackageKeyFrame(void){
+	if(this->outputPackages.empty()){
+		return false;
+	}
+	return this->outputPackages.front()->isKeyFrameData();
+}
+
+uint64_t H264TXFraming::getTXPackageQueuedTime(void){
+	if(this->outputPackages.empty()){
+		return 0;
+	}
+	return this->outputPackages.front()->getQueuedTime();
+}
+
+uint32_t H264TXFraming::getTXFifoSize(void){
+	return (uint32_t)this->outputPackages.size();
+}
@@ -20,6 +20,11 @@ class H264TXFraming : public H264
 	void inputStream(uint8_t *data, uint32_t maxlength); // input data with pointer to array and length of bytes to copy.	
 	uint16_t getTXPackage(uint8_t * &data); // Sets the pointer to the data array and returnt number of bytes in package.
 	void nextTXPackage(void); // Informs H264 that package was transmitted so it can move to next package.
+	bool isTXPackageKeyFrame(void); // the package from getTXPackage() holds IDR frame data.
+	uint64_t getTXPackageQueuedTime(void); // when the package from getTXPackage() was ready (ms, steady clock).
+	uint32_t getTXFifoSize(void); // returns the number of packages ready for TX.
+	void setPackageMaxSize(uint16_t size); // UDP package size (header included) from the next package on, default UDP_PACKET_SIZE.
+	uint16_t getPackageMaxSize(void);
 	
 	//uint16_t getStartHeader(uint8_t *data, uint32_t maxlength); // copy start header to data and returns number of bytes copied.
 	// getStatus...
@@ -34,6 +39,8 @@ class H264TXFraming : public H264
 	};
 	H264Header startHeader;
 	bool savingStream=false;
+	bool keyFrameData=false; // the data being packed is from an IDR frame (0x25).
+	uint16_t packageMaxSize=UDP_PACKET_SIZE;
 			
 	enum FrameState_t{
 	  LOOK_FOR_HEADER_00=0,		
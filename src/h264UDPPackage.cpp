@@ -7,6 +7,7 @@
 
 
 H264UDPPackage::H264UDPPackage(){
+	this->capacity=UDP_MAX_PACKET_SIZE; // RX takes any size, TX sets its package size.
 	// clear all memmory:
 	this->clear();
 }
@@ -16,12 +17,16 @@ void H264UDPPackage::clear(void){ // clear all data.
 	this->index=0;
 	this->FrameID=0;            
     this->PackageID=0; 				    
+    this->keyFrameData=false;
+    this->queuedTime=0;
+    this->receiveTime=0;
+    this->references=0;
     bzero(&this->data, sizeof(this->data));
 }
 
 
 bool H264UDPPackage::isFree(void){ 
-	if( (this->index==0) && (this->FrameID==0) && (this->PackageID==0) ){
+	if( (this->index==0) && (this->FrameID==0) && (this->PackageID==0) && (this->references==0) ){
 		return true; // data is free.
 	}else{
 		return false; // not free.
@@ -29,7 +34,7 @@ bool H264UDPPackage::isFree(void){
 }
 
 bool H264UDPPackage::isFull(void){ // clear all data.
-	if(this->index < UDP_DATA_SIZE){
+	if(this->index < this->capacity-UDP_HEADER){
 		return false;
 	}	
 	return true;
@@ -44,7 +49,7 @@ bool H264UDPPackage::setData(uint16_t length){
 
 // input data with pointer to array and length of bytes to copy.
 bool H264UDPPackage::setData(void *input, uint16_t length){ // return true if error.
-	if(length > UDP_PACKET_SIZE){  // too large
+	if(length > UDP_MAX_PACKET_SIZE){  // too large
 		return true;
 	}
 	
@@ -62,7 +67,7 @@ bool H264UDPPackage::addData(uint8_t data){ // return true when full.
 	}else{
 		this->data[this->index+UDP_HEADER]=data;
 		this->index++;
-		if(this->index >= UDP_DATA_SIZE){ //Data is now full
+		if(this->index >= this->capacity-UDP_HEADER){ //Data is now full
 			return true;
 		}
 	}
@@ -98,7 +103,16 @@ uint16_t H264UDPPackage::getPayloadSize(void){ // returns the size of the data.
 }
 
 uint16_t H264UDPPackage::getPackageMaxSize(void){
-	return UDP_PACKET_SIZE;
+	return this->capacity;
+}
+
+void H264UDPPackage::setPackageMaxSize(uint16_t size){
+	if(size < UDP_MIN_PACKET_SIZE){
+		size = UDP_MIN_PACKET_SIZE;
+	}else if(size > UDP_MAX_PACKET_SIZE){
+		size = UDP_MAX_PACKET_SIZE;
+	}
+	this->capacity = size;
 }
 
 uint16_t H264UDPPackage::getPackageID(void){
@@ -145,3 +159,40 @@ bool H264UDPPackage::isNewerThan(uint16_t FrameID, uint16_t PackageID){
 	}	
 	return false;
 }
+
+void H264UDPPackage::setKeyFrameData(bool keyFrame){
+	this->keyFrameData = keyFrame;
+}
+
+bool H264UDPPackage::isKeyFrameData(void){
+	return this->keyFrameData;
+}
+
+void H264UDPPackage::setQueuedTime(uint64_t timeMs){
+	this->queuedTime = timeMs;
+}
+
+uint64_t H264UDPPackage::getQueuedTime(void){
+	return this->queuedTime;
+}
+
+void H264UDPPackage::setReceiveTime(uint64_t timeUs){
+	this->receiveTime = timeUs;
+}
+
+uint64_t H264UDPPackage::getReceiveTime(void){
+	return this->receiveTime;
+}
+
+void H264UDPPackage::retain(void){
+	this->references++;
+}
+
+void H264UDPPackage::release(void){
+	if(this->references > 0){
+		this->references--;
+	}
+	if(this->references == 0){
+		this->clear();
+	}
+}
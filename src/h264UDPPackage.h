@@ -13,9 +13,11 @@
 #include <strings.h> // bzero
 #include <cstring> // memcpy
 
-#define UDP_PACKET_SIZE 1400 // MAX MTU size for ethernet is ~1456, so keep below this for none framing.
+#define UDP_PACKET_SIZE 1400 // MAX MTU size for ethernet is ~1456, so keep below this for none framing (default, tx_raw -u probes the path).
+#define UDP_MIN_PACKET_SIZE 508  // 576 (smallest IPv4 MTU every host takes) - 60 (IP header with options) - 8 (UDP).
+#define UDP_MAX_PACKET_SIZE 1472 // 1500 (ethernet MTU) - 20 (IPv4) - 8 (UDP), the largest a package can be.
+#define UDP_MAX_PACKET_SIZE_IPV6 1452 // 1500 (ethernet MTU) - 40 (IPv6) - 8 (UDP).
 #define UDP_HEADER 4
-#define UDP_DATA_SIZE UDP_PACKET_SIZE-UDP_HEADER
 
 class H264UDPPackage
 {
@@ -43,6 +45,7 @@ class H264UDPPackage
 	uint16_t getPackageSize(void); // returns the size of the data.
 	
 	uint16_t getPackageMaxSize(void); // returns the maxsize for the package.
+	void setPackageMaxSize(uint16_t size); // package size (header included) where it is full, UDP_MIN_PACKET_SIZE - UDP_MAX_PACKET_SIZE.
 	
 	uint16_t getFrameID(void);
 	uint16_t getPackageID(void);
@@ -51,12 +54,31 @@ class H264UDPPackage
 	void setPackageID(uint16_t packageID);
 	
 	bool isNewerThan(uint16_t FrameID, uint16_t PackageID); // compare it self to frameID and PackageID input, and return true if package is newer than input.
+
+	// Used for TX scheduling:
+	void setKeyFrameData(bool keyFrame); // package holds data of an IDR frame.
+	bool isKeyFrameData(void);
+	void setQueuedTime(uint64_t timeMs); // when the package was put in the output FIFO.
+	uint64_t getQueuedTime(void);
+
+	// Used for RX timing:
+	void setReceiveTime(uint64_t timeUs); // when the package arrived (kernel timestamp with rx_raw -T), 0 = not known.
+	uint64_t getReceiveTime(void);
+
+	// Used for RX output, the package stays out of the pool while someone holds a reference:
+	void retain(void);
+	void release(void); // cleared (free) when the last reference is released.
 		
 	private:
 	uint16_t index;
 	uint16_t FrameID;            
     uint16_t PackageID; 				    
-    uint8_t data[UDP_PACKET_SIZE]; 
+    bool keyFrameData;
+    uint64_t queuedTime;
+    uint64_t receiveTime;
+    uint16_t references;
+    uint16_t capacity;           // full at this size, not changed by clear().
+    uint8_t data[UDP_MAX_PACKET_SIZE]; 
 };
 
 #endif /* H264UDPPAGE_H_ */
\ No newline at end of file
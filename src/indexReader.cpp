@@ -0,0 +1,138 @@
+/*
+	indexReader.cpp
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+
+// Reads the .idx sidecar tx_raw / videoRecord write next to a recording, post-flight:
+// - all keyframes and positions, with the armed state, as one JSON object per line (time order).
+// - with -t the keyframe to seek to for that time in the recording, and the position at it (geotag).
+// Times are seconds since the recording started, "utc" is the wall clock in seconds since 1970.
+
+#include "recordIndex.h"
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int flagHelp = 0;
+
+void usage(void) {
+	printf("\nUsage: indexReader [options]\n"
+	"\n"
+	"Options:\n"
+	"-f  <file>     Index file (.idx) next to the recording.\n"
+	"-t  <seconds>  Keyframe to seek to and position at this time in the recording, instead of all records.\n"
+	"-k             Only the keyframes.\n"
+	"\n"
+	"Example:\n"
+	"  ./indexReader -f 01-06-2021_12-00-00_demo.idx\n"
+	"  ./indexReader -f record1.idx -t 95.5\n"
+	"\n");
+	exit(1);
+}
+
+void printKeyFrame(const RecordIndexHeader_t *header, const RecordIndexRecord_t *record){
+	printf("{\"type\":\"keyframe\",\"time\":%.3f,\"utc\":%.3f,\"frame\":%u,\"offset\":%llu,\"mediaTime\":%.3f,\"armed\":%u}\n",
+		record->timeUs/1000000.0, (header->startRealtimeUs + record->timeUs)/1000000.0, record->frame,
+		(unsigned long long)record->data.keyFrame.offset, record->data.keyFrame.mediaTimeUs/1000000.0, record->armed);
+}
+
+void printPosition(const RecordIndexHeader_t *header, const RecordIndexRecord_t *record){
+	printf("{\"type\":\"position\",\"time\":%.3f,\"utc\":%.3f,\"lat\":%.7f,\"lon\":%.7f,\"alt\":%.3f,\"relativeAlt\":%.3f",
+		record->timeUs/1000000.0, (header->startRealtimeUs + record->timeUs)/1000000.0, record->data.position.lat/10000000.0,
+		record->data.position.lon/10000000.0, record->data.position.alt/1000.0, record->data.position.relativeAlt/1000.0);
+	if(record->heading != UINT16_MAX){
+		printf(",\"heading\":%.2f", record->heading/100.0);
+	}
+	printf(",\"armed\":%u}\n", record->armed);
+}
+
+int main(int argc, char *argv[])
+{
+	char *filename=NULL;
+	double seekTime=-1;
+	bool keyFramesOnly=false;
+
+	while (1) {
+		int nOptionIndex;
+		static const struct option optiona[] = {
+			{ "help", no_argument, &flagHelp, 1 },
+			{      0,           0,         0, 0 }
+		};
+		int c = getopt_long(argc, argv, "h:f:t:k", optiona, &nOptionIndex);
+		if (c == -1) {
+			break;
+		}
+
+		switch (c) {
+			case 0: {
+				// long option
+				break;
+			}
+			case 'f': {
+				filename = optarg;
+				break;
+			}
+			case 't': {
+				seekTime = atof(optarg);
+				break;
+			}
+			case 'k': {
+				keyFramesOnly = true;
+				break;
+			}
+			default: {
+				usage();
+				break;
+			}
+		}
+	}
+	if(filename == NULL){
+		usage();
+	}
+
+	static RecordIndex index;
+	if(index.open(filename)){
+		exit(EXIT_FAILURE);
+	}
+	const RecordIndexHeader_t *header = index.getHeader();
+
+	if(seekTime >= 0){
+		uint64_t timeUs = (uint64_t)(seekTime*1000000);
+		const RecordIndexRecord_t *keyFrame = index.findKeyFrame(timeUs);
+		if(keyFrame == NULL){
+			keyFrame = index.getKeyFrame(0); // before the first keyframe, the recording starts with one.
+		}
+		if(keyFrame == NULL){
+			fprintf(stderr, "indexReader: %s has no keyframes\n", filename);
+			exit(EXIT_FAILURE);
+		}
+		printKeyFrame(header, keyFrame);
+		const RecordIndexRecord_t *position = index.findPosition(timeUs);
+		if(position != NULL){
+			printPosition(header, position);
+		}
+		printf("{\"type\":\"armed\",\"time\":%.3f,\"armed\":%u}\n", seekTime, index.isArmed(timeUs) ? 1 : 0);
+		return 0;
+	}
+
+	// Merge the keyframes and positions in time order.
+	uint32_t k=0, p=0;
+	while(k < index.getKeyFrameCount() || (!keyFramesOnly && p < index.getPositionCount())){
+		const RecordIndexRecord_t *keyFrame = index.getKeyFrame(k);
+		const RecordIndexRecord_t *position = keyFramesOnly ? NULL : index.getPosition(p);
+		if(keyFrame != NULL && (position == NULL || keyFrame->timeUs <= position->timeUs)){
+			printKeyFrame(header, keyFrame);
+			k++;
+		}else{
+			printPosition(header, position);
+			p++;
+		}
+	}
+	fprintf(stderr, "indexReader: %u keyframes, %u positions, %s recording\n", index.getKeyFrameCount(), index.getPositionCount(),
+		(header->format == RECORD_INDEX_MP4) ? "MP4" : "H.264");
+	return 0;
+}
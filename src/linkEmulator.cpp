@@ -0,0 +1,250 @@
+/*
+	linkEmulator.cpp
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+#include "linkEmulator.h"
+
+LinkEmulator::LinkEmulator(){
+	bzero(&this->condition, sizeof(this->condition));
+	bzero(&this->counts, sizeof(this->counts));
+	this->setSeed(1);
+	this->startUs=0;
+	this->traceIndex=0;
+	this->queueLimitMs=0;
+	this->reorder=0;
+	this->reorderDelayMs=0;
+	this->goodToBad=0;
+	this->badToGood=1;
+	this->lossGood=0;
+	this->lossBad=0;
+	this->badState=false;
+	this->outageIntervalMs=0;
+	this->outageDurationMs=0;
+	this->outageHold=false;
+	this->linkFreeUs=0;
+	this->lastDeliverUs=0;
+	this->reordered=0;
+	this->badStateCount=0;
+}
+
+LinkEmulator::~LinkEmulator(){
+}
+
+void LinkEmulator::setSeed(uint32_t seed){
+	this->random = (seed == 0) ? 1 : seed; // xorshift never leaves 0.
+}
+
+void LinkEmulator::setRate(uint32_t kbitPerSec){
+	this->condition.rateKbit = kbitPerSec;
+}
+
+void LinkEmulator::setQueueLimit(uint32_t ms){
+	this->queueLimitMs = ms;
+}
+
+void LinkEmulator::setDelay(uint32_t delayMs, uint32_t jitterMs){
+	this->condition.delayMs = delayMs;
+	this->condition.jitterMs = jitterMs;
+}
+
+void LinkEmulator::setReorder(double probability, uint32_t extraDelayMs){
+	this->reorder = probability;
+	this->reorderDelayMs = extraDelayMs;
+}
+
+void LinkEmulator::setLoss(double probability){
+	this->condition.loss = probability;
+}
+
+void LinkEmulator::setGilbertElliott(double goodToBad, double badToGood, double lossGood, double lossBad){
+	this->goodToBad = goodToBad;
+	this->badToGood = badToGood;
+	this->lossGood = lossGood;
+	this->lossBad = lossBad;
+}
+
+void LinkEmulator::setOutages(uint32_t intervalMs, uint32_t durationMs, bool hold){
+	this->outageIntervalMs = intervalMs;
+	this->outageDurationMs = durationMs;
+	this->outageHold = hold;
+}
+
+bool LinkEmulator::loadTraceFile(const char *filename){
+	FILE *fp = fopen(filename, "r");
+	if(fp == NULL){
+		fprintf(stderr, "LinkEmulator: Unable to open trace file %s\n", filename);
+		return true;
+	}
+
+	char line[128];
+	uint32_t lineNumber=0;
+	bool error=false;
+	this->trace.clear();
+	while(fgets(line, sizeof(line), fp) != NULL){
+		lineNumber++;
+		unsigned long long timeMs=0;
+		unsigned int rate=0;
+		unsigned int delay=0;
+		unsigned int jitter=0;
+		double loss=0;
+
+		char *comment = strchr(line, '#');
+		if(comment != NULL){
+			*comment=0;
+		}
+
+		int fields = sscanf(line, "%llu %u %u %u %lf", &timeMs, &rate, &delay, &jitter, &loss);
+		if(fields <= 0){
+			continue; // empty line.
+		}
+		if(fields < 5 || loss < 0 || loss > 100 || (this->trace.size() > 0 && timeMs < this->trace.back().timeMs)){
+			fprintf(stderr, "LinkEmulator: %s line %u - expected <time ms> <kbit/s> <delay ms> <jitter ms> <loss %%> with increasing time\n", filename, lineNumber);
+			error=true;
+			continue;
+		}
+		LinkCondition_t condition;
+		condition.timeMs = timeMs;
+		condition.rateKbit = rate;
+		condition.delayMs = delay;
+		condition.jitterMs = jitter;
+		condition.loss = loss / 100.0;
+		this->trace.push_back(condition);
+	}
+	fclose(fp);
+	if(this->trace.size() == 0){
+		fprintf(stderr, "LinkEmulator: %s has no conditions\n", filename);
+		error=true;
+	}
+	this->traceIndex=0;
+	return error;
+}
+
+LinkFate_t LinkEmulator::submit(uint64_t nowUs, uint16_t size, uint64_t &deliverUs){
+	if(this->startUs == 0){
+		this->startUs = nowUs;
+	}
+	this->updateCondition((nowUs - this->startUs) / 1000);
+
+	uint64_t outageEndUs = this->getOutageEnd(nowUs);
+	if(outageEndUs > 0 && false == this->outageHold){
+		this->counts[LINK_OUTAGE]++;
+		return LINK_OUTAGE;
+	}
+
+	// Radio loss, the Gilbert-Elliott state moves once per package.
+	if(this->goodToBad > 0){
+		if(this->badState){
+			this->badState = (this->nextRandom() >= this->badToGood);
+		}else{
+			this->badState = (this->nextRandom() < this->goodToBad);
+		}
+		if(this->badState){
+			this->badStateCount++;
+		}
+		if(this->nextRandom() < (this->badState ? this->lossBad : this->lossGood)){
+			this->counts[LINK_LOST]++;
+			return LINK_LOST;
+		}
+	}
+	if(this->condition.loss > 0 && this->nextRandom() < this->condition.loss){
+		this->counts[LINK_LOST]++;
+		return LINK_LOST;
+	}
+
+	// Bottleneck, the package waits for the ones before it. An outage in hold mode stops the link until it ends.
+	uint64_t startUs = (this->linkFreeUs > nowUs) ? this->linkFreeUs : nowUs;
+	if(this->queueLimitMs > 0 && startUs - nowUs > (uint64_t)this->queueLimitMs*1000){
+		this->counts[LINK_QUEUE_DROP]++;
+		return LINK_QUEUE_DROP;
+	}
+	if(outageEndUs > startUs){
+		startUs = outageEndUs;
+	}
+	if(this->condition.rateKbit > 0){
+		startUs += (uint64_t)size*8*1000 / this->condition.rateKbit;
+	}
+	this->linkFreeUs = startUs;
+
+	deliverUs = startUs + (uint64_t)this->condition.delayMs*1000;
+	if(this->condition.jitterMs > 0){
+		deliverUs += (uint64_t)(this->nextRandom() * this->condition.jitterMs * 1000);
+	}
+	if(this->reorder > 0 && this->nextRandom() < this->reorder){
+		deliverUs += (uint64_t)this->reorderDelayMs*1000; // overtaken by the next ones, does not hold them back.
+		this->reordered++;
+	}else{
+		if(deliverUs < this->lastDeliverUs){
+			deliverUs = this->lastDeliverUs;
+		}
+		this->lastDeliverUs = deliverUs;
+	}
+	this->counts[LINK_DELIVERED]++;
+	return LINK_DELIVERED;
+}
+
+bool LinkEmulator::isInOutage(uint64_t nowUs){
+	return (this->startUs > 0 && this->getOutageEnd(nowUs) > 0);
+}
+
+uint32_t LinkEmulator::getCount(LinkFate_t fate){
+	return this->counts[fate];
+}
+
+uint32_t LinkEmulator::getReordered(void){
+	return this->reordered;
+}
+
+uint32_t LinkEmulator::getBadStateCount(void){
+	return this->badStateCount;
+}
+
+const char* LinkEmulator::getFateName(LinkFate_t fate){
+	switch(fate){
+		case LINK_DELIVERED:  return "delivered";
+		case LINK_LOST:       return "lost";
+		case LINK_QUEUE_DROP: return "queue_drop";
+		case LINK_OUTAGE:     return "outage";
+		case LINK_MTU_DROP:   return "mtu_drop";
+		default:              return "unknown";
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+////////////////////////// Private Helper functions //////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+// xorshift32, the same sequence on every machine for a given seed.
+double LinkEmulator::nextRandom(void){
+	this->random ^= this->random << 13;
+	this->random ^= this->random >> 17;
+	this->random ^= this->random << 5;
+	return this->random / 4294967296.0;
+}
+
+// The last trace line before elapsedMs is used, the last line holds until the end.
+void LinkEmulator::updateCondition(uint64_t elapsedMs){
+	if(this->trace.size() == 0){
+		return;
+	}
+	while(this->traceIndex+1 < this->trace.size() && this->trace[this->traceIndex+1].timeMs <= elapsedMs){
+		this->traceIndex++;
+	}
+	if(this->trace[this->traceIndex].timeMs <= elapsedMs){
+		this->condition = this->trace[this->traceIndex];
+	}
+}
+
+// The first outage starts after one interval, so the link is up when the programs start.
+uint64_t LinkEmulator::getOutageEnd(uint64_t nowUs){
+	if(this->outageIntervalMs == 0 || this->outageDurationMs == 0){
+		return 0;
+	}
+	uint64_t elapsedMs = (nowUs - this->startUs) / 1000;
+	uint64_t phase = elapsedMs % this->outageIntervalMs;
+	if(elapsedMs < this->outageIntervalMs || phase >= this->outageDurationMs){
+		return 0;
+	}
+	return nowUs + (this->outageDurationMs - phase)*1000;
+}
@@ -0,0 +1,100 @@
+/*
+	linkEmulator.h
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+
+#ifndef LINKEMULATOR_H_
+#define LINKEMULATOR_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h> // bzero
+#include <vector>
+
+// What happened to a package on the emulated link.
+enum LinkFate_t{
+	LINK_DELIVERED=0,
+	LINK_LOST,        // random or Gilbert-Elliott loss (radio).
+	LINK_QUEUE_DROP,  // the bottleneck queue was full (more data than the rate allows).
+	LINK_OUTAGE,      // sent during a scripted outage (handover) in drop mode.
+	LINK_MTU_DROP,    // larger than the path MTU (Don't Fragment, no ICMP back).
+	LINK_FATE_COUNT
+};
+
+// Link conditions from a trace file line: <time ms> <kbit/s> <delay ms> <jitter ms> <loss %>.
+typedef struct {
+	uint64_t timeMs;     // from the first package.
+	uint32_t rateKbit;   // 0 = no limit.
+	uint32_t delayMs;
+	uint32_t jitterMs;
+	double loss;         // 0..1
+} LinkCondition_t;
+
+// One direction of an LTE link, as seen by the packages going through it:
+// - a bottleneck with a rate and a queue limit, packages which would wait longer are tail dropped.
+// - base delay plus jitter, delivered in order (like LTE RLC) except the packages picked for reordering.
+// - random loss and Gilbert-Elliott burst loss (good / bad state, one transition per package).
+// - outages every N ms for M ms (handover), packages are dropped or held and delivered as a burst after it.
+// - a trace file replaces rate, delay, jitter and loss over time, to replay recorded conditions.
+// The emulator only decides fate and delivery time, the caller holds the packages. Runs with the same
+// seed and arrival times give the same result.
+class LinkEmulator
+{
+	// Public functions
+	public:
+	LinkEmulator();
+	virtual ~LinkEmulator(); //destructor
+
+	void setSeed(uint32_t seed);
+	void setRate(uint32_t kbitPerSec); // 0 = no limit.
+	void setQueueLimit(uint32_t ms);   // max time in the bottleneck queue, 0 = no limit.
+	void setDelay(uint32_t delayMs, uint32_t jitterMs);
+	void setReorder(double probability, uint32_t extraDelayMs);
+	void setLoss(double probability);
+	void setGilbertElliott(double goodToBad, double badToGood, double lossGood, double lossBad);
+	void setOutages(uint32_t intervalMs, uint32_t durationMs, bool hold);
+	bool loadTraceFile(const char *filename); // returns true on error.
+
+	LinkFate_t submit(uint64_t nowUs, uint16_t size, uint64_t &deliverUs); // deliverUs is set when LINK_DELIVERED.
+	bool isInOutage(uint64_t nowUs);
+	uint32_t getCount(LinkFate_t fate);  // packages since start.
+	uint32_t getReordered(void);
+	uint32_t getBadStateCount(void);     // packages sent while Gilbert-Elliott was in the bad state.
+
+	static const char* getFateName(LinkFate_t fate);
+
+	private:
+	uint32_t random;
+	uint64_t startUs;
+	LinkCondition_t condition;    // from the options, or the current trace line.
+	std::vector<LinkCondition_t> trace;
+	uint32_t traceIndex;
+	uint32_t queueLimitMs;
+	double reorder;
+	uint32_t reorderDelayMs;
+	double goodToBad;
+	double badToGood;
+	double lossGood;
+	double lossBad;
+	bool badState;
+	uint32_t outageIntervalMs;
+	uint32_t outageDurationMs;
+	bool outageHold;
+
+	uint64_t linkFreeUs;     // when the bottleneck has sent what is queued.
+	uint64_t lastDeliverUs;  // in order delivery.
+
+	uint32_t counts[LINK_FATE_COUNT];
+	uint32_t reordered;
+	uint32_t badStateCount;
+
+	double nextRandom(void); // 0..1
+	void updateCondition(uint64_t elapsedMs);
+	uint64_t getOutageEnd(uint64_t nowUs); // 0 if not in an outage.
+};
+
+#endif /* LINKEMULATOR_H_ */
@@ -0,0 +1,127 @@
+/*
+	linkMonitor.cpp
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+#include "linkMonitor.h"
+
+LinkMonitor::LinkMonitor(){
+	this->numberOfEvents=0;
+	this->_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if(this->_fd < 0){
+		perror("LinkMonitor: netlink socket creation failed");
+		this->_fd=0; // we can live without it, socket errors will still trigger a recovery.
+		return;
+	}
+
+	struct sockaddr_nl addr;
+	bzero(&addr, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = RTMGRP_IPV4_IFADDR | RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_IFADDR | RTMGRP_IPV6_ROUTE;
+
+	if(bind(this->_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0){
+		int err = errno; // save off errno, because because the printf statement might reset it
+		fprintf(stderr, "LinkMonitor: netlink bind unable ERNO:%d\n", err);
+		close(this->_fd);
+		this->_fd=0;
+	}
+}
+
+LinkMonitor::~LinkMonitor(){
+	if(this->_fd > 0){
+		close(this->_fd);
+	}
+}
+
+int LinkMonitor::getFD(void){
+	return this->_fd;
+}
+
+void LinkMonitor::setFD_SET(fd_set* fdset){
+	if(this->_fd > 0){
+		FD_SET(this->_fd, fdset);
+	}
+}
+
+uint32_t LinkMonitor::getNumberOfEvents(void){
+	return this->numberOfEvents;
+}
+
+bool LinkMonitor::readEvents(void){
+	bool changed=false;
+
+	if(this->_fd <= 0){
+		return false;
+	}
+
+	// drain everything, a modem reconnect gives a burst of address and route messages.
+	while(true){
+		ssize_t n = recv(this->_fd, this->buffer, sizeof(this->buffer), 0);
+		if(n <= 0){
+			break; // EAGAIN, nothing more to read.
+		}
+
+		struct nlmsghdr *nh = (struct nlmsghdr *)this->buffer;
+		for(; NLMSG_OK(nh, (uint32_t)n); nh = NLMSG_NEXT(nh, n)){
+			if(nh->nlmsg_type == NLMSG_DONE || nh->nlmsg_type == NLMSG_ERROR){
+				break;
+			}
+			if(this->handleMessage(nh)){
+				changed=true;
+			}
+		}
+	}
+
+	if(changed){
+		this->numberOfEvents++;
+	}
+	return changed;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+////////////////////////// Private Helper functions //////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+bool LinkMonitor::handleMessage(struct nlmsghdr *nh){
+	switch(nh->nlmsg_type){
+		case RTM_NEWADDR:
+		case RTM_DELADDR:
+			this->printAddress(nh);
+			return true;
+
+		case RTM_NEWROUTE:
+		case RTM_DELROUTE:
+		{
+			// Only the default route in the main table matters, the rest is noise from local interfaces.
+			struct rtmsg *rt = (struct rtmsg *)NLMSG_DATA(nh);
+			if(rt->rtm_table == RT_TABLE_MAIN && rt->rtm_dst_len == 0){
+				fprintf(stderr, "LinkMonitor: default route %s\n", (nh->nlmsg_type == RTM_NEWROUTE) ? "added" : "removed");
+				return true;
+			}
+		}
+		break;
+
+		default:
+		break;
+	}
+	return false;
+}
+
+void LinkMonitor::printAddress(struct nlmsghdr *nh){
+	struct ifaddrmsg *ifa = (struct ifaddrmsg *)NLMSG_DATA(nh);
+	struct rtattr *rta = IFA_RTA(ifa);
+	int len = IFA_PAYLOAD(nh);
+	char ip[INET6_ADDRSTRLEN];
+	ip[0]=0;
+
+	for(; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)){
+		if(rta->rta_type == IFA_LOCAL || rta->rta_type == IFA_ADDRESS){
+			inet_ntop(ifa->ifa_family, RTA_DATA(rta), ip, sizeof(ip));
+			if(rta->rta_type == IFA_LOCAL){
+				break; // prefer the local address on point-to-point links (wwan0).
+			}
+		}
+	}
+	fprintf(stderr, "LinkMonitor: address %s %s on interface index %u\n", ip, (nh->nlmsg_type == RTM_NEWADDR) ? "added" : "removed", ifa->ifa_index);
+}
@@ -0,0 +1,48 @@
+/*
+	linkMonitor.h
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+
+#ifndef LINKMONITOR_H_
+#define LINKMONITOR_H_
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h> // bzero
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#define LINKMONITOR_BUFFER_SIZE 8192
+
+// Listens on rtnetlink for address and default route changes (LTE modem reconnect, new IP from udhcpc etc.)
+// so the sockets can be recreated right away instead of restarting the whole program.
+class LinkMonitor
+{
+	// Public functions
+	public:
+	LinkMonitor();
+	virtual ~LinkMonitor(); //destructor
+
+	int getFD(void);
+	void setFD_SET(fd_set* fdset);
+	bool readEvents(void); // reads all pending netlink messages, returns true if an address or the default route has changed.
+	uint32_t getNumberOfEvents(void); // number of changes seen since start.
+
+	private:
+	int _fd;
+	uint32_t numberOfEvents;
+	uint8_t buffer[LINKMONITOR_BUFFER_SIZE];
+
+	bool handleMessage(struct nlmsghdr *nh); // returns true if the message is a change we care about.
+	void printAddress(struct nlmsghdr *nh);
+};
+
+#endif /* LINKMONITOR_H_ */
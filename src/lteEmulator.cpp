@@ -0,0 +1,513 @@
+/*
+	lteEmulator.cpp
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+
+// UDP proxy between tx_raw and rx_raw on one machine, each package goes through an emulated LTE link.
+// tx_raw sends to the listen ports, the proxy forwards to the rx_raw ports. Replies from rx_raw (Mavlink
+// to the drone) go back the other way through a second emulated link.
+// With -l every package is logged as one JSON object per line, so a run can be scored afterwards:
+// {"seq":N,"flow":7001,"dir":"down","size":S,"arrivalUs":T,"fate":"delivered","latencyUs":L,"frameID":F,"packageID":P}
+// Lost packages are logged when they arrive, delivered ones when they are sent on. frameID / packageID
+// are the H264UDPPackage header, only on video flows. On exit a summary is printed to stdout.
+// Start it before tx_raw: tx_raw binds the ports it sends to as well (for the replies), the first one gets them.
+
+#include "linkEmulator.h"
+#include "connection.h"
+#include <getopt.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <queue>
+#include <vector>
+
+#define MAX_FLOWS 8
+#define MAX_PACKAGE_SIZE 1500
+#define POOL_SIZE 8192              // packages on the way, ~1 second at 100Mbit.
+#define DEFAULT_QUEUE_LIMIT_MS 500  // LTE modems / eNB buffer a lot, this is the bufferbloat tx_raw -b is for.
+#define DEFAULT_REORDER_DELAY_MS 20
+#define DEFAULT_SEED 2021
+#define LOG_INTERVAL_SEC 1
+#define MAX_SELECT_TIMEOUT_US 100000
+
+enum Direction_t{
+	DIRECTION_DOWN=0, // tx_raw -> rx_raw (air to ground).
+	DIRECTION_UP,     // rx_raw -> tx_raw.
+	DIRECTION_COUNT
+};
+
+typedef struct {
+	int listenPort;
+	int forwardPort;
+	bool video;
+	Connection *listen;       // tx_raw sends here, replies go back to where it came from.
+	int forwardFD;            // to rx_raw.
+	struct sockaddr_in target;
+	uint32_t counts[DIRECTION_COUNT][LINK_FATE_COUNT];
+	uint64_t bytes[DIRECTION_COUNT];
+	std::vector<uint32_t> latencies[DIRECTION_COUNT]; // us, delivered packages.
+	std::map<uint32_t, uint32_t> framePackages;       // video: frameID -> packages sent,
+	std::map<uint32_t, uint32_t> frameDelivered;      // and delivered.
+} flow_t;
+
+typedef struct {
+	uint64_t arrivalUs;
+	uint32_t seq;
+	uint8_t flow;
+	uint8_t direction;
+	uint16_t size;
+	uint8_t data[MAX_PACKAGE_SIZE];
+} emulatorPackage_t;
+
+typedef struct {
+	uint64_t deliverUs;
+	uint32_t seq;
+	uint32_t index; // in the pool.
+} scheduledPackage_t;
+
+struct laterPackage{
+	bool operator()(const scheduledPackage_t &a, const scheduledPackage_t &b) const {
+		return (a.deliverUs != b.deliverUs) ? (a.deliverUs > b.deliverUs) : (a.seq > b.seq);
+	}
+};
+
+int flagHelp = 0;
+volatile sig_atomic_t running = 1;
+
+void usage(void) {
+	printf("\nUsage: lteEmulator [options]\n"
+	"\n"
+	"Options:\n"
+	"-f  <listen>:<forward>[:video]  Flow, tx_raw sends to listen, forwarded to rx_raw on forward (repeat, max %d).\n"
+	"-i  <IP>       IP of rx_raw (default 127.0.0.1).\n"
+	"-b  <kbit/s>   Link rate (default no limit).\n"
+	"-q  <ms>       Max time in the link queue, packages waiting longer are dropped (default %d, 0 = no limit).\n"
+	"-d  <ms>       One way delay (default 0).\n"
+	"-j  <ms>       Jitter, 0..ms extra delay, the order is kept (default 0).\n"
+	"-R  <%%>[,<ms>] Reordering, packages delayed extra ms so the next ones overtake (default %d ms).\n"
+	"-L  <%%>        Random loss.\n"
+	"-g  <p>,<r>,<good>,<bad>  Gilbert-Elliott burst loss in %%: good->bad, bad->good, loss in good, loss in bad.\n"
+	"-o  <interval>,<duration>[,hold]  Outage (handover) every interval ms for duration ms, dropped or held (default drop).\n"
+	"-T  <file>     Trace file, lines of <time ms> <kbit/s> <delay ms> <jitter ms> <loss %%> replacing -b -d -j -L over time.\n"
+	"-M  <bytes>    Largest UDP package through the link, larger ones are dropped like on a path with a smaller MTU (tx_raw -u).\n"
+	"-u             No impairments on the way back (rx_raw -> tx_raw).\n"
+	"-l  <file>     Log the fate of every package (JSON lines).\n"
+	"-e  <seed>     Seed for loss, jitter and reordering (default %d).\n"
+	"\n"
+	"Example:\n"
+	"  ./rx_raw -v 7000 -m 12000 -t 5200\n"
+	"  ./lteEmulator -f 7001:7000:video -f 12001:12000 -f 5201:5200 -b 8000 -d 40 -j 15 -g 1,30,0,50 -o 20000,300,hold -l fates.json\n"
+	"  raspivid -t 0 | ./tx_raw -i 127.0.0.1 -v 7001 -p 12001 -t 5201\n"
+	"  ./lteEmulator -f 7001:7000:video -f 12001:12000 -f 5201:5200 -T drive-test.trace -l fates.json\n"
+	"\n", MAX_FLOWS, DEFAULT_QUEUE_LIMIT_MS, DEFAULT_REORDER_DELAY_MS, DEFAULT_SEED);
+	exit(1);
+}
+
+uint64_t timeMicrosec() {
+	using namespace std::chrono;
+	return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+void stopSignal(int){
+	running = 0;
+}
+
+bool parseFlow(const char *text, flow_t &flow){
+	char type[16] = "";
+	int fields = sscanf(text, "%d:%d:%15s", &flow.listenPort, &flow.forwardPort, type);
+	if(fields < 2 || flow.listenPort <= 0 || flow.listenPort > 65535 || flow.forwardPort <= 0 || flow.forwardPort > 65535){
+		return false;
+	}
+	flow.video = (strcmp(type, "video") == 0);
+	return (fields == 2 || flow.video);
+}
+
+const char* getDirectionName(uint8_t direction){
+	return (direction == DIRECTION_DOWN) ? "down" : "up";
+}
+
+void logFate(FILE *log, const emulatorPackage_t &package, const flow_t &flow, LinkFate_t fate, uint64_t latencyUs, uint64_t startUs){
+	if(log == NULL){
+		return;
+	}
+	fprintf(log, "{\"seq\":%u,\"flow\":%d,\"dir\":\"%s\",\"size\":%u,\"arrivalUs\":%llu,\"fate\":\"%s\"", package.seq, flow.listenPort, getDirectionName(package.direction),
+		package.size, (unsigned long long)(package.arrivalUs - startUs), LinkEmulator::getFateName(fate));
+	if(fate == LINK_DELIVERED){
+		fprintf(log, ",\"latencyUs\":%llu", (unsigned long long)latencyUs);
+	}
+	if(flow.video && package.direction == DIRECTION_DOWN && package.size >= 4){
+		fprintf(log, ",\"frameID\":%u,\"packageID\":%u", package.data[0] | (package.data[1] << 8), package.data[2] | (package.data[3] << 8));
+	}
+	fprintf(log, "}\n");
+}
+
+uint32_t getPercentile(std::vector<uint32_t> &values, uint32_t percent){
+	if(values.size() == 0){
+		return 0;
+	}
+	size_t index = (values.size() * percent) / 100;
+	if(index >= values.size()){
+		index = values.size()-1;
+	}
+	std::nth_element(values.begin(), values.begin() + index, values.end());
+	return values[index];
+}
+
+void printSummary(flow_t *flows, int numberOfFlows, LinkEmulator *emulators){
+	printf("{\"summary\":[");
+	for(int a=0;a<numberOfFlows;a++){
+		flow_t &flow = flows[a];
+		for(int direction=0;direction<DIRECTION_COUNT;direction++){
+			uint32_t packages=0;
+			for(int fate=0;fate<LINK_FATE_COUNT;fate++){
+				packages += flow.counts[direction][fate];
+			}
+			printf("%s{\"flow\":%d,\"dir\":\"%s\",\"packages\":%u,\"bytes\":%llu", (a == 0 && direction == 0) ? "" : ",", flow.listenPort, getDirectionName(direction),
+				packages, (unsigned long long)flow.bytes[direction]);
+			for(int fate=0;fate<LINK_FATE_COUNT;fate++){
+				printf(",\"%s\":%u", LinkEmulator::getFateName((LinkFate_t)fate), flow.counts[direction][fate]);
+			}
+			std::vector<uint32_t> &latencies = flow.latencies[direction];
+			uint32_t max = (latencies.size() > 0) ? *std::max_element(latencies.begin(), latencies.end()) : 0;
+			uint32_t p50 = getPercentile(latencies, 50);
+			uint32_t p99 = getPercentile(latencies, 99);
+			printf(",\"latencyP50Us\":%u,\"latencyP99Us\":%u,\"latencyMaxUs\":%u", p50, p99, max);
+			if(flow.video && direction == DIRECTION_DOWN){
+				// A frame ID is one GOP in tx_raw (it counts keyframes), complete when every package got through.
+				uint32_t complete=0;
+				for(std::map<uint32_t, uint32_t>::iterator it=flow.framePackages.begin(); it!=flow.framePackages.end(); ++it){
+					if(flow.frameDelivered[it->first] == it->second){
+						complete++;
+					}
+				}
+				printf(",\"gops\":%u,\"gopsComplete\":%u", (uint32_t)flow.framePackages.size(), complete);
+			}
+			printf("}");
+		}
+	}
+	printf("],\"reordered\":[%u,%u],\"badState\":[%u,%u]}\n", emulators[DIRECTION_DOWN].getReordered(), emulators[DIRECTION_UP].getReordered(),
+		emulators[DIRECTION_DOWN].getBadStateCount(), emulators[DIRECTION_UP].getBadStateCount());
+	fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+	static flow_t flows[MAX_FLOWS];
+	int numberOfFlows=0;
+	const char *targetIP = "127.0.0.1";
+	uint32_t rate=0;
+	uint32_t queueLimit=DEFAULT_QUEUE_LIMIT_MS;
+	uint32_t delay=0;
+	uint32_t jitter=0;
+	double reorder=0;
+	uint32_t reorderDelay=DEFAULT_REORDER_DELAY_MS;
+	double loss=0;
+	double geGoodToBad=0, geBadToGood=0, geLossGood=0, geLossBad=0;
+	uint32_t outageInterval=0, outageDuration=0;
+	bool outageHold=false;
+	char *traceFile=NULL;
+	bool cleanUplink=false;
+	uint32_t pathMtu=0;
+	char *logFile=NULL;
+	uint32_t seed=DEFAULT_SEED;
+
+	while (1) {
+		int nOptionIndex;
+		static const struct option optiona[] = {
+			{ "help", no_argument, &flagHelp, 1 },
+			{      0,           0,         0, 0 }
+		};
+		int c = getopt_long(argc, argv, "h:f:i:b:q:d:j:R:L:g:o:T:M:ul:e:", optiona, &nOptionIndex);
+		if (c == -1) {
+			break;
+		}
+
+		switch (c) {
+			case 0: {
+				// long option
+				break;
+			}
+			case 'f': {
+				if(numberOfFlows >= MAX_FLOWS || false == parseFlow(optarg, flows[numberOfFlows])){
+					fprintf(stderr, "lteEmulator: ERROR flow \"%s\" not valid (or more than %d)\n", optarg, MAX_FLOWS);
+					usage();
+				}
+				numberOfFlows++;
+				break;
+			}
+			case 'i': {
+				targetIP = optarg;
+				break;
+			}
+			case 'b': {
+				rate = (uint32_t)atoi(optarg);
+				break;
+			}
+			case 'q': {
+				queueLimit = (uint32_t)atoi(optarg);
+				break;
+			}
+			case 'd': {
+				delay = (uint32_t)atoi(optarg);
+				break;
+			}
+			case 'j': {
+				jitter = (uint32_t)atoi(optarg);
+				break;
+			}
+			case 'R': {
+				unsigned int extra = reorderDelay;
+				if(sscanf(optarg, "%lf,%u", &reorder, &extra) < 1 || reorder < 0 || reorder > 100){
+					usage();
+				}
+				reorder /= 100.0;
+				reorderDelay = extra;
+				break;
+			}
+			case 'L': {
+				loss = atof(optarg) / 100.0;
+				break;
+			}
+			case 'g': {
+				if(sscanf(optarg, "%lf,%lf,%lf,%lf", &geGoodToBad, &geBadToGood, &geLossGood, &geLossBad) != 4 || geBadToGood <= 0){
+					fprintf(stderr, "lteEmulator: ERROR -g needs <good->bad %%>,<bad->good %%>,<loss good %%>,<loss bad %%>\n");
+					usage();
+				}
+				break;
+			}
+			case 'o': {
+				char mode[16] = "";
+				if(sscanf(optarg, "%u,%u,%15s", &outageInterval, &outageDuration, mode) < 2 || outageDuration >= outageInterval){
+					fprintf(stderr, "lteEmulator: ERROR -o needs <interval ms>,<duration ms>[,hold] with duration < interval\n");
+					usage();
+				}
+				outageHold = (strcmp(mode, "hold") == 0);
+				break;
+			}
+			case 'T': {
+				traceFile = optarg;
+				break;
+			}
+			case 'M': {
+				pathMtu = (uint32_t)atoi(optarg);
+				break;
+			}
+			case 'u': {
+				cleanUplink = true;
+				break;
+			}
+			case 'l': {
+				logFile = optarg;
+				break;
+			}
+			case 'e': {
+				seed = (uint32_t)atoi(optarg);
+				break;
+			}
+			default: {
+				usage();
+				break;
+			}
+		}
+	}
+	if(numberOfFlows == 0 || loss < 0 || loss > 1){
+		usage();
+	}
+
+	static LinkEmulator emulators[DIRECTION_COUNT];
+	for(int direction=0;direction<DIRECTION_COUNT;direction++){
+		if(direction == DIRECTION_UP && cleanUplink){
+			continue;
+		}
+		LinkEmulator &emulator = emulators[direction];
+		emulator.setSeed(seed + direction);
+		emulator.setRate(rate);
+		emulator.setQueueLimit(queueLimit);
+		emulator.setDelay(delay, jitter);
+		emulator.setReorder(reorder, reorderDelay);
+		emulator.setLoss(loss);
+		emulator.setGilbertElliott(geGoodToBad/100.0, geBadToGood/100.0, geLossGood/100.0, geLossBad/100.0);
+		emulator.setOutages(outageInterval, outageDuration, outageHold);
+		if(traceFile != NULL && emulator.loadTraceFile(traceFile)){
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	FILE *log = NULL;
+	if(logFile != NULL){
+		log = fopen(logFile, "w");
+		if(log == NULL){
+			fprintf(stderr, "lteEmulator: Unable to create log file %s\n", logFile);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	// The forward side is a plain socket on a free port, Connection would bind the port rx_raw listens on.
+	for(int a=0;a<numberOfFlows;a++){
+		flow_t &flow = flows[a];
+		flow.listen = new Connection(flow.listenPort, SOCK_DGRAM, O_NONBLOCK);
+		flow.forwardFD = socket(AF_INET, SOCK_DGRAM, 0);
+		if(flow.forwardFD < 0){
+			perror("lteEmulator: UDP socket creation failed");
+			exit(EXIT_FAILURE);
+		}
+		fcntl(flow.forwardFD, F_SETFL, fcntl(flow.forwardFD, F_GETFL, 0) | O_NONBLOCK);
+		bzero(&flow.target, sizeof(flow.target));
+		flow.target.sin_family = AF_INET;
+		flow.target.sin_addr.s_addr = inet_addr(targetIP);
+		flow.target.sin_port = htons(flow.forwardPort);
+		fprintf(stderr, "lteEmulator: %d -> %s:%d%s\n", flow.listenPort, targetIP, flow.forwardPort, flow.video ? " (video)" : "");
+	}
+
+	static emulatorPackage_t pool[POOL_SIZE]; // static, too large for the stack.
+	std::vector<uint32_t> freePackages;
+	for(uint32_t a=0;a<POOL_SIZE;a++){
+		freePackages.push_back(POOL_SIZE-1-a);
+	}
+	std::priority_queue<scheduledPackage_t, std::vector<scheduledPackage_t>, laterPackage> scheduled;
+
+	signal(SIGINT, stopSignal);
+	signal(SIGTERM, stopSignal);
+
+	uint64_t startUs = timeMicrosec();
+	uint32_t seq=0;
+	uint8_t buffer[MAX_PACKAGE_SIZE];
+	time_t nextPrintTime = time(NULL) + LOG_INTERVAL_SEC;
+	uint32_t lastCounts[DIRECTION_COUNT][LINK_FATE_COUNT];
+	bzero(&lastCounts, sizeof(lastCounts));
+
+	while(running){
+		fd_set rset;
+		FD_ZERO(&rset);
+		int maxfdp1=0;
+		for(int a=0;a<numberOfFlows;a++){
+			flows[a].listen->setFD_SET(&rset);
+			FD_SET(flows[a].forwardFD, &rset);
+			maxfdp1 = std::max(maxfdp1, std::max(flows[a].listen->getFD(), flows[a].forwardFD) + 1);
+		}
+		uint64_t nowUs = timeMicrosec();
+		struct timeval timeout;
+		uint64_t waitUs = MAX_SELECT_TIMEOUT_US;
+		if(!scheduled.empty()){
+			waitUs = (scheduled.top().deliverUs > nowUs) ? std::min(scheduled.top().deliverUs - nowUs, (uint64_t)MAX_SELECT_TIMEOUT_US) : 0;
+		}
+		timeout.tv_sec = 0;
+		timeout.tv_usec = waitUs;
+		select(maxfdp1, &rset, NULL, NULL, &timeout);
+
+		// New packages, both directions:
+		for(int a=0;a<numberOfFlows;a++){
+			for(int direction=0;direction<DIRECTION_COUNT;direction++){
+				int fd = (direction == DIRECTION_DOWN) ? flows[a].listen->getFD() : flows[a].forwardFD;
+				if(fd < 0 || !FD_ISSET(fd, &rset)){ // the listen socket is -1 after a read error.
+					continue;
+				}
+				while(true){
+					int length;
+					if(direction == DIRECTION_DOWN){
+						length = flows[a].listen->readData(buffer, sizeof(buffer));
+					}else{
+						length = recv(fd, buffer, sizeof(buffer), 0);
+					}
+					if(length <= 0){
+						break;
+					}
+					nowUs = timeMicrosec();
+					emulatorPackage_t package;
+					package.arrivalUs = nowUs;
+					package.seq = seq++;
+					package.flow = (uint8_t)a;
+					package.direction = (uint8_t)direction;
+					package.size = (uint16_t)length;
+					memcpy(package.data, buffer, (length < 4) ? length : 4); // the header for the log.
+
+					uint64_t deliverUs = nowUs;
+					LinkFate_t fate = LINK_DELIVERED;
+					if(pathMtu > 0 && (uint32_t)length > pathMtu){
+						fate = LINK_MTU_DROP;
+					}else if(direction == DIRECTION_DOWN || false == cleanUplink){
+						fate = emulators[direction].submit(nowUs, package.size, deliverUs);
+					}
+					if(fate == LINK_DELIVERED && freePackages.empty()){
+						fate = LINK_QUEUE_DROP; // more on the way than the pool holds.
+					}
+					flows[a].counts[direction][fate]++;
+					flows[a].bytes[direction] += length;
+					if(flows[a].video && direction == DIRECTION_DOWN && length >= 4){
+						flows[a].framePackages[buffer[0] | (buffer[1] << 8)]++;
+					}
+					if(fate != LINK_DELIVERED){
+						logFate(log, package, flows[a], fate, 0, startUs);
+						continue;
+					}
+					uint32_t index = freePackages.back();
+					freePackages.pop_back();
+					memcpy(&pool[index], &package, offsetof(emulatorPackage_t, data));
+					memcpy(pool[index].data, buffer, length);
+					scheduledPackage_t entry;
+					entry.deliverUs = deliverUs;
+					entry.seq = package.seq;
+					entry.index = index;
+					scheduled.push(entry);
+				}
+			}
+		}
+
+		// Packages which have crossed the link:
+		nowUs = timeMicrosec();
+		while(!scheduled.empty() && scheduled.top().deliverUs <= nowUs){
+			emulatorPackage_t &package = pool[scheduled.top().index];
+			freePackages.push_back(scheduled.top().index);
+			scheduled.pop();
+			flow_t &flow = flows[package.flow];
+			if(package.direction == DIRECTION_DOWN){
+				sendto(flow.forwardFD, package.data, package.size, 0, (struct sockaddr *)&flow.target, sizeof(flow.target));
+				if(flow.video && package.size >= 4){
+					flow.frameDelivered[package.data[0] | (package.data[1] << 8)]++;
+				}
+			}else{
+				flow.listen->writeData(package.data, package.size); // back to tx_raw, not sent before tx_raw has sent something.
+			}
+			uint64_t latencyUs = nowUs - package.arrivalUs;
+			flow.latencies[package.direction].push_back((uint32_t)latencyUs);
+			logFate(log, package, flow, LINK_DELIVERED, latencyUs, startUs);
+		}
+
+		if(time(NULL) >= nextPrintTime){
+			nextPrintTime = time(NULL) + LOG_INTERVAL_SEC;
+			for(int direction=0;direction<DIRECTION_COUNT;direction++){
+				uint32_t counts[LINK_FATE_COUNT];
+				bzero(&counts, sizeof(counts));
+				for(int a=0;a<numberOfFlows;a++){
+					for(int fate=0;fate<LINK_FATE_COUNT;fate++){
+						counts[fate] += flows[a].counts[direction][fate];
+					}
+				}
+				fprintf(stderr, "%s %s: delivered %u lost %u queue %u outage %u", (direction == DIRECTION_DOWN) ? "LTE" : " |", getDirectionName(direction),
+					counts[LINK_DELIVERED] - lastCounts[direction][LINK_DELIVERED], counts[LINK_LOST] - lastCounts[direction][LINK_LOST],
+					counts[LINK_QUEUE_DROP] - lastCounts[direction][LINK_QUEUE_DROP], counts[LINK_OUTAGE] - lastCounts[direction][LINK_OUTAGE]);
+				memcpy(lastCounts[direction], counts, sizeof(counts));
+			}
+			fprintf(stderr, " | in flight %u%s\n", (uint32_t)scheduled.size(), emulators[DIRECTION_DOWN].isInOutage(timeMicrosec()) ? " OUTAGE" : "");
+			if(log != NULL){
+				fflush(log);
+			}
+		}
+	}
+
+	if(log != NULL){
+		fclose(log);
+	}
+	printSummary(flows, numberOfFlows, emulators);
+	return 0;
+}
@@ -0,0 +1,571 @@
+/*
+	mavlinkCompression.cpp
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+#include "mavlinkCompression.h"
+
+// Record types in the LZ block:
+// Mavlink 1: [type][seq][sysid][compid][msgid][len]([ref age])[payload]
+// Mavlink 2: [type][compat flags][seq][sysid][compid][msgid][len]([ref age])[payload]
+// Raw:       [type][len low][len high][bytes] (signed Mavlink 2 frames and anything else, sent as is)
+#define RECORD_RAW 0x00
+#define RECORD_MAVLINK1 0x01
+#define RECORD_MAVLINK2 0x02
+#define RECORD_TYPE_MASK 0x03
+#define RECORD_DELTA 0x80 // payload is XOR'ed with the full instance [ref age] batches back.
+
+// LZ block (LZ4 style sequences): [token: literals<<4 | match-4][more literals length][literals][offset (2 bytes)][more match length]
+// Offsets may point into the dictionary in front of the data.
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_NO_POSITION 0xFFFF
+
+MavlinkCompressionState::MavlinkCompressionState(){
+	bzero(&this->msgids, sizeof(this->msgids));
+	this->dictionaryLength=0;
+	this->dictionaryID=0;
+	this->clearIOstatus();
+}
+
+MavlinkCompressionState::~MavlinkCompressionState(){
+}
+
+bool MavlinkCompressionState::loadDictionary(const char *filename){
+	FILE *fp = fopen(filename, "rb");
+	if(fp == NULL){
+		fprintf(stderr, "MavlinkCompression: Unable to open dictionary %s\n", filename);
+		return true;
+	}
+	uint8_t data[MAVLINK_COMPRESSION_MAX_DICTIONARY];
+	size_t length = fread(data, 1, sizeof(data), fp);
+	bool tooLarge = (fgetc(fp) != EOF);
+	fclose(fp);
+	if(tooLarge){
+		fprintf(stderr, "MavlinkCompression: Dictionary %s is larger than %d bytes\n", filename, MAVLINK_COMPRESSION_MAX_DICTIONARY);
+		return true;
+	}
+	this->setDictionary(data, (uint16_t)length);
+	return false;
+}
+
+void MavlinkCompressionState::setDictionary(const uint8_t *data, uint16_t length){
+	if(length > MAVLINK_COMPRESSION_MAX_DICTIONARY){
+		length = MAVLINK_COMPRESSION_MAX_DICTIONARY;
+	}
+	memcpy(this->window, data, length);
+	this->dictionaryLength = length;
+	this->dictionaryID = (length > 0) ? MavlinkFrameParser::crc(data, length, X25_INIT_CRC) : 0;
+}
+
+uint16_t MavlinkCompressionState::getDictionaryID(void){
+	return this->dictionaryID;
+}
+
+uint32_t MavlinkCompressionState::getBytesIn(void){
+	return this->bytesIn;
+}
+
+uint32_t MavlinkCompressionState::getBytesOut(void){
+	return this->bytesOut;
+}
+
+uint32_t MavlinkCompressionState::getBatches(void){
+	return this->batches;
+}
+
+float MavlinkCompressionState::getRatio(void){
+	if(this->bytesOut == 0){
+		return 0;
+	}
+	return (float)this->bytesIn / this->bytesOut;
+}
+
+float MavlinkCompressionState::getMicrosecPerBatch(void){
+	if(this->batches == 0){
+		return 0;
+	}
+	return (float)this->cpuTimeNs / 1000.0f / this->batches;
+}
+
+void MavlinkCompressionState::clearIOstatus(void){
+	this->bytesIn=0;
+	this->bytesOut=0;
+	this->batches=0;
+	this->cpuTimeNs=0;
+}
+
+////////// tx_raw side //////////
+
+MavlinkCompressor::MavlinkCompressor(){
+	this->batchSeq=0;
+}
+
+uint16_t MavlinkCompressor::compress(const uint8_t *frames, uint16_t length, uint8_t *output, uint16_t maxOutput){
+	uint64_t start = cpuTimeNow();
+	if(MAVLINK_COMPRESSION_MAX_RECORDS(length) > MAVLINK_COMPRESSION_MAX_BATCH || maxOutput < MAVLINK_COMPRESSION_MAX_OUTPUT(length)){
+		fprintf(stderr, "MavlinkCompressor: batch of %u bytes does not fit, not compressed\n", length);
+		return 0;
+	}
+	this->batchSeq++;
+
+	// Records after the dictionary, so LZ can find matches in both.
+	uint8_t *records = &this->window[this->dictionaryLength];
+	uint16_t recordsLength=0;
+	uint16_t offset=0;
+	while(offset < length){
+		const uint8_t *frame = &frames[offset];
+		uint16_t frameLength = MavlinkFrameParser::getFrameLength(frame);
+		if(frameLength == 0 || offset + frameLength > length){
+			frameLength = length - offset; // should not happend, batches only holds validated frames.
+		}
+		MsgidState *state = &this->msgids[frame[0] == MAVLINK_STX ? frame[5] : frame[7]];
+		recordsLength += encodeRecord(frame, frameLength, state, this->batchSeq, true, &records[recordsLength]);
+		offset += frameLength;
+	}
+
+	output[0] = MAVLINK_COMPRESSION_MAGIC;
+	output[1] = MAVLINK_COMPRESSION_FORMAT;
+	output[2] = (uint8_t)(this->batchSeq & 0xff);
+	output[3] = (uint8_t)(this->batchSeq >> 8);
+	output[4] = (uint8_t)(this->dictionaryID & 0xff);
+	output[5] = (uint8_t)(this->dictionaryID >> 8);
+	uint32_t lzLength = lzCompress(this->window, this->dictionaryLength, recordsLength, &output[MAVLINK_COMPRESSION_HEADER_SIZE], maxOutput - MAVLINK_COMPRESSION_HEADER_SIZE);
+	if(lzLength == 0){
+		fprintf(stderr, "MavlinkCompressor: output buffer too small\n"); // can't happen with MAVLINK_COMPRESSION_MAX_OUTPUT.
+		return 0;
+	}
+	uint16_t size = MAVLINK_COMPRESSION_HEADER_SIZE + lzLength;
+
+	this->bytesIn += length;
+	this->bytesOut += size;
+	this->batches++;
+	this->cpuTimeNs += cpuTimeNow() - start;
+	return size;
+}
+
+uint16_t MavlinkCompressor::trainDictionary(const uint8_t *frames, uint32_t length, uint8_t *dictionary, uint16_t maxSize){
+	uint32_t count[256];
+	uint32_t first[256];
+	bzero(count, sizeof(count));
+	MsgidState state;
+
+	uint32_t offset=0;
+	while(offset < length){
+		uint16_t frameLength = MavlinkFrameParser::getFrameLength(&frames[offset]);
+		if(frameLength == 0 || offset + frameLength > length){
+			break;
+		}
+		uint8_t msgid = (frames[offset] == MAVLINK_STX) ? frames[offset+5] : frames[offset+7];
+		if(count[msgid] == 0){
+			first[msgid] = offset;
+		}
+		count[msgid]++;
+		offset += frameLength;
+	}
+
+	// Pick the most common msgids that fits, then write them with the most common last (closest to the data).
+	bool used[256];
+	bzero(used, sizeof(used));
+	uint32_t size=0;
+	while(true){
+		int best=-1;
+		for(int msgid=0;msgid<256;msgid++){
+			if(!used[msgid] && count[msgid] > 0 && (best < 0 || count[msgid] > count[best])){
+				best = msgid;
+			}
+		}
+		if(best < 0){
+			break;
+		}
+		used[best]=true;
+		uint16_t recordLength = encodeRecord(&frames[first[best]], MavlinkFrameParser::getFrameLength(&frames[first[best]]), &state, 0, false, NULL);
+		if(size + recordLength > maxSize){
+			used[best]=false;
+			count[best]=0;
+			continue;
+		}
+		size += recordLength;
+	}
+
+	uint32_t position=0;
+	for(uint32_t rank=1; rank<=256; rank++){
+		int least=-1;
+		for(int msgid=0;msgid<256;msgid++){
+			if(used[msgid] && (least < 0 || count[msgid] < count[least])){
+				least = msgid;
+			}
+		}
+		if(least < 0){
+			break;
+		}
+		used[least]=false;
+		position += encodeRecord(&frames[first[least]], MavlinkFrameParser::getFrameLength(&frames[first[least]]), &state, 0, false, &dictionary[position]);
+	}
+	return (uint16_t)position;
+}
+
+// Writes the record for one frame (output NULL only returns the size) and updates the msgid state.
+uint16_t MavlinkCompressor::encodeRecord(const uint8_t *frame, uint16_t frameLength, MsgidState *state, uint16_t batchSeq, bool allowDelta, uint8_t *output){
+	uint8_t type;
+	uint16_t headerLength;
+	// the decompressor calculates the CRC again, that needs a msgid from the dialect.
+	if(frame[0] == MAVLINK_STX && MavlinkFrameParser::isKnownMessage(frame[5])){
+		type = RECORD_MAVLINK1;
+		headerLength = MAVLINK_NUM_HEADER_BYTES;
+	}else if(frame[0] == MAVLINK2_STX && frame[2] == 0 && frame[8] == 0 && frame[9] == 0 && MavlinkFrameParser::isKnownMessage(frame[7])){ // unsigned and known msgid < 256.
+		type = RECORD_MAVLINK2;
+		headerLength = MAVLINK2_HEADER_LEN;
+	}else{
+		if(output != NULL){
+			output[0] = RECORD_RAW;
+			output[1] = (uint8_t)(frameLength & 0xff);
+			output[2] = (uint8_t)(frameLength >> 8);
+			memcpy(&output[3], frame, frameLength);
+		}
+		return frameLength + 3;
+	}
+
+	uint8_t payloadLength = frame[1];
+	const uint8_t *payload = &frame[headerLength];
+	uint16_t refAge = (uint16_t)(batchSeq - state->batchSeq);
+	bool delta = allowDelta && state->valid && refAge < MAVLINK_COMPRESSION_REFRESH_BATCHES;
+	uint16_t recordLength = ((type == RECORD_MAVLINK1) ? 6 : 7) + (delta ? 1 : 0) + payloadLength;
+	if(output == NULL){
+		return recordLength;
+	}
+
+	uint16_t index=0;
+	output[index++] = type | (delta ? RECORD_DELTA : 0);
+	if(type == RECORD_MAVLINK1){
+		output[index++] = frame[2]; // seq
+		output[index++] = frame[3]; // sysid
+		output[index++] = frame[4]; // compid
+		output[index++] = frame[5]; // msgid
+	}else{
+		output[index++] = frame[3]; // compat flags
+		output[index++] = frame[4]; // seq
+		output[index++] = frame[5]; // sysid
+		output[index++] = frame[6]; // compid
+		output[index++] = frame[7]; // msgid
+	}
+	output[index++] = payloadLength;
+	if(delta){
+		output[index++] = (uint8_t)refAge;
+		for(uint16_t a=0;a<payloadLength;a++){
+			output[index++] = payload[a] ^ ((a < state->length) ? state->payload[a] : 0);
+		}
+	}else{
+		memcpy(&output[index], payload, payloadLength);
+		index += payloadLength;
+		memcpy(state->payload, payload, payloadLength);
+		state->length = payloadLength;
+		state->batchSeq = batchSeq;
+		state->valid = true;
+	}
+	return index;
+}
+
+////////// rx_raw side //////////
+
+MavlinkDecompressor::MavlinkDecompressor(){
+	this->clearErrors();
+}
+
+bool MavlinkDecompressor::isCompressed(const uint8_t *data, uint16_t length){
+	return (length >= MAVLINK_COMPRESSION_HEADER_SIZE && data[0] == MAVLINK_COMPRESSION_MAGIC);
+}
+
+uint16_t MavlinkDecompressor::decompress(const uint8_t *data, uint16_t length, uint8_t *output, uint16_t maxOutput){
+	uint64_t start = cpuTimeNow();
+	if(false == isCompressed(data, length) || data[1] != MAVLINK_COMPRESSION_FORMAT){
+		this->errors++;
+		return 0;
+	}
+	uint16_t batchSeq = (uint16_t)data[2] | ((uint16_t)data[3] << 8);
+	uint16_t dictionaryID = (uint16_t)data[4] | ((uint16_t)data[5] << 8);
+	if(dictionaryID != this->dictionaryID){
+		if(this->errors == 0){
+			fprintf(stderr, "MavlinkDecompressor: Batch uses dictionary %04x but this side has %04x, use the same -x file on tx_raw and rx_raw.\n", dictionaryID, this->dictionaryID);
+		}
+		this->errors++;
+		return 0;
+	}
+
+	int32_t recordsLength = lzDecompress(&data[MAVLINK_COMPRESSION_HEADER_SIZE], length - MAVLINK_COMPRESSION_HEADER_SIZE, this->window, this->dictionaryLength, MAVLINK_COMPRESSION_MAX_BATCH);
+	if(recordsLength < 0){
+		this->errors++;
+		return 0;
+	}
+
+	const uint8_t *records = &this->window[this->dictionaryLength];
+	int32_t index=0;
+	uint16_t size=0;
+	while(index < recordsLength){
+		uint8_t type = records[index];
+		if((type & RECORD_TYPE_MASK) == RECORD_RAW){
+			if(index + 3 > recordsLength){
+				break;
+			}
+			uint16_t rawLength = (uint16_t)records[index+1] | ((uint16_t)records[index+2] << 8);
+			if(index + 3 + rawLength > recordsLength || size + rawLength > maxOutput){
+				break;
+			}
+			memcpy(&output[size], &records[index+3], rawLength);
+			size += rawLength;
+			index += 3 + rawLength;
+			continue;
+		}
+
+		bool mavlink1 = ((type & RECORD_TYPE_MASK) == RECORD_MAVLINK1);
+		bool delta = (type & RECORD_DELTA) != 0;
+		int32_t headerLength = (mavlink1 ? 6 : 7) + (delta ? 1 : 0);
+		if(index + headerLength > recordsLength){
+			break;
+		}
+		const uint8_t *record = &records[index];
+		const uint8_t *fields = mavlink1 ? &record[1] : &record[2]; // seq, sysid, compid, msgid, len
+		uint8_t msgid = fields[3];
+		uint8_t payloadLength = fields[4];
+		uint8_t refAge = delta ? fields[5] : 0;
+		const uint8_t *payload = &record[headerLength];
+		uint16_t frameHeaderLength = mavlink1 ? MAVLINK_NUM_HEADER_BYTES : MAVLINK2_HEADER_LEN;
+		if(index + headerLength + payloadLength > recordsLength || size + frameHeaderLength + payloadLength + MAVLINK_NUM_CHECKSUM_BYTES > maxOutput){
+			break;
+		}
+		index += headerLength + payloadLength;
+
+		MsgidState *state = &this->msgids[msgid];
+		if(delta && (false == state->valid || state->batchSeq != (uint16_t)(batchSeq - refAge))){
+			this->framesLost++; // the reference was in a lost batch.
+			continue;
+		}
+
+		uint8_t *frame = &output[size];
+		if(mavlink1){
+			frame[0] = MAVLINK_STX;
+			frame[1] = payloadLength;
+			frame[2] = fields[0];
+			frame[3] = fields[1];
+			frame[4] = fields[2];
+			frame[5] = msgid;
+		}else{
+			frame[0] = MAVLINK2_STX;
+			frame[1] = payloadLength;
+			frame[2] = 0;         // incompat flags
+			frame[3] = record[1]; // compat flags
+			frame[4] = fields[0];
+			frame[5] = fields[1];
+			frame[6] = fields[2];
+			frame[7] = msgid;
+			frame[8] = 0;
+			frame[9] = 0;
+		}
+		uint8_t *framePayload = &frame[frameHeaderLength];
+		for(uint16_t a=0;a<payloadLength;a++){
+			framePayload[a] = payload[a] ^ ((delta && a < state->length) ? state->payload[a] : 0);
+		}
+		if(false == delta){
+			memcpy(state->payload, framePayload, payloadLength);
+			state->length = payloadLength;
+			state->batchSeq = batchSeq;
+			state->valid = true;
+		}
+
+		size += MavlinkFrameParser::finishFrame(frame, frameHeaderLength + payloadLength, msgid);
+	}
+	if(index != recordsLength){
+		this->errors++; // broken batch, keep the frames before the error.
+	}
+
+	this->bytesIn += size;
+	this->bytesOut += length;
+	this->batches++;
+	this->cpuTimeNs += cpuTimeNow() - start;
+	return size;
+}
+
+uint32_t MavlinkDecompressor::getFramesLost(void){
+	return this->framesLost;
+}
+
+uint32_t MavlinkDecompressor::getErrors(void){
+	return this->errors;
+}
+
+void MavlinkDecompressor::clearErrors(void){
+	this->framesLost=0;
+	this->errors=0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+////////////////////////// Private Helper functions //////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+uint64_t MavlinkCompressionState::cpuTimeNow(void){
+	struct timespec now;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static inline uint32_t lzRead32(const uint8_t *data){
+	uint32_t value;
+	memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+static inline uint32_t lzHash(uint32_t value){
+	return (value * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+// Writes a LZ4 style length extension, returns false if there is no room.
+static inline bool lzWriteLength(uint32_t length, uint8_t *output, uint32_t &index, uint32_t maxOutput){
+	while(length >= 255){
+		if(index >= maxOutput){
+			return false;
+		}
+		output[index++] = 255;
+		length -= 255;
+	}
+	if(index >= maxOutput){
+		return false;
+	}
+	output[index++] = (uint8_t)length;
+	return true;
+}
+
+// window holds the dictionary followed by the data to compress. Returns compressed size, 0 if maxOutput is too small.
+uint32_t MavlinkCompressionState::lzCompress(const uint8_t *window, uint32_t dictionaryLength, uint32_t length, uint8_t *output, uint32_t maxOutput){
+	uint16_t table[1 << LZ_HASH_BITS];
+	memset(table, 0xff, sizeof(table)); // LZ_NO_POSITION
+
+	uint32_t end = dictionaryLength + length;
+	for(uint32_t position=0; position + LZ_MIN_MATCH <= dictionaryLength; position++){
+		table[lzHash(lzRead32(&window[position]))] = (uint16_t)position;
+	}
+
+	uint32_t index=0;
+	uint32_t anchor=dictionaryLength;
+	uint32_t position=dictionaryLength;
+	while(true){
+		uint32_t matchLength=0;
+		uint32_t matchPosition=0;
+		if(position + LZ_MIN_MATCH <= end){
+			uint32_t hash = lzHash(lzRead32(&window[position]));
+			matchPosition = table[hash];
+			table[hash] = (uint16_t)position;
+			if(matchPosition != LZ_NO_POSITION && lzRead32(&window[matchPosition]) == lzRead32(&window[position])){
+				matchLength = LZ_MIN_MATCH;
+				while(position + matchLength < end && window[matchPosition + matchLength] == window[position + matchLength]){
+					matchLength++;
+				}
+			}
+		}else{
+			position = end; // no room for a match, the rest is literals.
+		}
+
+		if(matchLength == 0 && position < end){
+			position++;
+			continue;
+		}
+
+		// Sequence: literals from anchor to position, then the match (none for the last sequence).
+		uint32_t literals = position - anchor;
+		if(index >= maxOutput){
+			return 0;
+		}
+		uint32_t tokenIndex = index++;
+		output[tokenIndex] = (uint8_t)(((literals >= 15) ? 15 : literals) << 4);
+		if(literals >= 15 && !lzWriteLength(literals - 15, output, index, maxOutput)){
+			return 0;
+		}
+		if(index + literals > maxOutput){
+			return 0;
+		}
+		memcpy(&output[index], &window[anchor], literals);
+		index += literals;
+
+		if(matchLength == 0){
+			break; // last sequence.
+		}
+
+		uint32_t offset = position - matchPosition;
+		if(index + 2 > maxOutput){
+			return 0;
+		}
+		output[index++] = (uint8_t)(offset & 0xff);
+		output[index++] = (uint8_t)(offset >> 8);
+		uint32_t extra = matchLength - LZ_MIN_MATCH;
+		output[tokenIndex] |= (uint8_t)((extra >= 15) ? 15 : extra);
+		if(extra >= 15 && !lzWriteLength(extra - 15, output, index, maxOutput)){
+			return 0;
+		}
+
+		// Add the positions inside the match, the batches are small so this is cheap and finds more matches.
+		for(uint32_t a=position+1; a<position+matchLength && a + LZ_MIN_MATCH <= end; a++){
+			table[lzHash(lzRead32(&window[a]))] = (uint16_t)a;
+		}
+		position += matchLength;
+		anchor = position;
+	}
+	return index;
+}
+
+// Decompress into window after the dictionary. Returns size of the output, -1 if the data is broken.
+int32_t MavlinkCompressionState::lzDecompress(const uint8_t *input, uint32_t length, uint8_t *window, uint32_t dictionaryLength, uint32_t maxOutput){
+	uint8_t *output = &window[dictionaryLength];
+	uint32_t index=0;
+	uint32_t size=0;
+	while(index < length){
+		uint8_t token = input[index++];
+
+		uint32_t literals = token >> 4;
+		if(literals == 15){
+			uint8_t value;
+			do{
+				if(index >= length){
+					return -1;
+				}
+				value = input[index++];
+				literals += value;
+			}while(value == 255);
+		}
+		if(index + literals > length || size + literals > maxOutput){
+			return -1;
+		}
+		memcpy(&output[size], &input[index], literals);
+		index += literals;
+		size += literals;
+
+		if(index >= length){
+			break; // last sequence has no match.
+		}
+
+		if(index + 2 > length){
+			return -1;
+		}
+		uint32_t offset = (uint32_t)input[index] | ((uint32_t)input[index+1] << 8);
+		index += 2;
+		uint32_t matchLength = (token & 0x0f) + LZ_MIN_MATCH;
+		if((token & 0x0f) == 15){
+			uint8_t value;
+			do{
+				if(index >= length){
+					return -1;
+				}
+				value = input[index++];
+				matchLength += value;
+			}while(value == 255);
+		}
+		if(offset == 0 || offset > dictionaryLength + size || size + matchLength > maxOutput){
+			return -1;
+		}
+		const uint8_t *match = &output[size] - offset;
+		for(uint32_t a=0;a<matchLength;a++){ // byte by byte, the match may overlap the output (runs of zeros).
+			output[size + a] = match[a];
+		}
+		size += matchLength;
+	}
+	return (int32_t)size;
+}
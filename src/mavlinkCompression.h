@@ -0,0 +1,111 @@
+/*
+	mavlinkCompression.h
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+
+#ifndef MAVLINKCOMPRESSION_H_
+#define MAVLINKCOMPRESSION_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h> // bzero
+#include <time.h>
+
+#include "mavlinkFrameParser.h"
+
+// Compressed Mavlink batch between tx_raw and rx_raw (UDP payload):
+// [magic 0xC5][format][batch seq (2 bytes)][dictionary id (2 bytes)][LZ block]
+// The LZ block holds one record per frame, the payload XOR'ed with the last full (not delta) instance of the same msgid,
+// so a lost UDP package only loses its own frames, unless it held a full instance.
+// The CRC is not sent, rx_raw calculates it again so the frames comes out exactly as the Flight Computer sent them.
+#define MAVLINK_COMPRESSION_MAGIC 0xC5 // not a Mavlink STX, so rx_raw can tell compressed and plain batches apart.
+#define MAVLINK_COMPRESSION_FORMAT 1
+#define MAVLINK_COMPRESSION_HEADER_SIZE 6
+#define MAVLINK_COMPRESSION_MAX_BATCH 2048      // max size of the frames in one batch (both sides).
+#define MAVLINK_COMPRESSION_MAX_DICTIONARY 4096
+#define MAVLINK_COMPRESSION_REFRESH_BATCHES 20  // max 255 (ref age is one byte), send a msgid without delta at least this often, new reference and heals a lost full instance.
+#define MAVLINK_COMPRESSION_MAX_RECORDS(size) ((size) + (size)/4) // records are smaller than the frames, except raw records (+3 bytes, frames of 13+ bytes).
+#define MAVLINK_COMPRESSION_MAX_OUTPUT(size) (MAVLINK_COMPRESSION_MAX_RECORDS(size) + MAVLINK_COMPRESSION_MAX_RECORDS(size)/255 + MAVLINK_COMPRESSION_HEADER_SIZE + 16) // worst case for data that don't compress.
+
+// Per msgid state, tx_raw and rx_raw keeps the same copy.
+class MavlinkCompressionState
+{
+	public:
+	MavlinkCompressionState();
+	virtual ~MavlinkCompressionState(); //destructor
+
+	bool loadDictionary(const char *filename); // returns true on error.
+	void setDictionary(const uint8_t *data, uint16_t length);
+	uint16_t getDictionaryID(void); // CRC of the dictionary, both sides must use the same, 0 = none.
+
+	// counters for the status line (this interval).
+	uint32_t getBytesIn(void);
+	uint32_t getBytesOut(void);
+	uint32_t getBatches(void);
+	float getRatio(void);           // frames size / compressed size.
+	float getMicrosecPerBatch(void); // CPU time.
+	void clearIOstatus(void);
+
+	protected:
+	struct MsgidState{
+		uint8_t payload[MAVLINK_MAX_PAYLOAD_LEN]; // last full instance, reference for the XOR deltas.
+		uint8_t length;
+		bool valid;
+		uint16_t batchSeq;      // batch the last full instance was in.
+	};
+	MsgidState msgids[256];
+	uint8_t window[MAVLINK_COMPRESSION_MAX_DICTIONARY + MAVLINK_COMPRESSION_MAX_BATCH]; // dictionary followed by the records of one batch.
+	uint16_t dictionaryLength;
+	uint16_t dictionaryID;
+
+	uint32_t bytesIn;
+	uint32_t bytesOut;
+	uint32_t batches;
+	uint64_t cpuTimeNs;
+
+	static uint64_t cpuTimeNow(void);
+	static uint32_t lzCompress(const uint8_t *window, uint32_t dictionaryLength, uint32_t length, uint8_t *output, uint32_t maxOutput);
+	static int32_t lzDecompress(const uint8_t *input, uint32_t length, uint8_t *window, uint32_t dictionaryLength, uint32_t maxOutput);
+};
+
+// tx_raw side.
+class MavlinkCompressor : public MavlinkCompressionState
+{
+	public:
+	MavlinkCompressor();
+
+	// frames is a batch of validated Mavlink frames (as put in the UDP package), returns the compressed size.
+	uint16_t compress(const uint8_t *frames, uint16_t length, uint8_t *output, uint16_t maxOutput);
+
+	// Dictionary for both sides: one full record of each msgid found in the frames, the most common last.
+	static uint16_t trainDictionary(const uint8_t *frames, uint32_t length, uint8_t *dictionary, uint16_t maxSize);
+
+	private:
+	uint16_t batchSeq;
+
+	static uint16_t encodeRecord(const uint8_t *frame, uint16_t frameLength, MsgidState *state, uint16_t batchSeq, bool allowDelta, uint8_t *output);
+};
+
+// rx_raw side.
+class MavlinkDecompressor : public MavlinkCompressionState
+{
+	public:
+	MavlinkDecompressor();
+
+	static bool isCompressed(const uint8_t *data, uint16_t length);
+	// Returns the size of the reconstructed frames in output, 0 on error.
+	uint16_t decompress(const uint8_t *data, uint16_t length, uint8_t *output, uint16_t maxOutput);
+
+	uint32_t getFramesLost(void);  // delta frames where the full instance was lost (UDP loss), dropped until the next full frame.
+	uint32_t getErrors(void);      // broken batches or wrong dictionary.
+	void clearErrors(void);
+
+	private:
+	uint32_t framesLost;
+	uint32_t errors;
+};
+
+#endif /* MAVLINKCOMPRESSION_H_ */
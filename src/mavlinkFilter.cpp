@@ -0,0 +1,236 @@
+/*
+	mavlinkFilter.cpp
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+#include "mavlinkFilter.h"
+
+MavlinkFilter::MavlinkFilter(){
+	bzero(&this->table, sizeof(this->table));
+	bzero(&this->heldFrames, sizeof(this->heldFrames));
+	// default is to forward everything, just like before the filter.
+}
+
+MavlinkFilter::~MavlinkFilter(){
+	for(int a=0;a<MAVLINK_FILTER_TABLE_SIZE;a++){
+		if(this->heldFrames[a] != NULL){
+			delete this->heldFrames[a];
+		}
+	}
+}
+
+// Policy file format, one msgid per line (# for comments):
+// <msgid|default> <forward|latest|drop> [max rate in Hz for latest]
+// Example:
+// default forward
+// 30 latest 5      (VFR_HUD max 5Hz)
+// 27 drop          (RAW_IMU)
+bool MavlinkFilter::loadPolicyFile(const char *filename){
+	FILE *fp = fopen(filename, "r");
+	if(fp == NULL){
+		fprintf(stderr, "MavlinkFilter: Unable to open policy file %s\n", filename);
+		return true;
+	}
+
+	char line[128];
+	uint32_t lineNumber=0;
+	bool error=false;
+	while(fgets(line, sizeof(line), fp) != NULL){
+		lineNumber++;
+		char id[32];
+		char name[32];
+		float rate=0;
+
+		char *comment = strchr(line, '#');
+		if(comment != NULL){
+			*comment=0;
+		}
+
+		int fields = sscanf(line, "%31s %31s %f", id, name, &rate);
+		if(fields <= 0){
+			continue; // empty line.
+		}
+		if(fields < 2){
+			fprintf(stderr, "MavlinkFilter: %s line %u - missing policy\n", filename, lineNumber);
+			error=true;
+			continue;
+		}
+
+		bool policyError=false;
+		MavlinkPolicy_t policy = parsePolicy(name, policyError);
+		if(policyError || (policy == MAVLINK_POLICY_LATEST && rate <= 0)){
+			fprintf(stderr, "MavlinkFilter: %s line %u - invalid policy \"%s\" (latest needs a rate > 0)\n", filename, lineNumber, name);
+			error=true;
+			continue;
+		}
+
+		if(strcmp(id, "default") == 0){
+			this->setDefaultPolicy(policy, rate);
+			continue;
+		}
+		char *end;
+		errno = 0;
+		unsigned long msgid = strtoul(id, &end, 10);
+		if(end == id || *end != 0 || errno != 0 || id[0] == '-' || msgid >= MAVLINK_FILTER_TABLE_SIZE){ // a name or a typo is not msgid 0 (HEARTBEAT).
+			fprintf(stderr, "MavlinkFilter: %s line %u - invalid msgid \"%s\" (0-%d or default)\n", filename, lineNumber, id, MAVLINK_FILTER_TABLE_SIZE - 1);
+			error=true;
+			continue;
+		}
+		this->setPolicy((uint32_t)msgid, policy, rate);
+	}
+	fclose(fp);
+	return error;
+}
+
+void MavlinkFilter::setPolicy(uint32_t msgid, MavlinkPolicy_t policy, float maxRate){
+	if(msgid >= MAVLINK_FILTER_TABLE_SIZE){
+		fprintf(stderr, "MavlinkFilter: msgid %u out of range, ignored\n", msgid);
+		return;
+	}
+	this->applyPolicy((uint16_t)msgid, policy, maxRate);
+	this->table[msgid].configured=true;
+}
+
+void MavlinkFilter::setDefaultPolicy(MavlinkPolicy_t policy, float maxRate){
+	for(uint16_t msgid=0;msgid<MAVLINK_FILTER_TABLE_SIZE;msgid++){
+		if(false == this->table[msgid].configured){
+			this->applyPolicy(msgid, policy, maxRate);
+		}
+	}
+}
+
+MavlinkFilterResult_t MavlinkFilter::input(const MavlinkFrame_t &frame, uint64_t nowMs){
+	if(frame.msgid >= MAVLINK_FILTER_TABLE_SIZE){
+		return MAVLINK_FILTER_FORWARD; // Mavlink 2 only msgids can't be configured.
+	}
+	FilterEntry *entry = &this->table[frame.msgid];
+
+	switch(entry->policy){
+		case MAVLINK_POLICY_DROP:
+			entry->bytesDropped += frame.length;
+			return MAVLINK_FILTER_DROP;
+
+		case MAVLINK_POLICY_LATEST:
+		{
+			if(false == entry->held && nowMs >= entry->nextSendTime){ // slot is free, send right away.
+				entry->nextSendTime = nowMs + entry->intervalMs;
+				entry->bytesForwarded += frame.length;
+				return MAVLINK_FILTER_FORWARD;
+			}
+			HeldFrame *held = this->heldFrames[frame.msgid];
+			if(true == entry->held){ // newer value replaces the one waiting.
+				entry->bytesDropped += held->frame.length;
+			}
+			// keep a copy of the raw frame, the parser buffer is reused on the next read.
+			memcpy(held->buffer, frame.data, frame.length);
+			held->frame = frame;
+			held->frame.data = held->buffer;
+			held->frame.payload = held->buffer + (frame.payload - frame.data);
+			entry->held=true;
+			return MAVLINK_FILTER_HOLD;
+		}
+
+		case MAVLINK_POLICY_FORWARD:
+		default:
+			entry->bytesForwarded += frame.length;
+			return MAVLINK_FILTER_FORWARD;
+	}
+}
+
+bool MavlinkFilter::getDueFrame(MavlinkFrame_t &frame, uint64_t nowMs){
+	for(uint32_t a=0;a<this->latestIDs.size();a++){
+		uint16_t msgid = this->latestIDs[a];
+		FilterEntry *entry = &this->table[msgid];
+		if(true == entry->held && nowMs >= entry->nextSendTime){
+			frame = this->heldFrames[msgid]->frame;
+			entry->held=false;
+			entry->nextSendTime = nowMs + entry->intervalMs;
+			entry->bytesForwarded += frame.length;
+			return true;
+		}
+	}
+	return false;
+}
+
+void MavlinkFilter::printStatus(FILE *out){
+	bool first=true;
+	for(uint16_t msgid=0;msgid<MAVLINK_FILTER_TABLE_SIZE;msgid++){
+		FilterEntry *entry = &this->table[msgid];
+		if(entry->bytesForwarded == 0 && entry->bytesDropped == 0){
+			continue;
+		}
+		if(first){
+			fprintf(out, "MAVLink per msgid (id:tx|dropped bytes):");
+			first=false;
+		}
+		fprintf(out, " %u:%u|%u", msgid, entry->bytesForwarded, entry->bytesDropped);
+	}
+	if(false == first){
+		fprintf(out, "\n");
+	}
+}
+
+void MavlinkFilter::clearStatus(void){
+	for(uint16_t msgid=0;msgid<MAVLINK_FILTER_TABLE_SIZE;msgid++){
+		this->table[msgid].bytesForwarded=0;
+		this->table[msgid].bytesDropped=0;
+	}
+}
+
+uint32_t MavlinkFilter::getBytesForwarded(void){
+	uint32_t total=0;
+	for(uint16_t msgid=0;msgid<MAVLINK_FILTER_TABLE_SIZE;msgid++){
+		total += this->table[msgid].bytesForwarded;
+	}
+	return total;
+}
+
+uint32_t MavlinkFilter::getBytesDropped(void){
+	uint32_t total=0;
+	for(uint16_t msgid=0;msgid<MAVLINK_FILTER_TABLE_SIZE;msgid++){
+		total += this->table[msgid].bytesDropped;
+	}
+	return total;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+////////////////////////// Private Helper functions //////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+void MavlinkFilter::applyPolicy(uint16_t msgid, MavlinkPolicy_t policy, float maxRate){
+	FilterEntry *entry = &this->table[msgid];
+	entry->policy = policy;
+	entry->held = false;
+	entry->nextSendTime = 0;
+	entry->intervalMs = 0;
+
+	// keep the list of LATEST msgids up to date.
+	for(uint32_t a=0;a<this->latestIDs.size();a++){
+		if(this->latestIDs[a] == msgid){
+			this->latestIDs.erase(this->latestIDs.begin() + a);
+			break;
+		}
+	}
+
+	if(policy == MAVLINK_POLICY_LATEST){
+		entry->intervalMs = (uint32_t)(1000.0f / maxRate);
+		if(this->heldFrames[msgid] == NULL){
+			this->heldFrames[msgid] = new HeldFrame;
+		}
+		this->latestIDs.push_back(msgid);
+	}
+}
+
+MavlinkPolicy_t MavlinkFilter::parsePolicy(const char *name, bool &error){
+	error=false;
+	if(strcmp(name, "forward") == 0){
+		return MAVLINK_POLICY_FORWARD;
+	}else if(strcmp(name, "latest") == 0){
+		return MAVLINK_POLICY_LATEST;
+	}else if(strcmp(name, "drop") == 0){
+		return MAVLINK_POLICY_DROP;
+	}
+	error=true;
+	return MAVLINK_POLICY_FORWARD;
+}
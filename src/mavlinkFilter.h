@@ -0,0 +1,80 @@
+/*
+	mavlinkFilter.h
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+
+#ifndef MAVLINKFILTER_H_
+#define MAVLINKFILTER_H_
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h> // bzero
+#include <vector>
+
+#include "mavlinkFrameParser.h"
+
+#define MAVLINK_FILTER_TABLE_SIZE 256 // one entry per Mavlink v1 msgid.
+
+// Policy for each message ID before it is batched for the LTE link:
+// FORWARD - always send.
+// LATEST  - send at most maxRate times per second, if more arrives in between only the newest is kept (latest-value-wins).
+// DROP    - never send.
+enum MavlinkPolicy_t{
+	MAVLINK_POLICY_FORWARD=0,
+	MAVLINK_POLICY_LATEST,
+	MAVLINK_POLICY_DROP
+};
+
+enum MavlinkFilterResult_t{
+	MAVLINK_FILTER_FORWARD=0, // send the message now.
+	MAVLINK_FILTER_HOLD,      // message is held back by the rate limit and will come out of getDueFrame().
+	MAVLINK_FILTER_DROP       // message is dropped.
+};
+
+class MavlinkFilter
+{
+	// Public functions
+	public:
+	MavlinkFilter();
+	virtual ~MavlinkFilter(); //destructor
+
+	bool loadPolicyFile(const char *filename); // returns true on error.
+	void setPolicy(uint32_t msgid, MavlinkPolicy_t policy, float maxRate); // maxRate in Hz, only used for LATEST.
+	void setDefaultPolicy(MavlinkPolicy_t policy, float maxRate);
+
+	MavlinkFilterResult_t input(const MavlinkFrame_t &frame, uint64_t nowMs); // apply policy to a parsed frame.
+	bool getDueFrame(MavlinkFrame_t &frame, uint64_t nowMs); // returns true and a held frame if its rate interval has elapsed (points into the filter, valid until next input()).
+
+	void printStatus(FILE *out); // prints per msgid byte counters (forwarded/dropped) for this interval.
+	void clearStatus(void);
+	uint32_t getBytesForwarded(void);
+	uint32_t getBytesDropped(void);
+
+	private:
+	struct FilterEntry{
+		MavlinkPolicy_t policy;
+		uint32_t intervalMs;     // minimum time between two messages for LATEST.
+		uint64_t nextSendTime;   // when the next LATEST message may be sent.
+		bool held;               // true when heldFrames[] contains a frame waiting for its slot.
+		bool configured;         // true when set explicitly, then the default policy will not change it.
+		uint32_t bytesForwarded; // counters for this status interval.
+		uint32_t bytesDropped;
+	};
+	struct HeldFrame{
+		MavlinkFrame_t frame;    // data and payload point into buffer below.
+		uint8_t buffer[MAVLINK_PARSER_MAX_FRAME_LEN];
+	};
+	FilterEntry table[MAVLINK_FILTER_TABLE_SIZE];
+	HeldFrame *heldFrames[MAVLINK_FILTER_TABLE_SIZE]; // only allocated for msgids with LATEST policy.
+	std::vector<uint16_t> latestIDs; // msgids with LATEST policy, so getDueFrame don't have to scan the full table.
+
+	void applyPolicy(uint16_t msgid, MavlinkPolicy_t policy, float maxRate);
+	static MavlinkPolicy_t parsePolicy(const char *name, bool &error);
+};
+
+#endif /* MAVLINKFILTER_H_ */
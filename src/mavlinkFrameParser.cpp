@@ -0,0 +1,388 @@
+/*
+	mavlinkFrameParser.cpp
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+#include "mavlinkFrameParser.h"
+
+static const uint8_t messageCRCs[256] = MAVLINK_MESSAGE_CRCS;
+static const uint8_t messageLengths[256] = MAVLINK_MESSAGE_LENGTHS;
+
+#define STX_NOT_FOUND 0xFFFFFFFF
+
+// X.25 (CRC-16/MCRF4XX) tables for slice-by-4, crcTable[0] is the normal byte table.
+static uint16_t crcTable[4][256];
+
+static struct CRCTableInit{
+	CRCTableInit(){
+		for(uint32_t a=0;a<256;a++){
+			uint16_t crc=(uint16_t)a;
+			for(int bit=0;bit<8;bit++){
+				crc = (crc & 1) ? ((crc >> 1) ^ 0x8408) : (crc >> 1);
+			}
+			crcTable[0][a]=crc;
+		}
+		for(uint32_t a=0;a<256;a++){
+			for(int slice=1;slice<4;slice++){
+				uint16_t prev = crcTable[slice-1][a];
+				crcTable[slice][a] = (prev >> 8) ^ crcTable[0][prev & 0xff];
+			}
+		}
+	}
+} crcTableInit;
+
+MavlinkFrameParser::MavlinkFrameParser(){
+	this->readIndex=0;
+	this->writeIndex=0;
+	for(int a=0;a<2;a++){
+		this->stxFound[a]=STX_NOT_FOUND;
+		this->stxScanned[a]=0;
+	}
+	this->clearIOstatus();
+}
+
+MavlinkFrameParser::~MavlinkFrameParser(){
+}
+
+uint8_t* MavlinkFrameParser::getInputBuffer(void){
+	this->compact();
+	return &this->buffer[this->writeIndex];
+}
+
+uint32_t MavlinkFrameParser::getInputBufferFreeSize(void){
+	this->compact();
+	return MAVLINK_PARSER_BUFFER_SIZE - this->writeIndex;
+}
+
+void MavlinkFrameParser::setData(uint32_t length){
+	if(length > MAVLINK_PARSER_BUFFER_SIZE - this->writeIndex){
+		length = MAVLINK_PARSER_BUFFER_SIZE - this->writeIndex;
+	}
+	this->writeIndex += length;
+}
+
+uint32_t MavlinkFrameParser::inputData(const uint8_t *data, uint32_t length){
+	uint8_t *dest = this->getInputBuffer();
+	if(length > this->getInputBufferFreeSize()){
+		length = this->getInputBufferFreeSize();
+	}
+	memcpy(dest, data, length);
+	this->writeIndex += length;
+	return length;
+}
+
+bool MavlinkFrameParser::nextFrame(MavlinkFrame_t &frame){
+	while(this->readIndex < this->writeIndex){
+		uint32_t stxV1 = this->findSTX(0, MAVLINK_STX);
+		uint32_t stxV2 = this->findSTX(1, MAVLINK2_STX);
+		this->skip(((stxV1 < stxV2) ? stxV1 : stxV2) - this->readIndex);
+		if(this->readIndex >= this->writeIndex){
+			return false; // no STX.
+		}
+
+		const uint8_t *stx = &this->buffer[this->readIndex];
+		uint32_t available = this->writeIndex - this->readIndex;
+		int32_t frameLength;
+		if(stx[0] == MAVLINK2_STX){
+			frameLength = this->checkMavlink2(stx, available, frame);
+		}else{
+			frameLength = this->checkMavlink1(stx, available, frame);
+		}
+
+		if(frameLength == 0){
+			return false; // wait for the rest of the frame.
+		}else if(frameLength < 0){
+			this->skip(1); // not a frame, resync on the next STX.
+			continue;
+		}
+
+		this->readIndex += (uint32_t)frameLength;
+		this->framesParsed++;
+		return true;
+	}
+	return false;
+}
+
+uint32_t MavlinkFrameParser::getFramesParsed(void){
+	return this->framesParsed;
+}
+
+uint32_t MavlinkFrameParser::getBytesSkipped(void){
+	return this->bytesSkipped;
+}
+
+uint32_t MavlinkFrameParser::getCRCErrors(void){
+	return this->crcErrors;
+}
+
+uint32_t MavlinkFrameParser::getHeaderErrors(void){
+	return this->headerErrors;
+}
+
+uint32_t MavlinkFrameParser::getUnknownMessages(void){
+	return this->unknownMessages;
+}
+
+void MavlinkFrameParser::clearIOstatus(void){
+	this->framesParsed=0;
+	this->bytesSkipped=0;
+	this->crcErrors=0;
+	this->headerErrors=0;
+	this->unknownMessages=0;
+}
+
+uint16_t MavlinkFrameParser::crc(const uint8_t *data, uint32_t length, uint16_t crcIn){
+	uint32_t crc = crcIn;
+	while(length >= 4){
+		crc ^= (uint32_t)data[0] | ((uint32_t)data[1] << 8);
+		crc = crcTable[3][crc & 0xff] ^ crcTable[2][(crc >> 8) & 0xff] ^ crcTable[1][data[2]] ^ crcTable[0][data[3]];
+		data += 4;
+		length -= 4;
+	}
+	while(length > 0){
+		crc = (crc >> 8) ^ crcTable[0][(crc ^ *data) & 0xff];
+		data++;
+		length--;
+	}
+	return (uint16_t)crc;
+}
+
+void MavlinkFrameParser::decode(const MavlinkFrame_t &frame, mavlink_message_t *msg){
+	msg->magic = frame.data[0];
+	msg->len = frame.payloadLength;
+	msg->seq = frame.seq;
+	msg->sysid = frame.sysid;
+	msg->compid = frame.compid;
+	msg->msgid = (uint8_t)frame.msgid;
+	msg->checksum = (uint16_t)frame.data[frame.length-2] | ((uint16_t)frame.data[frame.length-1] << 8);
+	memcpy(_MAV_PAYLOAD_NON_CONST(msg), frame.payload, frame.payloadLength);
+	if(frame.known && frame.payloadLength < messageLengths[frame.msgid]){ // trimmed Mavlink 2 payload, the decode functions expect the zeros.
+		memset(_MAV_PAYLOAD_NON_CONST(msg) + frame.payloadLength, 0, messageLengths[frame.msgid] - frame.payloadLength);
+	}
+}
+
+uint16_t MavlinkFrameParser::toMavlink2(const MavlinkFrame_t &frame, uint8_t *output){
+	if(frame.version == 2 || false == frame.known){
+		memcpy(output, frame.data, frame.length);
+		return frame.length;
+	}
+
+	uint8_t payloadLength = frame.payloadLength;
+	while(payloadLength > 1 && frame.payload[payloadLength-1] == 0){ // Mavlink 2 always keeps the first byte.
+		payloadLength--;
+	}
+
+	output[0] = MAVLINK2_STX;
+	output[1] = payloadLength;
+	output[2] = 0; // incompat flags
+	output[3] = 0; // compat flags
+	output[4] = frame.seq;
+	output[5] = frame.sysid;
+	output[6] = frame.compid;
+	output[7] = (uint8_t)frame.msgid;
+	output[8] = 0;
+	output[9] = 0;
+	memcpy(&output[MAVLINK2_HEADER_LEN], frame.payload, payloadLength);
+
+	return finishFrame(output, MAVLINK2_HEADER_LEN + payloadLength, frame.msgid);
+}
+
+uint16_t MavlinkFrameParser::toMavlink1(const MavlinkFrame_t &frame, uint8_t *output){
+	if(frame.version == 1 || false == frame.known){ // an unknown Mavlink 2 frame stays Mavlink 2, its length and CRC_EXTRA are not known.
+		memcpy(output, frame.data, frame.length);
+		return frame.length;
+	}
+
+	// Mavlink 1 has the full base payload, no trimming and no extension fields.
+	uint8_t payloadLength = messageLengths[frame.msgid];
+	output[0] = MAVLINK_STX;
+	output[1] = payloadLength;
+	output[2] = frame.seq;
+	output[3] = frame.sysid;
+	output[4] = frame.compid;
+	output[5] = (uint8_t)frame.msgid;
+	if(frame.payloadLength >= payloadLength){
+		memcpy(&output[MAVLINK_NUM_HEADER_BYTES], frame.payload, payloadLength);
+	}else{
+		memcpy(&output[MAVLINK_NUM_HEADER_BYTES], frame.payload, frame.payloadLength);
+		memset(&output[MAVLINK_NUM_HEADER_BYTES + frame.payloadLength], 0, payloadLength - frame.payloadLength);
+	}
+
+	return finishFrame(output, MAVLINK_NUM_HEADER_BYTES + payloadLength, frame.msgid);
+}
+
+uint16_t MavlinkFrameParser::finishFrame(uint8_t *output, uint16_t length, uint32_t msgid){
+	uint16_t checksum = crc(&output[1], length - 1, X25_INIT_CRC);
+	checksum = (checksum >> 8) ^ crcTable[0][(checksum ^ messageCRCs[msgid & 0xff]) & 0xff];
+	output[length] = (uint8_t)(checksum & 0xff);
+	output[length+1] = (uint8_t)(checksum >> 8);
+	return length + MAVLINK_NUM_CHECKSUM_BYTES;
+}
+
+uint16_t MavlinkFrameParser::getFrameLength(const uint8_t *data){
+	if(data[0] == MAVLINK_STX){
+		return (uint16_t)data[1] + MAVLINK_NUM_NON_PAYLOAD_BYTES;
+	}else if(data[0] == MAVLINK2_STX){
+		return MAVLINK2_HEADER_LEN + (uint16_t)data[1] + MAVLINK_NUM_CHECKSUM_BYTES + ((data[2] & MAVLINK2_IFLAG_SIGNED) ? MAVLINK2_SIGNATURE_LEN : 0);
+	}
+	return 0;
+}
+
+bool MavlinkFrameParser::isKnownMessage(uint32_t msgid){
+	return (msgid < 256 && messageLengths[msgid] != 0);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+////////////////////////// Private Helper functions //////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+int32_t MavlinkFrameParser::checkMavlink1(const uint8_t *stx, uint32_t available, MavlinkFrame_t &frame){
+	if(available < MAVLINK_NUM_HEADER_BYTES){
+		return 0; // wait for the rest of the header.
+	}
+
+	uint8_t payloadLength = stx[1];
+	uint8_t msgid = stx[5];
+	uint16_t frameLength = (uint16_t)payloadLength + MAVLINK_NUM_NON_PAYLOAD_BYTES;
+	bool known = isKnownMessage(msgid);
+	if(false == known){
+		int32_t result = this->checkFraming(stx, available, frameLength);
+		if(result <= 0){
+			return result;
+		}
+	}else if(messageLengths[msgid] != payloadLength){
+		// Mavlink 1 always sends the full payload, so this is not a frame start.
+		this->headerErrors++;
+		return -1;
+	}else if(available < frameLength){
+		return 0;
+	}else{
+		uint16_t checksum = crc(&stx[1], MAVLINK_CORE_HEADER_LEN + payloadLength, X25_INIT_CRC);
+		checksum = (checksum >> 8) ^ crcTable[0][(checksum ^ messageCRCs[msgid]) & 0xff];
+		if(stx[frameLength-2] != (uint8_t)(checksum & 0xff) || stx[frameLength-1] != (uint8_t)(checksum >> 8)){
+			this->crcErrors++;
+			return -1;
+		}
+	}
+
+	frame.data = stx;
+	frame.length = frameLength;
+	frame.payload = &stx[MAVLINK_NUM_HEADER_BYTES];
+	frame.payloadLength = payloadLength;
+	frame.version = 1;
+	frame.seq = stx[2];
+	frame.sysid = stx[3];
+	frame.compid = stx[4];
+	frame.msgid = msgid;
+	frame.known = known;
+	return frameLength;
+}
+
+int32_t MavlinkFrameParser::checkMavlink2(const uint8_t *stx, uint32_t available, MavlinkFrame_t &frame){
+	if(available < MAVLINK2_HEADER_LEN){
+		return 0;
+	}
+
+	uint8_t payloadLength = stx[1];
+	uint8_t incompatFlags = stx[2];
+	uint32_t msgid = (uint32_t)stx[7] | ((uint32_t)stx[8] << 8) | ((uint32_t)stx[9] << 16);
+	if((incompatFlags & ~MAVLINK2_IFLAG_SIGNED) != 0 || payloadLength == 0){
+		// Payload may be trimmed or have extensions, so the length can't be checked against the msgid.
+		this->headerErrors++;
+		return -1;
+	}
+
+	uint16_t frameLength = MAVLINK2_HEADER_LEN + (uint16_t)payloadLength + MAVLINK_NUM_CHECKSUM_BYTES;
+	if(incompatFlags & MAVLINK2_IFLAG_SIGNED){
+		frameLength += MAVLINK2_SIGNATURE_LEN; // forwarded as is, the signature is checked by the receiver.
+	}
+	bool known = isKnownMessage(msgid);
+	if(false == known){
+		int32_t result = this->checkFraming(stx, available, frameLength);
+		if(result <= 0){
+			return result;
+		}
+	}else if(available < frameLength){
+		return 0;
+	}else{
+		uint16_t crcIndex = MAVLINK2_HEADER_LEN + payloadLength;
+		uint16_t checksum = crc(&stx[1], crcIndex - 1, X25_INIT_CRC);
+		checksum = (checksum >> 8) ^ crcTable[0][(checksum ^ messageCRCs[msgid]) & 0xff];
+		if(stx[crcIndex] != (uint8_t)(checksum & 0xff) || stx[crcIndex+1] != (uint8_t)(checksum >> 8)){
+			this->crcErrors++;
+			return -1;
+		}
+	}
+
+	frame.data = stx;
+	frame.length = frameLength;
+	frame.payload = &stx[MAVLINK2_HEADER_LEN];
+	frame.payloadLength = payloadLength;
+	frame.version = 2;
+	frame.seq = stx[4];
+	frame.sysid = stx[5];
+	frame.compid = stx[6];
+	frame.msgid = msgid;
+	frame.known = known;
+	return frameLength;
+}
+
+// Without the CRC_EXTRA only the framing can be checked: the frame must end where the data ends (one UDP package
+// or read) or be followed by the next STX. A STX in the noise rarely passes both, the next frame then shows it.
+int32_t MavlinkFrameParser::checkFraming(const uint8_t *stx, uint32_t available, uint16_t frameLength){
+	if(available < frameLength){
+		return 0;
+	}
+	if(available > frameLength && stx[frameLength] != MAVLINK_STX && stx[frameLength] != MAVLINK2_STX){
+		this->headerErrors++;
+		return -1;
+	}
+	this->unknownMessages++;
+	return frameLength;
+}
+
+// memchr for one STX value, the result is kept until it has been parsed. Returns writeIndex if there is none.
+uint32_t MavlinkFrameParser::findSTX(uint8_t version, uint8_t stx){
+	if(this->stxFound[version] != STX_NOT_FOUND && this->stxFound[version] >= this->readIndex){
+		return this->stxFound[version];
+	}
+	uint32_t from = (this->stxScanned[version] > this->readIndex) ? this->stxScanned[version] : this->readIndex;
+	this->stxFound[version] = STX_NOT_FOUND;
+	this->stxScanned[version] = this->writeIndex;
+	if(from < this->writeIndex){
+		uint8_t *found = (uint8_t*)memchr(&this->buffer[from], stx, this->writeIndex - from);
+		if(found != NULL){
+			this->stxFound[version] = (uint32_t)(found - this->buffer);
+			this->stxScanned[version] = this->stxFound[version] + 1;
+			return this->stxFound[version];
+		}
+	}
+	return this->writeIndex;
+}
+
+// Move the unparsed tail (a partial frame) to the start of the buffer, so read() always gets the free space at the end.
+void MavlinkFrameParser::compact(void){
+	if(this->readIndex == 0){
+		return;
+	}
+	uint32_t remaining = this->writeIndex - this->readIndex;
+	if(remaining > 0){
+		memmove(this->buffer, &this->buffer[this->readIndex], remaining);
+	}
+	for(int a=0;a<2;a++){
+		if(this->stxFound[a] != STX_NOT_FOUND && this->stxFound[a] >= this->readIndex){
+			this->stxFound[a] -= this->readIndex;
+		}else{
+			this->stxFound[a] = STX_NOT_FOUND;
+		}
+		this->stxScanned[a] = (this->stxScanned[a] > this->readIndex) ? this->stxScanned[a] - this->readIndex : 0;
+	}
+	this->readIndex=0;
+	this->writeIndex=remaining;
+}
+
+void MavlinkFrameParser::skip(uint32_t length){
+	this->readIndex += length;
+	this->bytesSkipped += length;
+}
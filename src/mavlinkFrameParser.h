@@ -0,0 +1,99 @@
+/*
+	mavlinkFrameParser.h
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+
+#ifndef MAVLINKFRAMEPARSER_H_
+#define MAVLINKFRAMEPARSER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h> // bzero
+
+// for Mavlink, ardupilotmega first so its CRC_EXTRA and length tables (superset of common) are the ones used.
+#include "c_library_v1-master/ardupilotmega/mavlink.h"
+
+#define MAVLINK_PARSER_BUFFER_SIZE 4096 // bytes read from serial / UDP in one go, must be much larger than one frame.
+
+// Mavlink 2 framing, the vendored library only knows Mavlink 1 but the CRC_EXTRA table is the same for msgid 0-255.
+#define MAVLINK2_STX 0xFD
+#define MAVLINK2_HEADER_LEN 10    // STX, len, incompat flags, compat flags, seq, sysid, compid, msgid (3 bytes).
+#define MAVLINK2_SIGNATURE_LEN 13
+#define MAVLINK2_IFLAG_SIGNED 0x01
+#define MAVLINK_PARSER_MAX_FRAME_LEN (MAVLINK2_HEADER_LEN + MAVLINK_MAX_PAYLOAD_LEN + MAVLINK_NUM_CHECKSUM_BYTES + MAVLINK2_SIGNATURE_LEN)
+
+// One validated frame. data and payload point into the parser buffer (no copy), they are valid until
+// the next call to getInputBuffer() or inputData().
+typedef struct {
+	const uint8_t *data;    // full frame on the wire, STX to CRC.
+	uint16_t length;        // full frame length.
+	const uint8_t *payload;
+	uint8_t payloadLength;  // Mavlink 2 payloads are trimmed (trailing zeros removed).
+	uint8_t version;        // 1 or 2.
+	uint8_t seq;
+	uint8_t sysid;
+	uint8_t compid;
+	uint32_t msgid;
+	bool known;             // msgid in the vendored dialect, CRC checked. Others are only checked by their framing.
+} MavlinkFrame_t;
+
+// Bulk Mavlink 1 and 2 parser, replaces mavlink_parse_char() byte by byte:
+// STX is found with memchr, the length is checked against the message table and the CRC is
+// calculated over the whole frame with a slice-by-4 table, so a burst of frames is validated in one pass.
+// Only msgids known by the vendored dialect (0-255) can be CRC checked (the CRC_EXTRA is needed). Others, like the
+// Mavlink 2 only 24 bit msgids, are forwarded as is when the frame ends at the end of the data or at the next STX.
+// They are never converted between Mavlink 1 and 2, that would need a new CRC.
+class MavlinkFrameParser
+{
+	// Public functions
+	public:
+	MavlinkFrameParser();
+	virtual ~MavlinkFrameParser(); //destructor
+
+	uint8_t* getInputBuffer(void);         // read() directly into this buffer ...
+	uint32_t getInputBufferFreeSize(void); // ... up to this many bytes,
+	void setData(uint32_t length);         // ... and tell the parser how many bytes were read.
+	uint32_t inputData(const uint8_t *data, uint32_t length); // copy variant, returns number of bytes taken.
+
+	bool nextFrame(MavlinkFrame_t &frame); // returns true and the next valid frame, false when more data is needed.
+
+	uint32_t getFramesParsed(void);
+	uint32_t getBytesSkipped(void);  // bytes not part of a valid frame (noise, broken frames).
+	uint32_t getCRCErrors(void);
+	uint32_t getHeaderErrors(void);  // length not matching the msgid, unsupported Mavlink 2 flags or an unknown msgid not followed by a STX.
+	uint32_t getUnknownMessages(void); // frames forwarded without CRC check, msgid not in the dialect.
+	void clearIOstatus(void);
+
+	static uint16_t crc(const uint8_t *data, uint32_t length, uint16_t crcIn); // X.25 CRC like crc_calculate(), crcIn=X25_INIT_CRC to start.
+	static void decode(const MavlinkFrame_t &frame, mavlink_message_t *msg); // for the mavlink_msg_xxx_decode() functions.
+	static uint16_t toMavlink2(const MavlinkFrame_t &frame, uint8_t *output); // trimmed Mavlink 2 frame, returns the length. Mavlink 2 input is copied as is.
+	static uint16_t toMavlink1(const MavlinkFrame_t &frame, uint8_t *output); // full length Mavlink 1 frame (signature removed), returns the length.
+	static uint16_t finishFrame(uint8_t *output, uint16_t length, uint32_t msgid); // adds the CRC after header+payload, returns the frame length.
+	static uint16_t getFrameLength(const uint8_t *data); // length of an already validated frame from its header, 0 if data is not a STX.
+	static bool isKnownMessage(uint32_t msgid); // in the vendored dialect, its CRC can be checked and calculated.
+
+	private:
+	uint8_t buffer[MAVLINK_PARSER_BUFFER_SIZE];
+	uint32_t readIndex;  // first byte not parsed yet.
+	uint32_t writeIndex; // end of data.
+	uint32_t stxFound[2];   // index of the next Mavlink 1 / Mavlink 2 STX, so each byte is only searched once per version.
+	uint32_t stxScanned[2]; // searched up to here.
+
+	uint32_t framesParsed;
+	uint32_t bytesSkipped;
+	uint32_t crcErrors;
+	uint32_t headerErrors;
+	uint32_t unknownMessages;
+
+	int32_t checkMavlink1(const uint8_t *stx, uint32_t available, MavlinkFrame_t &frame); // returns frame length, 0 if more data is needed or -1 if not a frame.
+	int32_t checkMavlink2(const uint8_t *stx, uint32_t available, MavlinkFrame_t &frame);
+	int32_t checkFraming(const uint8_t *stx, uint32_t available, uint16_t frameLength); // unknown msgid, same return values.
+	uint32_t findSTX(uint8_t version, uint8_t stx);
+	void compact(void);
+	void skip(uint32_t length);
+};
+
+#endif /* MAVLINKFRAMEPARSER_H_ */
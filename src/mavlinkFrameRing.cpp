@@ -0,0 +1,142 @@
+/*
+	mavlinkFrameRing.cpp
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+#include "mavlinkFrameRing.h"
+
+#define MAVLINK_FRAME_RING_MASK (MAVLINK_FRAME_RING_FRAMES - 1)
+
+MavlinkFrameRing::MavlinkFrameRing(){
+	bzero(&this->descriptors, sizeof(this->descriptors));
+	this->clear();
+}
+
+MavlinkFrameRing::~MavlinkFrameRing(){
+}
+
+bool MavlinkFrameRing::push(const MavlinkFrame_t &frame, uint64_t timeMs){
+	uint8_t *data = this->prepare(frame.length);
+	if(data == NULL){
+		return true;
+	}
+	memcpy(data, frame.data, frame.length);
+	this->commit(frame, frame.length, timeMs);
+	return false;
+}
+
+uint8_t* MavlinkFrameRing::prepare(uint16_t maxLength){
+	this->prepared = this->findRoom(maxLength);
+	if(this->prepared < 0){
+		return NULL;
+	}
+	return &this->buffer[this->prepared];
+}
+
+void MavlinkFrameRing::commit(const MavlinkFrame_t &frame, uint16_t length, uint64_t timeMs){
+	if(this->prepared < 0){
+		fprintf(stderr, "MavlinkFrameRing: commit without prepare, frame msgid %u ignored\n", frame.msgid);
+		return;
+	}
+	MavlinkFrameDescriptor_t *descriptor = &this->descriptors[this->writeIndex & MAVLINK_FRAME_RING_MASK];
+	descriptor->offset = (uint16_t)this->prepared;
+	descriptor->length = length;
+	descriptor->msgid = frame.msgid;
+	descriptor->sysid = frame.sysid;
+	descriptor->compid = frame.compid;
+	descriptor->version = (this->buffer[this->prepared] == MAVLINK2_STX) ? 2 : 1; // converted frames differ from the input.
+	descriptor->timeMs = timeMs;
+	this->writeOffset = this->prepared + length;
+	this->bytes += length;
+	this->writeIndex++;
+	this->prepared = -1;
+}
+
+uint32_t MavlinkFrameRing::getFrames(void){
+	return this->writeIndex - this->readIndex;
+}
+
+uint32_t MavlinkFrameRing::getBytes(void){
+	return this->bytes;
+}
+
+const MavlinkFrameDescriptor_t* MavlinkFrameRing::getFrame(uint32_t index){
+	return &this->descriptors[(this->readIndex + index) & MAVLINK_FRAME_RING_MASK];
+}
+
+const uint8_t* MavlinkFrameRing::getData(const MavlinkFrameDescriptor_t *frame){
+	return &this->buffer[frame->offset];
+}
+
+int MavlinkFrameRing::peekBatch(uint32_t maxBytes, struct iovec *spans, uint32_t &frames){
+	int spanCount=0;
+	uint32_t total=0;
+	frames=0;
+	for(uint32_t index=this->readIndex; index != this->writeIndex; index++){
+		const MavlinkFrameDescriptor_t *descriptor = &this->descriptors[index & MAVLINK_FRAME_RING_MASK];
+		if(total + descriptor->length > maxBytes){
+			break;
+		}
+		uint8_t *data = &this->buffer[descriptor->offset];
+		if(spanCount > 0 && (uint8_t*)spans[spanCount-1].iov_base + spans[spanCount-1].iov_len == data){
+			spans[spanCount-1].iov_len += descriptor->length;
+		}else{ // the first frame, or the frames continue at the start of the ring.
+			if(spanCount == 2){
+				break;
+			}
+			spans[spanCount].iov_base = data;
+			spans[spanCount].iov_len = descriptor->length;
+			spanCount++;
+		}
+		total += descriptor->length;
+		frames++;
+	}
+	return spanCount;
+}
+
+void MavlinkFrameRing::pop(uint32_t frames){
+	if(frames > this->getFrames()){
+		frames = this->getFrames();
+	}
+	for(uint32_t a=0;a<frames;a++){
+		this->bytes -= this->descriptors[(this->readIndex + a) & MAVLINK_FRAME_RING_MASK].length;
+	}
+	this->readIndex += frames;
+	if(this->readIndex == this->writeIndex){
+		this->writeOffset = 0; // empty, the next frame starts at the beginning.
+	}
+}
+
+void MavlinkFrameRing::clear(void){
+	this->readIndex = 0;
+	this->writeIndex = 0;
+	this->writeOffset = 0;
+	this->bytes = 0;
+	this->prepared = -1;
+}
+
+// The frames are in one piece from the oldest (head) to writeOffset, or from head to the end of the
+// ring and then from the start to writeOffset once a frame did not fit at the end.
+int32_t MavlinkFrameRing::findRoom(uint16_t length){
+	if(length > MAVLINK_FRAME_RING_SIZE || this->getFrames() == MAVLINK_FRAME_RING_FRAMES){
+		return -1;
+	}
+	if(this->readIndex == this->writeIndex){
+		return 0;
+	}
+	uint32_t head = this->descriptors[this->readIndex & MAVLINK_FRAME_RING_MASK].offset;
+	if(this->writeOffset > head){
+		if(MAVLINK_FRAME_RING_SIZE - this->writeOffset >= length){
+			return this->writeOffset;
+		}
+		if(head >= length){
+			return 0; // wrap, the rest of the end is not used until the oldest frames are popped.
+		}
+		return -1;
+	}
+	if(head - this->writeOffset >= length){
+		return this->writeOffset;
+	}
+	return -1;
+}
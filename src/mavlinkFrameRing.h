@@ -0,0 +1,69 @@
+/*
+	mavlinkFrameRing.h
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+
+#ifndef MAVLINKFRAMERING_H_
+#define MAVLINKFRAMERING_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h> // bzero
+#include <sys/uio.h> // struct iovec
+#include "mavlinkFrameParser.h"
+
+#define MAVLINK_FRAME_RING_SIZE 4096   // bytes, several UDP batches.
+#define MAVLINK_FRAME_RING_FRAMES 128  // descriptors, power of two.
+
+// A frame in the ring, the bytes are at offset in one piece.
+typedef struct {
+	uint16_t offset;
+	uint16_t length;   // full frame on the wire, STX to CRC (and signature).
+	uint32_t msgid;
+	uint8_t sysid;
+	uint8_t compid;
+	uint8_t version;   // 1 or 2.
+	uint64_t timeMs;   // when it was put in the ring.
+} MavlinkFrameDescriptor_t;
+
+// Validated Mavlink frames kept as the bytes on the wire (no mavlink_message_t, no re-serializing), oldest first.
+// A frame is never split at the end of the byte ring, it goes to the start instead, so the frames of a UDP batch
+// are at most two spans (peekBatch) for one gather copy into the package. Not thread safe.
+class MavlinkFrameRing
+{
+	// Public functions
+	public:
+	MavlinkFrameRing();
+	virtual ~MavlinkFrameRing(); //destructor
+
+	bool push(const MavlinkFrame_t &frame, uint64_t timeMs); // copy of frame.data, returns true if the ring is full.
+	uint8_t* prepare(uint16_t maxLength); // room to write a frame in place (e.g. converted to Mavlink 2), NULL if the ring is full ...
+	void commit(const MavlinkFrame_t &frame, uint16_t length, uint64_t timeMs); // ... and length bytes of it written, with the ids of frame.
+
+	uint32_t getFrames(void);
+	uint32_t getBytes(void);
+	const MavlinkFrameDescriptor_t* getFrame(uint32_t index); // 0 is the oldest, index < getFrames().
+	const uint8_t* getData(const MavlinkFrameDescriptor_t *frame);
+
+	// The oldest frames up to maxBytes in total as 1 or 2 spans, returns the number of spans (0 if empty or
+	// the oldest frame is larger than maxBytes). Stays in the ring until pop().
+	int peekBatch(uint32_t maxBytes, struct iovec *spans, uint32_t &frames);
+	void pop(uint32_t frames); // removes the oldest frames.
+	void clear(void);
+
+	private:
+	uint8_t buffer[MAVLINK_FRAME_RING_SIZE];
+	MavlinkFrameDescriptor_t descriptors[MAVLINK_FRAME_RING_FRAMES];
+	uint32_t readIndex;   // free running, masked with MAVLINK_FRAME_RING_FRAMES - 1.
+	uint32_t writeIndex;
+	uint32_t writeOffset; // end of the newest frame.
+	uint32_t bytes;
+	int32_t prepared;     // offset given by prepare(), -1 if none.
+
+	int32_t findRoom(uint16_t length); // offset for a new frame, -1 if full.
+};
+
+#endif /* MAVLINKFRAMERING_H_ */
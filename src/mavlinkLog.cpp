@@ -0,0 +1,517 @@
+/*
+	mavlinkLog.cpp
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+#include "mavlinkLog.h"
+#include "mavlinkFrameParser.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <chrono>
+
+MavlinkLog::MavlinkLog(){
+	this->baseName[0] = 0;
+	this->segmentSize = MAVLINK_LOG_SEGMENT_SIZE;
+	this->indexFd = -1;
+	this->segmentFd = -1;
+	this->segment = 0;
+	this->map = NULL;
+	this->used = 0;
+	this->startSteadyUs = 0;
+	this->startRealtimeUs = 0;
+	bzero(&this->block, sizeof(this->block));
+	this->frames = 0;
+	this->bytes = 0;
+	this->droppedFrames = 0;
+	this->failed = false;
+	this->helperThread = NULL;
+	this->running = false;
+	this->spareFd = -1;
+	this->spareMap = NULL;
+	this->spareSegment = 0;
+	this->spareReady = false;
+	this->spareFailed = false;
+	this->retiredFd = -1;
+	this->retiredMap = NULL;
+	this->retiredSegment = 0;
+	this->retiredUsed = 0;
+	this->retiredReady = false;
+	bzero(&this->header, sizeof(this->header));
+	this->readMap = NULL;
+	this->readMapSize = 0;
+	this->readSegment = 0;
+	this->queryFromUs = 0;
+	this->queryToUs = 0;
+	this->queryMsgid = -1;
+	this->queryBlock = 0;
+	this->tailSegment = 0;
+	this->queryOffset = 0;
+	this->queryEnd = 0;
+	this->queryDone = true;
+	this->blocksRead = 0;
+}
+
+MavlinkLog::~MavlinkLog(){
+	this->close();
+}
+
+bool MavlinkLog::create(const char *base, uint32_t segmentSize){
+	this->close();
+	if(this->setBaseName(base)){
+		return true;
+	}
+	this->segmentSize = (segmentSize < MAVLINK_LOG_MIN_SEGMENT_SIZE) ? MAVLINK_LOG_MIN_SEGMENT_SIZE : segmentSize;
+
+	// Segments of an older log with the same name would be read as the tail of this one.
+	char name[MAVLINK_LOG_MAX_FILE_NAME];
+	for(uint32_t a=1;;a++){
+		this->getSegmentName(a, name, sizeof(name));
+		if(unlink(name) != 0){
+			break;
+		}
+	}
+
+	snprintf(name, sizeof(name), "%s.tidx", this->baseName);
+	this->indexFd = ::open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(this->indexFd < 0){
+		fprintf(stderr, "MavlinkLog: Unable to create %s (%s)\n", name, strerror(errno));
+		return true;
+	}
+	this->startSteadyUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	this->startRealtimeUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	MavlinkLogHeader_t header;
+	bzero(&header, sizeof(header));
+	header.magic = MAVLINK_LOG_MAGIC;
+	header.version = MAVLINK_LOG_VERSION;
+	header.headerSize = sizeof(MavlinkLogHeader_t);
+	header.entrySize = sizeof(MavlinkLogIndexEntry_t);
+	header.segmentSize = this->segmentSize;
+	header.startRealtimeUs = this->startRealtimeUs;
+	if(write(this->indexFd, &header, sizeof(header)) != sizeof(header)){
+		fprintf(stderr, "MavlinkLog: Write to %s failed (%s)\n", name, strerror(errno));
+		this->close();
+		return true;
+	}
+	this->segment = 1;
+	this->used = 0;
+	this->frames = 0;
+	this->bytes = 0;
+	this->droppedFrames = 0;
+	this->failed = false;
+	bzero(&this->block, sizeof(this->block));
+	if(this->openSegment(this->segment, this->segmentFd, this->map)){
+		this->close();
+		return true;
+	}
+	this->spareSegment = this->segment + 1;
+	this->spareReady = false;
+	this->spareFailed = false;
+	this->retiredReady = false;
+	__atomic_store_n(&this->running, true, __ATOMIC_RELEASE);
+	this->helperThread = new std::thread(&MavlinkLog::runHelper, this);
+	return false;
+}
+
+// The hot path: a range check and a memcpy into the mapped segment, the index entries and the segment files
+// are left to the helper thread.
+void MavlinkLog::logFrame(const uint8_t *frame, uint16_t length, uint64_t nowUs){
+	if(this->map == NULL || this->failed){
+		return;
+	}
+	uint32_t size = MAVLINK_LOG_TIME_SIZE + length;
+	uint64_t timeUs = this->startRealtimeUs + ((nowUs > this->startSteadyUs) ? nowUs - this->startSteadyUs : 0);
+	if(this->block.frames > 0 && (timeUs - this->block.startUs >= MAVLINK_LOG_BLOCK_US || this->block.length + size > MAVLINK_LOG_BLOCK_SIZE)){
+		this->endBlock();
+	}
+	if(this->used + size > this->segmentSize){
+		this->endBlock();
+		if(__atomic_load_n(&this->spareFailed, __ATOMIC_ACQUIRE)){
+			this->failed = true; // no room on the disk, the helper thread said so.
+			return;
+		}
+		if(false == __atomic_load_n(&this->spareReady, __ATOMIC_ACQUIRE) || __atomic_load_n(&this->retiredReady, __ATOMIC_ACQUIRE)){
+			this->droppedFrames++; // the helper thread is behind.
+			return;
+		}
+		this->retiredFd = this->segmentFd;
+		this->retiredMap = this->map;
+		this->retiredSegment = this->segment;
+		this->retiredUsed = this->used;
+		__atomic_store_n(&this->retiredReady, true, __ATOMIC_RELEASE);
+		this->segmentFd = this->spareFd;
+		this->map = this->spareMap;
+		this->segment = this->spareSegment;
+		this->used = 0;
+		__atomic_store_n(&this->spareReady, false, __ATOMIC_RELEASE);
+	}
+	if(this->block.frames == 0){
+		this->block.startUs = timeUs;
+		this->block.segment = this->segment;
+		this->block.offset = this->used;
+	}
+	uint8_t *record = &this->map[this->used];
+	for(uint32_t a=0;a<MAVLINK_LOG_TIME_SIZE;a++){
+		record[a] = (uint8_t)(timeUs >> (8*(MAVLINK_LOG_TIME_SIZE-1-a)));
+	}
+	memcpy(&record[MAVLINK_LOG_TIME_SIZE], frame, length);
+	uint8_t msgid = (uint8_t)getMsgid(frame);
+	this->block.msgids[msgid >> 3] |= (1 << (msgid & 0x07));
+	this->block.endUs = timeUs;
+	this->block.length += size;
+	this->block.frames++;
+	this->used += size;
+	this->frames++;
+	this->bytes += size;
+}
+
+void MavlinkLog::logFrames(const uint8_t *data, uint32_t length, uint64_t nowUs){
+	uint32_t offset = 0;
+	while(offset + MAVLINK_NUM_HEADER_BYTES <= length){
+		uint16_t frameLength = MavlinkFrameParser::getFrameLength(&data[offset]);
+		if(frameLength == 0 || offset + frameLength > length){
+			break; // not Mavlink, or cut.
+		}
+		this->logFrame(&data[offset], frameLength, nowUs);
+		offset += frameLength;
+	}
+}
+
+uint32_t MavlinkLog::getFrames(void){
+	return this->frames;
+}
+
+uint64_t MavlinkLog::getBytes(void){
+	return this->bytes;
+}
+
+uint32_t MavlinkLog::getDroppedFrames(void){
+	return this->droppedFrames;
+}
+
+bool MavlinkLog::open(const char *base){
+	this->close();
+	if(this->setBaseName(base)){
+		return true;
+	}
+	char name[MAVLINK_LOG_MAX_FILE_NAME];
+	snprintf(name, sizeof(name), "%s.tidx", this->baseName);
+	FILE *file = fopen(name, "rb");
+	if(file == NULL){
+		fprintf(stderr, "MavlinkLog: Unable to open %s (%s)\n", name, strerror(errno));
+		return true;
+	}
+	if(fread(&this->header, sizeof(this->header), 1, file) != 1 || this->header.magic != MAVLINK_LOG_MAGIC
+		|| this->header.version != MAVLINK_LOG_VERSION || this->header.headerSize < sizeof(MavlinkLogHeader_t)
+		|| this->header.entrySize < sizeof(MavlinkLogIndexEntry_t)){
+		fprintf(stderr, "MavlinkLog: %s is not a version %u log index\n", name, MAVLINK_LOG_VERSION);
+		fclose(file);
+		bzero(&this->header, sizeof(this->header));
+		return true;
+	}
+	// A cut entry at the end (power loss) is ignored, its frames are found by the tail scan.
+	std::vector<uint8_t> entry(this->header.entrySize);
+	fseek(file, this->header.headerSize, SEEK_SET);
+	while(fread(&entry[0], entry.size(), 1, file) == 1){
+		MavlinkLogIndexEntry_t next;
+		memcpy(&next, &entry[0], sizeof(next));
+		this->index.push_back(next);
+	}
+	fclose(file);
+	return false;
+}
+
+uint64_t MavlinkLog::getStartRealtimeUs(void){
+	return this->header.startRealtimeUs;
+}
+
+// Starts at the first block ending at or after fromUs (binary search, the blocks are in time order).
+void MavlinkLog::query(uint64_t fromUs, uint64_t toUs, int32_t msgid){
+	this->queryFromUs = fromUs;
+	this->queryToUs = toUs;
+	this->queryMsgid = msgid;
+	uint32_t low = 0;
+	uint32_t high = this->index.size();
+	while(low < high){
+		uint32_t middle = (low + high) / 2;
+		if(this->index[middle].endUs < fromUs){
+			low = middle + 1;
+		}else{
+			high = middle;
+		}
+	}
+	this->queryBlock = low;
+	this->tailSegment = 0;
+	this->queryOffset = 0;
+	this->queryEnd = 0;
+	this->queryDone = false;
+	this->blocksRead = 0;
+}
+
+bool MavlinkLog::next(const uint8_t *&frame, uint16_t &length, uint64_t &timeUs){
+	while(!this->queryDone){
+		if(this->queryOffset + MAVLINK_LOG_TIME_SIZE + MAVLINK_NUM_HEADER_BYTES > this->queryEnd){
+			this->nextBlock();
+			continue;
+		}
+		const uint8_t *record = &this->readMap[this->queryOffset];
+		uint16_t frameLength = MavlinkFrameParser::getFrameLength(&record[MAVLINK_LOG_TIME_SIZE]);
+		if(frameLength == 0 || this->queryOffset + MAVLINK_LOG_TIME_SIZE + frameLength > this->queryEnd){
+			this->queryOffset = this->queryEnd; // end of the used part of a segment (zeros) or a cut frame.
+			continue;
+		}
+		this->queryOffset += MAVLINK_LOG_TIME_SIZE + frameLength;
+		uint64_t recordUs = 0;
+		for(uint32_t a=0;a<MAVLINK_LOG_TIME_SIZE;a++){
+			recordUs = (recordUs << 8) | record[a];
+		}
+		if(recordUs > this->queryToUs){
+			this->queryDone = true;
+			break;
+		}
+		if(recordUs < this->queryFromUs || (this->queryMsgid >= 0 && getMsgid(&record[MAVLINK_LOG_TIME_SIZE]) != (uint32_t)this->queryMsgid)){
+			continue;
+		}
+		frame = &record[MAVLINK_LOG_TIME_SIZE];
+		length = frameLength;
+		timeUs = recordUs;
+		return true;
+	}
+	return false;
+}
+
+uint32_t MavlinkLog::getBlocksRead(void){
+	return this->blocksRead;
+}
+
+void MavlinkLog::close(void){
+	this->endBlock();
+	this->stopHelper(); // writes the queued index entries.
+	this->closeSegment(this->segment, this->segmentFd, this->map, this->used);
+	if(this->spareReady){ // the next segment was never used.
+		char name[MAVLINK_LOG_MAX_FILE_NAME];
+		this->getSegmentName(this->spareSegment, name, sizeof(name));
+		this->closeSegment(this->spareSegment, this->spareFd, this->spareMap, 0);
+		unlink(name);
+	}
+	this->spareFd = -1; // or taken by logFrame(), closed above.
+	this->spareMap = NULL;
+	this->spareReady = false;
+	if(this->indexFd >= 0){
+		::close(this->indexFd);
+		this->indexFd = -1;
+	}
+	if(this->readMap != NULL){
+		munmap((void *)this->readMap, this->readMapSize);
+		this->readMap = NULL;
+		this->readMapSize = 0;
+	}
+	this->readSegment = 0;
+	this->index.clear();
+	this->queryDone = true;
+}
+
+uint32_t MavlinkLog::getMsgid(const uint8_t *frame){
+	if(frame[0] == MAVLINK2_STX){
+		return frame[7] | ((uint32_t)frame[8] << 8) | ((uint32_t)frame[9] << 16);
+	}
+	return frame[5];
+}
+
+//////////////////////////////////////////////////////////////////////////////
+////////////////////////// Private Helper functions //////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+// A segment is allocated on the disk before it is mapped, so a full disk is an error here and not a SIGBUS
+// in logFrame(). File systems without fallocate (FAT) get the size with ftruncate.
+bool MavlinkLog::openSegment(uint32_t number, int &fd, uint8_t *&data){
+	char name[MAVLINK_LOG_MAX_FILE_NAME];
+	this->getSegmentName(number, name, sizeof(name));
+	fd = ::open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0){
+		fprintf(stderr, "MavlinkLog: Unable to create %s (%s)\n", name, strerror(errno));
+		return true;
+	}
+	if(fallocate(fd, 0, 0, this->segmentSize) != 0 && (errno != EOPNOTSUPP || ftruncate(fd, this->segmentSize) != 0)){
+		fprintf(stderr, "MavlinkLog: Unable to allocate %uMB for %s (%s), logging stopped\n", this->segmentSize/(1024*1024), name, strerror(errno));
+		::close(fd);
+		fd = -1;
+		unlink(name);
+		return true;
+	}
+	void *mapped = mmap(NULL, this->segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(mapped == MAP_FAILED){
+		fprintf(stderr, "MavlinkLog: Unable to map %s (%s)\n", name, strerror(errno));
+		::close(fd);
+		fd = -1;
+		return true;
+	}
+	madvise(mapped, this->segmentSize, MADV_SEQUENTIAL);
+	data = (uint8_t *)mapped;
+	return false;
+}
+
+// The segment is cut to the used size, so a closed log is a plain tlog.
+void MavlinkLog::closeSegment(uint32_t number, int &fd, uint8_t *&data, uint32_t used){
+	if(data != NULL){
+		munmap(data, this->segmentSize);
+		data = NULL;
+	}
+	if(fd >= 0){
+		if(ftruncate(fd, used) != 0){
+			fprintf(stderr, "MavlinkLog: Unable to truncate segment %u (%s)\n", number, strerror(errno));
+		}
+		::close(fd);
+		fd = -1;
+	}
+}
+
+// The entry is queued for the helper thread, a full queue (the disk stalled for minutes) loses it from the index.
+void MavlinkLog::endBlock(void){
+	if(this->block.frames == 0){
+		return;
+	}
+	if(!this->failed && false == this->indexQueue.push(this->block)){
+		fprintf(stderr, "MavlinkLog: Index queue full, block of %u frames only readable by scanning\n", this->block.frames);
+	}
+	bzero(&this->block, sizeof(this->block));
+}
+
+void MavlinkLog::stopHelper(void){
+	if(this->helperThread == NULL){
+		return;
+	}
+	__atomic_store_n(&this->running, false, __ATOMIC_RELEASE);
+	this->helperThread->join();
+	delete this->helperThread;
+	this->helperThread = NULL;
+}
+
+// The helper thread: index entries, the full segment from logFrame() and the next one. It finishes the index and
+// the full segment when stopped, so running is read first.
+void MavlinkLog::runHelper(void){
+	while(true){
+		bool running = __atomic_load_n(&this->running, __ATOMIC_ACQUIRE);
+		MavlinkLogIndexEntry_t entry;
+		while(this->indexQueue.pop(entry)){
+			if(write(this->indexFd, &entry, sizeof(entry)) != sizeof(entry)){
+				fprintf(stderr, "MavlinkLog: Index write failed (%s), the log is only readable by scanning\n", strerror(errno));
+			}
+		}
+		if(__atomic_load_n(&this->retiredReady, __ATOMIC_ACQUIRE)){
+			this->closeSegment(this->retiredSegment, this->retiredFd, this->retiredMap, this->retiredUsed);
+			__atomic_store_n(&this->retiredReady, false, __ATOMIC_RELEASE);
+		}
+		if(false == running){
+			return;
+		}
+		if(false == __atomic_load_n(&this->spareReady, __ATOMIC_ACQUIRE) && false == this->spareFailed){
+			if(this->spareMap != NULL){
+				this->spareSegment++; // the last one was taken.
+				this->spareMap = NULL;
+				this->spareFd = -1;
+			}
+			if(this->openSegment(this->spareSegment, this->spareFd, this->spareMap)){
+				__atomic_store_n(&this->spareFailed, true, __ATOMIC_RELEASE);
+			}else{
+				__atomic_store_n(&this->spareReady, true, __ATOMIC_RELEASE);
+			}
+		}
+		usleep(MAVLINK_LOG_HELPER_INTERVAL_US);
+	}
+}
+
+bool MavlinkLog::setBaseName(const char *base){
+	if(strlen(base) >= sizeof(this->baseName)){
+		fprintf(stderr, "MavlinkLog: Name %s is too long, max %d characters\n", base, MAVLINK_LOG_MAX_BASE_NAME-1);
+		this->baseName[0] = 0;
+		return true;
+	}
+	strcpy(this->baseName, base);
+	return false;
+}
+
+void MavlinkLog::getSegmentName(uint32_t number, char *name, uint32_t size){
+	snprintf(name, size, "%s-%04u.tlog", this->baseName, number);
+}
+
+bool MavlinkLog::mapSegment(uint32_t number){
+	if(this->readMap != NULL && this->readSegment == number){
+		return false;
+	}
+	if(this->readMap != NULL){
+		munmap((void *)this->readMap, this->readMapSize);
+		this->readMap = NULL;
+		this->readMapSize = 0;
+	}
+	char name[MAVLINK_LOG_MAX_FILE_NAME];
+	this->getSegmentName(number, name, sizeof(name));
+	int file = ::open(name, O_RDONLY);
+	if(file < 0){
+		return true;
+	}
+	struct stat info;
+	if(fstat(file, &info) < 0 || info.st_size == 0){
+		::close(file);
+		return true;
+	}
+	void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	::close(file);
+	if(data == MAP_FAILED){
+		fprintf(stderr, "MavlinkLog: Unable to map %s (%s)\n", name, strerror(errno));
+		return true;
+	}
+	this->readMap = (const uint8_t *)data;
+	this->readMapSize = info.st_size;
+	this->readSegment = number;
+	return false;
+}
+
+// Next block of the query: the indexed blocks in its range with its msgid, then the frames after the last index
+// entry (a log cut by a power loss) are scanned to the end of the segments.
+bool MavlinkLog::nextBlock(void){
+	while(this->tailSegment == 0 && this->queryBlock < this->index.size()){
+		const MavlinkLogIndexEntry_t &entry = this->index[this->queryBlock++];
+		if(entry.startUs > this->queryToUs){
+			this->queryDone = true;
+			return false;
+		}
+		if(this->queryMsgid >= 0 && !(entry.msgids[(this->queryMsgid & 0xFF) >> 3] & (1 << (this->queryMsgid & 0x07)))){
+			continue;
+		}
+		if(this->mapSegment(entry.segment) || entry.offset + entry.length > this->readMapSize){
+			continue;
+		}
+		this->queryOffset = entry.offset;
+		this->queryEnd = entry.offset + entry.length;
+		this->blocksRead++;
+		return true;
+	}
+
+	while(true){
+		uint32_t offset = 0;
+		if(this->tailSegment == 0){
+			this->tailSegment = 1;
+			if(this->index.size() > 0){
+				this->tailSegment = this->index.back().segment;
+				offset = this->index.back().offset + this->index.back().length;
+			}
+		}else{
+			this->tailSegment++;
+		}
+		if(this->mapSegment(this->tailSegment)){
+			this->queryDone = true;
+			return false;
+		}
+		if(offset < this->readMapSize){
+			this->queryOffset = offset;
+			this->queryEnd = this->readMapSize;
+			this->blocksRead++;
+			return true;
+		}
+	}
+}
@@ -0,0 +1,150 @@
+/*
+	mavlinkLog.h
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+
+#ifndef MAVLINKLOG_H_
+#define MAVLINKLOG_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h> // bzero
+#include <thread>
+#include <vector>
+#include "atomicRingBuf.h"
+
+#define MAVLINK_LOG_MAGIC 0x5444484F             // "OHDT" little endian.
+#define MAVLINK_LOG_VERSION 1
+#define MAVLINK_LOG_SEGMENT_SIZE (16*1024*1024)  // default, preallocated and mapped, 30+ minutes of a 57600 baud link.
+#define MAVLINK_LOG_MIN_SEGMENT_SIZE (64*1024)
+#define MAVLINK_LOG_BLOCK_US 1000000             // an index entry per second ...
+#define MAVLINK_LOG_BLOCK_SIZE (64*1024)         // ... or per this many bytes.
+#define MAVLINK_LOG_TIME_SIZE 8                  // tlog record: big endian us since 1970, then the frame.
+#define MAVLINK_LOG_MAX_FILE_NAME 256
+#define MAVLINK_LOG_MAX_BASE_NAME (MAVLINK_LOG_MAX_FILE_NAME-16) // room for -NNNN.tlog (up to 10 digits) and .tidx.
+#define MAVLINK_LOG_INDEX_QUEUE 256              // entries waiting for the helper thread, minutes of a stalled disk.
+#define MAVLINK_LOG_HELPER_INTERVAL_US 50000     // the helper thread looks for work this often.
+
+typedef struct {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t headerSize;       // sizeof(MavlinkLogHeader_t), entries start here.
+	uint16_t entrySize;        // sizeof(MavlinkLogIndexEntry_t).
+	uint16_t reserved;
+	uint32_t segmentSize;
+	uint64_t startRealtimeUs;  // tlog time of the first frame is at or after this.
+	uint64_t reserved2;
+} MavlinkLogHeader_t;
+
+// One block of frames in a segment, the index is sparse: a query reads the blocks overlapping its time range
+// and holding its msgid, not the file.
+typedef struct {
+	uint64_t startUs;          // tlog time of the first frame.
+	uint64_t endUs;            // tlog time of the last frame.
+	uint32_t segment;          // <base>-<segment>.tlog, from 1.
+	uint32_t offset;           // of the first record in the segment.
+	uint32_t length;           // bytes of records.
+	uint32_t frames;
+	uint8_t msgids[32];        // bit per msgid (msgid & 0xFF for Mavlink 2), set if the block has one.
+} MavlinkLogIndexEntry_t;
+
+// Append only Mavlink flight log in the tlog format (QGroundControl, MAVProxy and pymavlink read it), for
+// post-flight analysis of the link. Frames are copied into preallocated, memory mapped segments of
+// <base>-NNNN.tlog, and every second (or 64KB) an entry is added to the sparse index <base>.tidx.
+// The system calls are done by a helper thread: it writes the index entries, preallocates and maps the next
+// segment while the current one is filled (so it is on the disk too) and closes the full one, logFrame() is a
+// memcpy and at a rollover a swap of the maps. Should the next segment not be ready (a slow disk) the frames are
+// dropped and counted, the serial link is never held up by the log.
+// A segment is cut to its used size when it is closed, after a power loss it ends with zeros and the frames after
+// the last index entry are found by scanning the tail.
+class MavlinkLog
+{
+	// Public functions
+	public:
+	MavlinkLog();
+	virtual ~MavlinkLog(); //destructor
+
+	// Writing, nowUs is from the steady clock:
+	bool create(const char *base, uint32_t segmentSize); // returns true on error.
+	void logFrame(const uint8_t *frame, uint16_t length, uint64_t nowUs);
+	void logFrames(const uint8_t *data, uint32_t length, uint64_t nowUs); // one or more complete frames (a UDP package).
+	uint32_t getFrames(void);
+	uint64_t getBytes(void);
+	uint32_t getDroppedFrames(void); // the next segment was not ready.
+
+	// Reading, times are tlog times (us since 1970):
+	bool open(const char *base); // returns true on error.
+	uint64_t getStartRealtimeUs(void);
+	void query(uint64_t fromUs, uint64_t toUs, int32_t msgid); // msgid -1 = all, then call next().
+	bool next(const uint8_t *&frame, uint16_t &length, uint64_t &timeUs); // false when the query is done.
+	uint32_t getBlocksRead(void); // blocks the last query had to read.
+
+	void close(void);
+
+	static uint32_t getMsgid(const uint8_t *frame);
+
+	private:
+	char baseName[MAVLINK_LOG_MAX_BASE_NAME];
+	uint32_t segmentSize;
+
+	// Writing:
+	int indexFd;               // written by the helper thread once it runs.
+	int segmentFd;
+	uint32_t segment;
+	uint8_t *map;
+	uint32_t used;
+	uint64_t startSteadyUs;    // tlog time = startRealtimeUs + (nowUs - startSteadyUs), steady so the index is sorted.
+	uint64_t startRealtimeUs;
+	MavlinkLogIndexEntry_t block;
+	uint32_t frames;
+	uint64_t bytes;
+	uint32_t droppedFrames;
+	bool failed;
+
+	// Helper thread, the flags are __atomic: the spare segment is handed to logFrame() and the full one back.
+	std::thread *helperThread;
+	bool running;
+	SpscRingBuf<MavlinkLogIndexEntry_t, MAVLINK_LOG_INDEX_QUEUE> indexQueue;
+	int spareFd;
+	uint8_t *spareMap;
+	uint32_t spareSegment;
+	bool spareReady;
+	bool spareFailed;
+	int retiredFd;
+	uint8_t *retiredMap;
+	uint32_t retiredSegment;
+	uint32_t retiredUsed;
+	bool retiredReady;
+
+	// Reading:
+	MavlinkLogHeader_t header;
+	std::vector<MavlinkLogIndexEntry_t> index;
+	const uint8_t *readMap;
+	size_t readMapSize;
+	uint32_t readSegment;
+	uint64_t queryFromUs;
+	uint64_t queryToUs;
+	int32_t queryMsgid;
+	uint32_t queryBlock;       // next index entry.
+	uint32_t tailSegment;      // 0, or the segment of the unindexed tail being scanned.
+	uint32_t queryOffset;      // next record in the mapped segment.
+	uint32_t queryEnd;
+	bool queryDone;
+	uint32_t blocksRead;
+
+	bool openSegment(uint32_t number, int &fd, uint8_t *&data); // returns true on error.
+	void closeSegment(uint32_t number, int &fd, uint8_t *&data, uint32_t used);
+	void endBlock(void);
+	void stopHelper(void);
+	void runHelper(void);
+	bool setBaseName(const char *base); // returns true if it is too long.
+	void getSegmentName(uint32_t number, char *name, uint32_t size);
+	bool mapSegment(uint32_t number);
+	bool nextBlock(void);
+};
+
+#endif /* MAVLINKLOG_H_ */
@@ -0,0 +1,197 @@
+/*
+	metricsReader.cpp
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+
+// Samples the live metrics tx_raw / rx_raw publish in /dev/shm, read only, the processes are not touched.
+// Output is one JSON object per sample:
+// {"name":"tx","pid":N,"timeMs":T,"counters":{...},"gauges":{...},"histograms":{"x":{"count":N,"avg":A,"max":M,"p50":P,"p99":P}}}
+// With -d counters are per second and histograms only cover the samples since the last line (max is still since start).
+
+#include "shmMetrics.h"
+#include <getopt.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DEFAULT_SAMPLE_RATE_HZ 10
+#define MAX_SAMPLE_RATE_HZ 1000 // tx_raw / rx_raw publish at most once per ms.
+#define READ_RETRIES 100        // the writer holds the seqlock for a few us, retry before giving up this sample.
+
+int flagHelp = 0;
+
+void usage(void) {
+	printf("\nUsage: metricsReader [options]\n"
+	"\n"
+	"Options:\n"
+	"-n  <name>     Metrics to read, tx (tx_raw) or rx (rx_raw).\n"
+	"-r  <Hz>       Samples per second (default %d, max %d).\n"
+	"-c  <count>    Number of samples, 0 = until stopped (default 0).\n"
+	"-d             Counters as rate per second and histograms per sample instead of totals.\n"
+	"\n"
+	"Example:\n"
+	"  ./metricsReader -n tx\n"
+	"  ./metricsReader -n rx -r 100 -c 1000 -d > rx-metrics.json\n"
+	"\n", DEFAULT_SAMPLE_RATE_HZ, MAX_SAMPLE_RATE_HZ);
+	exit(1);
+}
+
+// Upper limit of the bucket holding the given percentile.
+uint64_t getPercentile(const ShmMetricsHistogram_t &histogram, uint32_t percent){
+	if(histogram.count == 0){
+		return 0;
+	}
+	uint64_t target = (histogram.count * percent + 99) / 100;
+	uint64_t sum = 0;
+	for(uint32_t a=0;a<SHM_METRICS_BUCKETS;a++){
+		sum += histogram.buckets[a];
+		if(sum >= target){
+			if(a == 0){
+				return 0;
+			}
+			uint64_t limit = (1ULL << a) - 1;
+			return (limit < histogram.max) ? limit : histogram.max;
+		}
+	}
+	return histogram.max;
+}
+
+void printSample(const char *name, const ShmMetricsBlock_t &sample, const ShmMetricsBlock_t *previous){
+	double seconds = 0;
+	if(previous != NULL && sample.publishTimeMs > previous->publishTimeMs){
+		seconds = (sample.publishTimeMs - previous->publishTimeMs) / 1000.0;
+	}
+	printf("{\"name\":\"%s\",\"pid\":%u,\"timeMs\":%llu", name, sample.pid, (unsigned long long)(sample.publishTimeMs - sample.startTimeMs));
+
+	for(uint32_t type=SHM_METRIC_COUNTER;type<=SHM_METRIC_GAUGE;type++){
+		printf((type == SHM_METRIC_COUNTER) ? ",\"counters\":{" : ",\"gauges\":{");
+		bool first = true;
+		for(uint32_t a=0;a<sample.counterCount;a++){
+			const ShmMetricsCounter_t *counter = &sample.counters[a];
+			if(counter->type != type || counter->name[0] == 0){
+				continue;
+			}
+			printf("%s\"%.*s\":", first ? "" : ",", SHM_METRICS_NAME_SIZE, counter->name);
+			first = false;
+			if(previous != NULL && type == SHM_METRIC_COUNTER){
+				uint64_t delta = counter->value - previous->counters[a].value;
+				printf("%.1f", (seconds > 0) ? delta / seconds : 0.0);
+			}else{
+				printf("%llu", (unsigned long long)counter->value);
+			}
+		}
+		printf("}");
+	}
+
+	printf(",\"histograms\":{");
+	for(uint32_t a=0;a<sample.histogramCount;a++){
+		ShmMetricsHistogram_t histogram = sample.histograms[a];
+		if(previous != NULL){
+			histogram.count -= previous->histograms[a].count;
+			histogram.sum -= previous->histograms[a].sum;
+			for(uint32_t b=0;b<SHM_METRICS_BUCKETS;b++){
+				histogram.buckets[b] -= previous->histograms[a].buckets[b];
+			}
+		}
+		printf("%s\"%.*s\":{\"count\":%llu,\"avg\":%.1f,\"max\":%llu,\"p50\":%llu,\"p99\":%llu}", (a == 0) ? "" : ",", SHM_METRICS_NAME_SIZE, histogram.name,
+			(unsigned long long)histogram.count, (histogram.count > 0) ? (double)histogram.sum / histogram.count : 0.0, (unsigned long long)histogram.max,
+			(unsigned long long)getPercentile(histogram, 50), (unsigned long long)getPercentile(histogram, 99));
+	}
+	printf("}}\n");
+	fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+	char *name=NULL;
+	uint32_t rate = DEFAULT_SAMPLE_RATE_HZ;
+	uint32_t count = 0;
+	bool delta = false;
+
+	while (1) {
+		int nOptionIndex;
+		static const struct option optiona[] = {
+			{ "help", no_argument, &flagHelp, 1 },
+			{      0,           0,         0, 0 }
+		};
+		int c = getopt_long(argc, argv, "h:n:r:c:d", optiona, &nOptionIndex);
+		if (c == -1) {
+			break;
+		}
+
+		switch (c) {
+			case 0: {
+				// long option
+				break;
+			}
+			case 'n': {
+				name = optarg;
+				break;
+			}
+			case 'r': {
+				rate = (uint32_t)atoi(optarg);
+				break;
+			}
+			case 'c': {
+				count = (uint32_t)atoi(optarg);
+				break;
+			}
+			case 'd': {
+				delta = true;
+				break;
+			}
+			default: {
+				usage();
+				break;
+			}
+		}
+	}
+	if(name == NULL || rate < 1 || rate > MAX_SAMPLE_RATE_HZ){
+		usage();
+	}
+
+	const ShmMetricsBlock_t *shared = ShmMetrics::attach(name);
+	if(shared == NULL){
+		fprintf(stderr, "metricsReader: No metrics for %s in /dev/shm (is it running?)\n", name);
+		exit(EXIT_FAILURE);
+	}
+
+	static ShmMetricsBlock_t sample, previous; // static, too large for the stack.
+	bool havePrevious = false;
+	uint32_t busy = 0;
+	for(uint32_t n=0; count == 0 || n < count; n++){
+		bool ok = false;
+		for(uint32_t a=0;a<READ_RETRIES && !ok;a++){
+			ok = ShmMetrics::readSnapshot(shared, sample);
+		}
+		if(!ok){
+			busy++;
+		}else if(sample.pid != previous.pid && havePrevious){
+			fprintf(stderr, "metricsReader: %s restarted (pid %u -> %u)\n", name, previous.pid, sample.pid);
+			havePrevious = false;
+		}
+		if(ok){
+			if(delta && !havePrevious){
+				n--; // first sample is only the reference.
+			}else{
+				printSample(name, sample, (delta) ? &previous : NULL);
+			}
+			memcpy(&previous, &sample, sizeof(sample));
+			havePrevious = true;
+		}
+		if(kill((pid_t)sample.pid, 0) != 0 && havePrevious){
+			fprintf(stderr, "metricsReader: %s (pid %u) has stopped\n", name, sample.pid);
+			break;
+		}
+		usleep(1000000 / rate);
+	}
+	if(busy > 0){
+		fprintf(stderr, "metricsReader: %u samples skipped, the writer was busy\n", busy);
+	}
+	return 0;
+}
@@ -0,0 +1,924 @@
+/*
+	mp4Recorder.cpp
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+#include "mp4Recorder.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NAL_TYPE_SLICE 1
+#define NAL_TYPE_IDR 5
+#define NAL_TYPE_SEI 6
+#define NAL_TYPE_SPS 7
+#define NAL_TYPE_PPS 8
+#define NAL_TYPE_AUD 9
+
+#define MP4_EPOCH_OFFSET 2082844800UL       // seconds from 1904 (MP4) to 1970.
+#define SAMPLE_FLAGS_KEYFRAME 0x02000000    // depends on no other sample.
+#define SAMPLE_FLAGS_DELTA 0x01010000       // depends on others, not a sync sample.
+
+// Reads the exp-Golomb coded fields of an SPS (emulation prevention bytes already removed).
+typedef struct {
+	const uint8_t *data;
+	uint32_t size;
+	uint32_t bit;
+} Mp4BitReader_t;
+
+static uint32_t readBits(Mp4BitReader_t &reader, uint32_t bits){
+	uint32_t value=0;
+	for(uint32_t a=0;a<bits;a++){
+		value <<= 1;
+		if(reader.bit < reader.size*8){
+			value |= (reader.data[reader.bit/8] >> (7 - reader.bit%8)) & 0x01;
+		}
+		reader.bit++;
+	}
+	return value;
+}
+
+static uint32_t readUE(Mp4BitReader_t &reader){
+	uint32_t leadingZeros=0;
+	while(readBits(reader, 1) == 0 && leadingZeros < 32 && reader.bit < reader.size*8){
+		leadingZeros++;
+	}
+	if(leadingZeros >= 32){
+		return 0;
+	}
+	return ((1UL << leadingZeros) - 1) + readBits(reader, leadingZeros);
+}
+
+static int32_t readSE(Mp4BitReader_t &reader){
+	uint32_t value = readUE(reader);
+	return (value & 0x01) ? (int32_t)((value+1)/2) : -(int32_t)(value/2);
+}
+
+static void skipScalingList(Mp4BitReader_t &reader, uint32_t size){
+	int32_t lastScale=8;
+	int32_t nextScale=8;
+	for(uint32_t a=0;a<size;a++){
+		if(nextScale != 0){
+			nextScale = (lastScale + readSE(reader) + 256) % 256;
+		}
+		lastScale = (nextScale == 0) ? lastScale : nextScale;
+	}
+}
+
+Mp4Recorder::Mp4Recorder(){
+	this->baseName[0]=0;
+	this->dateName=false;
+	this->fileName[0]=0;
+	this->fileNumber=0;
+	this->fd=-1;
+	this->fileSize=0;
+	this->maxFileSize=0;
+	this->fixedFrameRate=0;
+	this->syncFragments=false;
+	this->recording=false;
+	this->index=NULL;
+	this->inNal=false;
+	this->zeros=0;
+	this->nalStartUs=0;
+	this->spsSize=0;
+	this->ppsSize=0;
+	this->parameterSetsChanged=false;
+	bzero(&this->info, sizeof(this->info));
+	this->fragmentStartTime=0;
+	this->lastSampleUs=0;
+	this->lastDuration=0;
+	this->fragments=0;
+	this->frames=0;
+	this->preBuffer=NULL;
+	this->preBufferSize=0;
+	this->preStart=0;
+	this->preUsed=0;
+	this->preRecordUs=0;
+	this->clearAccessUnit();
+}
+
+Mp4Recorder::~Mp4Recorder(){
+	this->close();
+	free(this->preBuffer);
+}
+
+bool Mp4Recorder::setFileName(const char *base, bool dateName){
+	if(strlen(base) >= sizeof(this->baseName)){
+		fprintf(stderr, "Mp4Recorder: File name %s is too long, max %d characters\n", base, MP4_MAX_FILE_NAME-1);
+		return true;
+	}
+	strcpy(this->baseName, base);
+	this->dateName = dateName;
+	return false;
+}
+
+void Mp4Recorder::setFrameRate(uint32_t fps){
+	this->fixedFrameRate = fps;
+}
+
+void Mp4Recorder::setMaxFileSize(uint64_t bytes){
+	this->maxFileSize = bytes;
+}
+
+void Mp4Recorder::setSyncFragments(bool sync){
+	this->syncFragments = sync;
+}
+
+// The ring is allocated once here (pooled), the GOPs are copied into it while not recording.
+bool Mp4Recorder::setPreRecord(uint32_t seconds, uint32_t maxBytes){
+	this->preRecordClear();
+	free(this->preBuffer);
+	this->preBuffer=NULL;
+	this->preBufferSize=0;
+	this->preRecordUs=0;
+	if(seconds == 0 || maxBytes == 0){
+		return false;
+	}
+	this->preBuffer = (uint8_t *)malloc(maxBytes);
+	if(this->preBuffer == NULL){
+		fprintf(stderr, "Mp4Recorder: Unable to allocate %uMB for the pre-arm ring\n", maxBytes/(1024*1024));
+		return true;
+	}
+	this->preBufferSize = maxBytes;
+	this->preRecordUs = (uint64_t)seconds*1000000;
+	return false;
+}
+
+void Mp4Recorder::setIndex(RecordIndex *index){
+	this->index = index;
+}
+
+void Mp4Recorder::setRecording(bool recording){
+	this->recording = recording;
+}
+
+bool Mp4Recorder::isRecording(void){
+	return (this->fd >= 0);
+}
+
+void Mp4Recorder::inputData(const uint8_t *data, uint32_t length, uint64_t nowUs){
+	uint32_t start=0; // first byte not yet added to the NAL unit.
+	for(uint32_t a=0;a<length;a++){
+		if(data[a] == 0x00){
+			this->zeros++;
+		}else if(data[a] == 0x01 && this->zeros >= 2){
+			// Start code, the zeros before it (maybe from the last call) are not part of the NAL unit.
+			if(this->inNal){
+				if(this->nal.size() < MP4_MAX_NAL_SIZE){
+					this->nal.insert(this->nal.end(), &data[start], &data[a+1]);
+				}
+				uint32_t remove = (this->zeros + 1 < this->nal.size()) ? this->zeros + 1 : this->nal.size();
+				this->nal.resize(this->nal.size() - remove);
+				this->nalComplete();
+			}
+			this->nal.clear();
+			this->inNal=true;
+			this->nalStartUs=nowUs;
+			this->zeros=0;
+			start=a+1;
+		}else{
+			this->zeros=0;
+		}
+	}
+	if(this->inNal && start < length && this->nal.size() < MP4_MAX_NAL_SIZE){
+		this->nal.insert(this->nal.end(), &data[start], &data[length]);
+	}
+}
+
+void Mp4Recorder::close(void){
+	if(this->inNal){
+		while(this->nal.size() > 0 && this->nal.back() == 0x00){
+			this->nal.pop_back();
+		}
+		this->nalComplete();
+		this->nal.clear();
+		this->inNal=false;
+	}
+	this->recording=false;
+	if(this->fd >= 0 && this->accessUnitHasSlice){
+		this->accessUnitComplete();
+	}
+	this->clearAccessUnit();
+	this->closeFile();
+}
+
+const char* Mp4Recorder::getFileName(void){
+	return this->fileName;
+}
+
+uint64_t Mp4Recorder::getFileSize(void){
+	return this->fileSize;
+}
+
+uint32_t Mp4Recorder::getFragments(void){
+	return this->fragments;
+}
+
+uint32_t Mp4Recorder::getFrames(void){
+	return this->frames;
+}
+
+uint32_t Mp4Recorder::getPreRecordBytes(void){
+	return this->preUsed;
+}
+
+double Mp4Recorder::getPreRecordSeconds(void){
+	if(this->preSamples.size() == 0){
+		return 0;
+	}
+	return (this->lastSampleUs - this->preSamples.front().startUs)/1000000.0;
+}
+
+bool Mp4Recorder::parseSPS(const uint8_t *sps, uint32_t length, Mp4VideoInfo_t &info){
+	if(length < 4 || (sps[0] & 0x1F) != NAL_TYPE_SPS){
+		return false;
+	}
+	uint8_t rbsp[MP4_MAX_PARAMETER_SET];
+	uint32_t size=0;
+	uint32_t zeros=0;
+	for(uint32_t a=1;a<length && size<sizeof(rbsp);a++){
+		if(zeros >= 2 && sps[a] == 0x03){
+			zeros=0; // emulation prevention byte.
+			continue;
+		}
+		zeros = (sps[a] == 0x00) ? zeros+1 : 0;
+		rbsp[size++] = sps[a];
+	}
+	Mp4BitReader_t reader = {rbsp, size, 0};
+
+	bzero(&info, sizeof(info));
+	info.profile = readBits(reader, 8);
+	info.compatibility = readBits(reader, 8);
+	info.level = readBits(reader, 8);
+	info.chromaFormat = 1;
+	info.bitDepthLuma = 8;
+	info.bitDepthChroma = 8;
+	readUE(reader); // seq_parameter_set_id
+	if(info.profile == 100 || info.profile == 110 || info.profile == 122 || info.profile == 244 || info.profile == 44 ||
+		info.profile == 83 || info.profile == 86 || info.profile == 118 || info.profile == 128 || info.profile == 138 ||
+		info.profile == 139 || info.profile == 134 || info.profile == 135){
+		info.chromaFormat = readUE(reader);
+		if(info.chromaFormat == 3){
+			readBits(reader, 1); // separate_colour_plane_flag
+		}
+		info.bitDepthLuma = readUE(reader) + 8;
+		info.bitDepthChroma = readUE(reader) + 8;
+		readBits(reader, 1); // qpprime_y_zero_transform_bypass_flag
+		if(readBits(reader, 1)){ // seq_scaling_matrix_present_flag
+			uint32_t lists = (info.chromaFormat == 3) ? 12 : 8;
+			for(uint32_t a=0;a<lists;a++){
+				if(readBits(reader, 1)){
+					skipScalingList(reader, (a < 6) ? 16 : 64);
+				}
+			}
+		}
+	}
+	readUE(reader); // log2_max_frame_num_minus4
+	uint32_t pocType = readUE(reader);
+	if(pocType == 0){
+		readUE(reader); // log2_max_pic_order_cnt_lsb_minus4
+	}else if(pocType == 1){
+		readBits(reader, 1); // delta_pic_order_always_zero_flag
+		readSE(reader);
+		readSE(reader);
+		uint32_t cycle = readUE(reader);
+		for(uint32_t a=0;a<cycle && a<256;a++){
+			readSE(reader);
+		}
+	}
+	readUE(reader); // max_num_ref_frames
+	readBits(reader, 1); // gaps_in_frame_num_value_allowed_flag
+	uint32_t widthInMbs = readUE(reader) + 1;
+	uint32_t heightInMapUnits = readUE(reader) + 1;
+	uint32_t frameMbsOnly = readBits(reader, 1);
+	if(!frameMbsOnly){
+		readBits(reader, 1); // mb_adaptive_frame_field_flag
+	}
+	readBits(reader, 1); // direct_8x8_inference_flag
+	uint32_t cropLeft=0, cropRight=0, cropTop=0, cropBottom=0;
+	if(readBits(reader, 1)){ // frame_cropping_flag
+		cropLeft = readUE(reader);
+		cropRight = readUE(reader);
+		cropTop = readUE(reader);
+		cropBottom = readUE(reader);
+	}
+	uint32_t cropUnitX = (info.chromaFormat == 1 || info.chromaFormat == 2) ? 2 : 1;
+	uint32_t cropUnitY = ((info.chromaFormat == 1) ? 2 : 1) * (2 - frameMbsOnly);
+	uint32_t width = widthInMbs*16;
+	uint32_t height = (2 - frameMbsOnly)*heightInMapUnits*16;
+	if((cropLeft + cropRight)*cropUnitX < width && (cropTop + cropBottom)*cropUnitY < height){
+		width -= (cropLeft + cropRight)*cropUnitX;
+		height -= (cropTop + cropBottom)*cropUnitY;
+	}
+	info.width = width;
+	info.height = height;
+
+	if(readBits(reader, 1)){ // vui_parameters_present_flag
+		if(readBits(reader, 1)){ // aspect_ratio_info_present_flag
+			if(readBits(reader, 8) == 255){ // Extended_SAR
+				readBits(reader, 32);
+			}
+		}
+		if(readBits(reader, 1)){ // overscan_info_present_flag
+			readBits(reader, 1);
+		}
+		if(readBits(reader, 1)){ // video_signal_type_present_flag
+			readBits(reader, 4);
+			if(readBits(reader, 1)){ // colour_description_present_flag
+				readBits(reader, 24);
+			}
+		}
+		if(readBits(reader, 1)){ // chroma_loc_info_present_flag
+			readUE(reader);
+			readUE(reader);
+		}
+		if(readBits(reader, 1)){ // timing_info_present_flag
+			uint32_t unitsInTick = readBits(reader, 32);
+			uint32_t timeScale = readBits(reader, 32);
+			if(unitsInTick > 0 && timeScale > 0 && reader.bit <= size*8){
+				// A frame is two ticks (fields), e.g. 1001 / 60000 = 29.97 fps.
+				uint64_t duration = (uint64_t)MP4_TIMESCALE*2*unitsInTick / timeScale;
+				if(duration > 0 && duration <= MP4_TIMESCALE){
+					info.frameDuration = (uint32_t)duration;
+				}
+			}
+		}
+	}
+	return (reader.bit <= size*8 && info.width > 0 && info.height > 0);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+////////////////////////// Private Helper functions //////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+// A NAL unit is complete, access units are split on the first slice of a picture or the NAL units which start one.
+void Mp4Recorder::nalComplete(void){
+	if(this->nal.size() == 0){
+		return;
+	}
+	uint8_t type = this->nal[0] & 0x1F;
+	bool slice = (type == NAL_TYPE_SLICE || type == NAL_TYPE_IDR);
+	bool firstSlice = slice && this->nal.size() > 1 && (this->nal[1] & 0x80); // first_mb_in_slice == 0
+	if(this->accessUnitHasSlice && (firstSlice || (type >= NAL_TYPE_SEI && type <= NAL_TYPE_AUD))){
+		this->accessUnitComplete();
+	}
+	if(!this->accessUnitStarted){
+		this->accessUnitStarted=true;
+		this->accessUnitStartUs=this->nalStartUs;
+	}
+
+	if(type == NAL_TYPE_SPS || type == NAL_TYPE_PPS){
+		// Parameter sets go in the avcC, a change starts a new file on the next keyframe.
+		uint8_t *set = (type == NAL_TYPE_SPS) ? this->sps : this->pps;
+		uint16_t &setSize = (type == NAL_TYPE_SPS) ? this->spsSize : this->ppsSize;
+		if(this->nal.size() > MP4_MAX_PARAMETER_SET){
+			fprintf(stderr, "Mp4Recorder: %s of %u bytes is too large, ignored\n", (type == NAL_TYPE_SPS) ? "SPS" : "PPS", (uint32_t)this->nal.size());
+			return;
+		}
+		if(setSize != this->nal.size() || memcmp(set, &this->nal[0], setSize) != 0){
+			memcpy(set, &this->nal[0], this->nal.size());
+			setSize = this->nal.size();
+			this->parameterSetsChanged=true;
+			if(this->fd < 0){
+				// The GOPs in the pre-arm ring do not fit the new parameter sets, and the ring needs the frame rate of the new SPS.
+				this->preRecordClear();
+				if(type == NAL_TYPE_SPS && false == parseSPS(this->sps, this->spsSize, this->info)){
+					this->info.frameDuration=0;
+				}
+			}
+		}
+		return;
+	}
+	if(type == NAL_TYPE_AUD){
+		return;
+	}
+	uint32_t size = this->nal.size();
+	uint8_t length[4] = {(uint8_t)(size >> 24), (uint8_t)(size >> 16), (uint8_t)(size >> 8), (uint8_t)size};
+	this->accessUnit.insert(this->accessUnit.end(), length, length+4);
+	this->accessUnit.insert(this->accessUnit.end(), this->nal.begin(), this->nal.end());
+	if(slice){
+		this->accessUnitHasSlice=true;
+	}
+	if(type == NAL_TYPE_IDR){
+		this->accessUnitIsKeyFrame=true;
+	}
+}
+
+// A picture is complete.
+void Mp4Recorder::accessUnitComplete(void){
+	if(!this->accessUnitHasSlice){
+		this->clearAccessUnit();
+		return;
+	}
+	bool keyFrame = this->accessUnitIsKeyFrame;
+
+	if(this->fd >= 0 && this->samples.size() > 0){
+		this->samples.back().duration = this->getDuration(this->accessUnitStartUs);
+		if(keyFrame && (!this->recording || this->parameterSetsChanged || (this->maxFileSize > 0 && this->fileSize >= this->maxFileSize))){
+			this->closeFile();
+		}else if(keyFrame || this->mdat.size() >= MP4_MAX_FRAGMENT_SIZE || this->samples.size() >= MP4_MAX_FRAGMENT_SAMPLES){
+			this->writeFragment();
+		}
+	}
+
+	if(this->fd < 0){
+		// A file starts on a keyframe, or right away with the GOPs from before arming.
+		bool preRecorded = (this->preSamples.size() > 0);
+		if(preRecorded){
+			this->preSamples.back().duration = this->getDuration(this->accessUnitStartUs);
+		}
+		uint64_t startUs = preRecorded ? this->preSamples.front().startUs : this->accessUnitStartUs;
+		if(!this->recording || (!keyFrame && !preRecorded) || this->spsSize == 0 || this->ppsSize == 0 || this->openFile(startUs)){
+			this->preRecordAdd(keyFrame);
+			this->clearAccessUnit();
+			return;
+		}
+		if(preRecorded){
+			this->preRecordWrite(keyFrame);
+			if(this->fd < 0){
+				this->clearAccessUnit();
+				return;
+			}
+		}
+	}
+
+	Mp4Sample_t sample;
+	sample.duration = 0; // set when the next picture arrives.
+	sample.size = this->accessUnit.size();
+	sample.keyFrame = keyFrame;
+	sample.startUs = this->accessUnitStartUs;
+	this->samples.push_back(sample);
+	this->mdat.insert(this->mdat.end(), this->accessUnit.begin(), this->accessUnit.end());
+	this->lastSampleUs = this->accessUnitStartUs;
+	this->frames++;
+	this->clearAccessUnit();
+}
+
+void Mp4Recorder::clearAccessUnit(void){
+	this->accessUnit.clear();
+	this->accessUnitHasSlice=false;
+	this->accessUnitIsKeyFrame=false;
+	this->accessUnitStarted=false;
+	this->accessUnitStartUs=0;
+}
+
+// Duration of the last sample: fixed rate (-r), the rate in the SPS, or the time until the next picture arrived.
+uint32_t Mp4Recorder::getDuration(uint64_t nextStartUs){
+	if(this->fixedFrameRate > 0){
+		this->lastDuration = MP4_TIMESCALE / this->fixedFrameRate;
+	}else if(this->info.frameDuration > 0){
+		this->lastDuration = this->info.frameDuration;
+	}else if(nextStartUs > this->lastSampleUs){
+		uint64_t duration = (nextStartUs - this->lastSampleUs) * MP4_TIMESCALE / 1000000;
+		this->lastDuration = (duration > 0) ? (uint32_t)duration : 1;
+	}else if(this->lastDuration == 0){
+		this->lastDuration = 1; // pictures in the same read, the next ones get the time.
+	}
+	return this->lastDuration;
+}
+
+// startUs is the arrival of the first sample, the time 0 of the index.
+bool Mp4Recorder::openFile(uint64_t startUs){
+	if(false == parseSPS(this->sps, this->spsSize, this->info)){
+		fprintf(stderr, "Mp4Recorder: Unable to parse the SPS, waiting for the next one\n");
+		this->spsSize=0;
+		return true;
+	}
+	int length;
+	if(this->dateName){
+		time_t now = time(NULL);
+		struct tm *utc = gmtime(&now);
+		length = snprintf(this->fileName, sizeof(this->fileName), "%02d-%02d-%04d_%02d-%02d-%02d_%s.mp4", utc->tm_mday, utc->tm_mon+1, utc->tm_year+1900,
+			utc->tm_hour, utc->tm_min, utc->tm_sec, this->baseName);
+	}else{
+		do{
+			this->fileNumber++;
+			length = snprintf(this->fileName, sizeof(this->fileName), "%s%u.mp4", this->baseName, this->fileNumber);
+		}while(length > 0 && length < (int)sizeof(this->fileName) && access(this->fileName, F_OK) == 0);
+	}
+	if(length < 0 || length >= (int)sizeof(this->fileName)){ // a truncated name could be an other (existing) file.
+		fprintf(stderr, "Mp4Recorder: File name %s is too long with the date / number, max %d characters\n", this->baseName, MP4_MAX_FILE_NAME-1);
+		this->fileName[0]=0;
+		return true;
+	}
+	this->fd = ::open(this->fileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(this->fd < 0){
+		fprintf(stderr, "Mp4Recorder: Unable to create %s (%s)\n", this->fileName, strerror(errno));
+		return true;
+	}
+	this->fileSize=0;
+	this->fragments=0;
+	this->frames=0;
+	this->fragmentStartTime=0;
+	this->lastDuration=0;
+	this->parameterSetsChanged=false;
+	this->samples.clear();
+	this->mdat.clear();
+
+	this->box.clear();
+	this->buildMoov();
+	if(this->writeAll(&this->box[0], this->box.size())){
+		this->closeFile();
+		return true;
+	}
+	if(this->index != NULL){
+		this->index->create(this->fileName, RECORD_INDEX_MP4, startUs); // the recording goes on without it on errors.
+	}
+	fprintf(stderr, "Mp4Recorder: Recording %ux%u %s to %s\n", this->info.width, this->info.height,
+		(this->fixedFrameRate > 0 || this->info.frameDuration > 0) ? "at a fixed frame rate" : "with arrival timestamps", this->fileName);
+	return false;
+}
+
+// One moof + mdat with the samples since the last keyframe.
+void Mp4Recorder::writeFragment(void){
+	if(this->fd < 0 || this->samples.size() == 0){
+		return;
+	}
+	this->fragments++;
+	uint64_t moofOffset = this->fileSize;
+	this->box.clear();
+	uint32_t moof = this->beginBox("moof");
+	uint32_t mfhd = this->beginFullBox("mfhd", 0, 0);
+	this->put32(this->fragments); // sequence_number
+	this->endBox(mfhd);
+	uint32_t traf = this->beginBox("traf");
+	uint32_t tfhd = this->beginFullBox("tfhd", 0, 0x020000); // default-base-is-moof
+	this->put32(1); // track_ID
+	this->endBox(tfhd);
+	uint32_t tfdt = this->beginFullBox("tfdt", 1, 0);
+	this->put64(this->fragmentStartTime);
+	this->endBox(tfdt);
+	uint32_t trun = this->beginFullBox("trun", 0, 0x000701); // data-offset, sample duration, size and flags
+	this->put32(this->samples.size());
+	uint32_t dataOffset = this->box.size();
+	this->put32(0);
+	uint64_t duration=0;
+	for(uint32_t a=0;a<this->samples.size();a++){
+		this->put32(this->samples[a].duration);
+		this->put32(this->samples[a].size);
+		this->put32(this->samples[a].keyFrame ? SAMPLE_FLAGS_KEYFRAME : SAMPLE_FLAGS_DELTA);
+		duration += this->samples[a].duration;
+	}
+	this->endBox(trun);
+	this->endBox(traf);
+	this->endBox(moof);
+	this->set32(dataOffset, this->box.size() + 8); // first sample right after the mdat header.
+	this->put32(this->mdat.size() + 8);
+	this->putType("mdat");
+
+	if(this->writeAll(&this->box[0], this->box.size()) || this->writeAll(&this->mdat[0], this->mdat.size())){
+		this->closeFile();
+		return;
+	}
+	if(this->syncFragments){
+		fdatasync(this->fd);
+	}
+	if(this->index != NULL && this->samples[0].keyFrame){
+		this->index->keyFrame(this->samples[0].startUs, moofOffset, this->frames - this->samples.size(),
+			this->fragmentStartTime*1000000/MP4_TIMESCALE);
+	}
+	this->fragmentStartTime += duration;
+	this->samples.clear();
+	this->mdat.clear();
+}
+
+void Mp4Recorder::closeFile(void){
+	if(this->fd < 0){
+		return;
+	}
+	if(this->samples.size() > 0 && this->samples.back().duration == 0){
+		this->samples.back().duration = this->getDuration(0);
+	}
+	this->writeFragment();
+	if(this->index != NULL){
+		this->index->close();
+	}
+	if(this->fd >= 0){
+		::close(this->fd);
+		this->fd = -1;
+		fprintf(stderr, "Mp4Recorder: Closed %s, %u frames in %u fragments, %.1fMB, %.1fs\n", this->fileName, this->frames, this->fragments,
+			this->fileSize/(1024.0*1024.0), this->fragmentStartTime/(double)MP4_TIMESCALE);
+	}
+	this->samples.clear();
+	this->mdat.clear();
+}
+
+// Not recording, keep the picture in the pre-arm ring. The oldest GOP is dropped when the ring is full,
+// or when the GOP after it already covers the pre-arm time.
+void Mp4Recorder::preRecordAdd(bool keyFrame){
+	uint32_t size = this->accessUnit.size();
+	if(this->preBuffer == NULL || (!keyFrame && this->preSamples.size() == 0)){
+		return; // off, or waiting for a keyframe.
+	}
+	if(size > this->preBufferSize){
+		this->preRecordClear();
+		return;
+	}
+	if(keyFrame){
+		while(this->preSamples.size() > 0){
+			uint32_t next=1;
+			while(next < this->preSamples.size() && !this->preSamples[next].keyFrame){
+				next++;
+			}
+			if(next >= this->preSamples.size() || this->preSamples[next].startUs + this->preRecordUs > this->accessUnitStartUs){
+				break;
+			}
+			this->preRecordDropGop();
+		}
+	}
+	while(this->preSamples.size() > 0 && this->preUsed + size > this->preBufferSize){
+		this->preRecordDropGop();
+	}
+	if(!keyFrame && this->preSamples.size() == 0){
+		return; // the GOP of this picture did not fit.
+	}
+
+	uint32_t offset = (this->preStart + this->preUsed) % this->preBufferSize;
+	uint32_t first = (size < this->preBufferSize - offset) ? size : this->preBufferSize - offset;
+	memcpy(&this->preBuffer[offset], &this->accessUnit[0], first);
+	memcpy(this->preBuffer, &this->accessUnit[first], size - first);
+	this->preUsed += size;
+
+	Mp4Sample_t sample;
+	sample.duration = 0; // set when the next picture arrives.
+	sample.size = size;
+	sample.keyFrame = keyFrame;
+	sample.startUs = this->accessUnitStartUs;
+	this->preSamples.push_back(sample);
+	this->lastSampleUs = this->accessUnitStartUs;
+}
+
+void Mp4Recorder::preRecordDropGop(void){
+	do{
+		this->preStart = (this->preStart + this->preSamples.front().size) % this->preBufferSize;
+		this->preUsed -= this->preSamples.front().size;
+		this->preSamples.pop_front();
+	}while(this->preSamples.size() > 0 && !this->preSamples.front().keyFrame);
+	if(this->preSamples.size() == 0){
+		this->preStart=0;
+		this->preUsed=0;
+	}
+}
+
+// Recording started, the GOPs from the ring are written as fragments, the last one stays waiting unless the new picture is a keyframe.
+void Mp4Recorder::preRecordWrite(bool keyFrame){
+	double seconds = this->getPreRecordSeconds();
+	uint32_t offset = this->preStart;
+	for(uint32_t a=0;a<this->preSamples.size() && this->fd >= 0;a++){
+		const Mp4Sample_t &sample = this->preSamples[a];
+		if(this->samples.size() > 0 && (sample.keyFrame || this->mdat.size() >= MP4_MAX_FRAGMENT_SIZE || this->samples.size() >= MP4_MAX_FRAGMENT_SAMPLES)){
+			this->writeFragment();
+		}
+		uint32_t first = (sample.size < this->preBufferSize - offset) ? sample.size : this->preBufferSize - offset;
+		this->mdat.insert(this->mdat.end(), &this->preBuffer[offset], &this->preBuffer[offset + first]);
+		this->mdat.insert(this->mdat.end(), this->preBuffer, &this->preBuffer[sample.size - first]);
+		this->samples.push_back(sample);
+		this->frames++;
+		offset = (offset + sample.size) % this->preBufferSize;
+	}
+	if(keyFrame){
+		this->writeFragment();
+	}
+	if(this->fd >= 0){
+		fprintf(stderr, "Mp4Recorder: %.1fs (%u frames) from before arming written to %s\n", seconds, this->frames, this->fileName);
+	}
+	this->preRecordClear();
+}
+
+void Mp4Recorder::preRecordClear(void){
+	this->preSamples.clear();
+	this->preStart=0;
+	this->preUsed=0;
+}
+
+bool Mp4Recorder::writeAll(const uint8_t *data, uint32_t length){
+	uint32_t done=0;
+	while(done < length){
+		ssize_t result = write(this->fd, &data[done], length - done);
+		if(result < 0 && errno == EINTR){
+			continue;
+		}
+		if(result <= 0){
+			fprintf(stderr, "Mp4Recorder: Write to %s failed (%s), recording stopped\n", this->fileName, strerror(errno));
+			::close(this->fd);
+			this->fd = -1;
+			this->recording = false;
+			if(this->index != NULL){
+				this->index->close();
+			}
+			return true;
+		}
+		done += result;
+	}
+	this->fileSize += length;
+	return false;
+}
+
+void Mp4Recorder::put8(uint8_t value){
+	this->box.push_back(value);
+}
+
+void Mp4Recorder::put16(uint16_t value){
+	this->put8(value >> 8);
+	this->put8(value);
+}
+
+void Mp4Recorder::put32(uint32_t value){
+	this->put16(value >> 16);
+	this->put16(value);
+}
+
+void Mp4Recorder::put64(uint64_t value){
+	this->put32(value >> 32);
+	this->put32(value);
+}
+
+void Mp4Recorder::putType(const char *type){
+	this->box.insert(this->box.end(), type, type+4);
+}
+
+uint32_t Mp4Recorder::beginBox(const char *type){
+	uint32_t start = this->box.size();
+	this->put32(0); // size, set by endBox.
+	this->putType(type);
+	return start;
+}
+
+uint32_t Mp4Recorder::beginFullBox(const char *type, uint8_t version, uint32_t flags){
+	uint32_t start = this->beginBox(type);
+	this->put32(((uint32_t)version << 24) | (flags & 0xFFFFFF));
+	return start;
+}
+
+void Mp4Recorder::endBox(uint32_t start){
+	this->set32(start, this->box.size() - start);
+}
+
+void Mp4Recorder::set32(uint32_t offset, uint32_t value){
+	this->box[offset] = value >> 24;
+	this->box[offset+1] = value >> 16;
+	this->box[offset+2] = value >> 8;
+	this->box[offset+3] = value;
+}
+
+void Mp4Recorder::putMatrix(void){
+	const uint32_t matrix[9] = {0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000}; // unity
+	for(uint32_t a=0;a<9;a++){
+		this->put32(matrix[a]);
+	}
+}
+
+// ftyp and a moov without samples, the samples are in the fragments (mvex).
+void Mp4Recorder::buildMoov(void){
+	uint32_t now = (uint32_t)(time(NULL) + MP4_EPOCH_OFFSET);
+
+	uint32_t ftyp = this->beginBox("ftyp");
+	this->putType("isom");
+	this->put32(0x200);
+	this->putType("isom");
+	this->putType("iso6");
+	this->putType("avc1");
+	this->putType("mp41");
+	this->endBox(ftyp);
+
+	uint32_t moov = this->beginBox("moov");
+	uint32_t mvhd = this->beginFullBox("mvhd", 0, 0);
+	this->put32(now); // creation_time
+	this->put32(now); // modification_time
+	this->put32(1000); // timescale
+	this->put32(0); // duration, unknown (fragments)
+	this->put32(0x00010000); // rate 1.0
+	this->put16(0x0100); // volume 1.0
+	this->put16(0);
+	this->put64(0);
+	this->putMatrix();
+	for(uint32_t a=0;a<6;a++){
+		this->put32(0); // pre_defined
+	}
+	this->put32(2); // next_track_ID
+	this->endBox(mvhd);
+
+	uint32_t trak = this->beginBox("trak");
+	uint32_t tkhd = this->beginFullBox("tkhd", 0, 0x000003); // enabled, in movie
+	this->put32(now);
+	this->put32(now);
+	this->put32(1); // track_ID
+	this->put32(0);
+	this->put32(0); // duration
+	this->put64(0);
+	this->put16(0); // layer
+	this->put16(0); // alternate_group
+	this->put16(0); // volume, video
+	this->put16(0);
+	this->putMatrix();
+	this->put32((uint32_t)this->info.width << 16);
+	this->put32((uint32_t)this->info.height << 16);
+	this->endBox(tkhd);
+
+	uint32_t mdia = this->beginBox("mdia");
+	uint32_t mdhd = this->beginFullBox("mdhd", 0, 0);
+	this->put32(now);
+	this->put32(now);
+	this->put32(MP4_TIMESCALE);
+	this->put32(0); // duration
+	this->put16(0x55C4); // language "und"
+	this->put16(0);
+	this->endBox(mdhd);
+	uint32_t hdlr = this->beginFullBox("hdlr", 0, 0);
+	this->put32(0);
+	this->putType("vide");
+	this->put32(0);
+	this->put32(0);
+	this->put32(0);
+	const char name[] = "VideoHandler";
+	this->box.insert(this->box.end(), name, name+sizeof(name)); // with the 0 termination.
+	this->endBox(hdlr);
+
+	uint32_t minf = this->beginBox("minf");
+	uint32_t vmhd = this->beginFullBox("vmhd", 0, 1);
+	this->put16(0); // graphicsmode
+	this->put16(0); // opcolor
+	this->put16(0);
+	this->put16(0);
+	this->endBox(vmhd);
+	uint32_t dinf = this->beginBox("dinf");
+	uint32_t dref = this->beginFullBox("dref", 0, 0);
+	this->put32(1);
+	uint32_t url = this->beginFullBox("url ", 0, 1); // media in this file
+	this->endBox(url);
+	this->endBox(dref);
+	this->endBox(dinf);
+
+	uint32_t stbl = this->beginBox("stbl");
+	uint32_t stsd = this->beginFullBox("stsd", 0, 0);
+	this->put32(1);
+	uint32_t avc1 = this->beginBox("avc1");
+	this->put32(0); // reserved
+	this->put16(0);
+	this->put16(1); // data_reference_index
+	this->put16(0); // pre_defined
+	this->put16(0);
+	this->put32(0);
+	this->put32(0);
+	this->put32(0);
+	this->put16(this->info.width);
+	this->put16(this->info.height);
+	this->put32(0x00480000); // 72 dpi
+	this->put32(0x00480000);
+	this->put32(0);
+	this->put16(1); // frame_count
+	for(uint32_t a=0;a<32;a++){
+		this->put8(0); // compressorname
+	}
+	this->put16(0x0018); // depth
+	this->put16(0xFFFF); // pre_defined -1
+	uint32_t avcC = this->beginBox("avcC");
+	this->put8(1); // configurationVersion
+	this->put8(this->info.profile);
+	this->put8(this->info.compatibility);
+	this->put8(this->info.level);
+	this->put8(0xFF); // 4 byte NAL unit length
+	this->put8(0xE1); // 1 SPS
+	this->put16(this->spsSize);
+	this->box.insert(this->box.end(), this->sps, this->sps+this->spsSize);
+	this->put8(1); // 1 PPS
+	this->put16(this->ppsSize);
+	this->box.insert(this->box.end(), this->pps, this->pps+this->ppsSize);
+	if(this->info.profile == 100 || this->info.profile == 110 || this->info.profile == 122 || this->info.profile == 144){
+		this->put8(0xFC | this->info.chromaFormat);
+		this->put8(0xF8 | (this->info.bitDepthLuma - 8));
+		this->put8(0xF8 | (this->info.bitDepthChroma - 8));
+		this->put8(0); // numOfSequenceParameterSetExt
+	}
+	this->endBox(avcC);
+	this->endBox(avc1);
+	this->endBox(stsd);
+	const char *emptyTables[] = {"stts", "stsc", "stco"};
+	for(uint32_t a=0;a<3;a++){
+		uint32_t table = this->beginFullBox(emptyTables[a], 0, 0);
+		this->put32(0); // entry_count
+		this->endBox(table);
+	}
+	uint32_t stsz = this->beginFullBox("stsz", 0, 0);
+	this->put32(0); // sample_size
+	this->put32(0); // sample_count
+	this->endBox(stsz);
+	this->endBox(stbl);
+	this->endBox(minf);
+	this->endBox(mdia);
+	this->endBox(trak);
+
+	uint32_t mvex = this->beginBox("mvex");
+	uint32_t trex = this->beginFullBox("trex", 0, 0);
+	this->put32(1); // track_ID
+	this->put32(1); // default_sample_description_index
+	this->put32(0);
+	this->put32(0);
+	this->put32(0);
+	this->endBox(trex);
+	this->endBox(mvex);
+	this->endBox(moov);
+}
@@ -0,0 +1,161 @@
+/*
+	mp4Recorder.h
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+
+#ifndef MP4RECORDER_H_
+#define MP4RECORDER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h> // bzero
+#include <vector>
+#include <deque>
+#include "recordIndex.h"
+
+#define MP4_TIMESCALE 90000                 // ticks per second, like RTP video.
+#define MP4_MAX_FRAGMENT_SIZE (4*1024*1024) // a fragment is written at the next keyframe or when this much is waiting.
+#define MP4_MAX_FRAGMENT_SAMPLES 300
+#define MP4_MAX_PARAMETER_SET 256           // SPS / PPS bytes.
+#define MP4_MAX_NAL_SIZE (2*1024*1024)      // larger NAL units are cut, the stream is broken anyway.
+#define MP4_MAX_FILE_NAME 256
+#define MP4_DEFAULT_PRE_RECORD_MB 16        // pre-arm ring when only the seconds are given, fits a Pi Zero.
+
+// Parameters from the SPS needed for the MP4 sample entry.
+typedef struct {
+	uint8_t profile;
+	uint8_t compatibility;
+	uint8_t level;
+	uint8_t chromaFormat;
+	uint8_t bitDepthLuma;
+	uint8_t bitDepthChroma;
+	uint16_t width;
+	uint16_t height;
+	uint32_t frameDuration;  // in MP4_TIMESCALE from the VUI timing info, 0 if the SPS has none.
+} Mp4VideoInfo_t;
+
+typedef struct {
+	uint32_t duration;
+	uint32_t size;
+	bool keyFrame;
+	uint64_t startUs;        // arrival, used by the pre-arm ring.
+} Mp4Sample_t;
+
+// Records an H.264 Annex-B stream (as it comes from the camera or rx_raw) to fragmented MP4, no ffmpeg afterwards:
+// - ftyp + moov with the avcC from the SPS/PPS of the stream are written when a file starts on a keyframe.
+// - each GOP is one moof + mdat, with sample durations from the VUI frame rate, a fixed rate or the arrival times.
+// - a file cut by a power loss plays up to the last complete fragment.
+// Recording starts on the next keyframe after setRecording(true) and stops on the next keyframe after setRecording(false).
+// A new file is started on a keyframe when the file is larger than the max size or the SPS/PPS changed.
+// With a pre-arm ring the last complete GOPs (N seconds, max M bytes) are kept in memory while not recording,
+// and are written first when recording starts, so the file begins before the drone was armed.
+class Mp4Recorder
+{
+	// Public functions
+	public:
+	Mp4Recorder();
+	virtual ~Mp4Recorder(); //destructor
+
+	bool setFileName(const char *base, bool dateName); // dateName: <UTC date>_<base>.mp4, else <base><N>.mp4 with the first unused N. Returns true if base is too long.
+	void setFrameRate(uint32_t fps);       // 0 = from the SPS, or the arrival times if the SPS has no frame rate.
+	void setMaxFileSize(uint64_t bytes);   // 0 = no limit.
+	void setSyncFragments(bool sync);      // fdatasync after every fragment, for a dedicated recorder process.
+	bool setPreRecord(uint32_t seconds, uint32_t maxBytes); // 0 seconds = off, returns true on error (no memory).
+	void setIndex(RecordIndex *index);     // keyframe index sidecar (.idx) created and closed with every file, NULL = none.
+	void setRecording(bool recording);
+	bool isRecording(void);                // a file is open.
+
+	void inputData(const uint8_t *data, uint32_t length, uint64_t nowUs);
+	void close(void);                      // write what is waiting and close the file (end of stream).
+
+	const char* getFileName(void);
+	uint64_t getFileSize(void);
+	uint32_t getFragments(void);
+	uint32_t getFrames(void);
+	uint32_t getPreRecordBytes(void);      // in the pre-arm ring now.
+	double getPreRecordSeconds(void);
+
+	static bool parseSPS(const uint8_t *sps, uint32_t length, Mp4VideoInfo_t &info); // returns true if ok.
+
+	private:
+	char baseName[MP4_MAX_FILE_NAME];
+	bool dateName;
+	char fileName[MP4_MAX_FILE_NAME];
+	uint32_t fileNumber;
+	int fd;
+	uint64_t fileSize;
+	uint64_t maxFileSize;
+	uint32_t fixedFrameRate;
+	bool syncFragments;
+	bool recording;
+	RecordIndex *index;
+
+	// Annex-B parsing:
+	std::vector<uint8_t> nal;         // NAL unit being received, without start code.
+	bool inNal;
+	uint32_t zeros;                   // 0x00 bytes in a row, a start code is 00 00 01.
+	uint64_t nalStartUs;
+
+	// Access unit being built (length prefixed NAL units):
+	std::vector<uint8_t> accessUnit;
+	bool accessUnitHasSlice;
+	bool accessUnitIsKeyFrame;
+	bool accessUnitStarted;
+	uint64_t accessUnitStartUs;       // arrival of its first NAL unit.
+
+	uint8_t sps[MP4_MAX_PARAMETER_SET];
+	uint16_t spsSize;
+	uint8_t pps[MP4_MAX_PARAMETER_SET];
+	uint16_t ppsSize;
+	bool parameterSetsChanged;        // new SPS/PPS since the file was started.
+	Mp4VideoInfo_t info;
+
+	// Fragment waiting for the next keyframe:
+	std::vector<uint8_t> mdat;
+	std::vector<Mp4Sample_t> samples;
+	uint64_t fragmentStartTime;       // decode time of the first sample (MP4_TIMESCALE).
+	uint64_t lastSampleUs;            // arrival of the last sample.
+	uint32_t lastDuration;
+	uint32_t fragments;
+	uint32_t frames;
+	std::vector<uint8_t> box;         // boxes are built here before they are written.
+
+	// Pre-arm ring, GOPs in one buffer allocated at setPreRecord, the first sample is always a keyframe:
+	uint8_t *preBuffer;
+	uint32_t preBufferSize;
+	uint32_t preStart;                // offset of the first byte of the oldest GOP.
+	uint32_t preUsed;
+	uint64_t preRecordUs;
+	std::deque<Mp4Sample_t> preSamples;
+
+	void nalComplete(void);
+	void accessUnitComplete(void);
+	void clearAccessUnit(void);
+	uint32_t getDuration(uint64_t nextStartUs);
+	bool openFile(uint64_t startUs);
+	void writeFragment(void);
+	void closeFile(void);
+	bool writeAll(const uint8_t *data, uint32_t length); // returns true on error.
+	void preRecordAdd(bool keyFrame);
+	void preRecordDropGop(void);
+	void preRecordWrite(bool keyFrame);
+	void preRecordClear(void);
+
+	void put8(uint8_t value);
+	void put16(uint16_t value);
+	void put32(uint32_t value);
+	void put64(uint64_t value);
+	void putType(const char *type);
+	uint32_t beginBox(const char *type);
+	uint32_t beginFullBox(const char *type, uint8_t version, uint32_t flags);
+	void endBox(uint32_t start);
+	void set32(uint32_t offset, uint32_t value);
+	void putMatrix(void);
+	void buildMoov(void);
+};
+
+#endif /* MP4RECORDER_H_ */
@@ -0,0 +1,191 @@
+/*
+	pathMtu.cpp
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+#include "pathMtu.h"
+
+PathMtu::PathMtu(){
+	bzero(&this->probe, sizeof(this->probe));
+	this->packageSize = UDP_PACKET_SIZE;
+	this->probeId = 0;
+	this->probesSent = 0;
+	this->probesLost = 0;
+	this->nextCheckMs = 0;
+	this->start();
+}
+
+PathMtu::~PathMtu(){
+}
+
+void PathMtu::start(void){
+	this->state = PATH_MTU_SEARCH;
+	this->low = UDP_MIN_PACKET_SIZE;
+	this->high = UDP_MAX_PACKET_SIZE;
+	this->answered = false;
+	this->probeSize = UDP_MAX_PACKET_SIZE; // a clean ethernet path is the common case, done with one probe.
+	this->tries = 0;
+	this->sentMs = 0;
+	this->searchStartMs = 0;
+	this->nextSearchMs = 0;
+}
+
+uint16_t PathMtu::service(Connection &connection, uint64_t nowMs){
+	if(this->state == PATH_MTU_IDLE){
+		if(nowMs >= this->nextSearchMs){
+			this->start();
+		}else if(nowMs >= this->nextCheckMs){
+			this->state = PATH_MTU_CHECK;
+			this->probeSize = this->packageSize;
+			this->tries = 0;
+			this->sentMs = 0;
+		}else{
+			return this->packageSize;
+		}
+	}
+	if(this->searchStartMs == 0){
+		this->searchStartMs = nowMs;
+		if(this->state == PATH_MTU_SEARCH){ // an IPv6 path has 20 bytes less, starting at 1472 would only lose a probe.
+			this->high = PathMtu::getMaxPackageSize(connection);
+			this->probeSize = this->high;
+		}
+	}
+
+	if(this->sentMs != 0){
+		if(nowMs - this->sentMs < PATH_MTU_TIMEOUT_MS){
+			return this->packageSize; // waiting for the ack.
+		}
+		this->probesLost++;
+		this->sentMs = 0;
+		if(++this->tries >= PATH_MTU_TRIES){
+			this->result(false, nowMs);
+			if(this->state == PATH_MTU_IDLE){
+				return this->packageSize;
+			}
+		}
+	}
+
+	this->probeId++;
+	build(this->probe, PATH_MTU_TYPE_PROBE, this->probeId, this->probeSize);
+	int result = connection.writeProbe(this->probe, this->probeSize);
+	if(result == -EMSGSIZE){ // larger than the MTU of our own interface, no need to wait.
+		this->tries = PATH_MTU_TRIES;
+		this->result(false, nowMs);
+	}else if(result != 0){ // sent, or an error (link down) which is a lost probe.
+		this->sentMs = nowMs;
+		this->probesSent++;
+	}
+	return this->packageSize;
+}
+
+bool PathMtu::input(const uint8_t *data, uint32_t length, uint64_t nowMs){
+	PathMtuProbe_t ack;
+	if(length != sizeof(ack)){
+		return false;
+	}
+	memcpy(&ack, data, sizeof(ack));
+	if(ack.magic != PATH_MTU_MAGIC || ack.version != PATH_MTU_VERSION || ack.type != PATH_MTU_TYPE_ACK){
+		return false;
+	}
+	if(this->sentMs != 0 && ack.id == this->probeId && ack.size == this->probeSize){ // older acks (resent probes) are ignored.
+		this->sentMs = 0;
+		this->result(true, nowMs);
+	}
+	return true;
+}
+
+void PathMtu::result(bool acked, uint64_t nowMs){
+	this->tries = 0;
+	if(this->state == PATH_MTU_CHECK){
+		if(acked){
+			this->state = PATH_MTU_IDLE;
+			this->nextCheckMs = nowMs + PATH_MTU_CHECK_MS;
+		}else{
+			fprintf(stderr, "PathMtu: %u byte packages are lost now, the path changed. Searching again.\n", this->packageSize);
+			this->start();
+		}
+		return;
+	}
+
+	if(acked){
+		this->low = this->probeSize;
+		this->answered = true;
+	}else{
+		this->high = this->probeSize - 1;
+		if(this->answered && this->high < this->packageSize){
+			this->packageSize = this->low; // too large for the path, use the largest acked until the search is done.
+		}
+	}
+	if(this->high < this->low + PATH_MTU_STEP){
+		this->finishSearch(nowMs);
+		return;
+	}
+	this->probeSize = this->low + (this->high - this->low + 1) / 2;
+}
+
+void PathMtu::finishSearch(uint64_t nowMs){
+	this->state = PATH_MTU_IDLE;
+	this->nextCheckMs = nowMs + PATH_MTU_CHECK_MS;
+	this->nextSearchMs = nowMs + PATH_MTU_SEARCH_MS;
+	if(false == this->answered){
+		fprintf(stderr, "PathMtu: No probe was acked (rx_raw too old?), keeping %u byte packages.\n", this->packageSize);
+		this->nextCheckMs = this->nextSearchMs; // nothing to check.
+		return;
+	}
+	if(this->low != this->packageSize){
+		fprintf(stderr, "PathMtu: Video packages %u -> %u bytes (search took %llums).\n", this->packageSize, this->low,
+			(unsigned long long)(nowMs - this->searchStartMs));
+	}
+	this->packageSize = this->low;
+}
+
+uint16_t PathMtu::getPackageSize(void){
+	return this->packageSize;
+}
+
+PathMtuState_t PathMtu::getState(void){
+	return this->state;
+}
+
+uint32_t PathMtu::getProbesSent(void){
+	return this->probesSent;
+}
+
+uint32_t PathMtu::getProbesLost(void){
+	return this->probesLost;
+}
+
+uint16_t PathMtu::getMaxPackageSize(Connection &connection){
+	return (connection.getReceiverFamily() == AF_INET6) ? UDP_MAX_PACKET_SIZE_IPV6 : UDP_MAX_PACKET_SIZE;
+}
+
+bool PathMtu::isProbe(const uint8_t *data, uint32_t length, uint16_t &id){
+	PathMtuProbe_t probe;
+	if(length < sizeof(probe)){
+		return false;
+	}
+	memcpy(&probe, data, sizeof(probe));
+	if(probe.magic != PATH_MTU_MAGIC || probe.version != PATH_MTU_VERSION || probe.type != PATH_MTU_TYPE_PROBE ||
+		probe.size != length || probe.check != (uint16_t)~probe.size){
+		return false;
+	}
+	id = probe.id;
+	return true;
+}
+
+uint16_t PathMtu::buildAck(uint8_t *buffer, uint16_t id, uint16_t size){
+	build(buffer, PATH_MTU_TYPE_ACK, id, size);
+	return sizeof(PathMtuProbe_t);
+}
+
+void PathMtu::build(uint8_t *buffer, PathMtuType_t type, uint16_t id, uint16_t size){
+	PathMtuProbe_t probe;
+	probe.magic = PATH_MTU_MAGIC;
+	probe.version = PATH_MTU_VERSION;
+	probe.type = (uint8_t)type;
+	probe.id = id;
+	probe.size = size;
+	probe.check = (uint16_t)~size;
+	memcpy(buffer, &probe, sizeof(probe));
+}
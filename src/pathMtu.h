@@ -0,0 +1,94 @@
+/*
+	pathMtu.h
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+
+#ifndef PATHMTU_H_
+#define PATHMTU_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h> // bzero
+#include "connection.h"
+#include "h264UDPPackage.h"
+
+#define PATH_MTU_MAGIC 0x50444F48        // "OHDP" little endian.
+#define PATH_MTU_VERSION 1
+#define PATH_MTU_STEP 8                  // the search stops when the largest size is known this close.
+#define PATH_MTU_TIMEOUT_MS 1000         // a probe without ack is lost (the LTE RTT can be several 100ms with a full uplink).
+#define PATH_MTU_TRIES 3                 // lost probes of one size before it is too large, LTE loses packages too.
+#define PATH_MTU_CHECK_MS 10000          // the package size in use is probed again this often ...
+#define PATH_MTU_SEARCH_MS 600000        // ... and searched again (also upwards) this often.
+
+enum PathMtuType_t{
+	PATH_MTU_TYPE_PROBE=1,               // tx_raw -> rx_raw on the video port, padded to the size probed.
+	PATH_MTU_TYPE_ACK                    // rx_raw -> tx_raw, only the header.
+};
+
+// On the video port, told apart from a H264 package (FrameID, PackageID) by the magic and the size check.
+typedef struct {
+	uint32_t magic;
+	uint8_t version;
+	uint8_t type;
+	uint16_t id;                         // probe number, returned in the ack.
+	uint16_t size;                       // of the probe package.
+	uint16_t check;                      // ~size.
+} __attribute__((packed)) PathMtuProbe_t;
+
+enum PathMtuState_t{
+	PATH_MTU_IDLE=0,
+	PATH_MTU_SEARCH,                     // binary search between the largest acked and the smallest lost size.
+	PATH_MTU_CHECK                       // probing the size in use, a loss starts a new search.
+};
+
+// Path MTU discovery for the video packages (tx_raw -u), the ICMP "fragmentation needed" messages are often
+// filtered on LTE and VPN paths so the kernel path MTU can not be trusted. Probes with Don't Fragment set are
+// sent to rx_raw, which acks them, and the largest size which got through is the package size.
+// Until rx_raw has acked a probe (an older rx_raw does not) the package size stays at UDP_PACKET_SIZE.
+class PathMtu
+{
+	// Public functions
+	public:
+	PathMtu();
+	virtual ~PathMtu(); //destructor
+
+	// tx_raw:
+	void start(void);                                        // search again, also when the link changed (new sockets / IP).
+	uint16_t service(Connection &connection, uint64_t nowMs); // sends the next probe when due, returns the package size to use.
+	bool input(const uint8_t *data, uint32_t length, uint64_t nowMs); // a package from the video socket, returns true if it was an ack.
+	uint16_t getPackageSize(void);
+	PathMtuState_t getState(void);
+	uint32_t getProbesSent(void);
+	uint32_t getProbesLost(void);
+	static uint16_t getMaxPackageSize(Connection &connection); // one ethernet frame with the IP header of the receiver's family.
+
+	// rx_raw:
+	static bool isProbe(const uint8_t *data, uint32_t length, uint16_t &id); // returns true if data is a probe.
+	static uint16_t buildAck(uint8_t *buffer, uint16_t id, uint16_t size); // returns the size of the ack.
+
+	private:
+	PathMtuState_t state;
+	uint16_t packageSize;  // in use.
+	uint16_t low;          // largest size acked in this search (UDP_MIN_PACKET_SIZE until one is).
+	uint16_t high;         // smallest size lost in this search - 1.
+	bool answered;         // a probe was acked in this search.
+	uint16_t probeSize;
+	uint16_t probeId;
+	uint8_t tries;
+	uint64_t sentMs;       // of the probe waiting for its ack, 0 = none.
+	uint64_t searchStartMs;
+	uint64_t nextCheckMs;
+	uint64_t nextSearchMs; // 0 = now.
+	uint32_t probesSent;
+	uint32_t probesLost;
+	uint8_t probe[UDP_MAX_PACKET_SIZE];
+
+	void result(bool acked, uint64_t nowMs);
+	void finishSearch(uint64_t nowMs);
+	static void build(uint8_t *buffer, PathMtuType_t type, uint16_t id, uint16_t size);
+};
+
+#endif /* PATHMTU_H_ */
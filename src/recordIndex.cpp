@@ -0,0 +1,363 @@
+/*
+	recordIndex.cpp
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+#include "recordIndex.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+
+#define NAL_TYPE_SLICE 1
+#define NAL_TYPE_IDR 5
+#define NAL_TYPE_SEI 6
+#define NAL_TYPE_AUD 9
+
+static bool compareTime(const RecordIndexRecord_t &a, const RecordIndexRecord_t &b){
+	return a.timeUs < b.timeUs;
+}
+
+RecordIndex::RecordIndex(){
+	this->fd = -1;
+	this->fileName[0] = 0;
+	this->startUs = 0;
+	this->armed = false;
+	this->failed = false;
+	this->bufferUsed = 0;
+	this->zeros = 0;
+	this->headerBytes = 0;
+	this->inHeader = false;
+	this->nalOffset = 0;
+	this->prefixOffset = 0;
+	this->prefixSeen = false;
+	this->frames = 0;
+	bzero(&this->readHeader, sizeof(this->readHeader));
+}
+
+RecordIndex::~RecordIndex(){
+	this->close();
+}
+
+// <recording without extension>.idx, the telemetry from before (pre-arm recording) is written first.
+bool RecordIndex::create(const char *recordingFile, RecordIndexFormat_t format, uint64_t startUs){
+	this->close();
+	strncpy(this->fileName, recordingFile, sizeof(this->fileName)-1);
+	this->fileName[sizeof(this->fileName)-1] = 0;
+	char *extension = strrchr(this->fileName, '.');
+	if(extension != NULL && strchr(extension, '/') == NULL){
+		*extension = 0;
+	}
+	if(strlen(this->fileName) + strlen(RECORD_INDEX_EXTENSION) >= sizeof(this->fileName)){
+		fprintf(stderr, "RecordIndex: File name %s is too long\n", recordingFile);
+		this->fileName[0] = 0;
+		return true;
+	}
+	strcat(this->fileName, RECORD_INDEX_EXTENSION);
+	this->fd = ::open(this->fileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(this->fd < 0){
+		fprintf(stderr, "RecordIndex: Unable to create %s (%s)\n", this->fileName, strerror(errno));
+		return true;
+	}
+	this->failed = false;
+	this->bufferUsed = 0;
+	this->startUs = startUs;
+	this->zeros = 0;
+	this->inHeader = false;
+	this->prefixSeen = false;
+	this->frames = 0;
+
+	// The wall clock of timeUs 0, the caller's steady clock may already be past startUs.
+	uint64_t nowSteadyUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	uint64_t nowRealtimeUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	RecordIndexHeader_t header;
+	bzero(&header, sizeof(header));
+	header.magic = RECORD_INDEX_MAGIC;
+	header.version = RECORD_INDEX_VERSION;
+	header.headerSize = sizeof(RecordIndexHeader_t);
+	header.recordSize = sizeof(RecordIndexRecord_t);
+	header.format = (uint8_t)format;
+	header.startRealtimeUs = nowRealtimeUs - ((nowSteadyUs > startUs) ? nowSteadyUs - startUs : 0);
+	if(write(this->fd, &header, sizeof(header)) != sizeof(header)){
+		fprintf(stderr, "RecordIndex: Write to %s failed (%s)\n", this->fileName, strerror(errno));
+		this->close();
+		return true;
+	}
+
+	RecordIndexRecord_t state;
+	bzero(&state, sizeof(state));
+	state.type = RECORD_INDEX_ARMED;
+	state.timeUs = startUs;
+	state.heading = UINT16_MAX;
+	state.armed = this->armed;
+	for(uint32_t a=this->pending.size();a>0;a--){
+		if(this->pending[a-1].type == RECORD_INDEX_ARMED && this->pending[a-1].timeUs > startUs){
+			state.armed = !this->pending[a-1].armed; // the state before a change after the start.
+		}
+	}
+	this->add(state);
+	while(this->pending.size() > 0){
+		if(this->pending.front().timeUs >= startUs){
+			this->add(this->pending.front());
+		}
+		this->pending.pop_front();
+	}
+	this->flush();
+	return this->failed;
+}
+
+bool RecordIndex::isOpen(void){
+	return (this->fd >= 0);
+}
+
+void RecordIndex::keyFrame(uint64_t nowUs, uint64_t offset, uint32_t frame, uint64_t mediaTimeUs){
+	if(this->fd < 0){
+		return;
+	}
+	RecordIndexRecord_t record;
+	bzero(&record, sizeof(record));
+	record.timeUs = nowUs;
+	record.type = RECORD_INDEX_KEYFRAME;
+	record.armed = this->armed;
+	record.heading = UINT16_MAX;
+	record.frame = frame;
+	record.data.keyFrame.offset = offset;
+	record.data.keyFrame.mediaTimeUs = mediaTimeUs;
+	this->add(record);
+	this->flush(); // the index is as complete as the video on the SD card.
+}
+
+// Finds the keyframes in a raw Annex-B recording, data is what is written next at fileOffset. Start codes and
+// NAL unit headers split between calls are handled, the time is when the data is written.
+void RecordIndex::scanH264(const uint8_t *data, uint32_t length, uint64_t fileOffset, uint64_t nowUs){
+	if(this->fd < 0){
+		return;
+	}
+	for(uint32_t a=0;a<length;a++){
+		if(this->inHeader){
+			this->header[this->headerBytes++] = data[a];
+			if(this->headerBytes == sizeof(this->header)){
+				this->inHeader = false;
+				this->nalHeader(nowUs);
+			}
+		}
+		if(data[a] == 0x00){
+			this->zeros++;
+		}else if(data[a] == 0x01 && this->zeros >= 2){
+			this->nalOffset = fileOffset + a - ((this->zeros >= 3) ? 3 : 2);
+			this->inHeader = true;
+			this->headerBytes = 0;
+			this->zeros = 0;
+		}else{
+			this->zeros = 0;
+		}
+	}
+}
+
+void RecordIndex::position(uint64_t nowUs, int32_t lat, int32_t lon, int32_t alt, int32_t relativeAlt, uint16_t heading){
+	RecordIndexRecord_t record;
+	bzero(&record, sizeof(record));
+	record.timeUs = nowUs;
+	record.type = RECORD_INDEX_POSITION;
+	record.armed = this->armed;
+	record.heading = heading;
+	record.data.position.lat = lat;
+	record.data.position.lon = lon;
+	record.data.position.alt = alt;
+	record.data.position.relativeAlt = relativeAlt;
+	this->add(record);
+}
+
+void RecordIndex::setArmed(uint64_t nowUs, bool armed){
+	if(armed == this->armed){
+		return;
+	}
+	this->armed = armed;
+	RecordIndexRecord_t record;
+	bzero(&record, sizeof(record));
+	record.timeUs = nowUs;
+	record.type = RECORD_INDEX_ARMED;
+	record.armed = armed;
+	record.heading = UINT16_MAX;
+	this->add(record);
+}
+
+void RecordIndex::flush(void){
+	if(this->fd < 0 || this->failed || this->bufferUsed == 0){
+		return;
+	}
+	const uint8_t *data = (const uint8_t *)this->buffer;
+	uint32_t length = this->bufferUsed * sizeof(RecordIndexRecord_t);
+	uint32_t done = 0;
+	while(done < length){
+		ssize_t result = write(this->fd, &data[done], length - done);
+		if(result < 0 && errno == EINTR){
+			continue;
+		}
+		if(result <= 0){
+			fprintf(stderr, "RecordIndex: Write to %s failed (%s), index stopped\n", this->fileName, strerror(errno));
+			this->failed = true;
+			break;
+		}
+		done += result;
+	}
+	this->bufferUsed = 0;
+}
+
+const char* RecordIndex::getFileName(void){
+	return this->fileName;
+}
+
+bool RecordIndex::open(const char *filename){
+	this->close();
+	int file = ::open(filename, O_RDONLY);
+	if(file < 0){
+		fprintf(stderr, "RecordIndex: Unable to open %s (%s)\n", filename, strerror(errno));
+		return true;
+	}
+	struct stat info;
+	if(fstat(file, &info) < 0 || (size_t)info.st_size < sizeof(RecordIndexHeader_t)){
+		fprintf(stderr, "RecordIndex: %s is not an index file (too short)\n", filename);
+		::close(file);
+		return true;
+	}
+	void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	::close(file);
+	if(data == MAP_FAILED){
+		fprintf(stderr, "RecordIndex: Unable to map %s (%s)\n", filename, strerror(errno));
+		return true;
+	}
+	const uint8_t *map = (const uint8_t *)data;
+	memcpy(&this->readHeader, map, sizeof(this->readHeader));
+	if(this->readHeader.magic != RECORD_INDEX_MAGIC || this->readHeader.version != RECORD_INDEX_VERSION
+		|| this->readHeader.headerSize < sizeof(RecordIndexHeader_t) || this->readHeader.headerSize > (size_t)info.st_size
+		|| this->readHeader.recordSize < sizeof(RecordIndexRecord_t)){
+		fprintf(stderr, "RecordIndex: %s is not a version %u index file\n", filename, RECORD_INDEX_VERSION);
+		munmap(data, info.st_size);
+		bzero(&this->readHeader, sizeof(this->readHeader));
+		return true;
+	}
+	// A cut record at the end (power loss) is ignored.
+	for(size_t offset=this->readHeader.headerSize;offset + this->readHeader.recordSize <= (size_t)info.st_size;offset += this->readHeader.recordSize){
+		RecordIndexRecord_t record;
+		memcpy(&record, &map[offset], sizeof(record));
+		if(record.type == RECORD_INDEX_KEYFRAME){
+			this->keyFrames.push_back(record);
+		}else if(record.type == RECORD_INDEX_POSITION){
+			this->positions.push_back(record);
+		}else if(record.type == RECORD_INDEX_ARMED){
+			this->armedChanges.push_back(record);
+		}
+	}
+	munmap(data, info.st_size);
+	std::stable_sort(this->keyFrames.begin(), this->keyFrames.end(), compareTime);
+	std::stable_sort(this->positions.begin(), this->positions.end(), compareTime);
+	std::stable_sort(this->armedChanges.begin(), this->armedChanges.end(), compareTime);
+	return false;
+}
+
+const RecordIndexHeader_t* RecordIndex::getHeader(void){
+	return &this->readHeader;
+}
+
+uint32_t RecordIndex::getKeyFrameCount(void){
+	return this->keyFrames.size();
+}
+
+uint32_t RecordIndex::getPositionCount(void){
+	return this->positions.size();
+}
+
+const RecordIndexRecord_t* RecordIndex::getKeyFrame(uint32_t index){
+	return (index < this->keyFrames.size()) ? &this->keyFrames[index] : NULL;
+}
+
+const RecordIndexRecord_t* RecordIndex::getPosition(uint32_t index){
+	return (index < this->positions.size()) ? &this->positions[index] : NULL;
+}
+
+const RecordIndexRecord_t* RecordIndex::findKeyFrame(uint64_t timeUs){
+	return find(this->keyFrames, timeUs);
+}
+
+const RecordIndexRecord_t* RecordIndex::findPosition(uint64_t timeUs){
+	return find(this->positions, timeUs);
+}
+
+bool RecordIndex::isArmed(uint64_t timeUs){
+	const RecordIndexRecord_t *record = find(this->armedChanges, timeUs);
+	return (record != NULL && record->armed);
+}
+
+void RecordIndex::close(void){
+	if(this->fd >= 0){
+		this->flush();
+		::close(this->fd);
+		this->fd = -1;
+	}
+	this->bufferUsed = 0;
+	this->keyFrames.clear();
+	this->positions.clear();
+	this->armedChanges.clear();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+////////////////////////// Private Helper functions //////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+// Times are absolute until here. Without a file the telemetry is kept for the next one, keyframes are not.
+void RecordIndex::add(const RecordIndexRecord_t &record){
+	if(this->fd < 0){
+		if(record.type != RECORD_INDEX_KEYFRAME){
+			if(this->pending.size() >= RECORD_INDEX_MAX_PENDING){
+				this->pending.pop_front();
+			}
+			this->pending.push_back(record);
+		}
+		return;
+	}
+	if(this->failed){
+		return;
+	}
+	this->buffer[this->bufferUsed] = record;
+	this->buffer[this->bufferUsed].timeUs = (record.timeUs > this->startUs) ? record.timeUs - this->startUs : 0;
+	this->bufferUsed++;
+	if(this->bufferUsed >= RECORD_INDEX_BUFFER_RECORDS){
+		this->flush();
+	}
+}
+
+// The first bytes of a NAL unit, a keyframe is the first slice of an IDR picture.
+void RecordIndex::nalHeader(uint64_t nowUs){
+	uint8_t type = this->header[0] & 0x1F;
+	if(type >= NAL_TYPE_SEI && type <= NAL_TYPE_AUD){
+		if(!this->prefixSeen){
+			this->prefixOffset = this->nalOffset;
+			this->prefixSeen = true;
+		}
+		return;
+	}
+	if((type == NAL_TYPE_SLICE || type == NAL_TYPE_IDR) && (this->header[1] & 0x80)){ // first_mb_in_slice == 0
+		if(type == NAL_TYPE_IDR){
+			uint64_t timeUs = (nowUs > this->startUs) ? nowUs - this->startUs : 0;
+			this->keyFrame(nowUs, this->prefixSeen ? this->prefixOffset : this->nalOffset, this->frames, timeUs);
+		}
+		this->frames++;
+		this->prefixSeen = false;
+	}
+}
+
+const RecordIndexRecord_t* RecordIndex::find(const std::vector<RecordIndexRecord_t> &records, uint64_t timeUs){
+	RecordIndexRecord_t key;
+	key.timeUs = timeUs;
+	std::vector<RecordIndexRecord_t>::const_iterator next = std::upper_bound(records.begin(), records.end(), key, compareTime);
+	if(next == records.begin()){
+		return NULL;
+	}
+	return &(*(next - 1));
+}
@@ -0,0 +1,136 @@
+/*
+	recordIndex.h
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+
+#ifndef RECORDINDEX_H_
+#define RECORDINDEX_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h> // bzero
+#include <deque>
+#include <vector>
+
+#define RECORD_INDEX_MAGIC 0x4944484F   // "OHDI" little endian.
+#define RECORD_INDEX_VERSION 1
+#define RECORD_INDEX_EXTENSION ".idx"   // replaces the extension of the recording.
+#define RECORD_INDEX_BUFFER_RECORDS 128 // written at every keyframe or when this many are waiting.
+#define RECORD_INDEX_MAX_PENDING 256    // telemetry kept while no file is open, for recordings starting before arming.
+#define RECORD_INDEX_MAX_FILE_NAME 256
+
+enum RecordIndexFormat_t{
+	RECORD_INDEX_H264=0,       // raw Annex-B, keyframe offset is the start code of the NAL units before the IDR (SPS).
+	RECORD_INDEX_MP4           // fragmented MP4, keyframe offset is the moof of the fragment it starts.
+};
+
+enum RecordIndexType_t{
+	RECORD_INDEX_KEYFRAME=1,
+	RECORD_INDEX_POSITION,     // GLOBAL_POSITION_INT.
+	RECORD_INDEX_ARMED         // the armed state changed.
+};
+
+typedef struct {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t headerSize;       // sizeof(RecordIndexHeader_t), records start here.
+	uint16_t recordSize;       // sizeof(RecordIndexRecord_t).
+	uint8_t format;            // RecordIndexFormat_t.
+	uint8_t reserved;
+	uint32_t reserved2;
+	uint64_t startRealtimeUs;  // wall clock at timeUs 0, to geotag and match the flight log.
+	uint64_t reserved3;
+} RecordIndexHeader_t;
+
+typedef struct {
+	uint64_t offset;           // bytes from the start of the recording, see RecordIndexFormat_t.
+	uint64_t mediaTimeUs;      // decode time in the MP4, the same as timeUs for raw H.264.
+} RecordIndexKeyFrame_t;
+
+typedef struct {
+	int32_t lat;               // [degE7]
+	int32_t lon;               // [degE7]
+	int32_t alt;               // [mm] MSL
+	int32_t relativeAlt;       // [mm] above home
+} RecordIndexPosition_t;
+
+typedef struct {
+	uint64_t timeUs;           // since the recording started (steady clock), not sorted between the types.
+	uint8_t type;              // RecordIndexType_t.
+	uint8_t armed;             // when the record was written, the RECORD_INDEX_ARMED records have the exact changes.
+	uint16_t heading;          // [cdeg] position records, UINT16_MAX if unknown.
+	uint32_t frame;            // keyframes: frame number in the recording.
+	union {
+		RecordIndexKeyFrame_t keyFrame;
+		RecordIndexPosition_t position;
+	} data;
+} RecordIndexRecord_t;
+
+// Binary sidecar written next to a recording, so post-flight tools can seek and geotag without parsing the video:
+// keyframe offset -> time, plus the position / altitude / armed track on the same clock. Records are fixed size
+// and written at every keyframe, a file cut by a power loss is valid up to the last complete record.
+class RecordIndex
+{
+	// Public functions
+	public:
+	RecordIndex();
+	virtual ~RecordIndex(); //destructor
+
+	// Writing, the times are from the caller's steady clock in us:
+	bool create(const char *recordingFile, RecordIndexFormat_t format, uint64_t startUs); // returns true on error.
+	bool isOpen(void);
+	void keyFrame(uint64_t nowUs, uint64_t offset, uint32_t frame, uint64_t mediaTimeUs);
+	void scanH264(const uint8_t *data, uint32_t length, uint64_t fileOffset, uint64_t nowUs); // raw recordings, before the data is written.
+	void position(uint64_t nowUs, int32_t lat, int32_t lon, int32_t alt, int32_t relativeAlt, uint16_t heading);
+	void setArmed(uint64_t nowUs, bool armed);
+	void flush(void);
+	const char* getFileName(void);
+
+	// Reading, the records are loaded and sorted by time per type:
+	bool open(const char *filename); // returns true on error.
+	const RecordIndexHeader_t* getHeader(void);
+	uint32_t getKeyFrameCount(void);
+	uint32_t getPositionCount(void);
+	const RecordIndexRecord_t* getKeyFrame(uint32_t index);
+	const RecordIndexRecord_t* getPosition(uint32_t index);
+	const RecordIndexRecord_t* findKeyFrame(uint64_t timeUs);  // last keyframe at or before the time, NULL if none.
+	const RecordIndexRecord_t* findPosition(uint64_t timeUs);  // last position at or before the time, NULL if none.
+	bool isArmed(uint64_t timeUs);
+
+	void close(void);
+
+	private:
+	int fd;
+	char fileName[RECORD_INDEX_MAX_FILE_NAME];
+	uint64_t startUs;
+	bool armed;
+	bool failed;               // a write failed, the video recording goes on without the index.
+	RecordIndexRecord_t buffer[RECORD_INDEX_BUFFER_RECORDS];
+	uint32_t bufferUsed;
+	std::deque<RecordIndexRecord_t> pending; // absolute times while no file is open.
+
+	// Raw H.264 scanning:
+	uint32_t zeros;
+	uint8_t header[2];         // first bytes of the NAL unit after a start code.
+	uint32_t headerBytes;
+	bool inHeader;
+	uint64_t nalOffset;        // start code of the NAL unit being scanned.
+	uint64_t prefixOffset;     // first AUD / SEI / SPS / PPS since the last picture, a decoder can start there.
+	bool prefixSeen;
+	uint32_t frames;
+
+	RecordIndexHeader_t readHeader;
+	std::vector<RecordIndexRecord_t> keyFrames;
+	std::vector<RecordIndexRecord_t> positions;
+	std::vector<RecordIndexRecord_t> armedChanges;
+
+	void add(const RecordIndexRecord_t &record);
+	void nalHeader(uint64_t nowUs);
+	static const RecordIndexRecord_t* find(const std::vector<RecordIndexRecord_t> &records, uint64_t timeUs);
+};
+
+#endif /* RECORDINDEX_H_ */
@@ -0,0 +1,197 @@
+/*
+	relay.cpp
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+
+// Relay on a server with a public IP (VPS), for drones behind the carrier-grade NAT of the LTE network.
+// tx_raw -i <relay> -k <session> and rx_raw -G <relay> -k <session> both connect to it, the relay pairs them
+// by the session number and forwards video, Mavlink and telemetry between them. Any number of drones (up to
+// RELAY_MAX_SESSIONS) can use the same relay and ports, each with its own session number.
+// Only hellos signed with the key (-K) given to the relay, tx_raw and rx_raw are taken, and each must be newer than
+// the last one, so knowing the session number or seeing a hello on the way does not let anyone take over a session.
+// The clocks of all of them must be within RELAY_HELLO_MAX_SKEW_MS (NTP).
+
+#include "udpRelay.h"
+#include <getopt.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+
+#define DEFAULT_VIDEO_PORT 7000
+#define DEFAULT_MAVLINK_PORT 12000
+#define DEFAULT_TELEMETRY_PORT 5200
+#define DEFAULT_STATS_INTERVAL_SEC 10
+
+int flagHelp = 0;
+volatile sig_atomic_t running = 1;
+
+void usage(void) {
+	printf("\nUsage: relay [options]\n"
+	"\n"
+	"Options:\n"
+	"-v  <port>     Video port, the same as tx_raw -v and rx_raw -v (default %d).\n"
+	"-m  <port>     Mavlink port, the same as tx_raw -p and rx_raw -m (default %d).\n"
+	"-t  <port>     Telemetry port, the same as tx_raw -t and rx_raw -t (default %d, 0 = not relayed).\n"
+	"-j  <threads>  Worker threads, each with its own sockets (default the number of CPUs, max %d).\n"
+	"-s  <sec>      Print the sessions every sec seconds (default %d, 0 = never).\n"
+	"-K  <key>      Key the hellos of tx_raw -K and rx_raw -K are signed with, %d to %d characters (required).\n"
+	"-r  <count>    New sessions per minute from one IP address (default %d, 0 = no limit).\n"
+	"\n"
+	"Example:\n"
+	"  ./relay -v 7000 -m 12000 -t 5200 -K <key>\n"
+	"  raspivid -t 0 | ./tx_raw -i <relay IP> -v 7000 -s /dev/serial0 -p 12000 -t 5200 -k 3141592 -K <key>\n"
+	"  ./rx_raw -v 7000 -m 12000 -t 5200 -G <relay IP> -k 3141592 -K <key>\n"
+	"\n", DEFAULT_VIDEO_PORT, DEFAULT_MAVLINK_PORT, DEFAULT_TELEMETRY_PORT, RELAY_MAX_THREADS, DEFAULT_STATS_INTERVAL_SEC,
+	RELAY_KEY_MIN_LENGTH, RELAY_KEY_MAX_LENGTH, RELAY_SESSION_RATE);
+	exit(1);
+}
+
+uint64_t timeMillisec() {
+	using namespace std::chrono;
+	return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+void stopSignal(int){
+	running = 0;
+}
+
+void printSessions(UdpRelay &relay, RelaySessionStats_t *previous, double seconds, uint64_t nowMs){
+	printf("relay: Status: %u sessions  forwarded %llu packages %.1fMB  dropped %llu  hellos refused (key|time|replay|rate) %llu|%llu|%llu|%llu\n", relay.getSessions(),
+		(unsigned long long)relay.getPackagesForwarded(), relay.getBytesForwarded()/(1024.0*1024.0), (unsigned long long)relay.getPackagesDropped(),
+		(unsigned long long)relay.getHellosRefused(RELAY_REFUSED_KEY), (unsigned long long)relay.getHellosRefused(RELAY_REFUSED_TIME),
+		(unsigned long long)relay.getHellosRefused(RELAY_REFUSED_REPLAY), (unsigned long long)relay.getHellosRefused(RELAY_REFUSED_RATE));
+	RelaySessionStats_t stats;
+	for(uint32_t a=0;a<RELAY_MAX_SESSIONS;a++){
+		if(false == relay.getSession(a, stats)){
+			previous[a].session = 0;
+			continue;
+		}
+		if(previous[a].session != stats.session){ // new in this slot.
+			bzero(&previous[a], sizeof(previous[a]));
+		}
+		printf("  session %u  air ", stats.session);
+		UdpRelay::printEndpoint(stdout, stats.endpoints[RELAY_CHANNEL_VIDEO][RELAY_ROLE_AIR]);
+		printf(" (hello %llus ago)  ground ", (unsigned long long)((nowMs - stats.lastHelloMs[RELAY_ROLE_AIR])/1000));
+		UdpRelay::printEndpoint(stdout, stats.endpoints[RELAY_CHANNEL_VIDEO][RELAY_ROLE_GROUND]);
+		printf(" (hello %llus ago)", (unsigned long long)((nowMs - stats.lastHelloMs[RELAY_ROLE_GROUND])/1000));
+		printf("  down %.0fkbit/s %.0fpps  up %.1fkbit/s  no peer (down|up) %llu|%llu  send errors %llu\n",
+			(stats.bytes[RELAY_ROLE_AIR] - previous[a].bytes[RELAY_ROLE_AIR])*8/(1000.0*seconds),
+			(stats.packages[RELAY_ROLE_AIR] - previous[a].packages[RELAY_ROLE_AIR])/seconds,
+			(stats.bytes[RELAY_ROLE_GROUND] - previous[a].bytes[RELAY_ROLE_GROUND])*8/(1000.0*seconds),
+			(unsigned long long)stats.noPeer[RELAY_ROLE_AIR], (unsigned long long)stats.noPeer[RELAY_ROLE_GROUND], (unsigned long long)stats.sendErrors);
+		previous[a] = stats;
+	}
+	fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+	uint16_t ports[RELAY_CHANNEL_COUNT];
+	ports[RELAY_CHANNEL_VIDEO] = DEFAULT_VIDEO_PORT;
+	ports[RELAY_CHANNEL_MAVLINK] = DEFAULT_MAVLINK_PORT;
+	ports[RELAY_CHANNEL_TELEMETRY] = DEFAULT_TELEMETRY_PORT;
+	uint32_t threads = std::thread::hardware_concurrency();
+	uint32_t statsInterval = DEFAULT_STATS_INTERVAL_SEC;
+	const char *key = NULL;
+	uint32_t sessionRate = RELAY_SESSION_RATE;
+
+	while (1) {
+		int nOptionIndex;
+		static const struct option optiona[] = {
+			{ "help", no_argument, &flagHelp, 1 },
+			{      0,           0,         0, 0 }
+		};
+		int c = getopt_long(argc, argv, "hv:m:t:j:s:K:r:", optiona, &nOptionIndex);
+		if (c == -1) {
+			break;
+		}
+		switch (c) {
+			case 0: {
+				break;
+			}
+			case 'v': {
+				ports[RELAY_CHANNEL_VIDEO] = (uint16_t)atoi(optarg);
+				break;
+			}
+			case 'm': {
+				ports[RELAY_CHANNEL_MAVLINK] = (uint16_t)atoi(optarg);
+				break;
+			}
+			case 't': {
+				ports[RELAY_CHANNEL_TELEMETRY] = (uint16_t)atoi(optarg);
+				break;
+			}
+			case 'j': {
+				threads = (uint32_t)atoi(optarg);
+				break;
+			}
+			case 's': {
+				statsInterval = (uint32_t)atoi(optarg);
+				break;
+			}
+			case 'K': {
+				key = optarg;
+				break;
+			}
+			case 'r': {
+				sessionRate = (uint32_t)atoi(optarg);
+				break;
+			}
+			default: {
+				usage();
+				break;
+			}
+		}
+	}
+	if(threads == 0){
+		threads = 1;
+	}
+	if(threads > RELAY_MAX_THREADS){
+		threads = RELAY_MAX_THREADS;
+	}
+
+	if(key == NULL){
+		fprintf(stderr, "relay: No key (-K), Terminate program.\n");
+		usage();
+	}
+
+	static UdpRelay relay; // static, the session table is large.
+	if(relay.setKey(key)){
+		fprintf(stderr, "relay: Invalid key, Terminate program.\n");
+		exit(EXIT_FAILURE);
+	}
+	relay.setSessionRate(sessionRate);
+	if(relay.start(ports, threads)){
+		fprintf(stderr, "relay: Unable to open the ports, Terminate program.\n");
+		exit(EXIT_FAILURE);
+	}
+	printf("relay: %u threads on ports video %u mavlink %u telemetry %u, max %d sessions.\n", relay.getThreads(),
+		ports[RELAY_CHANNEL_VIDEO], ports[RELAY_CHANNEL_MAVLINK], ports[RELAY_CHANNEL_TELEMETRY], RELAY_MAX_SESSIONS);
+	fflush(stdout);
+
+	signal(SIGINT, stopSignal);
+	signal(SIGTERM, stopSignal);
+
+	static RelaySessionStats_t previous[RELAY_MAX_SESSIONS];
+	bzero(previous, sizeof(previous));
+	uint64_t lastStatsMs = timeMillisec();
+	while(running){
+		usleep(100000);
+		uint64_t nowMs = timeMillisec();
+		relay.expireSessions(nowMs);
+		if(statsInterval > 0 && nowMs >= lastStatsMs + statsInterval*1000){
+			printSessions(relay, previous, (nowMs - lastStatsMs)/1000.0, nowMs);
+			lastStatsMs = nowMs;
+		}
+	}
+
+	relay.stop();
+	printf("relay: Stopped, forwarded %llu packages %.1fMB dropped %llu.\n", (unsigned long long)relay.getPackagesForwarded(),
+		relay.getBytesForwarded()/(1024.0*1024.0), (unsigned long long)relay.getPackagesDropped());
+	return 0;
+}
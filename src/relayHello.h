@@ -0,0 +1,106 @@
+/*
+	relayHello.h
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+
+#ifndef RELAYHELLO_H_
+#define RELAYHELLO_H_
+
+#include <stddef.h> // offsetof
+#include <stdint.h>
+#include <string.h>
+#include <chrono>
+#include "connection.h"
+#include "sha256.h"
+
+#define RELAY_HELLO_MAGIC 0x52444F48     // "OHDR" little endian.
+#define RELAY_HELLO_VERSION 2
+#define RELAY_HELLO_INTERVAL_MS 1000     // also keeps the NAT mapping of the LTE modem open.
+#define RELAY_HELLO_MAC_SIZE 16          // HMAC-SHA256 truncated (RFC 2104 allows half the hash).
+#define RELAY_HELLO_MAX_SKEW_MS 60000    // the clocks of tx_raw / rx_raw and the relay (NTP) may differ this much.
+#define RELAY_KEY_MIN_LENGTH 8
+#define RELAY_KEY_MAX_LENGTH 256
+
+enum RelayRole_t{
+	RELAY_ROLE_AIR=0,                    // tx_raw -k
+	RELAY_ROLE_GROUND,                   // rx_raw -G -k
+	RELAY_ROLE_COUNT
+};
+
+// Sent by tx_raw and rx_raw from each of their sockets (video, Mavlink, telemetry) to the relay, which pairs the
+// air and ground address of the session per port. The other packages are forwarded as they are, the H264 and
+// Mavlink wire format does not change with a relay.
+// The hello is signed with the key the relay and its users share (-K), over the session, role and the time it
+// was sent, so the session number alone does not let anyone take over a session and an old hello can't be replayed.
+typedef struct {
+	uint32_t magic;
+	uint8_t version;
+	uint8_t role;
+	uint16_t reserved;
+	uint32_t session;
+	uint64_t timeMs;                     // realtime clock of the sender, ms since 1970.
+	uint8_t mac[RELAY_HELLO_MAC_SIZE];   // HMAC-SHA256 of the fields before it.
+} __attribute__((packed)) RelayHello_t;
+
+class RelayHello
+{
+	public:
+	static uint16_t build(uint8_t *buffer, RelayRole_t role, uint32_t session, const char *key, uint64_t timeMs){ // returns the size.
+		RelayHello_t hello;
+		hello.magic = RELAY_HELLO_MAGIC;
+		hello.version = RELAY_HELLO_VERSION;
+		hello.role = (uint8_t)role;
+		hello.reserved = 0;
+		hello.session = session;
+		hello.timeMs = timeMs;
+		sign(hello, key, hello.mac);
+		memcpy(buffer, &hello, sizeof(hello));
+		return sizeof(hello);
+	}
+
+	// Returns true if it is a hello, the signature is checked by verify().
+	static bool parse(const uint8_t *data, uint32_t length, RelayRole_t &role, uint32_t &session, uint64_t &timeMs){
+		RelayHello_t hello;
+		if(length != sizeof(hello)){
+			return false;
+		}
+		memcpy(&hello, data, sizeof(hello));
+		if(hello.magic != RELAY_HELLO_MAGIC || hello.version != RELAY_HELLO_VERSION || hello.role >= RELAY_ROLE_COUNT || hello.session == 0){
+			return false;
+		}
+		role = (RelayRole_t)hello.role;
+		session = hello.session;
+		timeMs = hello.timeMs;
+		return true;
+	}
+
+	static bool verify(const uint8_t *data, const char *key){ // a parsed hello, returns true if it is signed with key.
+		RelayHello_t hello;
+		memcpy(&hello, data, sizeof(hello));
+		uint8_t mac[RELAY_HELLO_MAC_SIZE];
+		sign(hello, key, mac);
+		return Sha256::equal(mac, hello.mac, RELAY_HELLO_MAC_SIZE);
+	}
+
+	static void send(Connection &connection, RelayRole_t role, uint32_t session, const char *key){
+		uint8_t buffer[sizeof(RelayHello_t)];
+		uint16_t size = build(buffer, role, session, key, realtimeMs());
+		connection.writeData(buffer, size);
+	}
+
+	static uint64_t realtimeMs(void){
+		using namespace std::chrono;
+		return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+	}
+
+	private:
+	static void sign(const RelayHello_t &hello, const char *key, uint8_t *mac){
+		uint8_t digest[SHA256_DIGEST_SIZE];
+		Sha256::hmac((const uint8_t *)key, strlen(key), (const uint8_t *)&hello, offsetof(RelayHello_t, mac), digest);
+		memcpy(mac, digest, RELAY_HELLO_MAC_SIZE);
+	}
+};
+
+#endif /* RELAYHELLO_H_ */
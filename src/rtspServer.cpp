@@ -0,0 +1,817 @@
+/*
+	rtspServer.cpp
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+#include "rtspServer.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NAL_TYPE_SLICE 1
+#define NAL_TYPE_IDR 5
+#define NAL_TYPE_SEI 6
+#define NAL_TYPE_SPS 7
+#define NAL_TYPE_PPS 8
+#define NAL_TYPE_AUD 9
+#define NAL_TYPE_FU_A 28
+
+#define RTP_MARKER 0x80
+
+RtspServer::RtspServer(){
+	this->listenFd = -1;
+	this->rtpFd = -1;
+	this->rtcpFd = -1;
+	this->port = 0;
+	this->rtpPort = 0;
+	this->path[0] = 0;
+	for(uint32_t a=0;a<RTSP_MAX_CLIENTS;a++){
+		this->clients[a].state = RTSP_CLIENT_FREE;
+		this->clients[a].fd = -1;
+	}
+	this->nextSession = 0;
+	this->packetsSent = 0;
+	this->overflows = 0;
+	this->udpBlocked = false;
+	this->ring = NULL;
+	this->ringHead = 0;
+	this->ssrc = 0;
+	this->sequence = 0;
+	this->inNal = false;
+	this->zeros = 0;
+	this->nalTooLarge = false;
+	this->nalStartUs = 0;
+	this->accessUnitStarted = false;
+	this->accessUnitHasSlice = false;
+	this->accessUnitHasJoinPoint = false;
+	this->timestamp = 0;
+	this->timestampOffset = 0;
+	this->timestampValid = false;
+	this->lastPacketOfAccessUnit = 0;
+	this->hasPacketInAccessUnit = false;
+	this->spsSize = 0;
+	this->ppsSize = 0;
+}
+
+RtspServer::~RtspServer(){
+	this->close();
+}
+
+bool RtspServer::open(uint16_t port, const char *path){
+	this->close();
+	this->port = port;
+	while(*path == '/'){
+		path++;
+	}
+	strncpy(this->path, path, sizeof(this->path)-1);
+	this->path[sizeof(this->path)-1] = 0;
+
+	this->listenFd = socket(AF_INET, SOCK_STREAM, 0);
+	if(this->listenFd < 0){
+		fprintf(stderr, "RtspServer: Unable to create socket (%s)\n", strerror(errno));
+		return true;
+	}
+	int on = 1;
+	setsockopt(this->listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	struct sockaddr_in address;
+	bzero(&address, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(port);
+	if(bind(this->listenFd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(this->listenFd, RTSP_MAX_CLIENTS) < 0){
+		fprintf(stderr, "RtspServer: Unable to listen on port %u (%s)\n", port, strerror(errno));
+		this->close();
+		return true;
+	}
+	fcntl(this->listenFd, F_SETFL, fcntl(this->listenFd, F_GETFL) | O_NONBLOCK);
+
+	// RTP / RTCP pair for the UDP transport, RTP on the even port.
+	for(uint32_t rtpPort=RTSP_RTP_PORT_FIRST;rtpPort<=RTSP_RTP_PORT_LAST && this->rtpPort == 0;rtpPort+=2){
+		int fds[2];
+		fds[0] = socket(AF_INET, SOCK_DGRAM, 0);
+		fds[1] = socket(AF_INET, SOCK_DGRAM, 0);
+		bool ok = (fds[0] >= 0 && fds[1] >= 0);
+		for(uint32_t a=0;a<2 && ok;a++){
+			address.sin_port = htons(rtpPort + a);
+			ok = (bind(fds[a], (struct sockaddr *)&address, sizeof(address)) == 0);
+		}
+		if(ok){
+			this->rtpFd = fds[0];
+			this->rtcpFd = fds[1];
+			this->rtpPort = rtpPort;
+			fcntl(this->rtpFd, F_SETFL, fcntl(this->rtpFd, F_GETFL) | O_NONBLOCK);
+			fcntl(this->rtcpFd, F_SETFL, fcntl(this->rtcpFd, F_GETFL) | O_NONBLOCK);
+		}else{
+			if(fds[0] >= 0){
+				::close(fds[0]);
+			}
+			if(fds[1] >= 0){
+				::close(fds[1]);
+			}
+		}
+	}
+	if(this->rtpPort == 0){
+		fprintf(stderr, "RtspServer: No free RTP port pair in %u-%u\n", RTSP_RTP_PORT_FIRST, RTSP_RTP_PORT_LAST+1);
+		this->close();
+		return true;
+	}
+
+	this->ring = (RtspPacket_t *)malloc(sizeof(RtspPacket_t) * RTSP_RING_PACKETS);
+	if(this->ring == NULL){
+		fprintf(stderr, "RtspServer: Unable to allocate %u packets\n", RTSP_RING_PACKETS);
+		this->close();
+		return true;
+	}
+	this->ringHead = 0;
+	srand(time(NULL) ^ getpid());
+	this->ssrc = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+	this->sequence = (uint16_t)rand();
+	this->timestampOffset = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+	this->nextSession = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+	return false;
+}
+
+int RtspServer::setFD_SET(fd_set *readSet, fd_set *writeSet){
+	if(this->listenFd < 0){
+		return 0;
+	}
+	int maxFd = this->listenFd;
+	FD_SET(this->listenFd, readSet);
+	FD_SET(this->rtpFd, readSet);
+	FD_SET(this->rtcpFd, readSet);
+	maxFd = (this->rtpFd > maxFd) ? this->rtpFd : maxFd;
+	maxFd = (this->rtcpFd > maxFd) ? this->rtcpFd : maxFd;
+	if(this->udpBlocked){
+		FD_SET(this->rtpFd, writeSet);
+	}
+	for(uint32_t a=0;a<RTSP_MAX_CLIENTS;a++){
+		RtspClient_t &client = this->clients[a];
+		if(client.state == RTSP_CLIENT_FREE){
+			continue;
+		}
+		FD_SET(client.fd, readSet);
+		if(client.pending.size() > 0 || (client.tcp && client.state == RTSP_CLIENT_PLAYING && !client.waitingKeyFrame && client.nextPacket < this->ringHead)){
+			FD_SET(client.fd, writeSet);
+		}
+		maxFd = (client.fd > maxFd) ? client.fd : maxFd;
+	}
+	return maxFd;
+}
+
+void RtspServer::service(fd_set *readSet, fd_set *writeSet){
+	if(this->listenFd < 0){
+		return;
+	}
+	if(FD_ISSET(this->listenFd, readSet)){
+		this->acceptClient();
+	}
+	// Receiver reports are not used, read them so the socket buffers do not fill.
+	uint8_t buffer[RTSP_MAX_PACKET];
+	if(FD_ISSET(this->rtpFd, readSet)){
+		while(recv(this->rtpFd, buffer, sizeof(buffer), MSG_DONTWAIT) > 0);
+	}
+	if(FD_ISSET(this->rtcpFd, readSet)){
+		while(recv(this->rtcpFd, buffer, sizeof(buffer), MSG_DONTWAIT) > 0);
+	}
+	for(uint32_t a=0;a<RTSP_MAX_CLIENTS;a++){
+		if(this->clients[a].state != RTSP_CLIENT_FREE && FD_ISSET(this->clients[a].fd, readSet)){
+			this->readClient(this->clients[a]);
+		}
+	}
+	if(this->udpBlocked && FD_ISSET(this->rtpFd, writeSet)){
+		this->udpBlocked = false;
+	}
+	this->sendPackets();
+}
+
+void RtspServer::inputData(const uint8_t *data, uint32_t length, uint64_t nowUs){
+	if(this->ring == NULL){
+		return;
+	}
+	uint32_t start=0; // first byte not yet added to the NAL unit.
+	for(uint32_t a=0;a<length;a++){
+		if(data[a] == 0x00){
+			this->zeros++;
+		}else if(data[a] == 0x01 && this->zeros >= 2){
+			// Start code, the zeros before it (maybe from the last call) are not part of the NAL unit.
+			if(this->inNal){
+				if(this->nal.size() + (a+1 - start) <= RTSP_MAX_NAL_SIZE){
+					this->nal.insert(this->nal.end(), &data[start], &data[a+1]);
+				}else{
+					this->nalTooLarge = true;
+				}
+				uint32_t remove = (this->zeros + 1 < this->nal.size()) ? this->zeros + 1 : this->nal.size();
+				this->nal.resize(this->nal.size() - remove);
+				this->nalComplete();
+			}
+			this->nal.clear();
+			this->nalTooLarge = false;
+			this->inNal = true;
+			this->nalStartUs = nowUs;
+			this->zeros = 0;
+			start = a+1;
+		}else{
+			this->zeros = 0;
+		}
+	}
+	if(this->inNal && start < length){
+		if(this->nal.size() + (length - start) <= RTSP_MAX_NAL_SIZE){
+			this->nal.insert(this->nal.end(), &data[start], &data[length]);
+		}else{
+			this->nalTooLarge = true;
+		}
+	}
+}
+
+// The input ends on a frame, the last NAL unit and access unit are complete: packetize and send.
+void RtspServer::flush(void){
+	if(this->ring == NULL){
+		return;
+	}
+	if(this->inNal){
+		while(this->nal.size() > 0 && this->nal.back() == 0x00){
+			this->nal.pop_back();
+		}
+		this->nalComplete();
+		this->nal.clear();
+		this->nalTooLarge = false;
+		this->inNal = false;
+		this->zeros = 0;
+	}
+	this->endAccessUnit();
+	this->sendPackets();
+}
+
+void RtspServer::close(void){
+	for(uint32_t a=0;a<RTSP_MAX_CLIENTS;a++){
+		if(this->clients[a].state != RTSP_CLIENT_FREE){
+			this->closeClient(this->clients[a]);
+		}
+	}
+	if(this->listenFd >= 0){
+		::close(this->listenFd);
+		this->listenFd = -1;
+	}
+	if(this->rtpFd >= 0){
+		::close(this->rtpFd);
+		this->rtpFd = -1;
+	}
+	if(this->rtcpFd >= 0){
+		::close(this->rtcpFd);
+		this->rtcpFd = -1;
+	}
+	this->rtpPort = 0;
+	free(this->ring);
+	this->ring = NULL;
+}
+
+uint32_t RtspServer::getClients(void){
+	uint32_t count=0;
+	for(uint32_t a=0;a<RTSP_MAX_CLIENTS;a++){
+		if(this->clients[a].state != RTSP_CLIENT_FREE){
+			count++;
+		}
+	}
+	return count;
+}
+
+uint32_t RtspServer::getPlayingClients(void){
+	uint32_t count=0;
+	for(uint32_t a=0;a<RTSP_MAX_CLIENTS;a++){
+		if(this->clients[a].state == RTSP_CLIENT_PLAYING){
+			count++;
+		}
+	}
+	return count;
+}
+
+uint64_t RtspServer::getPacketsSent(void){
+	return this->packetsSent;
+}
+
+uint32_t RtspServer::getOverflows(void){
+	return this->overflows;
+}
+
+uint64_t RtspServer::getPackets(void){
+	return this->ringHead;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+////////// Private Helper functions //////////
+////////////////////////////////////////////////////////////////////////////////////
+
+void RtspServer::nalComplete(void){
+	if(this->nal.size() == 0 || this->nalTooLarge){
+		if(this->nalTooLarge){
+			fprintf(stderr, "RtspServer: NAL unit larger than %u bytes dropped\n", RTSP_MAX_NAL_SIZE);
+		}
+		return;
+	}
+	uint8_t type = this->nal[0] & 0x1F;
+	bool slice = (type == NAL_TYPE_SLICE || type == NAL_TYPE_IDR);
+	bool firstSlice = slice && this->nal.size() > 1 && (this->nal[1] & 0x80); // first_mb_in_slice == 0
+	if(this->accessUnitHasSlice && (firstSlice || (type >= NAL_TYPE_SEI && type <= NAL_TYPE_AUD))){
+		this->endAccessUnit();
+	}
+	if(!this->accessUnitStarted){
+		// All packets of a picture have the time its first NAL unit arrived, frames delivered together still get increasing times.
+		uint32_t timestamp = this->timestampOffset + (uint32_t)(this->nalStartUs * 9 / 100);
+		if(this->timestampValid && (int32_t)(timestamp - this->timestamp) <= 0){
+			timestamp = this->timestamp + 1;
+		}
+		this->timestamp = timestamp;
+		this->timestampValid = true;
+		this->accessUnitStarted = true;
+	}
+
+	if(type == NAL_TYPE_SPS || type == NAL_TYPE_PPS){
+		// Kept for the SDP and for keyframes without them.
+		uint8_t *set = (type == NAL_TYPE_SPS) ? this->sps : this->pps;
+		uint16_t &setSize = (type == NAL_TYPE_SPS) ? this->spsSize : this->ppsSize;
+		if(this->nal.size() <= RTSP_MAX_PARAMETER_SET){
+			memcpy(set, &this->nal[0], this->nal.size());
+			setSize = this->nal.size();
+		}
+		bool joinPoint = (type == NAL_TYPE_SPS && !this->accessUnitHasJoinPoint);
+		if(joinPoint){
+			this->accessUnitHasJoinPoint = true;
+		}
+		this->packetizeNal(&this->nal[0], this->nal.size(), joinPoint);
+		return;
+	}
+	if(type == NAL_TYPE_IDR && !this->accessUnitHasJoinPoint){
+		this->accessUnitHasJoinPoint = true;
+		if(this->spsSize > 0 && this->ppsSize > 0){
+			this->packetizeNal(this->sps, this->spsSize, true);
+			this->packetizeNal(this->pps, this->ppsSize, false);
+			this->packetizeNal(&this->nal[0], this->nal.size(), false);
+		}else{
+			this->packetizeNal(&this->nal[0], this->nal.size(), true); // SDP only clients, if any.
+		}
+	}else{
+		this->packetizeNal(&this->nal[0], this->nal.size(), false);
+	}
+	if(slice){
+		this->accessUnitHasSlice = true;
+	}
+}
+
+void RtspServer::endAccessUnit(void){
+	if(this->hasPacketInAccessUnit){
+		this->ring[this->lastPacketOfAccessUnit % RTSP_RING_PACKETS].data[1] |= RTP_MARKER;
+	}
+	this->hasPacketInAccessUnit = false;
+	this->accessUnitStarted = false;
+	this->accessUnitHasSlice = false;
+	this->accessUnitHasJoinPoint = false;
+}
+
+// RFC 6184 packetization mode 1: a NAL unit in one packet, or in FU-A fragments.
+void RtspServer::packetizeNal(const uint8_t *data, uint32_t length, bool joinPoint){
+	if(length <= RTSP_MAX_PAYLOAD){
+		RtspPacket_t *packet = this->newPacket(joinPoint);
+		memcpy(&packet->data[RTSP_RTP_HEADER_SIZE], data, length);
+		packet->length = RTSP_RTP_HEADER_SIZE + length;
+		return;
+	}
+	uint8_t indicator = (data[0] & 0xE0) | NAL_TYPE_FU_A;
+	uint8_t type = data[0] & 0x1F;
+	uint32_t offset = 1; // the NAL header is in the FU indicator and header.
+	while(offset < length){
+		uint32_t size = length - offset;
+		if(size > RTSP_MAX_PAYLOAD - 2){
+			size = RTSP_MAX_PAYLOAD - 2;
+		}
+		RtspPacket_t *packet = this->newPacket(joinPoint && offset == 1);
+		packet->data[RTSP_RTP_HEADER_SIZE] = indicator;
+		packet->data[RTSP_RTP_HEADER_SIZE+1] = type | ((offset == 1) ? 0x80 : 0x00) | ((offset + size == length) ? 0x40 : 0x00);
+		memcpy(&packet->data[RTSP_RTP_HEADER_SIZE+2], &data[offset], size);
+		packet->length = RTSP_RTP_HEADER_SIZE + 2 + size;
+		offset += size;
+	}
+}
+
+RtspPacket_t* RtspServer::newPacket(bool joinPoint){
+	// A client still on the packet this overwrites is too slow, it continues on the next keyframe.
+	if(this->ringHead >= RTSP_RING_PACKETS){
+		for(uint32_t a=0;a<RTSP_MAX_CLIENTS;a++){
+			RtspClient_t &client = this->clients[a];
+			if(client.state == RTSP_CLIENT_PLAYING && !client.waitingKeyFrame && client.nextPacket <= this->ringHead - RTSP_RING_PACKETS){
+				client.waitingKeyFrame = true;
+				client.overflows++;
+				this->overflows++;
+				fprintf(stderr, "RtspServer: %s is %llu packets behind, continues at the next keyframe\n", inet_ntoa(client.address.sin_addr),
+					(unsigned long long)(this->ringHead - client.nextPacket));
+			}
+		}
+	}
+	if(joinPoint){
+		for(uint32_t a=0;a<RTSP_MAX_CLIENTS;a++){
+			RtspClient_t &client = this->clients[a];
+			if(client.state == RTSP_CLIENT_PLAYING && client.waitingKeyFrame){
+				client.waitingKeyFrame = false;
+				client.nextPacket = this->ringHead;
+			}
+		}
+	}
+	RtspPacket_t *packet = &this->ring[this->ringHead % RTSP_RING_PACKETS];
+	packet->joinPoint = joinPoint;
+	packet->data[0] = 0x80; // version 2.
+	packet->data[1] = RTSP_PAYLOAD_TYPE;
+	packet->data[2] = (uint8_t)(this->sequence >> 8);
+	packet->data[3] = (uint8_t)this->sequence;
+	packet->data[4] = (uint8_t)(this->timestamp >> 24);
+	packet->data[5] = (uint8_t)(this->timestamp >> 16);
+	packet->data[6] = (uint8_t)(this->timestamp >> 8);
+	packet->data[7] = (uint8_t)this->timestamp;
+	packet->data[8] = (uint8_t)(this->ssrc >> 24);
+	packet->data[9] = (uint8_t)(this->ssrc >> 16);
+	packet->data[10] = (uint8_t)(this->ssrc >> 8);
+	packet->data[11] = (uint8_t)this->ssrc;
+	this->sequence++;
+	this->lastPacketOfAccessUnit = this->ringHead;
+	this->hasPacketInAccessUnit = true;
+	this->ringHead++;
+	return packet;
+}
+
+void RtspServer::sendPackets(void){
+	for(uint32_t a=0;a<RTSP_MAX_CLIENTS;a++){
+		if(this->clients[a].state != RTSP_CLIENT_FREE){
+			this->sendClient(this->clients[a]);
+		}
+	}
+}
+
+// Sends until the client has all packets or its socket is full, the rest is sent when select() says it is writable.
+void RtspServer::sendClient(RtspClient_t &client){
+	if(!this->sendPending(client)){
+		return;
+	}
+	while(client.state == RTSP_CLIENT_PLAYING && !client.waitingKeyFrame && client.nextPacket < this->ringHead){
+		RtspPacket_t &packet = this->ring[client.nextPacket % RTSP_RING_PACKETS];
+		if(client.tcp){
+			uint8_t header[4] = {'$', client.channel, (uint8_t)(packet.length >> 8), (uint8_t)packet.length};
+			struct iovec iov[2];
+			iov[0].iov_base = header;
+			iov[0].iov_len = sizeof(header);
+			iov[1].iov_base = packet.data;
+			iov[1].iov_len = packet.length;
+			struct msghdr message;
+			bzero(&message, sizeof(message));
+			message.msg_iov = iov;
+			message.msg_iovlen = 2;
+			ssize_t result = sendmsg(client.fd, &message, MSG_NOSIGNAL | MSG_DONTWAIT);
+			if(result < 0){
+				if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR){
+					this->closeClient(client);
+				}
+				return;
+			}
+			if((uint32_t)result < sizeof(header) + packet.length){
+				// The stream must stay framed, the rest of the packet goes first next time (the ring slot may be reused).
+				for(uint32_t a=(uint32_t)result;a<sizeof(header);a++){
+					client.pending.push_back(header[a]);
+				}
+				uint32_t sent = ((uint32_t)result > sizeof(header)) ? (uint32_t)result - sizeof(header) : 0;
+				client.pending.insert(client.pending.end(), &packet.data[sent], &packet.data[packet.length]);
+			}
+		}else{
+			ssize_t result = sendto(this->rtpFd, packet.data, packet.length, MSG_DONTWAIT, (struct sockaddr *)&client.rtpAddress, sizeof(client.rtpAddress));
+			if(result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+				this->udpBlocked = true;
+				return;
+			}
+			// Other errors (no route, ICMP from a closed port) lose the packet like the network would.
+		}
+		client.nextPacket++;
+		client.packetsSent++;
+		this->packetsSent++;
+		if(client.pending.size() > 0){
+			return;
+		}
+	}
+}
+
+bool RtspServer::sendPending(RtspClient_t &client){
+	if(client.pending.size() == 0){
+		return true;
+	}
+	ssize_t result = send(client.fd, &client.pending[0], client.pending.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+	if(result < 0){
+		if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR){
+			this->closeClient(client);
+		}
+		return false;
+	}
+	client.pending.erase(client.pending.begin(), client.pending.begin() + result);
+	return client.pending.size() == 0;
+}
+
+void RtspServer::acceptClient(void){
+	struct sockaddr_in address;
+	socklen_t addressLength = sizeof(address);
+	int fd = accept(this->listenFd, (struct sockaddr *)&address, &addressLength);
+	if(fd < 0){
+		return;
+	}
+	RtspClient_t *client = NULL;
+	for(uint32_t a=0;a<RTSP_MAX_CLIENTS && client == NULL;a++){
+		if(this->clients[a].state == RTSP_CLIENT_FREE){
+			client = &this->clients[a];
+		}
+	}
+	if(client == NULL){
+		fprintf(stderr, "RtspServer: %s refused, %u clients already\n", inet_ntoa(address.sin_addr), RTSP_MAX_CLIENTS);
+		::close(fd);
+		return;
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	int on = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)); // interleaved RTP, do not wait to fill segments.
+	client->state = RTSP_CLIENT_CONNECTED;
+	client->fd = fd;
+	client->address = address;
+	client->requestSize = 0;
+	client->pending.clear();
+	client->tcp = false;
+	client->channel = 0;
+	bzero(&client->rtpAddress, sizeof(client->rtpAddress));
+	client->session = 0;
+	client->waitingKeyFrame = true;
+	client->nextPacket = 0;
+	client->packetsSent = 0;
+	client->overflows = 0;
+	fprintf(stderr, "RtspServer: %s connected\n", inet_ntoa(address.sin_addr));
+}
+
+void RtspServer::readClient(RtspClient_t &client){
+	ssize_t result = recv(client.fd, &client.request[client.requestSize], RTSP_MAX_REQUEST - 1 - client.requestSize, MSG_DONTWAIT);
+	if(result == 0 || (result < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)){
+		this->closeClient(client);
+		return;
+	}
+	if(result < 0){
+		return;
+	}
+	client.requestSize += result;
+	while(client.state != RTSP_CLIENT_FREE && client.requestSize > 0){
+		uint32_t used = 0;
+		if(client.request[0] == '$'){
+			// Interleaved RTCP from the client.
+			if(client.requestSize < 4){
+				break;
+			}
+			used = 4 + (((uint8_t)client.request[2] << 8) | (uint8_t)client.request[3]);
+			if(used >= RTSP_MAX_REQUEST){
+				this->closeClient(client);
+				return;
+			}
+			if(client.requestSize < used){
+				break;
+			}
+		}else{
+			client.request[client.requestSize] = 0;
+			char *end = strstr(client.request, "\r\n\r\n");
+			if(end == NULL){
+				if(client.requestSize >= RTSP_MAX_REQUEST - 1){
+					fprintf(stderr, "RtspServer: %s sent a request larger than %u bytes\n", inet_ntoa(client.address.sin_addr), RTSP_MAX_REQUEST);
+					this->closeClient(client);
+				}
+				break;
+			}
+			end[2] = 0; // the headers end with the last line break.
+			used = (end - client.request) + 4;
+			char value[32];
+			if(this->getHeader(client.request, "Content-Length", value, sizeof(value))){
+				used += (uint32_t)atoi(value); // body (SET_PARAMETER) is not used.
+			}
+			if(used >= RTSP_MAX_REQUEST){
+				this->closeClient(client);
+				return;
+			}
+			if(client.requestSize < used){
+				end[2] = '\r';
+				break;
+			}
+			if(this->handleRequest(client, client.request)){
+				this->sendPending(client);
+				this->closeClient(client);
+			}
+			if(client.state == RTSP_CLIENT_FREE){
+				return;
+			}
+		}
+		memmove(client.request, &client.request[used], client.requestSize - used);
+		client.requestSize -= used;
+	}
+}
+
+bool RtspServer::handleRequest(RtspClient_t &client, const char *request){
+	char method[32];
+	char url[256];
+	if(sscanf(request, "%31s %255s", method, url) != 2){
+		this->reply(client, "400 Bad Request", "0", "", "");
+		return true;
+	}
+	char cseq[32];
+	if(!this->getHeader(request, "CSeq", cseq, sizeof(cseq))){
+		strcpy(cseq, "0");
+	}
+	char headers[512];
+
+	// rtsp://host:port/<path>[/track], OPTIONS may use *.
+	bool pathOk = false;
+	const char *host = strstr(url, "://");
+	if(host != NULL){
+		const char *path = strchr(host + 3, '/');
+		uint32_t pathLength = strlen(this->path);
+		if(path != NULL){
+			path++;
+			pathOk = (strncmp(path, this->path, pathLength) == 0 && (path[pathLength] == 0 || path[pathLength] == '/'));
+		}else{
+			pathOk = (pathLength == 0);
+		}
+	}
+
+	if(strcmp(method, "OPTIONS") == 0){
+		this->reply(client, "200 OK", cseq, "Public: OPTIONS, DESCRIBE, SETUP, PLAY, TEARDOWN, GET_PARAMETER, SET_PARAMETER\r\n", "");
+	}else if(strcmp(method, "GET_PARAMETER") == 0 || strcmp(method, "SET_PARAMETER") == 0){
+		this->reply(client, "200 OK", cseq, "", ""); // keep alive.
+	}else if(strcmp(method, "TEARDOWN") == 0){
+		this->reply(client, "200 OK", cseq, "", "");
+		return true;
+	}else if(!pathOk){
+		this->reply(client, "404 Not Found", cseq, "", "");
+	}else if(strcmp(method, "DESCRIBE") == 0){
+		char sdp[RTSP_MAX_SDP];
+		uint32_t sdpLength = this->buildSdp(client, sdp, sizeof(sdp));
+		if(sdpLength == 0){ // a cut SDP would start the client with the wrong parameter sets.
+			this->reply(client, "500 Internal Server Error", cseq, "", "");
+			return false;
+		}
+		const char *slash = (url[strlen(url)-1] == '/') ? "" : "/";
+		snprintf(headers, sizeof(headers), "Content-Base: %s%s\r\nContent-Type: application/sdp\r\nContent-Length: %u\r\n", url, slash, sdpLength);
+		this->reply(client, "200 OK", cseq, headers, sdp);
+	}else if(strcmp(method, "SETUP") == 0){
+		char transport[256];
+		if(!this->getHeader(request, "Transport", transport, sizeof(transport)) || strstr(transport, "multicast") != NULL){
+			this->reply(client, "461 Unsupported Transport", cseq, "", "");
+			return false;
+		}
+		if(client.session == 0){
+			client.session = this->nextSession++;
+			if(client.session == 0){
+				client.session = this->nextSession++;
+			}
+		}
+		const char *interleaved = strstr(transport, "interleaved=");
+		const char *clientPort = strstr(transport, "client_port=");
+		if(strstr(transport, "RTP/AVP/TCP") != NULL || interleaved != NULL){
+			client.tcp = true;
+			client.channel = (interleaved != NULL) ? (uint8_t)atoi(interleaved + 12) : 0;
+			snprintf(headers, sizeof(headers), "Transport: RTP/AVP/TCP;unicast;interleaved=%u-%u;ssrc=%08X\r\nSession: %08X;timeout=%u\r\n",
+				client.channel, client.channel+1, this->ssrc, client.session, RTSP_SESSION_TIMEOUT);
+		}else if(clientPort != NULL){
+			uint32_t rtp = (uint32_t)atoi(clientPort + 12);
+			client.tcp = false;
+			client.rtpAddress = client.address;
+			client.rtpAddress.sin_port = htons(rtp);
+			snprintf(headers, sizeof(headers), "Transport: RTP/AVP;unicast;client_port=%u-%u;server_port=%u-%u;ssrc=%08X\r\nSession: %08X;timeout=%u\r\n",
+				rtp, rtp+1, this->rtpPort, this->rtpPort+1, this->ssrc, client.session, RTSP_SESSION_TIMEOUT);
+		}else{
+			this->reply(client, "461 Unsupported Transport", cseq, "", "");
+			return false;
+		}
+		this->reply(client, "200 OK", cseq, headers, "");
+	}else if(strcmp(method, "PLAY") == 0){
+		if(client.session == 0){
+			this->reply(client, "455 Method Not Valid in This State", cseq, "", "");
+			return false;
+		}
+		snprintf(headers, sizeof(headers), "Session: %08X;timeout=%u\r\nRange: npt=0.000-\r\n", client.session, RTSP_SESSION_TIMEOUT);
+		this->reply(client, "200 OK", cseq, headers, "");
+		if(client.state != RTSP_CLIENT_PLAYING){
+			client.state = RTSP_CLIENT_PLAYING;
+			client.waitingKeyFrame = true;
+			fprintf(stderr, "RtspServer: %s playing over %s, starts at the next keyframe\n", inet_ntoa(client.address.sin_addr), client.tcp ? "TCP" : "UDP");
+		}
+	}else{
+		this->reply(client, "501 Not Implemented", cseq, "", "");
+	}
+	return false;
+}
+
+void RtspServer::reply(RtspClient_t &client, const char *status, const char *cseq, const char *headers, const char *body){
+	char response[RTSP_MAX_REQUEST];
+	int length = snprintf(response, sizeof(response), "RTSP/1.0 %s\r\nCSeq: %s\r\nServer: OpenHD-LTE rx_raw\r\n%s\r\n%s", status, cseq, headers, body);
+	if(length < 0 || length >= (int)sizeof(response)){
+		return;
+	}
+	if(client.pending.size() + length > RTSP_MAX_PENDING){
+		fprintf(stderr, "RtspServer: %s does not read the replies\n", inet_ntoa(client.address.sin_addr));
+		this->closeClient(client);
+		return;
+	}
+	client.pending.insert(client.pending.end(), (uint8_t *)response, (uint8_t *)response + length);
+	this->sendPending(client);
+}
+
+void RtspServer::closeClient(RtspClient_t &client){
+	if(client.state == RTSP_CLIENT_FREE){
+		return;
+	}
+	fprintf(stderr, "RtspServer: %s disconnected, %llu packets sent, fell behind %u times\n", inet_ntoa(client.address.sin_addr),
+		(unsigned long long)client.packetsSent, client.overflows);
+	::close(client.fd);
+	client.fd = -1;
+	client.state = RTSP_CLIENT_FREE;
+	client.requestSize = 0;
+	client.pending.clear();
+}
+
+bool RtspServer::getHeader(const char *request, const char *name, char *value, uint32_t size){
+	uint32_t nameLength = strlen(name);
+	const char *line = strstr(request, "\r\n");
+	while(line != NULL){
+		line += 2;
+		if(strncasecmp(line, name, nameLength) == 0 && line[nameLength] == ':'){
+			const char *start = &line[nameLength+1];
+			while(*start == ' ' || *start == '\t'){
+				start++;
+			}
+			const char *end = strstr(start, "\r\n");
+			uint32_t length = (end != NULL) ? end - start : strlen(start);
+			if(length >= size){
+				length = size - 1;
+			}
+			memcpy(value, start, length);
+			value[length] = 0;
+			return true;
+		}
+		line = strstr(line, "\r\n");
+	}
+	return false;
+}
+
+uint32_t RtspServer::buildSdp(RtspClient_t &client, char *sdp, uint32_t size){
+	struct sockaddr_in local;
+	socklen_t localLength = sizeof(local);
+	bzero(&local, sizeof(local));
+	getsockname(client.fd, (struct sockaddr *)&local, &localLength);
+	char fmtp[RTSP_MAX_FMTP] = "packetization-mode=1";
+	if(this->spsSize >= 4 && this->ppsSize > 0){
+		char sps[RTSP_BASE64_SIZE(RTSP_MAX_PARAMETER_SET)];
+		char pps[RTSP_BASE64_SIZE(RTSP_MAX_PARAMETER_SET)];
+		base64(this->sps, this->spsSize, sps);
+		base64(this->pps, this->ppsSize, pps);
+		int fmtpLength = snprintf(fmtp, sizeof(fmtp), "packetization-mode=1;profile-level-id=%02X%02X%02X;sprop-parameter-sets=%s,%s",
+			this->sps[1], this->sps[2], this->sps[3], sps, pps);
+		if(fmtpLength < 0 || fmtpLength >= (int)sizeof(fmtp)){
+			fprintf(stderr, "RtspServer: sprop-parameter-sets does not fit the SDP\n");
+			return 0;
+		}
+	}
+	int length = snprintf(sdp, size, "v=0\r\n"
+		"o=- %u 1 IN IP4 %s\r\n"
+		"s=OpenHD-LTE\r\n"
+		"c=IN IP4 0.0.0.0\r\n"
+		"t=0 0\r\n"
+		"a=tool:rx_raw\r\n"
+		"a=control:*\r\n"
+		"a=range:npt=0-\r\n"
+		"m=video 0 RTP/AVP %u\r\n"
+		"a=rtpmap:%u H264/90000\r\n"
+		"a=fmtp:%u %s\r\n"
+		"a=control:track1\r\n",
+		this->ssrc, inet_ntoa(local.sin_addr), RTSP_PAYLOAD_TYPE, RTSP_PAYLOAD_TYPE, RTSP_PAYLOAD_TYPE, fmtp);
+	return (length > 0 && (uint32_t)length < size) ? (uint32_t)length : 0;
+}
+
+uint32_t RtspServer::base64(const uint8_t *data, uint32_t length, char *output){
+	const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	uint32_t size=0;
+	for(uint32_t a=0;a<length;a+=3){
+		uint32_t value = (uint32_t)data[a] << 16;
+		if(a+1 < length){
+			value |= (uint32_t)data[a+1] << 8;
+		}
+		if(a+2 < length){
+			value |= data[a+2];
+		}
+		output[size++] = table[(value >> 18) & 0x3F];
+		output[size++] = table[(value >> 12) & 0x3F];
+		output[size++] = (a+1 < length) ? table[(value >> 6) & 0x3F] : '=';
+		output[size++] = (a+2 < length) ? table[value & 0x3F] : '=';
+	}
+	output[size] = 0;
+	return size;
+}
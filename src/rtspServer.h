@@ -0,0 +1,158 @@
+/*
+	rtspServer.h
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+
+#ifndef RTSPSERVER_H_
+#define RTSPSERVER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h> // bzero
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <vector>
+
+#define RTSP_DEFAULT_PORT 8554
+#define RTSP_DEFAULT_PATH "live"
+#define RTSP_MAX_CLIENTS 16
+#define RTSP_RING_PACKETS 4096          // shared by all clients, ~2s of a 20Mbit/s stream.
+#define RTSP_MAX_PAYLOAD 1400           // RTP payload, fits the 1500 MTU with IP/UDP/RTP headers.
+#define RTSP_RTP_HEADER_SIZE 12
+#define RTSP_MAX_PACKET (RTSP_RTP_HEADER_SIZE + RTSP_MAX_PAYLOAD)
+#define RTSP_MAX_REQUEST 4096
+#define RTSP_MAX_PENDING (256*1024)     // RTSP replies and the rest of a cut RTP packet (TCP).
+#define RTSP_MAX_NAL_SIZE (2*1024*1024) // larger NAL units are dropped, the stream is broken anyway.
+#define RTSP_MAX_PARAMETER_SET 256
+#define RTSP_BASE64_SIZE(n) (4*(((n)+2)/3) + 1)                              // with the terminating 0.
+#define RTSP_MAX_FMTP (64 + 2*RTSP_BASE64_SIZE(RTSP_MAX_PARAMETER_SET))      // sprop-parameter-sets of the largest SPS and PPS.
+#define RTSP_MAX_SDP (512 + RTSP_MAX_FMTP)
+#define RTSP_PAYLOAD_TYPE 96
+#define RTSP_RTP_PORT_FIRST 6970        // server_port pairs are searched from here, like live555.
+#define RTSP_RTP_PORT_LAST 6998
+#define RTSP_SESSION_TIMEOUT 60         // seconds, in the Session header. The session ends with its TCP connection.
+
+enum RtspClientState_t{
+	RTSP_CLIENT_FREE=0,
+	RTSP_CLIENT_CONNECTED,   // OPTIONS / DESCRIBE / SETUP.
+	RTSP_CLIENT_PLAYING
+};
+
+typedef struct {
+	RtspClientState_t state;
+	int fd;                           // RTSP connection, also carries the interleaved RTP with TCP transport.
+	struct sockaddr_in address;
+	char request[RTSP_MAX_REQUEST];
+	uint32_t requestSize;
+	std::vector<uint8_t> pending;     // bytes to send on fd before the next ring packet.
+	bool tcp;
+	uint8_t channel;                  // interleaved RTP channel.
+	struct sockaddr_in rtpAddress;    // UDP transport.
+	uint32_t session;
+	bool waitingKeyFrame;             // joined (or fell behind), starts at the next SPS / IDR.
+	uint64_t nextPacket;              // ring packet number to send next.
+	uint64_t packetsSent;
+	uint32_t overflows;
+} RtspClient_t;
+
+typedef struct {
+	uint16_t length;
+	bool joinPoint;                   // first packet of a keyframe with its SPS / PPS.
+	uint8_t data[RTSP_MAX_PACKET];
+} RtspPacket_t;
+
+// RTSP server for the H.264 stream rx_raw reassembles, so viewers connect to the ground Pi directly
+// (VLC, ffplay, QGroundControl, rtsp-simple-server as a relay) without a second Pi re-encoding the HDMI output.
+// Single threaded, rx_raw adds the sockets to its select(). The stream is packetized once (RFC 6184,
+// single NAL unit and FU-A) into a ring all clients share, each client has its own position in it:
+// - RTP over UDP (client_port) or interleaved in the RTSP TCP connection, per client.
+// - a new client starts on the next keyframe, a client too slow for the ring is moved to the next keyframe
+//   instead of getting a broken stream, without slowing the other clients or rx_raw.
+// - the SDP has the SPS / PPS (sprop-parameter-sets) from the stream, they are also sent before a keyframe
+//   when the stream does not repeat them.
+class RtspServer
+{
+	// Public functions
+	public:
+	RtspServer();
+	virtual ~RtspServer(); //destructor
+
+	bool open(uint16_t port, const char *path); // returns true on error.
+	int setFD_SET(fd_set *readSet, fd_set *writeSet); // returns the highest fd added.
+	void service(fd_set *readSet, fd_set *writeSet);  // after select().
+
+	// Annex-B data of complete NAL units (the frames H264RXFraming delivers), then flush() at the end of the frames.
+	void inputData(const uint8_t *data, uint32_t length, uint64_t nowUs);
+	void flush(void);
+	void close(void);
+
+	uint32_t getClients(void);
+	uint32_t getPlayingClients(void);
+	uint64_t getPacketsSent(void);    // to all clients.
+	uint32_t getOverflows(void);      // clients moved to the next keyframe because they were too slow.
+	uint64_t getPackets(void);        // packetized.
+
+	private:
+	int listenFd;
+	int rtpFd;
+	int rtcpFd;
+	uint16_t port;
+	uint16_t rtpPort;
+	char path[128];
+	RtspClient_t clients[RTSP_MAX_CLIENTS];
+	uint32_t nextSession;
+	uint64_t packetsSent;
+	uint32_t overflows;
+	bool udpBlocked;                  // a sendto() on rtpFd would block, wait for it to be writable.
+
+	// Shared packet ring:
+	RtspPacket_t *ring;
+	uint64_t ringHead;                // number of the next packet.
+	uint32_t ssrc;
+	uint16_t sequence;
+
+	// Annex-B parsing:
+	std::vector<uint8_t> nal;         // NAL unit being received, without start code.
+	bool inNal;
+	uint32_t zeros;
+	bool nalTooLarge;
+	uint64_t nalStartUs;
+
+	// Access unit being packetized:
+	bool accessUnitStarted;
+	bool accessUnitHasSlice;
+	bool accessUnitHasJoinPoint;      // SPS sent (or added) for the keyframe, new clients start there.
+	uint32_t timestamp;               // 90kHz, from the arrival of the first NAL unit.
+	uint32_t timestampOffset;         // random start, RFC 3550.
+	bool timestampValid;
+	uint64_t lastPacketOfAccessUnit;  // gets the marker bit when the access unit ends.
+	bool hasPacketInAccessUnit;
+
+	uint8_t sps[RTSP_MAX_PARAMETER_SET];
+	uint16_t spsSize;
+	uint8_t pps[RTSP_MAX_PARAMETER_SET];
+	uint16_t ppsSize;
+
+	void nalComplete(void);
+	void endAccessUnit(void);
+	void packetizeNal(const uint8_t *data, uint32_t length, bool joinPoint);
+	RtspPacket_t* newPacket(bool joinPoint);
+	void sendPackets(void);
+	void sendClient(RtspClient_t &client);
+	bool sendPending(RtspClient_t &client); // returns true when all is sent.
+
+	void acceptClient(void);
+	void readClient(RtspClient_t &client);
+	bool handleRequest(RtspClient_t &client, const char *request); // returns true if the client is to be closed.
+	void reply(RtspClient_t &client, const char *status, const char *cseq, const char *headers, const char *body);
+	void closeClient(RtspClient_t &client);
+	bool getHeader(const char *request, const char *name, char *value, uint32_t size); // returns true if found.
+	uint32_t buildSdp(RtspClient_t &client, char *sdp, uint32_t size);
+	static uint32_t base64(const uint8_t *data, uint32_t length, char *output);
+};
+
+#endif /* RTSPSERVER_H_ */
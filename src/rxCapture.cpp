@@ -0,0 +1,208 @@
+/*
+	rxCapture.cpp
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+#include "rxCapture.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <chrono>
+
+RXCapture::RXCapture(){
+	this->fd = -1;
+	this->startUs = 0;
+	this->buffer = NULL;
+	this->bufferUsed = 0;
+	this->records = 0;
+	this->bytesWritten = 0;
+	this->failed = false;
+	this->map = NULL;
+	this->mapSize = 0;
+	this->readOffset = 0;
+}
+
+RXCapture::~RXCapture(){
+	this->close();
+}
+
+bool RXCapture::create(const char *filename){
+	this->close();
+	this->fd = ::open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(this->fd < 0){
+		fprintf(stderr, "RXCapture: Unable to create %s (%s)\n", filename, strerror(errno));
+		return true;
+	}
+	this->buffer = (uint8_t *)malloc(RX_CAPTURE_BUFFER_SIZE);
+	if(this->buffer == NULL){
+		fprintf(stderr, "RXCapture: Unable to allocate capture buffer\n");
+		this->close();
+		return true;
+	}
+	this->startUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	this->records = 0;
+	this->bytesWritten = 0;
+	this->failed = false;
+
+	RXCaptureHeader_t header;
+	bzero(&header, sizeof(header));
+	header.magic = RX_CAPTURE_MAGIC;
+	header.version = RX_CAPTURE_VERSION;
+	header.headerSize = sizeof(RXCaptureHeader_t);
+	header.startRealtimeUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	memcpy(this->buffer, &header, sizeof(header));
+	this->bufferUsed = sizeof(header);
+	this->flush(); // a capture always starts with a valid header, even if nothing arrives.
+	return this->failed;
+}
+
+void RXCapture::record(RXCaptureChannel_t channel, uint64_t nowUs, const struct sockaddr_in *source, const uint8_t *data, uint16_t length){
+	if(this->fd < 0 || this->failed){
+		return;
+	}
+	uint32_t size = getRecordSize(length);
+	if(this->bufferUsed + size > RX_CAPTURE_BUFFER_SIZE){
+		this->flush();
+		if(this->failed){
+			return;
+		}
+	}
+	RXCaptureRecord_t *record = (RXCaptureRecord_t *)&this->buffer[this->bufferUsed];
+	bzero(record, sizeof(RXCaptureRecord_t));
+	record->timeUs = (nowUs > this->startUs) ? nowUs - this->startUs : 0;
+	if(source != NULL){
+		record->sourceIP = source->sin_addr.s_addr;
+		record->sourcePort = ntohs(source->sin_port);
+	}
+	record->channel = (uint8_t)channel;
+	record->length = length;
+	memcpy(&this->buffer[this->bufferUsed + sizeof(RXCaptureRecord_t)], data, length);
+	// Padding is cleared so captures of the same input are identical files.
+	bzero(&this->buffer[this->bufferUsed + sizeof(RXCaptureRecord_t) + length], size - sizeof(RXCaptureRecord_t) - length);
+	this->bufferUsed += size;
+	this->records++;
+}
+
+void RXCapture::flush(void){
+	if(this->fd < 0 || this->failed || this->bufferUsed == 0){
+		return;
+	}
+	uint32_t done = 0;
+	while(done < this->bufferUsed){
+		ssize_t result = write(this->fd, &this->buffer[done], this->bufferUsed - done);
+		if(result < 0 && errno == EINTR){
+			continue;
+		}
+		if(result <= 0){
+			fprintf(stderr, "RXCapture: Write failed (%s), capture stopped after %u records\n", strerror(errno), this->records);
+			this->failed = true;
+			break;
+		}
+		done += result;
+	}
+	this->bytesWritten += done;
+	this->bufferUsed = 0;
+}
+
+uint32_t RXCapture::getRecords(void){
+	return this->records;
+}
+
+uint64_t RXCapture::getBytesWritten(void){
+	return this->bytesWritten;
+}
+
+bool RXCapture::open(const char *filename){
+	this->close();
+	int file = ::open(filename, O_RDONLY);
+	if(file < 0){
+		fprintf(stderr, "RXCapture: Unable to open %s (%s)\n", filename, strerror(errno));
+		return true;
+	}
+	struct stat info;
+	if(fstat(file, &info) < 0 || (size_t)info.st_size < sizeof(RXCaptureHeader_t)){
+		fprintf(stderr, "RXCapture: %s is not a capture file (too short)\n", filename);
+		::close(file);
+		return true;
+	}
+	void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	::close(file);
+	if(data == MAP_FAILED){
+		fprintf(stderr, "RXCapture: Unable to map %s (%s)\n", filename, strerror(errno));
+		return true;
+	}
+	madvise(data, info.st_size, MADV_SEQUENTIAL);
+	this->map = (const uint8_t *)data;
+	this->mapSize = info.st_size;
+
+	const RXCaptureHeader_t *header = (const RXCaptureHeader_t *)this->map;
+	if(header->magic != RX_CAPTURE_MAGIC || header->version != RX_CAPTURE_VERSION || header->headerSize < sizeof(RXCaptureHeader_t)
+		|| header->headerSize > this->mapSize || (header->headerSize % RX_CAPTURE_ALIGN) != 0){
+		fprintf(stderr, "RXCapture: %s is not a version %u capture file\n", filename, RX_CAPTURE_VERSION);
+		this->close();
+		return true;
+	}
+	this->rewind();
+	return false;
+}
+
+bool RXCapture::nextRecord(const RXCaptureRecord_t *&record, const uint8_t *&data){
+	if(this->map == NULL || this->readOffset + sizeof(RXCaptureRecord_t) > this->mapSize){
+		return false;
+	}
+	const RXCaptureRecord_t *next = (const RXCaptureRecord_t *)&this->map[this->readOffset];
+	uint32_t size = getRecordSize(next->length);
+	if(this->readOffset + size > this->mapSize || next->channel >= RX_CAPTURE_CHANNEL_COUNT){
+		fprintf(stderr, "RXCapture: Capture ends with an incomplete record at offset %zu, ignored\n", this->readOffset);
+		this->readOffset = this->mapSize;
+		return false;
+	}
+	record = next;
+	data = &this->map[this->readOffset + sizeof(RXCaptureRecord_t)];
+	this->readOffset += size;
+	return true;
+}
+
+void RXCapture::rewind(void){
+	if(this->map != NULL){
+		this->readOffset = ((const RXCaptureHeader_t *)this->map)->headerSize;
+	}
+}
+
+uint64_t RXCapture::getStartRealtimeUs(void){
+	if(this->map == NULL){
+		return 0;
+	}
+	return ((const RXCaptureHeader_t *)this->map)->startRealtimeUs;
+}
+
+void RXCapture::close(void){
+	if(this->fd >= 0){
+		this->flush();
+		::close(this->fd);
+		this->fd = -1;
+	}
+	if(this->buffer != NULL){
+		free(this->buffer);
+		this->buffer = NULL;
+	}
+	this->bufferUsed = 0;
+	if(this->map != NULL){
+		munmap((void *)this->map, this->mapSize);
+		this->map = NULL;
+		this->mapSize = 0;
+	}
+	this->readOffset = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+////////////////////////// Private Helper functions //////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+uint32_t RXCapture::getRecordSize(uint16_t length){
+	return (sizeof(RXCaptureRecord_t) + length + RX_CAPTURE_ALIGN - 1) & ~(RX_CAPTURE_ALIGN - 1);
+}
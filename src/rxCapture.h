@@ -0,0 +1,91 @@
+/*
+	rxCapture.h
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+
+#ifndef RXCAPTURE_H_
+#define RXCAPTURE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h> // bzero
+#include <netinet/in.h>
+
+#define RX_CAPTURE_MAGIC 0x4344484F   // "OHDC" little endian.
+#define RX_CAPTURE_VERSION 1
+#define RX_CAPTURE_BUFFER_SIZE 65536  // records are collected and written in blocks of this size.
+#define RX_CAPTURE_ALIGN 8            // every record starts 8 byte aligned, the file can be used straight from mmap.
+
+// What the datagram was received on.
+enum RXCaptureChannel_t{
+	RX_CAPTURE_VIDEO=0,
+	RX_CAPTURE_MAVLINK,
+	RX_CAPTURE_TELEMETRY,
+	RX_CAPTURE_CHANNEL_COUNT
+};
+
+typedef struct {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t headerSize;       // sizeof(RXCaptureHeader_t), records start here.
+	uint64_t startRealtimeUs;  // wall clock when the capture started, to match it with the flight log.
+	uint64_t reserved[2];
+} RXCaptureHeader_t;
+
+typedef struct {
+	uint64_t timeUs;           // arrival time since the capture started (steady clock).
+	uint32_t sourceIP;         // network byte order.
+	uint16_t sourcePort;
+	uint8_t channel;           // RXCaptureChannel_t.
+	uint8_t reserved;
+	uint16_t length;           // datagram bytes after this header, then padding to RX_CAPTURE_ALIGN.
+	uint16_t reserved2;
+	uint32_t reserved3;
+} RXCaptureRecord_t;
+
+// Append only capture of the datagrams rx_raw receives, with arrival time and source, for replaying a flight
+// through H264RXFraming. Records are copied to a buffer and written in blocks, so capturing costs a memcpy per
+// datagram in the receive loop. A capture cut short (power loss) can be read up to the last complete record.
+class RXCapture
+{
+	// Public functions
+	public:
+	RXCapture();
+	virtual ~RXCapture(); //destructor
+
+	// Writing:
+	bool create(const char *filename); // returns true on error.
+	void record(RXCaptureChannel_t channel, uint64_t nowUs, const struct sockaddr_in *source, const uint8_t *data, uint16_t length);
+	void flush(void); // write what is buffered (once per status interval).
+	uint32_t getRecords(void);
+	uint64_t getBytesWritten(void);
+
+	// Reading (mmap):
+	bool open(const char *filename); // returns true on error.
+	bool nextRecord(const RXCaptureRecord_t *&record, const uint8_t *&data); // false at the end.
+	void rewind(void);
+	uint64_t getStartRealtimeUs(void);
+
+	void close(void);
+
+	private:
+	int fd;
+	uint64_t startUs;          // steady clock at create(), record times are relative to this.
+	uint8_t *buffer;
+	uint32_t bufferUsed;
+	uint32_t records;
+	uint64_t bytesWritten;
+	bool failed;               // a write failed, capturing has stopped (rx_raw keeps running).
+
+	const uint8_t *map;
+	size_t mapSize;
+	size_t readOffset;
+
+	static uint32_t getRecordSize(uint16_t length);
+};
+
+#endif /* RXCAPTURE_H_ */
@@ -13,6 +13,21 @@ void usage(void) {
 
 	"-i  <IP>       IP to forward all Mavlink data to MavlinkServer.\n"
 	"-r  <port>     Port for relay Mavlink data.\n"
+	"-l             Convert Mavlink 2 from the drone back to Mavlink 1 for legacy consumers (tx_raw -m 2).\n"
+	"-x  <file>     Dictionary for compressed Mavlink (tx_raw -c -x), must be the same file as on the drone.\n"
+	"-s  <Hz>       Rate of the link status frame to QOpenHD (default %d).\n"
+	"-w  <file>     Capture every UDP package from the drone (arrival time and source) to file.\n"
+	"-R  <file>     Replay a capture through the video framing to stdout, no ports are opened.\n"
+	"-F             Replay as fast as possible instead of at the original timing.\n"
+	"-L  <name>     Log the Mavlink frames from and to the drone as tlog (<name>-NNNN.tlog + <name>.tidx, tools/tlogReader).\n"
+	"-S  <port>[/<path>] Serve the video over RTSP (RTP/UDP or TCP) at rtsp://<this IP>:<port>/<path> (default path %s).\n"
+	"-o  <output>   Also send the video to fifo:<path>, udp:<ip>:<port> (unicast or multicast) or unix:<path> (local\n"
+	"               socket, any number of readers). Up to %d outputs, a slow one skips to the next keyframe.\n"
+	"-G  <IP>       Receive through the relay at IP or hostname (the drone is behind carrier-grade NAT), the ports are the same there.\n"
+	"-k  <session>  Session number at the relay, the same as tx_raw -k.\n"
+	"-K  <key>      Key of the relay (relay -K), the hellos are signed with it. Needed with -G.\n"
+	"-T             Kernel receive timestamps on the video packages, splits the waiting in the socket from the LTE delay\n"
+	"               (metrics video_socket_queue_us) and times the jitter and frame delay from the arrival.\n"
 	"Program will automatically sent:\n"
 	"Video->localhost:5600\n"
 	"Mavlink->localhost:14450\n"
@@ -22,7 +37,17 @@ void usage(void) {
 	"Mavlink->192.168.0.8:6000\n" // For video record on/off.
 	"Example:\n"
 	"  ./rx_raw -v 7000 -m 12000 -t 5200 -i 192.168.0.67 -r 14550\n"
-	"\n");
+	"  ./rx_raw -v 7000 -m 12000 -t 5200 -l\n"
+	"  ./rx_raw -v 7000 -m 12000 -t 5200 -l -x mavlink.dict\n"
+	"  ./rx_raw -v 7000 -m 12000 -t 5200 -s 5\n"
+	"  ./rx_raw -v 7000 -m 12000 -t 5200 -w flight.cap | gst-launch-1.0 ...\n"
+	"  ./rx_raw -R flight.cap -F > flight.h264\n"
+	"  ./rx_raw -v 7000 -m 12000 -t 5200 -L flight\n"
+	"  ./rx_raw -v 7000 -m 12000 -t 5200 -S %u > /dev/null   (ffplay rtsp://<ground pi>:%u/%s)\n"
+	"  ./rx_raw -v 7000 -m 12000 -t 5200 -o fifo:/tmp/record.h264 -o udp:239.0.0.1:5600 -o unix:/tmp/video.sock | ...\n"
+	"  ./rx_raw -v 7000 -m 12000 -t 5200 -G <relay IP> -k 42 -K <key>\n"
+	"  ./rx_raw -v 7000 -m 12000 -t 5200 -T\n"
+	"\n", DEFAULT_TELEMETRY_RATE_HZ, RTSP_DEFAULT_PATH, VIDEO_FANOUT_MAX_SUBSCRIBERS, RTSP_DEFAULT_PORT, RTSP_DEFAULT_PORT, RTSP_DEFAULT_PATH);
 	exit(1);
 }
 
@@ -30,6 +55,170 @@ void usage(void) {
 #define OUTPUT_MAVLINK_PORT 14550
 #define OUTPUT_TELEMETRY_PORT 5155
 
+uint64_t timeMillisec() {
+	using namespace std::chrono;
+	return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t timeMicrosec() {
+	using namespace std::chrono;
+	return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t timeRealtimeNanosec() { // the clock of the kernel receive timestamps.
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// The frames written to the video pipe also go to the RTSP clients and the -o outputs (which keep the package).
+void videoOutputTap(void *context, H264UDPPackage *package){
+	rx_videoOutputs_t *outputs = (rx_videoOutputs_t *)context;
+	if(outputs->rtspServer != NULL){
+		outputs->rtspServer->inputData(package->getPayload(), package->getPayloadSize(), timeMicrosec());
+	}
+	if(outputs->fanout != NULL){
+		outputs->fanout->inputPackage(package);
+	}
+}
+
+void initRXMetrics(ShmMetrics &metrics){
+	metrics.define(RX_METRIC_VIDEO_BYTES, "video_bytes", SHM_METRIC_COUNTER);
+	metrics.define(RX_METRIC_VIDEO_OUT_BYTES, "video_out_bytes", SHM_METRIC_COUNTER);
+	metrics.define(RX_METRIC_VIDEO_DROPPED_BYTES, "video_dropped_bytes", SHM_METRIC_COUNTER);
+	metrics.define(RX_METRIC_VIDEO_PACKAGES, "video_packages", SHM_METRIC_COUNTER);
+	metrics.define(RX_METRIC_VIDEO_LOST, "video_lost_packages", SHM_METRIC_COUNTER);
+	metrics.define(RX_METRIC_VIDEO_REORDERED, "video_reordered_packages", SHM_METRIC_COUNTER);
+	metrics.define(RX_METRIC_VIDEO_LATE, "video_late_packages", SHM_METRIC_COUNTER);
+	metrics.define(RX_METRIC_VIDEO_RESYNCS, "video_resyncs", SHM_METRIC_COUNTER);
+	metrics.define(RX_METRIC_VIDEO_FRAMES, "video_frames", SHM_METRIC_COUNTER);
+	metrics.define(RX_METRIC_VIDEO_FRAMES_DROPPED, "video_frames_dropped", SHM_METRIC_COUNTER);
+	metrics.define(RX_METRIC_VIDEO_WAITING, "video_waiting_packages", SHM_METRIC_GAUGE);
+	metrics.define(RX_METRIC_VIDEO_FRAME_PACKAGES, "video_frame_packages", SHM_METRIC_GAUGE);
+	metrics.define(RX_METRIC_VIDEO_OUTPUT_FIFO, "video_output_fifo_packages", SHM_METRIC_GAUGE);
+	metrics.define(RX_METRIC_MAVLINK_BYTES, "mavlink_bytes", SHM_METRIC_COUNTER);
+	metrics.define(RX_METRIC_MAVLINK_TO_DRONE_BYTES, "mavlink_to_drone_bytes", SHM_METRIC_COUNTER);
+	metrics.define(RX_METRIC_MAVLINK_BATCHES, "mavlink_compressed_batches", SHM_METRIC_COUNTER);
+	metrics.define(RX_METRIC_MAVLINK_LOST_FRAMES, "mavlink_lost_frames", SHM_METRIC_COUNTER);
+	metrics.define(RX_METRIC_MAVLINK_ERRORS, "mavlink_decompress_errors", SHM_METRIC_COUNTER);
+	metrics.define(RX_METRIC_STATUS_FRAMES, "qopenhd_status_frames", SHM_METRIC_COUNTER);
+	metrics.define(RX_METRIC_VIDEO_SOCKET_DROPS, "video_socket_dropped_packages", SHM_METRIC_COUNTER);
+	metrics.define(RX_METRIC_VIDEO_SOCKET_BUFFER, "video_socket_buffer_bytes", SHM_METRIC_GAUGE);
+	metrics.define(RX_METRIC_VIDEO_SOCKET_BURST, "video_socket_burst_bytes", SHM_METRIC_GAUGE);
+	metrics.define(RX_METRIC_VIDEO_MTU_PROBES, "video_mtu_probes", SHM_METRIC_COUNTER);
+	metrics.defineHistogram(RX_HISTOGRAM_VIDEO_GAP, "video_gap_us");
+	metrics.defineHistogram(RX_HISTOGRAM_VIDEO_WRITE, "video_write_us");
+	metrics.defineHistogram(RX_HISTOGRAM_VIDEO_SOCKET_QUEUE, "video_socket_queue_us");
+	metrics.defineHistogram(RX_HISTOGRAM_VIDEO_FRAME_DELAY, "video_frame_delay_us");
+}
+
+// Counters the other classes keep per status interval (or as totals), called before publish and before they are cleared.
+void updateRXMetrics(ShmMetrics &metrics, H264RXFraming &framing, MavlinkDecompressor &decompressor, rx_dataRates_t &linkstatus){
+	metrics.setInterval(RX_METRIC_VIDEO_BYTES, framing.getBytesInputted());
+	metrics.setInterval(RX_METRIC_VIDEO_OUT_BYTES, framing.getBytesOutputted());
+	metrics.setInterval(RX_METRIC_VIDEO_DROPPED_BYTES, framing.getBytesDropped());
+	metrics.set(RX_METRIC_VIDEO_PACKAGES, framing.getPackagesReceived());
+	metrics.set(RX_METRIC_VIDEO_LOST, framing.getPackagesLost());
+	metrics.set(RX_METRIC_VIDEO_REORDERED, framing.getPackagesReordered());
+	metrics.set(RX_METRIC_VIDEO_LATE, framing.getPackagesLate());
+	metrics.set(RX_METRIC_VIDEO_RESYNCS, framing.getResyncs());
+	metrics.set(RX_METRIC_VIDEO_FRAMES, framing.getFramesDelivered());
+	metrics.set(RX_METRIC_VIDEO_FRAMES_DROPPED, framing.getFramesDropped());
+	metrics.set(RX_METRIC_VIDEO_WAITING, framing.getWaitingPackages());
+	metrics.set(RX_METRIC_VIDEO_FRAME_PACKAGES, framing.getFramePackages());
+	metrics.set(RX_METRIC_VIDEO_OUTPUT_FIFO, framing.getOutputStreamFIFOSize());
+	metrics.setInterval(RX_METRIC_MAVLINK_TO_DRONE_BYTES, (uint64_t)linkstatus.tx);
+	metrics.setInterval(RX_METRIC_MAVLINK_BATCHES, decompressor.getBatches());
+	metrics.setInterval(RX_METRIC_MAVLINK_LOST_FRAMES, decompressor.getFramesLost());
+	metrics.setInterval(RX_METRIC_MAVLINK_ERRORS, decompressor.getErrors());
+}
+
+volatile sig_atomic_t stopRequested = 0;
+
+void stopHandler(int){
+	stopRequested = 1;
+}
+
+// Feed a capture from -w through the video framing and Mavlink decompression, like it arrived on the sockets.
+// The framing does not look at the clock, so the output and counters are the same at any replay speed.
+int replayCapture(const char *filename, bool fast, H264RXFraming &framing, MavlinkDecompressor &decompressor){
+	static RXCapture capture;
+	if(capture.open(filename)){
+		return EXIT_FAILURE;
+	}
+	time_t started = (time_t)(capture.getStartRealtimeUs() / 1000000);
+	fprintf(stderr, "RX: Replaying %s captured %s", filename, ctime(&started));
+
+	uint8_t mavlinkFrames[MAVLINK_COMPRESSION_MAX_BATCH];
+	uint32_t records[RX_CAPTURE_CHANNEL_COUNT] = {0};
+	uint64_t bytesIn = 0;
+	uint64_t bytesOut = 0;
+	uint32_t oversized = 0;
+	const RXCaptureRecord_t *record;
+	const uint8_t *data;
+	uint64_t startUs = timeMicrosec();
+	uint64_t lastTimeUs = 0;
+	while(capture.nextRecord(record, data) && !stopRequested){
+		if(!fast && record->timeUs > lastTimeUs){
+			// Output what the last burst completed before waiting for the next package, like the receive loop.
+			framing.writeAllOutputStreamTo(STDOUT_FILENO);
+			uint64_t dueUs = startUs + record->timeUs;
+			uint64_t nowUs = timeMicrosec();
+			if(dueUs > nowUs){
+				std::this_thread::sleep_for(std::chrono::microseconds(dueUs - nowUs));
+			}
+		}
+		lastTimeUs = record->timeUs;
+		records[record->channel]++;
+		if(record->channel == RX_CAPTURE_VIDEO){
+			if(record->length > framing.getPackageMaxSize()){
+				oversized++;
+				continue;
+			}
+			memcpy(framing.getInputBuffer(), data, record->length);
+			framing.setData(record->length);
+			bytesIn += record->length;
+			if(fast){
+				framing.writeAllOutputStreamTo(STDOUT_FILENO);
+			}
+			bytesOut += framing.getBytesOutputted();
+			framing.clearIOstatus();
+		}else if(record->channel == RX_CAPTURE_MAVLINK && MavlinkDecompressor::isCompressed(data, record->length)){
+			decompressor.decompress(data, record->length, mavlinkFrames, sizeof(mavlinkFrames));
+		}
+	}
+	framing.writeAllOutputStreamTo(STDOUT_FILENO);
+	bytesOut += framing.getBytesOutputted();
+
+	double seconds = (timeMicrosec() - startUs) / 1000000.0;
+	fprintf(stderr, "RX: Replay of %u video, %u Mavlink and %u telemetry packages took %.3fs (%.1fMB/s video in, capture length %.3fs)\n",
+		records[RX_CAPTURE_VIDEO], records[RX_CAPTURE_MAVLINK], records[RX_CAPTURE_TELEMETRY], seconds,
+		(seconds > 0) ? bytesIn / seconds / (1024*1024) : 0.0, lastTimeUs / 1000000.0);
+	fprintf(stderr, "RX: Video packages: (rx|lost|reordered|late) %u|%u|%u|%u  frames: (ok|dropped) %u|%u  resyncs: %u  bytes: (in|out) %llu|%llu",
+		framing.getPackagesReceived(), framing.getPackagesLost(), framing.getPackagesReordered(), framing.getPackagesLate(),
+		framing.getFramesDelivered(), framing.getFramesDropped(), framing.getResyncs(), (unsigned long long)bytesIn, (unsigned long long)bytesOut);
+	if(decompressor.getBatches() > 0 || decompressor.getErrors() > 0){
+		fprintf(stderr, "  Mavlink batches: %u lost frames: %u errors: %u", decompressor.getBatches(), decompressor.getFramesLost(), decompressor.getErrors());
+	}
+	if(oversized > 0){
+		fprintf(stderr, "  oversized video packages skipped: %u", oversized);
+	}
+	fprintf(stderr, "\n");
+	return EXIT_SUCCESS;
+}
+
+// Parse the Mavlink frames in one UDP package from the drone and write them as Mavlink 1, packed in UDP packages of max RX_BUFFER_SIZE.
+// Msgids not in the dialect are passed on as they are (Mavlink 2), they can't be converted.
+// Returns number of bytes in output, 0 when all frames has been converted.
+uint16_t convertToMavlink1(MavlinkFrameParser &parser, uint8_t *output){
+	MavlinkFrame_t frame;
+	uint16_t size=0;
+	while(size + MAVLINK_PARSER_MAX_FRAME_LEN <= RX_BUFFER_SIZE && parser.nextFrame(frame)){
+		size += MavlinkFrameParser::toMavlink1(frame, &output[size]);
+	}
+	return size;
+}
+
 int main(int argc, char *argv[]) 
 // Input arguments ./rx_raw [INPUT UDP PORT]
 // argv[0] 	./main - not used
@@ -41,6 +230,21 @@ int main(int argc, char *argv[])
 	int telemetryPort= 0; 
 	char *relayIP;
 	int relayPort=0;
+	bool legacyMavlink=false;
+	char *dictionaryFile=NULL;
+	uint32_t telemetryRate=DEFAULT_TELEMETRY_RATE_HZ;
+	char *captureFile=NULL;
+	char *replayFile=NULL;
+	bool replayFast=false;
+	char *logFile=NULL;
+	uint16_t rtspPort=0;
+	const char *rtspPath=RTSP_DEFAULT_PATH;
+	const char *videoOutputs[VIDEO_FANOUT_MAX_SUBSCRIBERS];
+	uint32_t videoOutputCount=0;
+	char *relayServer=NULL;
+	uint32_t relaySession=0;
+	char *relayKey=NULL;
+	bool receiveTimestamps=false;
 		
     while (1) {
 	    int nOptionIndex;
@@ -48,7 +252,7 @@ int main(int argc, char *argv[])
 		    { "help", no_argument, &flagHelp, 1 },
 		    {      0,           0,         0, 0 }
 	    };
-	    int c = getopt_long(argc, argv, "h:v:m:t:i:r:", optiona, &nOptionIndex);
+	    int c = getopt_long(argc, argv, "h:v:m:t:i:r:lx:s:w:R:FL:S:o:G:k:K:T", optiona, &nOptionIndex);
 	    if (c == -1) {
 		    break;
 	    }
@@ -91,6 +295,82 @@ int main(int argc, char *argv[])
 				relayPort = atoi(optarg);
 				break;
 			}
+
+			case 'l': {
+				legacyMavlink = true;
+				break;
+			}
+
+			case 'x': {
+				dictionaryFile = optarg;
+				break;
+			}
+
+			case 's': {
+				telemetryRate = (uint32_t)atoi(optarg);
+				if(telemetryRate < 1 || telemetryRate > 50){
+					fprintf(stderr, "RX: ERROR status frame rate must be 1-50Hz\n");
+					usage();
+				}
+				break;
+			}
+
+			case 'w': {
+				captureFile = optarg;
+				break;
+			}
+
+			case 'R': {
+				replayFile = optarg;
+				break;
+			}
+
+			case 'F': {
+				replayFast = true;
+				break;
+			}
+
+			case 'L': {
+				logFile = optarg;
+				break;
+			}
+
+			case 'S': {
+				rtspPort = (uint16_t)atoi(optarg);
+				if(strchr(optarg, '/') != NULL){
+					rtspPath = strchr(optarg, '/') + 1;
+				}
+				break;
+			}
+
+			case 'o': {
+				if(videoOutputCount >= VIDEO_FANOUT_MAX_SUBSCRIBERS){
+					fprintf(stderr, "RX: ERROR max %d video outputs\n", VIDEO_FANOUT_MAX_SUBSCRIBERS);
+					usage();
+				}
+				videoOutputs[videoOutputCount++] = optarg;
+				break;
+			}
+
+			case 'G': {
+				relayServer = optarg;
+				break;
+			}
+
+			case 'k': {
+				relaySession = (uint32_t)strtoul(optarg, NULL, 0);
+				break;
+			}
+
+			case 'K': {
+				relayKey = optarg;
+				break;
+			}
+
+			case 'T': {
+				receiveTimestamps = true;
+				break;
+			}
 			
 		    default: {
 			    fprintf(stderr, "RX: unknown input parameter switch %c\n", c);
@@ -104,6 +384,17 @@ int main(int argc, char *argv[])
     if (optind > argc) {
 	    usage();
     }
+
+	if(replayFile != NULL){
+		static H264RXFraming replayFraming; // static, 8MB.
+		static MavlinkDecompressor replayDecompressor;
+		if(dictionaryFile != NULL && replayDecompressor.loadDictionary(dictionaryFile)){
+			fprintf(stderr, "RX: Error in Mavlink dictionary file %s, Terminate program.\n", dictionaryFile);
+			exit(EXIT_FAILURE);
+		}
+		signal(SIGINT, stopHandler);
+		return replayCapture(replayFile, replayFast, replayFraming, replayDecompressor);
+	}
 	
 	
 	if (videoPort <= 0) {
@@ -121,6 +412,16 @@ int main(int argc, char *argv[])
 		usage();
 	}
 
+	if ((relayServer != NULL) != (relaySession != 0)) {
+		fprintf(stderr, "RX: ERROR -G and -k (not 0) are used together\n");
+		usage();
+	}
+
+	if (relayServer != NULL && (relayKey == NULL || strlen(relayKey) < RELAY_KEY_MIN_LENGTH || strlen(relayKey) > RELAY_KEY_MAX_LENGTH)) {
+		fprintf(stderr, "RX: ERROR -G needs the key of the relay, -K with %d to %d characters\n", RELAY_KEY_MIN_LENGTH, RELAY_KEY_MAX_LENGTH);
+		usage();
+	}
+
 	fprintf(stderr, "Starting Lagoni's UDP RX program v0.30\n");
 
 
@@ -139,6 +440,17 @@ int main(int argc, char *argv[])
 	//Connection inputVideoConnection(videoPort, SOCK_DGRAM);
 	Connection inputVideoConnection(videoPort, SOCK_DGRAM,O_NONBLOCK);
 	Connection outputVideoConnection("127.0.0.1", OUTPUT_VIDEO_PORT, SOCK_DGRAM); 
+	if(receiveTimestamps){
+		if(inputVideoConnection.enableTimestamps()){
+			fprintf(stderr, "RX: Warning! no kernel receive timestamps, the video is timed when it is read.\n");
+		}else{
+			fprintf(stderr, "RX: kernel receive timestamps on the video packages.\n");
+		}
+	}
+	// The receive buffer follows the video rate and the largest burst read at once (a keyframe after a stall on the link).
+	inputVideoConnection.tuneBuffer(SO_RCVBUF, 0, 0, RX_VIDEO_BUFFER_MS);
+	uint32_t videoBurst = 0;   // largest number of bytes read in one go, decays each status interval.
+	uint32_t videoDrops = 0;   // kernel drops at the last status.
 
 	// For UDP/TCP Sockets
 	Connection inputMavlinkConnection(mavlinkPort, SOCK_DGRAM); // UDP port
@@ -148,6 +460,18 @@ int main(int argc, char *argv[])
 	Connection inputTelemetryConnection(telemetryPort, SOCK_DGRAM); // UDP port
 	Connection outputTelemetryConnection("127.0.0.1", OUTPUT_TELEMETRY_PORT, SOCK_DGRAM);
 
+	// Behind a relay the drone can't reach us, we send the hello (and keep-alive) there and it forwards the drone.
+	Connection *relayedConnections[] = {&inputVideoConnection, &inputMavlinkConnection, &inputTelemetryConnection};
+	if(relayServer != NULL){
+		inputVideoConnection.setReceiver(relayServer, videoPort);
+		inputMavlinkConnection.setReceiver(relayServer, mavlinkPort);
+		inputTelemetryConnection.setReceiver(relayServer, telemetryPort);
+		for(uint32_t a=0;a<sizeof(relayedConnections)/sizeof(relayedConnections[0]);a++){
+			RelayHello::send(*relayedConnections[a], RELAY_ROLE_GROUND, relaySession, relayKey);
+		}
+		fprintf(stderr, "RX: receiving through the relay %s as session %u.\n", relayServer, relaySession);
+	}
+
 	// For UDP/TCP Sockets Video record  mavlink forward
 	Connection extraRelayMavlinkConnection("192.168.0.8",6000, SOCK_DGRAM); // UDP port
 				
@@ -159,8 +483,81 @@ int main(int argc, char *argv[])
 	uint16_t lastPackage=0;
 	
 	uint8_t rxBuffer[RX_BUFFER_SIZE];
+	static MavlinkFrameParser mavlinkParser; // only used with -l
+	uint8_t mavlinkOutput[RX_BUFFER_SIZE];
+	static MavlinkDecompressor mavlinkDecompressor; // compressed batches from tx_raw -c are detected automatically.
+	uint8_t mavlinkFrames[MAVLINK_COMPRESSION_MAX_BATCH];
+	if(dictionaryFile != NULL){
+		if(mavlinkDecompressor.loadDictionary(dictionaryFile)){
+			fprintf(stderr, "RX: Error in Mavlink dictionary file %s, Terminate program.\n", dictionaryFile);
+			exit(EXIT_FAILURE);
+		}
+		fprintf(stderr, "RX: using Mavlink dictionary file (%s) id %04x.\n", dictionaryFile, mavlinkDecompressor.getDictionaryID());
+	}
+	// Live metrics for tools/metricsReader:
+	static ShmMetrics metrics; // static, the block is too large for the stack.
+	initRXMetrics(metrics);
+	if(metrics.open(RX_METRICS_NAME)){
+		fprintf(stderr, "RX: Warning! metrics are not published.\n");
+	}
+	uint64_t lastVideoPackageTime = 0;
+
+	// Capture for replay (-R), flushed with the status print.
+	static RXCapture capture;
+	if(captureFile != NULL){
+		if(capture.create(captureFile)){
+			fprintf(stderr, "RX: Unable to capture to %s, Terminate program.\n", captureFile);
+			exit(EXIT_FAILURE);
+		}
+		fprintf(stderr, "RX: capturing received packages to %s.\n", captureFile);
+		signal(SIGINT, stopHandler); // stop at the next loop so the end of the capture is written.
+		signal(SIGTERM, stopHandler);
+	}
+
+	// Mavlink flight log, frames are copied to mapped segments and the files are finished when stopped.
+	static MavlinkLog mavlinkLog;
+	if(logFile != NULL){
+		if(mavlinkLog.create(logFile, MAVLINK_LOG_SEGMENT_SIZE)){
+			fprintf(stderr, "RX: Unable to log Mavlink to %s, Terminate program.\n", logFile);
+			exit(EXIT_FAILURE);
+		}
+		fprintf(stderr, "RX: logging Mavlink to %s-NNNN.tlog.\n", logFile);
+		signal(SIGINT, stopHandler);
+		signal(SIGTERM, stopHandler);
+	}
+
+	// RTSP server for viewers and the -o outputs, they get the same frames as the video pipe.
+	static RtspServer rtspServer;
+	static VideoFanout videoFanout;
+	rx_videoOutputs_t videoOutputTapContext;
+	bzero(&videoOutputTapContext, sizeof(videoOutputTapContext));
+	if(rtspPort != 0){
+		if(rtspServer.open(rtspPort, rtspPath)){
+			fprintf(stderr, "RX: Unable to start the RTSP server on port %u, Terminate program.\n", rtspPort);
+			exit(EXIT_FAILURE);
+		}
+		videoOutputTapContext.rtspServer = &rtspServer;
+		fprintf(stderr, "RX: serving video at rtsp://<this IP>:%u/%s\n", rtspPort, rtspPath);
+	}
+	for(uint32_t a=0;a<videoOutputCount;a++){
+		if(videoFanout.addSubscriber(videoOutputs[a])){
+			fprintf(stderr, "RX: Unable to send video to %s, Terminate program.\n", videoOutputs[a]);
+			exit(EXIT_FAILURE);
+		}
+		videoOutputTapContext.fanout = &videoFanout;
+		fprintf(stderr, "RX: video also to %s\n", videoOutputs[a]);
+	}
+	if(videoOutputCount > 0){
+		signal(SIGINT, stopHandler); // the unix sockets are removed when stopped.
+		signal(SIGTERM, stopHandler);
+	}
+	if(videoOutputTapContext.rtspServer != NULL || videoOutputTapContext.fanout != NULL){
+		RXpackageManager.setOutputTap(videoOutputTap, &videoOutputTapContext);
+	}
+
 	int nready, maxfdp1; 
 	fd_set rset; 
+	fd_set wset; // only RTSP clients and video outputs waiting to be written.
 	struct timeval timeout; // select timeout.
 
 	// For link status:
@@ -178,7 +575,7 @@ int main(int argc, char *argv[])
 	 telmetryData.received_packet_cnt = 0;
 	 telmetryData.kbitrate = 0; // Video rate icon.
 	 telmetryData.kbitrate_measured = 0; // shown as "Measured" when clicked on video icon
-	 telmetryData.kbitrate_set = 5000000; // shown as "Set" when clicked on video icon
+	 telmetryData.kbitrate_set = 0; // shown as "Set" when clicked on video icon, the camera bitrate is not known on the ground.
 	 telmetryData.lost_packet_cnt_telemetry_up = 0;
 	 telmetryData.lost_packet_cnt_telemetry_down = 0;
 	 telmetryData.lost_packet_cnt_msp_up = 0;
@@ -204,14 +601,9 @@ int main(int argc, char *argv[])
 	 telmetryData.adapter[0].signal_good = 0;
 	 telmetryData.adapter[0].current_signal_dbm = 0;
 	 telmetryData.adapter[0].received_packet_cnt = 0;
-
-
-	 telmetryData.adapter[0].signal_good = 0xDC;
-	 telmetryData.adapter[1].signal_good = 0x30;
-	 telmetryData.adapter[2].signal_good = 0x76;
-	 telmetryData.adapter[3].signal_good = 0x00;
-	 telmetryData.adapter[4].signal_good = 0xd0;
-	 telmetryData.adapter[5].signal_good = 0xc4;
+	uint64_t nextTelemetryTime = timeMillisec() + 1000/telemetryRate;
+	uint32_t lastPackagesReceived = 0;
+	uint32_t lastPackagesLost = 0;
 	
 		
 //	videoStream_t recordStream; // 0x27 First header in h.264 stream
@@ -223,13 +615,16 @@ int main(int argc, char *argv[])
 		outputMavlinkConnection.setFD_SET(&rset);
 		
 		//inputVideoConnectionListener.setFD_SET(&rset); // For TCP
-		if(inputVideoConnection.getFD() != 0){ // only include id connection is valid
+		if(inputVideoConnection.getFD() >= 0){ // only include id connection is valid
 			inputVideoConnection.setFD_SET(&rset);			
 		}
 		outputVideoConnection.setFD_SET(&rset);
 
 		inputTelemetryConnection.setFD_SET(&rset);
 		outputTelemetryConnection.setFD_SET(&rset);		
+		FD_ZERO(&wset);
+		int rtspMaxFd = rtspServer.setFD_SET(&rset, &wset);
+		int fanoutMaxFd = videoFanout.setFD_SET(&rset, &wset);
 				
 						
 				
@@ -242,19 +637,26 @@ int main(int argc, char *argv[])
 		maxfdp1 = max(maxfdp1, outputMavlinkConnection.getFD());
 		
 		//maxfdp1 = max(maxfdp1, inputVideoConnectionListener.getFD());		
-		if(inputVideoConnection.getFD() != 0){ // only include id connection is valid
+		if(inputVideoConnection.getFD() >= 0){ // only include id connection is valid
 			maxfdp1 = max(maxfdp1, inputVideoConnection.getFD());
 		}
 		maxfdp1 = max(maxfdp1, outputVideoConnection.getFD());				
 		
 		maxfdp1 = max(maxfdp1, inputTelemetryConnection.getFD());
 		maxfdp1 = max(maxfdp1, outputTelemetryConnection.getFD());
+		maxfdp1 = max(maxfdp1, rtspMaxFd);
+		maxfdp1 = max(maxfdp1, fanoutMaxFd);
 		
 		// Timeout
 		timeout.tv_sec = 0;
 		timeout.tv_usec = 10000; // 10ms
 		
-		nready = select(maxfdp1+1, &rset, NULL, NULL, &timeout); // since we are blocking, wait here for data.//
+		nready = select(maxfdp1+1, &rset, &wset, NULL, &timeout); // since we are blocking, wait here for data.//
+		if(nready < 0){
+			continue; // interrupted by a signal, the sets are not valid (the blocking sockets would hang).
+		}
+		rtspServer.service(&rset, &wset);
+		videoFanout.service(&rset, &wset, timeMillisec());
 		
 		// Listen for TCP connection for video TCP
 		/*
@@ -265,15 +667,17 @@ int main(int argc, char *argv[])
 		*/
 		
 		// Video DATA from Drone		
-		if (FD_ISSET(inputVideoConnection.getFD(), &rset)) { 
+		if (inputVideoConnection.isFD_SET(&rset)) { 
 
 			int result = 0;
 			int numberOfPackages=0;
+			uint32_t bytesRead=0; // what waited in the socket since the last select.
 //			fprintf(stderr, "RX: Start input service... ");
 			do{
 				//result = inputVideoConnection.readData(videoPackagesFromRX, RX_BUFFER_SIZE);
 				uint32_t maxSize = RXpackageManager.getPackageMaxSize();
-				result = inputVideoConnection.readData(RXpackageManager.getInputBuffer(), maxSize);
+				uint8_t *inputBuffer = RXpackageManager.getInputBuffer(); // only once, it writes the IDs of the buffer to its header.
+				result = inputVideoConnection.readData(inputBuffer, maxSize);
 	//			fprintf(stderr, "Read result(%d) ", result);
 				if (result < 0 || result > maxSize){
 					// If TCP that means server connection is lost:
@@ -287,9 +691,31 @@ int main(int argc, char *argv[])
 					// None blocking, nothing to read.
 					// Blocking will never end up here because it will wait in readData... :-(
 				}else{	
-					// 
-					RXpackageManager.setData((uint16_t)result); // handles the 
+					uint16_t probeId;
+					if(PathMtu::isProbe(inputBuffer, result, probeId)){ // tx_raw -u, ack it on the way it came (also through the relay).
+						uint8_t ack[sizeof(PathMtuProbe_t)];
+						inputVideoConnection.writeData(ack, PathMtu::buildAck(ack, probeId, (uint16_t)result));
+						metrics.add(RX_METRIC_VIDEO_MTU_PROBES, 1);
+						continue;
+					}
+					uint64_t now = timeMicrosec();
+					uint64_t kernelTime = inputVideoConnection.getReceiveTime();
+					if(kernelTime != 0){ // -T, time it from the arrival instead of when we came by.
+						uint64_t realtime = timeRealtimeNanosec();
+						uint64_t queued = (realtime > kernelTime) ? (realtime - kernelTime)/1000 : 0;
+						metrics.record(RX_HISTOGRAM_VIDEO_SOCKET_QUEUE, queued);
+						now -= queued;
+					}
+					if(captureFile != NULL){
+						capture.record(RX_CAPTURE_VIDEO, now, inputVideoConnection.getClientAddress(), inputBuffer, (uint16_t)result);
+					}
+					RXpackageManager.setData((uint16_t)result, now); // handles the 
+					if(lastVideoPackageTime != 0 && now > lastVideoPackageTime){
+						metrics.record(RX_HISTOGRAM_VIDEO_GAP, now - lastVideoPackageTime);
+					}
+					lastVideoPackageTime = now;
 					numberOfPackages++;
+					bytesRead += result;
 					//uint16_t packageID = (uint16_t)((uint16_t)videoPackagesFromRX[2] +  (uint16_t)(videoPackagesFromRX[3] << 8));
 					//if(packageID != (lastPackage + 1) ){
 					//	uint16_t frameID = (uint16_t)((uint16_t)videoPackagesFromRX[0] +  (uint16_t)(videoPackagesFromRX[1] << 8));	
@@ -302,7 +728,17 @@ int main(int argc, char *argv[])
 				//if(numberOfPackages>40){
 				//	fprintf(stderr, "done reading (%u) Packages\n",numberOfPackages);	
 				//}
+				if(bytesRead > videoBurst){
+					videoBurst = bytesRead;
+				}
+				uint64_t writeStart = timeMicrosec();
 				RXpackageManager.writeAllOutputStreamTo(STDOUT_FILENO);
+				rtspServer.flush(); // the frames are complete, send them to the RTSP clients.
+				videoFanout.flush();
+				metrics.record(RX_HISTOGRAM_VIDEO_WRITE, timeMicrosec() - writeStart);
+				if(RXpackageManager.getOutputReceiveTime() != 0 && writeStart > RXpackageManager.getOutputReceiveTime()){
+					metrics.record(RX_HISTOGRAM_VIDEO_FRAME_DELAY, writeStart - RXpackageManager.getOutputReceiveTime());
+				}
 				
 				
 				//std::this_thread::sleep_for(std::chrono::milliseconds(100)); // test UDP buffer by sleeping.
@@ -329,7 +765,7 @@ int main(int argc, char *argv[])
 		}
 
 		// DATA from QOpenHD (Video return) This should not happend
-		if (FD_ISSET(outputVideoConnection.getFD(), &rset)) {
+		if (outputVideoConnection.isFD_SET(&rset)) {
 			int result = 0;
 			result = outputVideoConnection.readData(rxBuffer, RX_BUFFER_SIZE);
 			
@@ -345,7 +781,7 @@ int main(int argc, char *argv[])
 		}
 
 		// Mavlink DATA from Drone
-		if (FD_ISSET(inputMavlinkConnection.getFD(), &rset)) {
+		if (inputMavlinkConnection.isFD_SET(&rset)) {
 			int result = 0;
 			result = inputMavlinkConnection.readData(rxBuffer, RX_BUFFER_SIZE);
 			
@@ -355,18 +791,46 @@ int main(int argc, char *argv[])
 				exit(EXIT_FAILURE);
 			}else  if(result == 0){
 				// None blocking, nothing to read.
-			}else {
-				outputMavlinkConnection.writeData(rxBuffer, result);
+			}else{
+				if(captureFile != NULL){
+					capture.record(RX_CAPTURE_MAVLINK, timeMicrosec(), inputMavlinkConnection.getClientAddress(), rxBuffer, (uint16_t)result);
+				}
+				metrics.add(RX_METRIC_MAVLINK_BYTES, result);
+				uint8_t *mavlinkData = rxBuffer;
+				if(MavlinkDecompressor::isCompressed(rxBuffer, result)){
+					mavlinkData = mavlinkFrames;
+					result = mavlinkDecompressor.decompress(rxBuffer, result, mavlinkFrames, sizeof(mavlinkFrames));
+				}
+				if(result > 0 && logFile != NULL){
+					mavlinkLog.logFrames(mavlinkData, result, timeMicrosec());
+				}
+				if(result == 0){
+					// Broken compressed batch, counted by the decompressor.
+				}else if(true == legacyMavlink){
+					// Trimmed Mavlink 2 from the LTE link back to full length Mavlink 1.
+					mavlinkParser.inputData(mavlinkData, result);
+					uint16_t size;
+					while((size = convertToMavlink1(mavlinkParser, mavlinkOutput)) > 0){
+						outputMavlinkConnection.writeData(mavlinkOutput, size);
 
-				if(relayPort != 0){
-					relayConnection->writeData(rxBuffer, result);
-				}			
-				extraRelayMavlinkConnection.writeData(rxBuffer, result); // extra relay for video record when armed.	
+						if(relayPort != 0){
+							relayConnection->writeData(mavlinkOutput, size);
+						}
+						extraRelayMavlinkConnection.writeData(mavlinkOutput, size); // extra relay for video record when armed.
+					}
+				}else {
+					outputMavlinkConnection.writeData(mavlinkData, result);
+
+					if(relayPort != 0){
+						relayConnection->writeData(mavlinkData, result);
+					}
+					extraRelayMavlinkConnection.writeData(mavlinkData, result); // extra relay for video record when armed.
+				}
 			}
 		}
 
 		// DATA from OpenHD (Mavlink return) This should not happend, or it is a keep-alive
-		if (FD_ISSET(outputMavlinkConnection.getFD(), &rset)) {
+		if (outputMavlinkConnection.isFD_SET(&rset)) {
 			int result = 0;
 			result = outputMavlinkConnection.readData(rxBuffer, RX_BUFFER_SIZE);
 			
@@ -383,7 +847,7 @@ int main(int argc, char *argv[])
 
 
 		// Telemtry DATA from Drone
-		if (FD_ISSET(inputTelemetryConnection.getFD(), &rset)) {
+		if (inputTelemetryConnection.isFD_SET(&rset)) {
 			int result = 0;
 			result = inputTelemetryConnection.readData(rxBuffer, RX_BUFFER_SIZE);
 			
@@ -394,13 +858,16 @@ int main(int argc, char *argv[])
 			}else  if(result == 0){
 				// None blocking, nothing to read.
 			}else { // We have data lets build the frame and sent it to QOpenHD
+				if(captureFile != NULL){
+					capture.record(RX_CAPTURE_TELEMETRY, timeMicrosec(), inputTelemetryConnection.getClientAddress(), rxBuffer, (uint16_t)result);
+				}
 				telmetryData.cpuload_air = rxBuffer[0];
 				telmetryData.temp_air = rxBuffer[1];										
 			}
 		}
 
 		// DATA from OpenHD (Telemetry return) This should not happend, or it is a keep-alive
-		if (FD_ISSET(outputTelemetryConnection.getFD(), &rset)) {
+		if (outputTelemetryConnection.isFD_SET(&rset)) {
 			int result = 0;
 			result = outputTelemetryConnection.readData(rxBuffer, RX_BUFFER_SIZE);
 			
@@ -417,7 +884,7 @@ int main(int argc, char *argv[])
 
 		
 		
-		if( (relayPort != 0) && (FD_ISSET(relayConnection->getFD(), &rset))){// Data from UDP relay back (When we relay to Mavlink server, it will send a few messages back to drone)
+		if( (relayPort != 0) && (relayConnection->isFD_SET(&rset))){// Data from UDP relay back (When we relay to Mavlink server, it will send a few messages back to drone)
 			int result = 0;
 			result = relayConnection->readData(rxBuffer, RX_BUFFER_SIZE);
 			//printf("Read result:%d\n\r", n);
@@ -428,6 +895,9 @@ int main(int argc, char *argv[])
 				// None blocking, nothing to read.
 			}else {
 				int res = 0;
+				if(logFile != NULL){
+					mavlinkLog.logFrames(rxBuffer, result, timeMicrosec());
+				}
 				res = inputMavlinkConnection.writeData(rxBuffer, result); // Write incoming data to drone.
 				if(res < 0){
 					fprintf(stderr, "RX: Error on write to Output Mavlink UDP Socket Port: %d, Terminate program.\n", OUTPUT_MAVLINK_PORT);
@@ -443,30 +913,58 @@ int main(int argc, char *argv[])
 
 		// check if it is time to log the status and sent Telemtry frame to QOpenHD:
 		if(time(NULL) >= nextPrintTime){
+			// the interval counters are cleared below, add them to the metrics totals first.
+			updateRXMetrics(metrics, RXpackageManager, mavlinkDecompressor, linkstatus);
+			metrics.endInterval();
 			linkstatus.rx = RXpackageManager.getBytesInputted();
 			linkstatus.dropped = RXpackageManager.getBytesDropped();
 			RXpackageManager.clearIOstatus();
+
+			// Buffer for the measured rate and burst, twice what it holds now if the kernel still dropped packages.
+			// Not while the video stalls, the backlog of the LTE link comes right after.
+			uint32_t socketDrops = inputVideoConnection.getReceiveDrops();
+			metrics.set(RX_METRIC_VIDEO_SOCKET_DROPS, socketDrops);
+			metrics.set(RX_METRIC_VIDEO_SOCKET_BURST, videoBurst);
+			if(socketDrops != videoDrops){
+				fprintf(stderr, "RX: Warning! the kernel dropped %u video packages, the socket buffer was full.\n", socketDrops - videoDrops);
+				videoBurst = max(videoBurst, inputVideoConnection.getBuffer(SO_RCVBUF) / 2);
+				videoDrops = socketDrops;
+			}
+			if(linkstatus.rx > 0){
+				inputVideoConnection.tuneBuffer(SO_RCVBUF, (uint32_t)(linkstatus.rx / LOG_INTERVAL_SEC), videoBurst, RX_VIDEO_BUFFER_MS);
+			}
+			metrics.set(RX_METRIC_VIDEO_SOCKET_BUFFER, inputVideoConnection.getBuffer(SO_RCVBUF));
+			videoBurst -= videoBurst / 8; // a burst is forgotten over ~15 status intervals.
 			
 			fprintf(stderr, "RX: Status:       UDP Packages: (tx|rx|dropped):  %*.2fKB  |  %*.2fKB  | %*.2fKB", 6, linkstatus.tx/1024 , 6, linkstatus.rx/1024 , 6 , linkstatus.dropped/1024);
+			if(mavlinkDecompressor.getBatches() > 0 || mavlinkDecompressor.getErrors() > 0){
+				fprintf(stderr, "   Mavlink compression: %.2f:1 %.0fus/batch lost frames: %u errors: %u", mavlinkDecompressor.getRatio(), mavlinkDecompressor.getMicrosecPerBatch(), mavlinkDecompressor.getFramesLost(), mavlinkDecompressor.getErrors());
+				mavlinkDecompressor.clearIOstatus();
+				mavlinkDecompressor.clearErrors();
+			}
 			nextPrintTime = time(NULL) + LOG_INTERVAL_SEC;
+			if(captureFile != NULL){
+				capture.flush();
+				fprintf(stderr, "   Capture: %u packages %.1fMB", capture.getRecords(), capture.getBytesWritten()/(1024.0*1024.0));
+			}
+			if(logFile != NULL){
+				fprintf(stderr, "   Mavlink log: %u frames %.1fMB", mavlinkLog.getFrames(), mavlinkLog.getBytes()/(1024.0*1024.0));
+			}
+			if(rtspPort != 0){
+				fprintf(stderr, "   RTSP: %u clients (%u playing) packets %llu sent %llu fell behind %u", rtspServer.getClients(), rtspServer.getPlayingClients(),
+					(unsigned long long)rtspServer.getPackets(), (unsigned long long)rtspServer.getPacketsSent(), rtspServer.getOverflows());
+			}
+			if(videoOutputCount > 0){
+				fprintf(stderr, "   Outputs: %u (%u with reader) packages sent %llu fell behind %u (%u packages)", videoFanout.getSubscribers(), videoFanout.getConnected(),
+					(unsigned long long)videoFanout.getPackagesSent(), videoFanout.getDrops(), videoFanout.getPackagesDropped());
+			}
 			
-			// Sendt the Telemtry frame to QOpenHD.
 			telmetryData.kbitrate = (linkstatus.rx*8)/1024; // Video kbit rate.
+			telmetryData.kbitrate_measured = telmetryData.kbitrate;
 
-			telmetryData.HomeLat = 0;
-			telmetryData.HomeLon = 0;
-			int res = 0;
-			res = outputTelemetryConnection.writeData(&telmetryData, 113);
-			
-			if(res < 0){
-				fprintf(stderr, "RX: Error on write to output Telemetry UDP Socket Port: %d, Terminate program.\n", OUTPUT_TELEMETRY_PORT);		
-				exit(EXIT_FAILURE);
-			}else if(res == 0){
-
-			}else{
-
-			}			
-			
+			fprintf(stderr, "   Video packages: (rx|lost|reordered|late) %u|%u|%u|%u  frames: (ok|dropped) %u|%u  resyncs: %u",
+				RXpackageManager.getPackagesReceived(), RXpackageManager.getPackagesLost(), RXpackageManager.getPackagesReordered(), RXpackageManager.getPackagesLate(),
+				RXpackageManager.getFramesDelivered(), RXpackageManager.getFramesDropped(), RXpackageManager.getResyncs());
 			fprintf(stderr, "     Video rate: %4dkbit/s   Air CPU Load: %3d%%     CPU Temp: %3dC\n",telmetryData.kbitrate, telmetryData.cpuload_air, telmetryData.temp_air);		
 			bzero(&linkstatus, sizeof(linkstatus));
 			
@@ -479,6 +977,42 @@ int main(int argc, char *argv[])
 			rxBuffer[5]=0x55;
 			inputVideoConnection.writeData(rxBuffer, 6);
 			inputTelemetryConnection.writeData(rxBuffer, 6);
+			if(relayServer != NULL){
+				for(uint32_t a=0;a<sizeof(relayedConnections)/sizeof(relayedConnections[0]);a++){
+					RelayHello::send(*relayedConnections[a], RELAY_ROLE_GROUND, relaySession, relayKey);
+				}
+			}
+		}
+		
+		// Link status frame to QOpenHD, the counters are totals since start like wifibroadcast sends them:
+		if(timeMillisec() >= nextTelemetryTime){
+			nextTelemetryTime = timeMillisec() + 1000/telemetryRate;
+			uint32_t packagesReceived = RXpackageManager.getPackagesReceived();
+			uint32_t packagesLost = RXpackageManager.getPackagesLost();
+			telmetryData.received_packet_cnt = packagesReceived;
+			telmetryData.lost_packet_cnt = packagesLost;
+			telmetryData.skipped_packet_cnt = RXpackageManager.getPackagesLate();
+			telmetryData.damaged_block_cnt = RXpackageManager.getFramesDropped();
+			telmetryData.adapter[0].received_packet_cnt = packagesReceived;
+			// Good when packages arrived since the last frame and less than 5% of them were lost.
+			uint32_t received = packagesReceived - lastPackagesReceived;
+			uint32_t lost = (packagesLost > lastPackagesLost) ? packagesLost - lastPackagesLost : 0;
+			telmetryData.adapter[0].signal_good = (received > 0 && lost*20 < received + lost) ? 1 : 0;
+			lastPackagesReceived = packagesReceived;
+			lastPackagesLost = packagesLost;
+
+			telmetryData.HomeLat = 0;
+			telmetryData.HomeLon = 0;
+			if(outputTelemetryConnection.writeData(&telmetryData, sizeof(telmetryData)) < 0){
+				fprintf(stderr, "RX: Error on write to output Telemetry UDP Socket Port: %d, Terminate program.\n", OUTPUT_TELEMETRY_PORT);		
+				exit(EXIT_FAILURE);
+			}
+			metrics.add(RX_METRIC_STATUS_FRAMES, 1);
+		}
+
+		if(metrics.isPublishDue(timeMillisec())){
+			updateRXMetrics(metrics, RXpackageManager, mavlinkDecompressor, linkstatus);
+			metrics.publish(timeMillisec());
 		}
 		
 		//check if there is data ready for output stream:
@@ -518,8 +1052,20 @@ int main(int argc, char *argv[])
 
 		//}
 		
-	}while(1);
-	
+	}while(!stopRequested);
+
+	if(stopRequested){
+		if(captureFile != NULL){
+			capture.close();
+			fprintf(stderr, "RX: Stopped, capture %s has %u packages.\n", captureFile, capture.getRecords());
+		}
+		if(logFile != NULL){
+			mavlinkLog.close();
+			fprintf(stderr, "RX: Stopped, Mavlink log %s has %u frames (%u dropped, disk too slow).\n", logFile, mavlinkLog.getFrames(), mavlinkLog.getDroppedFrames());
+		}
+		videoFanout.close();
+		return 0;
+	}
 	perror("RX: PANIC! Exit While 1\n");
     return 1;
 }
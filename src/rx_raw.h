@@ -39,9 +39,56 @@
 #include "RingBuf.h"
 //#include "h264.h"
 #include "h264RXFraming.h"
+#include "mavlinkFrameParser.h"
+#include "mavlinkCompression.h"
+#include "shmMetrics.h"
+#include "rxCapture.h"
+#include "mavlinkLog.h"
+#include "rtspServer.h"
+#include "videoFanout.h"
+#include "relayHello.h"
+#include "pathMtu.h"
 
 #define RX_BUFFER_SIZE 1400
 #define LOG_INTERVAL_SEC 1 // log every minute
+#define DEFAULT_TELEMETRY_RATE_HZ 1 // link status frames to QOpenHD per second.
+#define RX_VIDEO_BUFFER_MS 200 // the video socket buffer holds this much at the measured rate (and two of the largest bursts).
+
+// Live metrics in /dev/shm/openhd-lte-rx (tools/metricsReader -n rx).
+#define RX_METRICS_NAME "rx"
+enum RXMetric_t{
+	RX_METRIC_VIDEO_BYTES=0,
+	RX_METRIC_VIDEO_OUT_BYTES,
+	RX_METRIC_VIDEO_DROPPED_BYTES,
+	RX_METRIC_VIDEO_PACKAGES,
+	RX_METRIC_VIDEO_LOST,
+	RX_METRIC_VIDEO_REORDERED,
+	RX_METRIC_VIDEO_LATE,
+	RX_METRIC_VIDEO_RESYNCS,
+	RX_METRIC_VIDEO_FRAMES,
+	RX_METRIC_VIDEO_FRAMES_DROPPED,
+	RX_METRIC_VIDEO_WAITING,
+	RX_METRIC_VIDEO_FRAME_PACKAGES,
+	RX_METRIC_VIDEO_OUTPUT_FIFO,
+	RX_METRIC_MAVLINK_BYTES,
+	RX_METRIC_MAVLINK_TO_DRONE_BYTES,
+	RX_METRIC_MAVLINK_BATCHES,
+	RX_METRIC_MAVLINK_LOST_FRAMES,
+	RX_METRIC_MAVLINK_ERRORS,
+	RX_METRIC_STATUS_FRAMES,
+	RX_METRIC_VIDEO_SOCKET_DROPS,   // SO_RXQ_OVFL, only counted with -T.
+	RX_METRIC_VIDEO_SOCKET_BUFFER,
+	RX_METRIC_VIDEO_SOCKET_BURST,   // largest number of bytes waiting in the socket at once (decays over ~15s).
+	RX_METRIC_VIDEO_MTU_PROBES,     // path MTU probes from tx_raw -u, acked.
+	RX_METRIC_COUNT
+};
+enum RXHistogram_t{
+	RX_HISTOGRAM_VIDEO_GAP=0,   // time between video packages (us), jitter on the LTE link.
+	RX_HISTOGRAM_VIDEO_WRITE,   // writing the finished frames to the video pipe (us).
+	RX_HISTOGRAM_VIDEO_SOCKET_QUEUE, // kernel arrival to read (us), only with -T.
+	RX_HISTOGRAM_VIDEO_FRAME_DELAY,  // arrival of the oldest package to the frame written (us), waiting for reordered packages.
+	RX_HISTOGRAM_COUNT
+};
 
 int max(int x, int y)
 {
@@ -72,6 +119,11 @@ typedef struct {
 	float rx;
 	float dropped;
 } rx_dataRates_t;
+
+typedef struct {
+	RtspServer *rtspServer;  // NULL without -S.
+	VideoFanout *fanout;     // NULL without -o.
+} rx_videoOutputs_t;
 
 typedef struct {
     uint32_t received_packet_cnt;
@@ -0,0 +1,229 @@
+/*
+	serialPort.cpp
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+#include "serialPort.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <asm/termbits.h> // termios2 and BOTHER, not compatible with <termios.h> so only used in here.
+#include <linux/serial.h> // low latency and TIOCGICOUNT.
+
+SerialPort::SerialPort(){
+	this->fd=-1;
+	this->baudrate=0;
+	this->ring = new uint8_t[SERIAL_RING_SIZE];
+	this->head=0;
+	this->tail=0;
+	this->hasIcount=false;
+	this->uartOverruns=0;
+	this->uartErrors=0;
+	this->clearIOstatus();
+}
+
+SerialPort::~SerialPort(){
+	this->closePort();
+	delete[] this->ring;
+}
+
+bool SerialPort::openPort(const char *device, uint32_t baudrate){
+	this->closePort();
+	this->fd = open(device, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if(this->fd < 0){
+		fprintf(stderr, "SerialPort: Unable to open %s (%s)\n", device, strerror(errno));
+		return true;
+	}
+	if(this->setBaudrate(baudrate)){
+		this->closePort();
+		return true;
+	}
+	this->setLowLatency();
+	this->hasIcount = this->readIcount(this->uartOverruns, this->uartErrors);
+	this->head=0;
+	this->tail=0;
+	this->clearIOstatus();
+	return false;
+}
+
+void SerialPort::closePort(void){
+	if(this->fd >= 0){
+		close(this->fd);
+		this->fd=-1;
+	}
+}
+
+int SerialPort::getFD(void){
+	return this->fd;
+}
+
+uint32_t SerialPort::getBaudrate(void){
+	return this->baudrate;
+}
+
+int32_t SerialPort::readAvailable(void){
+	int32_t total=0;
+	while(true){
+		uint32_t used = this->head - this->tail;
+		if(used >= SERIAL_RING_SIZE){ // full, drop the oldest so the newest Mavlink gets through.
+			uint32_t drop = SERIAL_RING_SIZE / 16;
+			this->tail += drop;
+			this->ringOverruns += drop;
+			used -= drop;
+		}
+		uint32_t free = SERIAL_RING_SIZE - used;
+		uint32_t start = this->head & (SERIAL_RING_SIZE - 1);
+		uint32_t first = SERIAL_RING_SIZE - start;
+		if(first > free){
+			first = free;
+		}
+		struct iovec vector[2];
+		vector[0].iov_base = &this->ring[start];
+		vector[0].iov_len = first;
+		vector[1].iov_base = this->ring;
+		vector[1].iov_len = free - first;
+
+		ssize_t result = readv(this->fd, vector, (free > first) ? 2 : 1);
+		if(result < 0){
+			if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR){
+				break; // all read.
+			}
+			fprintf(stderr, "SerialPort: read failed (%s)\n", strerror(errno));
+			return -1;
+		}
+		if(result == 0){
+			break;
+		}
+		this->head += (uint32_t)result;
+		total += (int32_t)result;
+		if((uint32_t)result < free){
+			break; // the driver had no more.
+		}
+	}
+	this->bytesRead += total;
+	uint32_t used = this->head - this->tail;
+	if(used > this->maxBuffered){
+		this->maxBuffered = used;
+	}
+	return total;
+}
+
+uint32_t SerialPort::read(uint8_t *data, uint32_t maxLength){
+	uint32_t length = this->head - this->tail;
+	if(length > maxLength){
+		length = maxLength;
+	}
+	uint32_t start = this->tail & (SERIAL_RING_SIZE - 1);
+	uint32_t first = SERIAL_RING_SIZE - start;
+	if(first > length){
+		first = length;
+	}
+	memcpy(data, &this->ring[start], first);
+	memcpy(&data[first], this->ring, length - first);
+	this->tail += length;
+	return length;
+}
+
+uint32_t SerialPort::getBufferedSize(void){
+	return this->head - this->tail;
+}
+
+int32_t SerialPort::write(const uint8_t *data, uint32_t length){
+	return (int32_t)::write(this->fd, data, length);
+}
+
+uint32_t SerialPort::getBytesRead(void){
+	return this->bytesRead;
+}
+
+uint32_t SerialPort::getRingOverruns(void){
+	return this->ringOverruns;
+}
+
+uint32_t SerialPort::getUartOverruns(void){
+	uint32_t overruns, errors;
+	if(false == this->hasIcount || false == this->readIcount(overruns, errors)){
+		return 0;
+	}
+	return overruns - this->uartOverruns;
+}
+
+uint32_t SerialPort::getUartErrors(void){
+	uint32_t overruns, errors;
+	if(false == this->hasIcount || false == this->readIcount(overruns, errors)){
+		return 0;
+	}
+	return errors - this->uartErrors;
+}
+
+uint32_t SerialPort::getMaxBuffered(void){
+	return this->maxBuffered;
+}
+
+void SerialPort::clearIOstatus(void){
+	this->bytesRead=0;
+	this->ringOverruns=0;
+	this->maxBuffered=0;
+	if(this->hasIcount){
+		this->readIcount(this->uartOverruns, this->uartErrors);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+////////////////////////// Private Helper functions //////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+// Raw 8N1 at any rate, BOTHER lets the driver find the nearest divisor instead of only the Bxxxx table.
+bool SerialPort::setBaudrate(uint32_t baudrate){
+	struct termios2 options;
+	if(ioctl(this->fd, TCGETS2, &options) < 0){
+		fprintf(stderr, "SerialPort: Unable to read the port settings (%s)\n", strerror(errno));
+		return true;
+	}
+	options.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON | IXOFF | IXANY);
+	options.c_oflag &= ~OPOST;
+	options.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+	options.c_cflag &= ~(CSIZE | PARENB | CSTOPB | CRTSCTS | CBAUD | (CBAUD << IBSHIFT));
+	options.c_cflag |= CS8 | CLOCAL | CREAD | BOTHER | (BOTHER << IBSHIFT);
+	options.c_ispeed = baudrate;
+	options.c_ospeed = baudrate;
+	options.c_cc[VMIN] = 0;  // read() returns what is there,
+	options.c_cc[VTIME] = 0; // and never waits, select() does the waiting.
+	if(ioctl(this->fd, TCSETS2, &options) < 0){
+		fprintf(stderr, "SerialPort: Unable to set %u baud (%s)\n", baudrate, strerror(errno));
+		return true;
+	}
+
+	// The UART can't always hit the rate exactly, tell if it is far off.
+	if(ioctl(this->fd, TCGETS2, &options) == 0){
+		this->baudrate = options.c_ospeed;
+		if(this->baudrate > 0 && (this->baudrate < baudrate - baudrate/50 || this->baudrate > baudrate + baudrate/50)){
+			fprintf(stderr, "SerialPort: Warning %u baud requested but the port runs %u baud\n", baudrate, this->baudrate);
+		}
+	}else{
+		this->baudrate = baudrate;
+	}
+	return false;
+}
+
+void SerialPort::setLowLatency(void){
+	struct serial_struct serial;
+	if(ioctl(this->fd, TIOCGSERIAL, &serial) == 0){
+		serial.flags |= ASYNC_LOW_LATENCY;
+		ioctl(this->fd, TIOCSSERIAL, &serial); // not all drivers support it, that is ok.
+	}
+}
+
+bool SerialPort::readIcount(uint32_t &overruns, uint32_t &errors){
+	struct serial_icounter_struct icount;
+	if(ioctl(this->fd, TIOCGICOUNT, &icount) < 0){
+		return false;
+	}
+	overruns = (uint32_t)(icount.overrun + icount.buf_overrun);
+	errors = (uint32_t)(icount.frame + icount.parity);
+	return true;
+}
@@ -0,0 +1,70 @@
+/*
+	serialPort.h
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+
+#ifndef SERIALPORT_H_
+#define SERIALPORT_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h> // bzero
+
+#define SERIAL_DEFAULT_BAUDRATE 57600
+#define SERIAL_RING_SIZE 65536 // power of 2, ~0.4s of 1.5Mbaud so a slow SD card write in the main loop does not lose Mavlink.
+
+// Serial port for the Flight Computer link:
+// - any baud rate (termios2 / BOTHER, e.g. 921600 or 1500000), raw 8N1, VMIN=0 / VTIME=0 non-blocking.
+// - low latency mode on UARTs that support it, so the driver does not hold bytes back.
+// - everything available is read in one go into a large ring buffer, the parser takes it from there.
+// - overruns are counted both in the ring (main loop too slow) and in the UART/driver (TIOCGICOUNT).
+// Works on a pty as well (the baud rate is then only stored), which is used for testing.
+class SerialPort
+{
+	// Public functions
+	public:
+	SerialPort();
+	virtual ~SerialPort(); //destructor
+
+	bool openPort(const char *device, uint32_t baudrate); // returns true on error.
+	void closePort(void);
+	int getFD(void);
+	uint32_t getBaudrate(void); // as read back from the driver.
+
+	int32_t readAvailable(void); // read all the driver has into the ring, returns bytes read or -1 if the device failed.
+	uint32_t read(uint8_t *data, uint32_t maxLength); // take bytes from the ring.
+	uint32_t getBufferedSize(void);
+	int32_t write(const uint8_t *data, uint32_t length);
+
+	// counters for the status line (this interval).
+	uint32_t getBytesRead(void);
+	uint32_t getRingOverruns(void);   // bytes dropped because the ring was full.
+	uint32_t getUartOverruns(void);   // driver / hardware overruns, 0 if the device does not report it (pty).
+	uint32_t getUartErrors(void);     // framing and parity errors (wrong baud rate?).
+	uint32_t getMaxBuffered(void);    // high watermark of the ring.
+	void clearIOstatus(void);
+
+	private:
+	int fd;
+	uint32_t baudrate;
+	uint8_t *ring;
+	uint32_t head; // write position (free running, masked with SERIAL_RING_SIZE-1).
+	uint32_t tail; // read position.
+
+	uint32_t bytesRead;
+	uint32_t ringOverruns;
+	uint32_t maxBuffered;
+	uint32_t uartOverruns; // totals from the driver when the interval started.
+	uint32_t uartErrors;
+	bool hasIcount;
+
+	bool setBaudrate(uint32_t baudrate);
+	void setLowLatency(void);
+	bool readIcount(uint32_t &overruns, uint32_t &errors);
+};
+
+#endif /* SERIALPORT_H_ */
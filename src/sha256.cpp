@@ -0,0 +1,143 @@
+/*
+	sha256.cpp
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+#include "sha256.h"
+
+static const uint32_t roundConstants[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t rotateRight(uint32_t value, uint32_t bits){
+	return (value >> bits) | (value << (32 - bits));
+}
+
+Sha256::Sha256(){
+	this->state[0] = 0x6a09e667;
+	this->state[1] = 0xbb67ae85;
+	this->state[2] = 0x3c6ef372;
+	this->state[3] = 0xa54ff53a;
+	this->state[4] = 0x510e527f;
+	this->state[5] = 0x9b05688c;
+	this->state[6] = 0x1f83d9ab;
+	this->state[7] = 0x5be0cd19;
+	this->blockLength = 0;
+	this->totalLength = 0;
+}
+
+void Sha256::update(const uint8_t *data, uint32_t length){
+	for(uint32_t a=0;a<length;a++){
+		this->block[this->blockLength++] = data[a];
+		if(this->blockLength == SHA256_BLOCK_SIZE){
+			this->transform();
+			this->blockLength = 0;
+		}
+	}
+	this->totalLength += length;
+}
+
+void Sha256::final(uint8_t *digest){
+	uint64_t bits = this->totalLength * 8;
+	uint8_t padding = 0x80;
+	this->update(&padding, 1);
+	padding = 0;
+	while(this->blockLength != SHA256_BLOCK_SIZE - 8){
+		this->update(&padding, 1);
+	}
+	uint8_t length[8];
+	for(uint32_t a=0;a<8;a++){
+		length[a] = (uint8_t)(bits >> (8*(7-a)));
+	}
+	this->update(length, 8);
+	for(uint32_t a=0;a<8;a++){
+		digest[a*4] = (uint8_t)(this->state[a] >> 24);
+		digest[a*4+1] = (uint8_t)(this->state[a] >> 16);
+		digest[a*4+2] = (uint8_t)(this->state[a] >> 8);
+		digest[a*4+3] = (uint8_t)this->state[a];
+	}
+}
+
+void Sha256::hmac(const uint8_t *key, uint32_t keyLength, const uint8_t *data, uint32_t length, uint8_t *mac){
+	uint8_t keyBlock[SHA256_BLOCK_SIZE];
+	bzero(keyBlock, sizeof(keyBlock));
+	if(keyLength > SHA256_BLOCK_SIZE){
+		Sha256 keyHash;
+		keyHash.update(key, keyLength);
+		keyHash.final(keyBlock);
+	}else{
+		memcpy(keyBlock, key, keyLength);
+	}
+
+	uint8_t pad[SHA256_BLOCK_SIZE];
+	for(uint32_t a=0;a<SHA256_BLOCK_SIZE;a++){
+		pad[a] = keyBlock[a] ^ 0x36;
+	}
+	uint8_t inner[SHA256_DIGEST_SIZE];
+	Sha256 innerHash;
+	innerHash.update(pad, SHA256_BLOCK_SIZE);
+	innerHash.update(data, length);
+	innerHash.final(inner);
+
+	for(uint32_t a=0;a<SHA256_BLOCK_SIZE;a++){
+		pad[a] = keyBlock[a] ^ 0x5c;
+	}
+	Sha256 outerHash;
+	outerHash.update(pad, SHA256_BLOCK_SIZE);
+	outerHash.update(inner, SHA256_DIGEST_SIZE);
+	outerHash.final(mac);
+}
+
+bool Sha256::equal(const uint8_t *a, const uint8_t *b, uint32_t length){
+	uint8_t difference = 0;
+	for(uint32_t i=0;i<length;i++){
+		difference |= a[i] ^ b[i];
+	}
+	return (difference == 0);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+////////////////////////// Private Helper functions //////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+void Sha256::transform(void){
+	uint32_t words[64];
+	for(uint32_t a=0;a<16;a++){
+		words[a] = ((uint32_t)this->block[a*4] << 24) | ((uint32_t)this->block[a*4+1] << 16) | ((uint32_t)this->block[a*4+2] << 8) | this->block[a*4+3];
+	}
+	for(uint32_t a=16;a<64;a++){
+		uint32_t s0 = rotateRight(words[a-15], 7) ^ rotateRight(words[a-15], 18) ^ (words[a-15] >> 3);
+		uint32_t s1 = rotateRight(words[a-2], 17) ^ rotateRight(words[a-2], 19) ^ (words[a-2] >> 10);
+		words[a] = words[a-16] + s0 + words[a-7] + s1;
+	}
+
+	uint32_t v[8];
+	memcpy(v, this->state, sizeof(v));
+	for(uint32_t a=0;a<64;a++){
+		uint32_t s1 = rotateRight(v[4], 6) ^ rotateRight(v[4], 11) ^ rotateRight(v[4], 25);
+		uint32_t choose = (v[4] & v[5]) ^ (~v[4] & v[6]);
+		uint32_t temp1 = v[7] + s1 + choose + roundConstants[a] + words[a];
+		uint32_t s0 = rotateRight(v[0], 2) ^ rotateRight(v[0], 13) ^ rotateRight(v[0], 22);
+		uint32_t majority = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+		uint32_t temp2 = s0 + majority;
+		v[7] = v[6];
+		v[6] = v[5];
+		v[5] = v[4];
+		v[4] = v[3] + temp1;
+		v[3] = v[2];
+		v[2] = v[1];
+		v[1] = v[0];
+		v[0] = temp1 + temp2;
+	}
+	for(uint32_t a=0;a<8;a++){
+		this->state[a] += v[a];
+	}
+}
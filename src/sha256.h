@@ -0,0 +1,41 @@
+/*
+	sha256.h
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+
+#ifndef SHA256_H_
+#define SHA256_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <strings.h> // bzero
+
+#define SHA256_BLOCK_SIZE 64
+#define SHA256_DIGEST_SIZE 32
+
+// SHA-256 (FIPS 180-4) and HMAC-SHA256 (RFC 2104), for the relay hello which is a few dozen bytes once a second,
+// so the plain byte at a time version and no dependency on a crypto library.
+class Sha256
+{
+	// Public functions
+	public:
+	Sha256();
+
+	void update(const uint8_t *data, uint32_t length);
+	void final(uint8_t *digest); // SHA256_DIGEST_SIZE bytes, start again with a new object.
+
+	static void hmac(const uint8_t *key, uint32_t keyLength, const uint8_t *data, uint32_t length, uint8_t *mac); // SHA256_DIGEST_SIZE bytes.
+	static bool equal(const uint8_t *a, const uint8_t *b, uint32_t length); // in constant time, for comparing MACs.
+
+	private:
+	uint32_t state[8];
+	uint8_t block[SHA256_BLOCK_SIZE];
+	uint32_t blockLength;
+	uint64_t totalLength;
+
+	void transform(void);
+};
+
+#endif /* SHA256_H_ */
@@ -0,0 +1,177 @@
+/*
+	shmMetrics.cpp
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+#include "shmMetrics.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <chrono>
+
+ShmMetrics::ShmMetrics(){
+	bzero(&this->local, sizeof(this->local));
+	bzero(&this->intervalBase, sizeof(this->intervalBase));
+	this->local.magic = SHM_METRICS_MAGIC;
+	this->local.version = SHM_METRICS_VERSION;
+	this->local.size = sizeof(ShmMetricsBlock_t);
+	this->local.pid = (uint32_t)getpid();
+	this->local.startTimeMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	this->shared = NULL;
+	this->lastPublishMs = 0;
+	this->path[0] = 0;
+}
+
+ShmMetrics::~ShmMetrics(){
+	if(this->shared != NULL){
+		munmap(this->shared, sizeof(ShmMetricsBlock_t));
+		shm_unlink(this->path);
+	}
+}
+
+bool ShmMetrics::open(const char *name){
+	getPath(name, this->path);
+	int fd = shm_open(this->path, O_CREAT | O_RDWR, 0644);
+	if(fd < 0){
+		fprintf(stderr, "ShmMetrics: Unable to create /dev/shm%s (%s)\n", this->path, strerror(errno));
+		return true;
+	}
+	if(ftruncate(fd, sizeof(ShmMetricsBlock_t)) < 0){
+		fprintf(stderr, "ShmMetrics: Unable to size /dev/shm%s (%s)\n", this->path, strerror(errno));
+		close(fd);
+		return true;
+	}
+	void *block = mmap(NULL, sizeof(ShmMetricsBlock_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(block == MAP_FAILED){
+		fprintf(stderr, "ShmMetrics: Unable to map /dev/shm%s (%s)\n", this->path, strerror(errno));
+		return true;
+	}
+	this->shared = (ShmMetricsBlock_t *)block;
+
+	// A block left by a previous run is taken over, readers see the magic only when the header is valid.
+	__atomic_store_n(&this->shared->magic, 0, __ATOMIC_RELEASE);
+	memcpy(&this->shared->version, &this->local.version, sizeof(ShmMetricsBlock_t) - sizeof(this->local.magic));
+	this->shared->sequence = 0;
+	__atomic_store_n(&this->shared->magic, SHM_METRICS_MAGIC, __ATOMIC_RELEASE);
+	return false;
+}
+
+void ShmMetrics::define(uint32_t index, const char *name, ShmMetricType_t type){
+	if(index >= SHM_METRICS_MAX_COUNTERS){
+		fprintf(stderr, "ShmMetrics: Counter %s index %u out of range\n", name, index);
+		return;
+	}
+	strncpy(this->local.counters[index].name, name, SHM_METRICS_NAME_SIZE-1);
+	this->local.counters[index].type = type;
+	if(index >= this->local.counterCount){
+		this->local.counterCount = index+1;
+	}
+}
+
+void ShmMetrics::defineHistogram(uint32_t index, const char *name){
+	if(index >= SHM_METRICS_MAX_HISTOGRAMS){
+		fprintf(stderr, "ShmMetrics: Histogram %s index %u out of range\n", name, index);
+		return;
+	}
+	strncpy(this->local.histograms[index].name, name, SHM_METRICS_NAME_SIZE-1);
+	if(index >= this->local.histogramCount){
+		this->local.histogramCount = index+1;
+	}
+}
+
+void ShmMetrics::endInterval(void){
+	for(uint32_t a=0;a<this->local.counterCount;a++){
+		this->intervalBase[a] = this->local.counters[a].value;
+	}
+}
+
+void ShmMetrics::record(uint32_t histogram, uint64_t value){
+	ShmMetricsHistogram_t *h = &this->local.histograms[histogram];
+	uint32_t bucket = (value == 0) ? 0 : 64 - __builtin_clzll(value);
+	if(bucket >= SHM_METRICS_BUCKETS){
+		bucket = SHM_METRICS_BUCKETS-1;
+	}
+	h->buckets[bucket]++;
+	h->count++;
+	h->sum += value;
+	if(value > h->max){
+		h->max = value;
+	}
+}
+
+bool ShmMetrics::isPublishDue(uint64_t nowMs){
+	return (this->shared != NULL && nowMs != this->lastPublishMs);
+}
+
+void ShmMetrics::publish(uint64_t nowMs){
+	if(false == this->isPublishDue(nowMs)){
+		return;
+	}
+	this->lastPublishMs = nowMs;
+	this->local.publishTimeMs = nowMs;
+
+	ShmMetricsBlock_t *block = this->shared;
+	uint32_t sequence = block->sequence;
+	__atomic_store_n(&block->sequence, sequence+1, __ATOMIC_RELAXED); // odd, update in progress.
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	if(block->counterCount != this->local.counterCount || block->histogramCount != this->local.histogramCount){
+		memcpy(block->counters, this->local.counters, sizeof(block->counters)); // names too, only when something was defined.
+		memcpy(block->histograms, this->local.histograms, sizeof(block->histograms));
+		block->counterCount = this->local.counterCount;
+		block->histogramCount = this->local.histogramCount;
+	}else{
+		for(uint32_t a=0;a<this->local.counterCount;a++){
+			block->counters[a].value = this->local.counters[a].value;
+		}
+		for(uint32_t a=0;a<this->local.histogramCount;a++){
+			memcpy(&block->histograms[a].count, &this->local.histograms[a].count, sizeof(ShmMetricsHistogram_t) - SHM_METRICS_NAME_SIZE);
+		}
+	}
+	block->publishTimeMs = nowMs;
+
+	__atomic_store_n(&block->sequence, sequence+2, __ATOMIC_RELEASE); // even, consistent again.
+}
+
+const ShmMetricsBlock_t* ShmMetrics::attach(const char *name){
+	char path[SHM_METRICS_PATH_SIZE];
+	getPath(name, path);
+	int fd = shm_open(path, O_RDONLY, 0);
+	if(fd < 0){
+		return NULL;
+	}
+	void *block = mmap(NULL, sizeof(ShmMetricsBlock_t), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(block == MAP_FAILED){
+		return NULL;
+	}
+	const ShmMetricsBlock_t *shared = (const ShmMetricsBlock_t *)block;
+	if(__atomic_load_n(&shared->magic, __ATOMIC_ACQUIRE) != SHM_METRICS_MAGIC || shared->version != SHM_METRICS_VERSION || shared->size != sizeof(ShmMetricsBlock_t)){
+		munmap(block, sizeof(ShmMetricsBlock_t));
+		return NULL;
+	}
+	return shared;
+}
+
+bool ShmMetrics::readSnapshot(const ShmMetricsBlock_t *shared, ShmMetricsBlock_t &copy){
+	uint32_t before = __atomic_load_n(&shared->sequence, __ATOMIC_ACQUIRE);
+	if(before & 1){
+		return false;
+	}
+	memcpy(&copy, shared, sizeof(ShmMetricsBlock_t));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	uint32_t after = __atomic_load_n(&shared->sequence, __ATOMIC_RELAXED);
+	return (before == after && copy.counterCount <= SHM_METRICS_MAX_COUNTERS && copy.histogramCount <= SHM_METRICS_MAX_HISTOGRAMS);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+////////////////////////// Private Helper functions //////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+void ShmMetrics::getPath(const char *name, char *path){
+	snprintf(path, SHM_METRICS_PATH_SIZE, "/openhd-lte-%s", name);
+}
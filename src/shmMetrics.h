@@ -0,0 +1,101 @@
+/*
+	shmMetrics.h
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+
+#ifndef SHMMETRICS_H_
+#define SHMMETRICS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h> // bzero
+
+#define SHM_METRICS_MAGIC 0x4D44484F // "OHDM" little endian.
+#define SHM_METRICS_VERSION 1        // change when the block layout changes.
+#define SHM_METRICS_MAX_COUNTERS 64
+#define SHM_METRICS_MAX_HISTOGRAMS 16
+#define SHM_METRICS_NAME_SIZE 32
+#define SHM_METRICS_BUCKETS 24       // bucket 0 = 0, bucket N = [2^(N-1), 2^N), the last takes the rest.
+#define SHM_METRICS_PATH_SIZE 64
+
+enum ShmMetricType_t{
+	SHM_METRIC_COUNTER=0, // only goes up, readers show the rate.
+	SHM_METRIC_GAUGE      // current value (queue depth, buffer fill).
+};
+
+typedef struct {
+	char name[SHM_METRICS_NAME_SIZE];
+	uint32_t type;
+	uint32_t reserved;
+	uint64_t value;
+} ShmMetricsCounter_t;
+
+typedef struct {
+	char name[SHM_METRICS_NAME_SIZE]; // unit is part of the name (_us, _ms).
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t buckets[SHM_METRICS_BUCKETS];
+} ShmMetricsHistogram_t;
+
+// The block in /dev/shm. sequence is a seqlock: odd while the writer updates, readers retry if it
+// was odd or changed while they copied. Names are written once before the counts are set.
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;           // sizeof(ShmMetricsBlock_t), readers check it with the version.
+	uint32_t pid;
+	uint32_t sequence;
+	uint32_t counterCount;
+	uint32_t histogramCount;
+	uint32_t reserved;
+	uint64_t startTimeMs;    // steady clock, same as publishTimeMs.
+	uint64_t publishTimeMs;
+	ShmMetricsCounter_t counters[SHM_METRICS_MAX_COUNTERS];
+	ShmMetricsHistogram_t histograms[SHM_METRICS_MAX_HISTOGRAMS];
+} ShmMetricsBlock_t;
+
+// Live counters and histograms for tools/metricsReader, published in /dev/shm/openhd-lte-<name>.
+// The hot path only updates a private copy (plain adds, no locks or syscalls), publish() copies it
+// to the shared block at most once per millisecond from the main loop.
+// Counters that are cleared every status interval in the other classes are given with setInterval()
+// and folded into the total with endInterval() just before they are cleared.
+class ShmMetrics
+{
+	// Public functions
+	public:
+	ShmMetrics();
+	virtual ~ShmMetrics(); //destructor
+
+	bool open(const char *name); // returns true on error, the metrics still work but nothing is published.
+	void define(uint32_t index, const char *name, ShmMetricType_t type);
+	void defineHistogram(uint32_t index, const char *name);
+
+	inline void add(uint32_t index, uint64_t delta){ this->local.counters[index].value += delta; }
+	inline void set(uint32_t index, uint64_t value){ this->local.counters[index].value = value; }
+	inline void setInterval(uint32_t index, uint64_t intervalValue){ this->local.counters[index].value = this->intervalBase[index] + intervalValue; }
+	void endInterval(void);
+	void record(uint32_t histogram, uint64_t value);
+
+	bool isPublishDue(uint64_t nowMs);
+	void publish(uint64_t nowMs);
+
+	// Reader side:
+	static const ShmMetricsBlock_t* attach(const char *name); // NULL if no process publishes name (or wrong version).
+	static bool readSnapshot(const ShmMetricsBlock_t *shared, ShmMetricsBlock_t &copy); // false if the writer was busy, try again.
+
+	private:
+	ShmMetricsBlock_t local;
+	ShmMetricsBlock_t *shared;
+	uint64_t intervalBase[SHM_METRICS_MAX_COUNTERS];
+	uint64_t lastPublishMs;
+	char path[SHM_METRICS_PATH_SIZE];
+
+	static void getPath(const char *name, char *path);
+};
+
+#endif /* SHMMETRICS_H_ */
@@ -0,0 +1,146 @@
+/*
+	tlogReader.cpp
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+
+// Range queries on the Mavlink log tx_raw / rx_raw write with -L, post-flight. Only the index blocks in the
+// time range holding the msgid are read, e.g. all GLOBAL_POSITION_INT (33) from 60s to 120s after the start:
+//   ./tlogReader -f flight -s 60 -e 120 -m 33
+// Output is one JSON object per frame, or with -o the frames as a tlog for QGroundControl / MAVProxy.
+
+#include "mavlinkLog.h"
+#include "mavlinkFrameParser.h"
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int flagHelp = 0;
+
+void usage(void) {
+	printf("\nUsage: tlogReader [options]\n"
+	"\n"
+	"Options:\n"
+	"-f  <base>     Log name as given to tx_raw / rx_raw -L (reads <base>.tidx and <base>-NNNN.tlog).\n"
+	"-s  <seconds>  From this time after the start of the log (default 0).\n"
+	"-e  <seconds>  To this time after the start of the log (default the end).\n"
+	"-m  <msgid>    Only this message, e.g. 33 for GLOBAL_POSITION_INT (default all).\n"
+	"-o  <file>     Write the frames to a tlog file instead of printing them.\n"
+	"-c             Only count the frames.\n"
+	"\n"
+	"Example:\n"
+	"  ./tlogReader -f flight -s 60 -e 120 -m 33\n"
+	"  ./tlogReader -f flight -s 300 -o landing.tlog\n"
+	"\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	char *base=NULL;
+	char *outputFile=NULL;
+	double fromSeconds=0;
+	double toSeconds=-1;
+	int32_t msgid=-1;
+	bool countOnly=false;
+
+	while (1) {
+		int nOptionIndex;
+		static const struct option optiona[] = {
+			{ "help", no_argument, &flagHelp, 1 },
+			{      0,           0,         0, 0 }
+		};
+		int c = getopt_long(argc, argv, "h:f:s:e:m:o:c", optiona, &nOptionIndex);
+		if (c == -1) {
+			break;
+		}
+
+		switch (c) {
+			case 0: {
+				// long option
+				break;
+			}
+			case 'f': {
+				base = optarg;
+				break;
+			}
+			case 's': {
+				fromSeconds = atof(optarg);
+				break;
+			}
+			case 'e': {
+				toSeconds = atof(optarg);
+				break;
+			}
+			case 'm': {
+				msgid = atoi(optarg);
+				break;
+			}
+			case 'o': {
+				outputFile = optarg;
+				break;
+			}
+			case 'c': {
+				countOnly = true;
+				break;
+			}
+			default: {
+				usage();
+				break;
+			}
+		}
+	}
+	if(base == NULL){
+		usage();
+	}
+
+	static MavlinkLog log;
+	if(log.open(base)){
+		exit(EXIT_FAILURE);
+	}
+	FILE *output = NULL;
+	if(outputFile != NULL){
+		output = fopen(outputFile, "wb");
+		if(output == NULL){
+			fprintf(stderr, "tlogReader: Unable to create %s\n", outputFile);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	uint64_t startUs = log.getStartRealtimeUs();
+	uint64_t fromUs = startUs + (uint64_t)(fromSeconds*1000000);
+	uint64_t toUs = (toSeconds < 0) ? UINT64_MAX : startUs + (uint64_t)(toSeconds*1000000);
+	log.query(fromUs, toUs, msgid);
+
+	const uint8_t *frame;
+	uint16_t length;
+	uint64_t timeUs;
+	uint32_t frames=0;
+	while(log.next(frame, length, timeUs)){
+		frames++;
+		if(countOnly){
+			continue;
+		}
+		if(output != NULL){
+			uint8_t time[MAVLINK_LOG_TIME_SIZE];
+			for(uint32_t a=0;a<MAVLINK_LOG_TIME_SIZE;a++){
+				time[a] = (uint8_t)(timeUs >> (8*(MAVLINK_LOG_TIME_SIZE-1-a)));
+			}
+			fwrite(time, sizeof(time), 1, output);
+			fwrite(frame, length, 1, output);
+		}else{
+			bool mavlink2 = (frame[0] == MAVLINK2_STX);
+			printf("{\"time\":%.6f,\"utc\":%.6f,\"msgid\":%u,\"version\":%u,\"sysid\":%u,\"compid\":%u,\"seq\":%u,\"length\":%u}\n",
+				(timeUs - startUs)/1000000.0, timeUs/1000000.0, MavlinkLog::getMsgid(frame), mavlink2 ? 2 : 1,
+				frame[mavlink2 ? 5 : 3], frame[mavlink2 ? 6 : 4], frame[mavlink2 ? 4 : 2], length);
+		}
+	}
+	if(output != NULL){
+		fclose(output);
+	}
+	fprintf(stderr, "tlogReader: %u frames, %u blocks read\n", frames, log.getBlocksRead());
+	return 0;
+}
@@ -0,0 +1,321 @@
+/*
+	txScheduler.cpp
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+#include "txScheduler.h"
+
+#define TX_SCHEDULER_NO_PRIORITY 256
+
+TXScheduler::TXScheduler(){
+	bzero(&this->queues, sizeof(this->queues));
+	// default is the old tx_raw behaviour: Mavlink and telemetry before video, and control traffic before all.
+	this->setClass(TX_CLASS_CONTROL, 0, 1, 0);
+	this->setClass(TX_CLASS_MAVLINK, 1, 1, 0);
+	this->setClass(TX_CLASS_TELEMETRY, 1, 1, 0);
+	this->setClass(TX_CLASS_KEYFRAME, 2, 1, 0);
+	this->setClass(TX_CLASS_VIDEO, 2, 1, 0);
+	this->roundRobin=0;
+	this->selected=-1;
+	this->bytesPerSec=0;
+	this->tokens=0;
+	this->lastRefill=0;
+	this->queueTargetMs=0;
+	this->queueDelayMs=0;
+	this->holdSince=0;
+	this->heldMs=0;
+}
+
+TXScheduler::~TXScheduler(){
+}
+
+// Config file format, one class per line (# for comments):
+// <control|mavlink|keyframe|video|telemetry> <priority> <weight> <deadline ms, 0 = none>
+// Example:
+// control   0 1 0      (command / mission / parameter traffic always first)
+// telemetry 1 1 0
+// mavlink   1 2 500
+// keyframe  1 8 0
+// video     1 8 300    (drop P frame packages which waited more than 300ms)
+bool TXScheduler::loadConfigFile(const char *filename){
+	FILE *fp = fopen(filename, "r");
+	if(fp == NULL){
+		fprintf(stderr, "TXScheduler: Unable to open config file %s\n", filename);
+		return true;
+	}
+
+	char line[128];
+	uint32_t lineNumber=0;
+	bool error=false;
+	while(fgets(line, sizeof(line), fp) != NULL){
+		lineNumber++;
+		char name[32];
+		int priority=0;
+		int weight=0;
+		int deadline=0;
+
+		char *comment = strchr(line, '#');
+		if(comment != NULL){
+			*comment=0;
+		}
+
+		int fields = sscanf(line, "%31s %d %d %d", name, &priority, &weight, &deadline);
+		if(fields <= 0){
+			continue; // empty line.
+		}
+		TXClass_t txClass;
+		if(false == parseClass(name, txClass)){
+			fprintf(stderr, "TXScheduler: %s line %u - unknown class \"%s\"\n", filename, lineNumber, name);
+			error=true;
+			continue;
+		}
+		if(fields < 4 || priority < 0 || priority > 255 || weight < 1 || weight > 1000 || deadline < 0){
+			fprintf(stderr, "TXScheduler: %s line %u - expected <class> <priority 0-255> <weight 1-1000> <deadline ms>\n", filename, lineNumber);
+			error=true;
+			continue;
+		}
+		this->setClass(txClass, (uint8_t)priority, (uint16_t)weight, (uint32_t)deadline);
+	}
+	fclose(fp);
+	return error;
+}
+
+void TXScheduler::setClass(TXClass_t txClass, uint8_t priority, uint16_t weight, uint32_t deadlineMs){
+	ClassQueue *queue = &this->queues[txClass];
+	queue->priority = priority;
+	queue->weight = (weight < 1) ? 1 : weight;
+	queue->deadlineMs = deadlineMs;
+}
+
+void TXScheduler::setRate(uint32_t kbitPerSec){
+	this->bytesPerSec = kbitPerSec*1000/8;
+	this->tokens = 0;
+	this->lastRefill = 0;
+}
+
+void TXScheduler::setQueueTarget(uint32_t targetMs){
+	this->queueTargetMs = targetMs;
+}
+
+void TXScheduler::setQueueDelay(uint32_t delayMs){
+	this->queueDelayMs = delayMs;
+}
+
+bool TXScheduler::enqueue(TXClass_t txClass, const uint8_t *data, uint16_t size, uint64_t queuedTime){
+	struct iovec span;
+	span.iov_base = (void*)data;
+	span.iov_len = size;
+	return this->enqueue(txClass, &span, 1, queuedTime);
+}
+
+bool TXScheduler::enqueue(TXClass_t txClass, const struct iovec *spans, int spanCount, uint64_t queuedTime){
+	ClassQueue *queue = &this->queues[txClass];
+	size_t size=0;
+	for(int a=0;a<spanCount;a++){
+		size += spans[a].iov_len;
+	}
+	if(size == 0 || size > TX_SCHEDULER_MAX_PACKET){
+		fprintf(stderr, "TXScheduler: %s package of %u bytes ignored\n", getClassName(txClass), (uint32_t)size);
+		return false;
+	}
+	bool dropped=false;
+	if(queue->count >= TX_SCHEDULER_QUEUE_SIZE){
+		if(this->selected == (int)txClass){
+			this->selected = -1; // the package waiting for the socket is the one dropped.
+		}
+		this->dropHead(queue);
+		dropped=true;
+	}
+	TXPacket *packet = &queue->packets[(queue->head + queue->count) % TX_SCHEDULER_QUEUE_SIZE];
+	size=0;
+	for(int a=0;a<spanCount;a++){ // one copy into the slot, no batch buffer in between.
+		memcpy(&packet->data[size], spans[a].iov_base, spans[a].iov_len);
+		size += spans[a].iov_len;
+	}
+	packet->size = (uint16_t)size;
+	packet->queuedTime = queuedTime;
+	queue->count++;
+	return dropped;
+}
+
+uint32_t TXScheduler::getQueueSize(TXClass_t txClass){
+	return this->queues[txClass].count;
+}
+
+const uint8_t* TXScheduler::nextPacket(uint64_t nowMs, TXClass_t &txClass, uint16_t &size){
+	// Rate limit, a package may be sent as long as there are tokens left (it may take the bucket negative).
+	if(this->bytesPerSec > 0){
+		if(this->lastRefill == 0){
+			this->lastRefill = nowMs;
+		}
+		int64_t maxTokens = (int64_t)this->bytesPerSec * TX_SCHEDULER_BURST_MS / 1000;
+		if(maxTokens < TX_SCHEDULER_MAX_PACKET){
+			maxTokens = TX_SCHEDULER_MAX_PACKET;
+		}
+		this->tokens += (int64_t)(nowMs - this->lastRefill) * this->bytesPerSec / 1000;
+		this->lastRefill = nowMs;
+		if(this->tokens > maxTokens){
+			this->tokens = maxTokens;
+		}
+		if(this->tokens <= 0){
+			return NULL;
+		}
+	}
+
+	// Highest priority (lowest number) with something to send.
+	uint32_t best = TX_SCHEDULER_NO_PRIORITY;
+	for(uint32_t a=0;a<TX_CLASS_COUNT;a++){
+		ClassQueue *queue = &this->queues[a];
+		this->dropExpired(queue, nowMs);
+		if(queue->count > 0 && queue->priority < best){
+			best = queue->priority;
+		}
+	}
+
+	// The uplink is slower than the kernel queue says (no feedback from the ground needed), keep the packages here
+	// where the classes decide, until the queue is down at the target.
+	bool holding = (best != TX_SCHEDULER_NO_PRIORITY && this->queueTargetMs > 0 && this->queueDelayMs > this->queueTargetMs);
+	if(holding && this->holdSince == 0){
+		this->holdSince = nowMs;
+	}else if(false == holding && this->holdSince != 0){
+		this->heldMs += (uint32_t)(nowMs - this->holdSince);
+		this->holdSince = 0;
+	}
+	if(best == TX_SCHEDULER_NO_PRIORITY || holding){
+		this->selected = -1;
+		return NULL;
+	}
+
+	// Deficit round robin between the classes with that priority, stays on a class until its deficit is used.
+	while(true){
+		ClassQueue *queue = &this->queues[this->roundRobin];
+		if(queue->count > 0 && queue->priority == best){
+			TXPacket *packet = &queue->packets[queue->head];
+			if(queue->deficit >= (int32_t)packet->size){
+				this->selected = (int)this->roundRobin;
+				txClass = (TXClass_t)this->roundRobin;
+				size = packet->size;
+				return packet->data;
+			}
+			queue->deficit += (int32_t)queue->weight * TX_SCHEDULER_QUANTUM;
+		}
+		this->roundRobin = (this->roundRobin + 1) % TX_CLASS_COUNT;
+	}
+}
+
+uint32_t TXScheduler::packetSent(uint64_t nowMs){
+	if(this->selected < 0){
+		return 0;
+	}
+	ClassQueue *queue = &this->queues[this->selected];
+	TXPacket *packet = &queue->packets[queue->head];
+	uint32_t delay = (uint32_t)(nowMs - packet->queuedTime);
+	queue->bytesSent += packet->size;
+	queue->packetsSent++;
+	queue->delaySumMs += delay;
+	if(delay > queue->delayMaxMs){
+		queue->delayMaxMs = delay;
+	}
+	queue->deficit -= packet->size;
+	this->tokens -= packet->size;
+
+	queue->head = (queue->head + 1) % TX_SCHEDULER_QUEUE_SIZE;
+	queue->count--;
+	if(queue->count == 0){
+		queue->deficit = 0; // an idle class does not save up.
+	}
+	this->selected = -1;
+	return delay;
+}
+
+uint32_t TXScheduler::getBytesSent(TXClass_t txClass){
+	return this->queues[txClass].bytesSent;
+}
+
+uint32_t TXScheduler::getBytesDropped(TXClass_t txClass){
+	return this->queues[txClass].bytesDropped;
+}
+
+uint32_t TXScheduler::getBytesExpired(TXClass_t txClass){
+	return this->queues[txClass].bytesExpired;
+}
+
+uint32_t TXScheduler::getHeldMs(void){
+	return this->heldMs;
+}
+
+void TXScheduler::printStatus(FILE *out){
+	fprintf(out, "TX scheduler (class:tx|dropped KB|delay avg/max ms):");
+	for(uint32_t a=0;a<TX_CLASS_COUNT;a++){
+		ClassQueue *queue = &this->queues[a];
+		uint32_t average = (queue->packetsSent > 0) ? (uint32_t)(queue->delaySumMs / queue->packetsSent) : 0;
+		fprintf(out, " %s:%.1f|%.1f|%u/%u", getClassName((TXClass_t)a), queue->bytesSent/1024.0f, queue->bytesDropped/1024.0f, average, queue->delayMaxMs);
+	}
+	if(this->heldMs > 0){
+		fprintf(out, " held:%ums", this->heldMs);
+	}
+	fprintf(out, "\n");
+}
+
+void TXScheduler::clearStatus(void){
+	for(uint32_t a=0;a<TX_CLASS_COUNT;a++){
+		ClassQueue *queue = &this->queues[a];
+		queue->bytesSent=0;
+		queue->bytesDropped=0;
+		queue->bytesExpired=0;
+		queue->packetsSent=0;
+		queue->delaySumMs=0;
+		queue->delayMaxMs=0;
+	}
+	this->heldMs=0;
+}
+
+const char* TXScheduler::getClassName(TXClass_t txClass){
+	switch(txClass){
+		case TX_CLASS_CONTROL:   return "control";
+		case TX_CLASS_MAVLINK:   return "mavlink";
+		case TX_CLASS_KEYFRAME:  return "keyframe";
+		case TX_CLASS_VIDEO:     return "video";
+		case TX_CLASS_TELEMETRY: return "telemetry";
+		default:                 return "unknown";
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+////////////////////////// Private Helper functions //////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+void TXScheduler::dropExpired(ClassQueue *queue, uint64_t nowMs){
+	if(queue->deadlineMs == 0){
+		return;
+	}
+	// The package also waits in the local queue once sent, it arrives too late anyway.
+	while(queue->count > 0 && (nowMs - queue->packets[queue->head].queuedTime) + this->queueDelayMs > queue->deadlineMs){
+		if(this->selected == (int)(queue - this->queues)){
+			this->selected = -1;
+		}
+		queue->bytesExpired += this->dropHead(queue);
+	}
+}
+
+uint32_t TXScheduler::dropHead(ClassQueue *queue){
+	uint32_t size = queue->packets[queue->head].size;
+	queue->bytesDropped += size;
+	queue->head = (queue->head + 1) % TX_SCHEDULER_QUEUE_SIZE;
+	queue->count--;
+	if(queue->count == 0){
+		queue->deficit = 0;
+	}
+	return size;
+}
+
+bool TXScheduler::parseClass(const char *name, TXClass_t &txClass){
+	for(uint32_t a=0;a<TX_CLASS_COUNT;a++){
+		if(strcmp(name, getClassName((TXClass_t)a)) == 0){
+			txClass = (TXClass_t)a;
+			return true;
+		}
+	}
+	return false;
+}
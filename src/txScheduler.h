@@ -0,0 +1,114 @@
+/*
+	txScheduler.h
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+
+#ifndef TXSCHEDULER_H_
+#define TXSCHEDULER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h> // bzero
+#include <sys/uio.h> // struct iovec
+
+#define TX_SCHEDULER_MAX_PACKET 1472  // one UDP package (largest video package with tx_raw -u, Mavlink batches are smaller).
+#define TX_SCHEDULER_QUEUE_SIZE 32    // packages per class, when full the oldest is dropped.
+#define TX_SCHEDULER_QUANTUM 1400     // bytes a class with weight 1 may send per round.
+#define TX_SCHEDULER_BURST_MS 10      // with a rate limit, max burst after an idle period.
+
+// Traffic classes on the LTE uplink, each with its own queue.
+enum TXClass_t{
+	TX_CLASS_CONTROL=0,   // Mavlink batches with command / mission / parameter traffic (COMMAND_ACK etc.).
+	TX_CLASS_MAVLINK,     // other Mavlink batches (attitude, position, HUD...).
+	TX_CLASS_KEYFRAME,    // video packages of an IDR frame.
+	TX_CLASS_VIDEO,       // video packages of P frames.
+	TX_CLASS_TELEMETRY,   // air status for QOpenHD.
+	TX_CLASS_COUNT
+};
+
+// Scheduler in front of the sockets: classes with the lowest priority number are served first (strict),
+// classes with the same priority share the link by weight (deficit round robin). Packages older than the
+// class deadline are dropped instead of sent. An optional rate limit keeps the queueing in here instead of
+// in the socket / modem buffers, so a COMMAND_ACK does not wait behind a large IDR frame. Without a rate limit
+// (or when the uplink got slower than it) the local queue delay does the same: the time a package will still
+// wait in the kernel counts towards its deadline, and nothing is sent while that delay is above the target.
+// tx_raw owns the sockets: nextPacket() tells what to send, packetSent() when it went out.
+class TXScheduler
+{
+	// Public functions
+	public:
+	TXScheduler();
+	virtual ~TXScheduler(); //destructor
+
+	bool loadConfigFile(const char *filename); // returns true on error.
+	void setClass(TXClass_t txClass, uint8_t priority, uint16_t weight, uint32_t deadlineMs);
+	void setRate(uint32_t kbitPerSec); // 0 = no limit, send until the socket is full.
+	void setQueueTarget(uint32_t targetMs); // hold the packages while the local queue delay is above this, 0 = never.
+	void setQueueDelay(uint32_t delayMs); // socket / qdisc queue in front of the uplink (UplinkQueue), before nextPacket().
+
+	bool enqueue(TXClass_t txClass, const uint8_t *data, uint16_t size, uint64_t queuedTime); // returns true if an old package was dropped to make room.
+	bool enqueue(TXClass_t txClass, const struct iovec *spans, int spanCount, uint64_t queuedTime); // the package gathered from spans.
+	uint32_t getQueueSize(TXClass_t txClass);
+
+	// The package to send now, NULL if nothing may be sent. If the socket is full, call again later
+	// without packetSent(), the same package comes back unless a higher priority package arrived.
+	const uint8_t* nextPacket(uint64_t nowMs, TXClass_t &txClass, uint16_t &size);
+	uint32_t packetSent(uint64_t nowMs); // returns the time the package waited in the queue (ms).
+
+	uint32_t getBytesSent(TXClass_t txClass);
+	uint32_t getBytesDropped(TXClass_t txClass);
+	uint32_t getBytesExpired(TXClass_t txClass); // the part of the dropped bytes which passed the deadline, the rest was a full queue.
+	uint32_t getHeldMs(void); // time the packages were held for the local queue in this status interval.
+	void printStatus(FILE *out); // per class sent / dropped / queueing delay for this interval.
+	void clearStatus(void);
+
+	static const char* getClassName(TXClass_t txClass);
+
+	private:
+	struct TXPacket{
+		uint8_t data[TX_SCHEDULER_MAX_PACKET];
+		uint16_t size;
+		uint64_t queuedTime;
+	};
+	struct ClassQueue{
+		TXPacket packets[TX_SCHEDULER_QUEUE_SIZE];
+		uint32_t head;
+		uint32_t count;
+		uint8_t priority;
+		uint16_t weight;
+		uint32_t deadlineMs;  // 0 = no deadline.
+		int32_t deficit;      // bytes this class may still send in this round.
+
+		// counters for this status interval.
+		uint32_t bytesSent;
+		uint32_t bytesDropped;
+		uint32_t bytesExpired;
+		uint32_t packetsSent;
+		uint64_t delaySumMs;
+		uint32_t delayMaxMs;
+	};
+	ClassQueue queues[TX_CLASS_COUNT];
+	uint32_t roundRobin;  // next class to visit among equal priorities.
+	int selected;         // class of the package returned by nextPacket(), -1 if none.
+
+	// rate limit (token bucket in bytes).
+	uint32_t bytesPerSec; // 0 = no limit.
+	int64_t tokens;
+	uint64_t lastRefill;
+
+	// local queue (kernel / qdisc) in front of the uplink.
+	uint32_t queueTargetMs; // 0 = no hold.
+	uint32_t queueDelayMs;
+	uint64_t holdSince;     // 0 = not holding.
+	uint32_t heldMs;        // this status interval.
+
+	void dropExpired(ClassQueue *queue, uint64_t nowMs);
+	uint32_t dropHead(ClassQueue *queue); // returns the bytes dropped.
+	static bool parseClass(const char *name, TXClass_t &txClass);
+};
+
+#endif /* TXSCHEDULER_H_ */
@@ -8,65 +8,178 @@ typedef struct {
 	float mavlinkdropped;
 	float videotx;
 	float videodropped;
+	float linkrecoveries;
+	float mavlinksaved; // bytes saved by Mavlink 2 trimming.
 } tx_dataRates_t;
 
 void usage(void) {
     printf("\nUsage: [Video stream] | tx_raw [options]\n"
            "\n"
            "Options:\n"
-           "-i  <ip>       Ip to which the stream is sent. This is where the rx_raw is listening\n"
+           "-i  <ip>       Ip to which the stream is sent. This is where the rx_raw is listening (IPv4, IPv6 or hostname)\n"
            "-v  <port>     UDP port for video.\n"
            "-s  <serial>   Serial device to listen for Mavlink packages from Flight Computer\n"
+           "-r  <baud>     Serial baud rate, any rate the UART can do e.g. 921600 or 1500000 (default 57600).\n"
 		   "-p  <port>     UDP port for serial data output.\n"
 		   "-t  <port>     Port for Telemetry data.\n"
            "-o  <file>     Output file to local record of input stream, .h264 will be added to the name\n"
+           "               An .idx with the keyframe offsets and the position / armed track is written next to it.\n"
            "-z  <Mbytes>   Maximum allowed output file size, on FAT32 2000 should be used. Next file will be same filename as -o but 1..N added.\n"
+           "-M             Record -o as fragmented MP4 (.mp4, starts on a keyframe when armed) instead of the raw H.264 stream.\n"
+           "-P  <s>[,<MB>] With -M, keep the last <s> seconds of video (max <MB>, default 16) while disarmed, written first when armed.\n"
+           "-f  <file>     Mavlink filter policy file, per msgid forward / latest <max Hz> / drop (default is forward all).\n"
+           "-m  <version>  Mavlink version on the LTE link, 1 = as received from the Flight Computer (default), 2 = convert Mavlink 1 to trimmed Mavlink 2.\n"
+           "-c             Compress the Mavlink batches (delta to the previous message of the same type + LZ), rx_raw detects it.\n"
+           "-x  <file>     Dictionary for the Mavlink compression, rx_raw must use the same file (create it with tools/benchmark -D).\n"
+           "-q  <file>     TX scheduler config, per class (control, mavlink, keyframe, video, telemetry) priority, weight and deadline.\n"
+           "-b  <kbit/s>   Uplink rate limit, keeps the queueing in the scheduler instead of the modem (default no limit).\n"
+           "-Q  <ms>       Hold the packages in the scheduler while the socket / qdisc queue to the modem is longer (default %d, 0 = off).\n"
+           "-L  <name>     Log the Mavlink frames from and to the Flight Computer as tlog (<name>-NNNN.tlog + <name>.tidx, tools/tlogReader).\n"
+           "-k  <session>  Send through a relay (-i is the relay) which pairs this drone with the rx_raw using the same session number.\n"
+           "-K  <key>      Key of the relay (relay -K), the hellos are signed with it. Needed with -k.\n"
+           "-u             Path MTU discovery, the video packages get the largest size acked by rx_raw (up to %d, IPv6 %d, default %d bytes).\n"
+           "               Needs an rx_raw which answers the probes (this version or newer).\n"
            "\n"
            "Example:\n"
            "  raspvid -t 0 | ./tx_raw -i X.X.X.X -v 7000 -s /dev/serial0 -p 8000 -o record -z 2000\n"
 		   "  raspvid -t 0 | ./tx_raw -i X.X.X.X -v 7000 -s /dev/serial0 -p 8000 -t 5200 -o record -z 2000\n"
-           "\n");
+		   "  raspvid -t 0 | ./tx_raw -i X.X.X.X -v 7000 -s /dev/serial0 -p 8000 -t 5200 -o record -z 2000 -f mavlink-filter.conf\n"
+		   "  raspvid -t 0 | ./tx_raw -i X.X.X.X -v 7000 -s /dev/serial0 -p 8000 -t 5200 -o record -z 2000 -m 2\n"
+		   "  raspvid -t 0 | ./tx_raw -i X.X.X.X -v 7000 -s /dev/serial0 -p 8000 -t 5200 -o record -z 2000 -m 2 -c -x mavlink.dict\n"
+		   "  raspvid -t 0 | ./tx_raw -i X.X.X.X -v 7000 -s /dev/serial0 -p 8000 -t 5200 -o record -z 2000 -q tx-scheduler.conf -b 8000\n"
+		   "  raspvid -t 0 | ./tx_raw -i X.X.X.X -v 7000 -s /dev/ttyAMA0 -r 921600 -p 8000 -t 5200 -o record -z 2000\n"
+		   "  raspvid -t 0 | ./tx_raw -i X.X.X.X -v 7000 -s /dev/serial0 -p 8000 -t 5200 -o record -z 2000 -M\n"
+		   "  raspvid -t 0 | ./tx_raw -i X.X.X.X -v 7000 -s /dev/serial0 -p 8000 -t 5200 -o record -z 2000 -M -P 5,8\n"
+		   "  raspvid -t 0 | ./tx_raw -i X.X.X.X -v 7000 -s /dev/serial0 -p 8000 -t 5200 -o record -z 2000 -L flight\n"
+		   "  raspvid -t 0 | ./tx_raw -i <relay IP> -v 7000 -s /dev/serial0 -p 8000 -t 5200 -o record -z 2000 -k 42 -K <key>\n"
+		   "  raspvid -t 0 | ./tx_raw -i X.X.X.X -v 7000 -s /dev/serial0 -p 8000 -t 5200 -o record -z 2000 -u\n"
+           "\n", TX_UPLINK_QUEUE_TARGET_MS, UDP_MAX_PACKET_SIZE, UDP_MAX_PACKET_SIZE_IPV6, UDP_PACKET_SIZE);
     exit(1);
 }
 
-int open_port(const char* serialDevice){
-	int fd;		//File descriptor for the port
-	struct termios options;
+volatile sig_atomic_t stopRequested = 0;
 
-	fd = open(serialDevice, O_RDWR | O_NOCTTY | O_NDELAY);
-//	fd = open(serialDevice, O_RDWR );
-
-	if (fd == -1){
-		//Could not open the port.
-		fprintf(stderr, "tx_raw: Serial Port Failed to Open, exit");
-		exit(EXIT_FAILURE);
-	}
-	else{
-		fcntl(fd, F_SETFL, FNDELAY); // Sets the read() function to return NOW and not wait for data to enter buffer if there isn't anything there.
-
-		//Configure port for 8N1 transmission
-		tcgetattr(fd, &options);					//Gets the current options for the port
-		cfsetispeed(&options, B57600);				//Sets the Input Baud Rate
-		cfsetospeed(&options, B57600);				//Sets the Output Baud Rate
-		options.c_cflag |= (CLOCAL | CREAD);		// Enable reciever
-		options.c_cflag &= ~PARENB;					// Set parry bit
-		options.c_cflag &= ~CSTOPB;					// 1 Stop Bit
-		options.c_cflag &= ~CSIZE;					// 8 Data bits
-		options.c_cflag |= CS8;						// --||---
-	    options.c_iflag &= ~(IXON | IXOFF | IXANY); // disable flow control (software)
-
-		tcsetattr(fd, TCSANOW, &options);			//Set the new options for the port "NOW"
-
-		//std::cout << "seems like everything is ok, keep going\n";
-	};
+void stopHandler(int){
+	stopRequested = 1;
+}
 
-	return (fd);
-};
-/*
 uint64_t timeMillisec() {
 	using namespace std::chrono;
-	return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
-}*/
+	return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t timeMicrosec() {
+	using namespace std::chrono;
+	return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Recreate all sockets towards ground, used when the modem got a new IP or a socket failed.
+// Returns true if all sockets are valid again.
+bool recoverConnections(Connection **connections, int numberOfConnections){
+	bool allOk=true;
+	fprintf(stderr, "tx_raw: Link changed or socket error, recreating %d sockets.\n", numberOfConnections);
+	for(int a=0;a<numberOfConnections;a++){
+		if(false == connections[a]->reopen()){
+			allOk=false;
+		}
+	}
+	return allOk;
+}
+
+void initSerialBatch(serialBatch_t &batch){
+	batch.frames.clear();
+	batch.compressor = NULL;
+	batch.metrics = NULL;
+}
+
+// Mavlink replies the ground station waits for (commands, missions, parameters), these are sent right away as TX_CLASS_CONTROL.
+bool isControlMessage(uint32_t msgid){
+	switch(msgid){
+		case MAVLINK_MSG_ID_PARAM_VALUE:
+		case MAVLINK_MSG_ID_MISSION_ITEM:
+		case MAVLINK_MSG_ID_MISSION_REQUEST:
+		case MAVLINK_MSG_ID_MISSION_COUNT:
+		case MAVLINK_MSG_ID_MISSION_ITEM_REACHED:
+		case MAVLINK_MSG_ID_MISSION_ACK:
+		case MAVLINK_MSG_ID_MISSION_REQUEST_INT:
+		case MAVLINK_MSG_ID_MISSION_ITEM_INT:
+		case MAVLINK_MSG_ID_COMMAND_ACK:
+		case MAVLINK_MSG_ID_STATUSTEXT:
+			return true;
+		default:
+			return false;
+	}
+}
+
+// The oldest frames in the ring become UDP packages of up to MAX_SERIAL_BUFFER_SIZE bytes, queued in the scheduler
+// (compressed with tx_raw -c). A package which is not full yet is only queued with all, else its frames wait for more.
+void finishSerialBatch(serialBatch_t &batch, TXScheduler &scheduler, bool all){
+	struct iovec spans[2];
+	uint32_t frames;
+	while(batch.frames.getFrames() > 0){
+		int spanCount = batch.frames.peekBatch(MAX_SERIAL_BUFFER_SIZE, spans, frames);
+		if(spanCount == 0 || (false == all && frames == batch.frames.getFrames())){
+			break;
+		}
+		bool control=false; // batch holds command / mission / parameter traffic, queued as TX_CLASS_CONTROL.
+		for(uint32_t a=0;a<frames;a++){
+			if(isControlMessage(batch.frames.getFrame(a)->msgid)){
+				control=true;
+				break;
+			}
+		}
+		uint64_t startTime = batch.frames.getFrame(0)->timeMs;
+		TXClass_t txClass = control ? TX_CLASS_CONTROL : TX_CLASS_MAVLINK;
+		if(batch.compressor != NULL){
+			const uint8_t *input = (const uint8_t*)spans[0].iov_base;
+			uint16_t size = spans[0].iov_len;
+			if(spanCount > 1){ // the compressor needs the frames in one piece.
+				memcpy(batch.packed, spans[0].iov_base, spans[0].iov_len);
+				memcpy(&batch.packed[spans[0].iov_len], spans[1].iov_base, spans[1].iov_len);
+				input = batch.packed;
+				size += spans[1].iov_len;
+			}
+			uint16_t compressedSize = batch.compressor->compress(input, size, batch.compressed, sizeof(batch.compressed));
+			if(compressedSize > 0){
+				scheduler.enqueue(txClass, batch.compressed, compressedSize, startTime);
+			}else{
+				scheduler.enqueue(txClass, input, size, startTime);
+			}
+		}else{
+			scheduler.enqueue(txClass, spans, spanCount, startTime); // gathered straight from the ring.
+		}
+		if(batch.metrics != NULL){
+			batch.metrics->add(TX_METRIC_MAVLINK_BATCHES, 1);
+			batch.metrics->record(TX_HISTOGRAM_MAVLINK_BATCH_AGE, timeMillisec() - startTime);
+		}
+		batch.frames.pop(frames);
+	}
+}
+
+// Copy a validated Mavlink frame (raw bytes, no re-serializing) into the frame ring, if it is full the frames in it are queued first.
+// With linkVersion 2 Mavlink 1 frames are converted to Mavlink 2 with the trailing zeros of the payload removed.
+// Returns true if the frames should be sent now, MSG ID 30 (HUD 10HZ) or a command / mission reply.
+bool addSerialBatchFrame(serialBatch_t &batch, const MavlinkFrame_t &frame, int linkVersion, TXScheduler &scheduler, tx_dataRates_t &linkstatus){
+	bool convert = (linkVersion == 2 && frame.version == 1);
+	uint16_t maxLength = frame.length + (convert ? (MAVLINK2_HEADER_LEN - MAVLINK_NUM_HEADER_BYTES) : 0);
+	uint8_t *data = batch.frames.prepare(maxLength);
+	if(data == NULL){
+		finishSerialBatch(batch, scheduler, true);
+		data = batch.frames.prepare(maxLength);
+		if(data == NULL){ // larger than the ring, not a frame from the parser.
+			return false;
+		}
+	}
+	uint16_t length = frame.length;
+	if(convert){
+		length = MavlinkFrameParser::toMavlink2(frame, data);
+		linkstatus.mavlinksaved += (float)frame.length - length;
+	}else{
+		memcpy(data, frame.data, frame.length);
+	}
+	batch.frames.commit(frame, length, timeMillisec());
+	return (frame.msgid == MAVLINK_MSG_ID_VFR_HUD || isControlMessage(frame.msgid));
+}
 
 float getCpuTemp(void){
 	float systemp, millideg;
@@ -74,6 +187,9 @@ float getCpuTemp(void){
 	int n;
 
 	thermal = fopen("/sys/class/thermal/thermal_zone0/temp","r");
+	if(thermal == NULL){
+		return 0; // no thermal zone (not a Pi).
+	}
 	n = fscanf(thermal,"%f",&millideg);
 	fclose(thermal);
 	systemp = millideg / 1000;	
@@ -88,6 +204,71 @@ bool checkExists(std::string file){
     return false;
 }
 
+void initTXMetrics(ShmMetrics &metrics){
+	metrics.define(TX_METRIC_SERIAL_BYTES, "serial_bytes", SHM_METRIC_COUNTER);
+	metrics.define(TX_METRIC_SERIAL_RING_OVERRUNS, "serial_ring_overrun_bytes", SHM_METRIC_COUNTER);
+	metrics.define(TX_METRIC_SERIAL_UART_OVERRUNS, "serial_uart_overruns", SHM_METRIC_COUNTER);
+	metrics.define(TX_METRIC_SERIAL_UART_ERRORS, "serial_uart_errors", SHM_METRIC_COUNTER);
+	metrics.define(TX_METRIC_SERIAL_BUFFERED, "serial_buffered_bytes", SHM_METRIC_GAUGE);
+	metrics.define(TX_METRIC_MAVLINK_FRAMES, "mavlink_frames", SHM_METRIC_COUNTER);
+	metrics.define(TX_METRIC_MAVLINK_CRC_ERRORS, "mavlink_crc_errors", SHM_METRIC_COUNTER);
+	metrics.define(TX_METRIC_MAVLINK_HEADER_ERRORS, "mavlink_header_errors", SHM_METRIC_COUNTER);
+	metrics.define(TX_METRIC_MAVLINK_UNKNOWN_MESSAGES, "mavlink_unknown_messages", SHM_METRIC_COUNTER);
+	metrics.define(TX_METRIC_MAVLINK_SKIPPED_BYTES, "mavlink_skipped_bytes", SHM_METRIC_COUNTER);
+	metrics.define(TX_METRIC_MAVLINK_BATCHES, "mavlink_batches", SHM_METRIC_COUNTER);
+	metrics.define(TX_METRIC_MAVLINK_FROM_GROUND_BYTES, "mavlink_from_ground_bytes", SHM_METRIC_COUNTER);
+	metrics.define(TX_METRIC_VIDEO_IN_BYTES, "video_in_bytes", SHM_METRIC_COUNTER);
+	metrics.define(TX_METRIC_VIDEO_FIFO, "video_fifo_packages", SHM_METRIC_GAUGE);
+	metrics.define(TX_METRIC_VIDEO_FIFO_DROPPED_BYTES, "video_fifo_dropped_bytes", SHM_METRIC_COUNTER);
+	metrics.define(TX_METRIC_LINK_RECOVERIES, "link_recoveries", SHM_METRIC_COUNTER);
+	metrics.define(TX_METRIC_VIDEO_PACKAGE_SIZE, "video_package_size", SHM_METRIC_GAUGE);
+	metrics.define(TX_METRIC_UPLINK_SOCKET_QUEUE, "uplink_socket_queue_bytes", SHM_METRIC_GAUGE);
+	metrics.define(TX_METRIC_UPLINK_QDISC_BACKLOG, "uplink_qdisc_backlog_bytes", SHM_METRIC_GAUGE);
+	metrics.define(TX_METRIC_UPLINK_QUEUE_DELAY, "uplink_queue_delay_ms", SHM_METRIC_GAUGE);
+	metrics.define(TX_METRIC_UPLINK_HELD, "uplink_held_ms", SHM_METRIC_COUNTER);
+	char name[SHM_METRICS_NAME_SIZE];
+	for(uint32_t a=0;a<TX_CLASS_COUNT;a++){
+		const char *className = TXScheduler::getClassName((TXClass_t)a);
+		snprintf(name, sizeof(name), "%s_sent_bytes", className);
+		metrics.define(TX_METRIC_CLASS_SENT_BYTES + a, name, SHM_METRIC_COUNTER);
+		snprintf(name, sizeof(name), "%s_full_dropped_bytes", className);
+		metrics.define(TX_METRIC_CLASS_FULL_DROPPED_BYTES + a, name, SHM_METRIC_COUNTER);
+		snprintf(name, sizeof(name), "%s_expired_bytes", className);
+		metrics.define(TX_METRIC_CLASS_EXPIRED_BYTES + a, name, SHM_METRIC_COUNTER);
+		snprintf(name, sizeof(name), "%s_queue_packages", className);
+		metrics.define(TX_METRIC_CLASS_QUEUE + a, name, SHM_METRIC_GAUGE);
+		snprintf(name, sizeof(name), "%s_delay_ms", className);
+		metrics.defineHistogram(TX_HISTOGRAM_CLASS_DELAY + a, name);
+	}
+	metrics.defineHistogram(TX_HISTOGRAM_MAVLINK_BATCH_AGE, "mavlink_batch_age_ms");
+}
+
+// Counters the other classes keep per status interval, called before publish and before they are cleared.
+void updateTXMetrics(ShmMetrics &metrics, SerialPort &serialPort, MavlinkFrameParser &parser, H264TXFraming &framing, TXScheduler &scheduler, UplinkQueue &uplinkQueue, tx_dataRates_t &linkstatus){
+	metrics.setInterval(TX_METRIC_SERIAL_BYTES, serialPort.getBytesRead());
+	metrics.setInterval(TX_METRIC_SERIAL_RING_OVERRUNS, serialPort.getRingOverruns());
+	metrics.set(TX_METRIC_SERIAL_BUFFERED, serialPort.getBufferedSize());
+	metrics.setInterval(TX_METRIC_MAVLINK_FRAMES, parser.getFramesParsed());
+	metrics.setInterval(TX_METRIC_MAVLINK_CRC_ERRORS, parser.getCRCErrors());
+	metrics.setInterval(TX_METRIC_MAVLINK_HEADER_ERRORS, parser.getHeaderErrors());
+	metrics.setInterval(TX_METRIC_MAVLINK_UNKNOWN_MESSAGES, parser.getUnknownMessages());
+	metrics.setInterval(TX_METRIC_MAVLINK_SKIPPED_BYTES, parser.getBytesSkipped());
+	metrics.setInterval(TX_METRIC_MAVLINK_FROM_GROUND_BYTES, (uint64_t)linkstatus.mavlinkrx);
+	metrics.set(TX_METRIC_VIDEO_FIFO, framing.getTXFifoSize());
+	metrics.setInterval(TX_METRIC_VIDEO_FIFO_DROPPED_BYTES, framing.getBytesDropped());
+	metrics.set(TX_METRIC_UPLINK_SOCKET_QUEUE, uplinkQueue.getSocketBytes());
+	metrics.set(TX_METRIC_UPLINK_QDISC_BACKLOG, uplinkQueue.getQdiscBytes());
+	metrics.set(TX_METRIC_UPLINK_QUEUE_DELAY, uplinkQueue.getDelayMs());
+	metrics.setInterval(TX_METRIC_UPLINK_HELD, scheduler.getHeldMs());
+	for(uint32_t a=0;a<TX_CLASS_COUNT;a++){
+		TXClass_t txClass = (TXClass_t)a;
+		metrics.setInterval(TX_METRIC_CLASS_SENT_BYTES + a, scheduler.getBytesSent(txClass));
+		metrics.setInterval(TX_METRIC_CLASS_FULL_DROPPED_BYTES + a, scheduler.getBytesDropped(txClass) - scheduler.getBytesExpired(txClass));
+		metrics.setInterval(TX_METRIC_CLASS_EXPIRED_BYTES + a, scheduler.getBytesExpired(txClass));
+		metrics.set(TX_METRIC_CLASS_QUEUE + a, scheduler.getQueueSize(txClass));
+	}
+}
+
 int main(int argc, char *argv[]) {
 //    setpriority(PRIO_PROCESS, 0, -10);
 
@@ -100,6 +281,21 @@ int main(int argc, char *argv[]) {
 	char *outputFile;
 	long maxFileSize=0;
 	int telemetryPort=0;
+	char *filterFile=NULL;
+	int linkMavlinkVersion=1;
+	bool compressMavlink=false;
+	char *dictionaryFile=NULL;
+	char *schedulerFile=NULL;
+	uint32_t rateLimit=0;
+	uint32_t serialBaudrate=SERIAL_DEFAULT_BAUDRATE;
+	bool recordMp4=false;
+	uint32_t preRecordSeconds=0;
+	uint32_t preRecordMB=MP4_DEFAULT_PRE_RECORD_MB;
+	char *logFile=NULL;
+	uint32_t relaySession=0;
+	char *relayKey=NULL;
+	bool probePathMtu=false;
+	uint32_t uplinkQueueTarget=TX_UPLINK_QUEUE_TARGET_MS;
 	printf("Starting tx_raw program v0.20 (c)2021 by Lagoni. Not for commercial use\n");
 //	fprintf(stderr, "Inputs are:\n");
 
@@ -109,7 +305,7 @@ int main(int argc, char *argv[]) {
             { "help", no_argument, &flagHelp, 1 },
             {      0,           0,         0, 0 }
         };
-        int c = getopt_long(argc, argv, "h:i:v:s:p:o:z:t:", optiona, &nOptionIndex);
+        int c = getopt_long(argc, argv, "h:i:v:s:r:p:o:z:t:f:m:cx:q:b:MP:L:k:K:uQ:", optiona, &nOptionIndex);
         if (c == -1) {
             break;
         }
@@ -145,6 +341,15 @@ int main(int argc, char *argv[]) {
             }
 
 
+            case 'r': {
+	            serialBaudrate = (uint32_t)atoi(optarg);
+	            if(serialBaudrate == 0){
+		            fprintf(stderr, "tx_raw: Invalid serial baud rate %s\n", optarg);
+		            usage();
+	            }
+	            break;
+            }
+
             case 'p': {
 	            udpSerialPort = atoi(optarg);
 //				fprintf(stderr, "Serial Port   :%d\n",udpSerialPort);
@@ -171,6 +376,82 @@ int main(int argc, char *argv[]) {
 	            break;
             }
 
+            case 'f': {
+	            filterFile = optarg;
+	            break;
+            }
+
+            case 'm': {
+	            linkMavlinkVersion = atoi(optarg);
+	            if(linkMavlinkVersion != 1 && linkMavlinkVersion != 2){
+		            fprintf(stderr, "tx_raw: Mavlink version must be 1 or 2\n");
+		            usage();
+	            }
+	            break;
+            }
+
+            case 'c': {
+	            compressMavlink = true;
+	            break;
+            }
+
+            case 'x': {
+	            dictionaryFile = optarg;
+	            break;
+            }
+
+            case 'q': {
+	            schedulerFile = optarg;
+	            break;
+            }
+
+            case 'b': {
+	            rateLimit = (uint32_t)atoi(optarg);
+	            break;
+            }
+
+            case 'M': {
+	            recordMp4 = true;
+	            break;
+            }
+
+            case 'P': {
+	            preRecordSeconds = (uint32_t)atoi(optarg);
+	            if(strchr(optarg, ',') != NULL){
+		            preRecordMB = (uint32_t)atoi(strchr(optarg, ',') + 1);
+	            }
+	            break;
+            }
+
+            case 'L': {
+	            logFile = optarg;
+	            break;
+            }
+
+            case 'k': {
+	            relaySession = (uint32_t)strtoul(optarg, NULL, 0);
+	            if(relaySession == 0){
+		            fprintf(stderr, "tx_raw: Invalid relay session %s\n", optarg);
+		            usage();
+	            }
+	            break;
+            }
+
+            case 'K': {
+	            relayKey = optarg;
+	            break;
+            }
+
+            case 'u': {
+	            probePathMtu = true;
+	            break;
+            }
+
+            case 'Q': {
+	            uplinkQueueTarget = (uint32_t)atoi(optarg);
+	            break;
+            }
+
             default: {
                 fprintf(stderr, "tx_raw: Unknown input switch %c\n", c);
                 usage();
@@ -184,36 +465,107 @@ int main(int argc, char *argv[]) {
         usage();
     }
 
+	if(relaySession != 0 && (relayKey == NULL || strlen(relayKey) < RELAY_KEY_MIN_LENGTH || strlen(relayKey) > RELAY_KEY_MAX_LENGTH)){
+		fprintf(stderr, "tx_raw: -k needs the key of the relay, -K with %d to %d characters\n", RELAY_KEY_MIN_LENGTH, RELAY_KEY_MAX_LENGTH);
+		usage();
+	}
+
 	 if(maxFileSize == 0){
 		 maxFileSize=DEFAULT_MAX_VIDEO_FILE_SIZE;
 	 }
 
 	Connection videoToBaseConnection(targetIp,udpVideoPort, SOCK_DGRAM, O_NONBLOCK); // UDP None blocking	
 	Connection serialToBaseConnection(targetIp,udpSerialPort, SOCK_DGRAM, O_NONBLOCK); // UDP None blocking
+	Connection telemetryToBaseConnection(targetIp,telemetryPort, SOCK_DGRAM, O_NONBLOCK); // UDP None blocking
+
+	// For fast recovery when the LTE modem reconnects, recreate the sockets instead of restarting the program (and camera pipe).
+	LinkMonitor linkMonitor;
+	Connection *linkConnections[] = {&videoToBaseConnection, &serialToBaseConnection, &telemetryToBaseConnection};
+	bool linkRecoveryPending=false;
+	uint64_t nextLinkRecoveryTime=0;
+	uint64_t nextRelayHelloTime=0; // with -k, the relay forwards from the ports it got a hello from (and the LTE NAT keeps them).
+	if(relaySession != 0){
+		fprintf(stderr, "tx_raw: sending through the relay %s as session %u.\n", targetIp, relaySession);
+	}
 	
 	// For UDP Sockets
-	uint8_t rxBuffer[MAXLINE];
 	int nready;
 	ssize_t n;
 	
 	//Mavlink parser and serial:
-	mavlink_status_t status;
+	static MavlinkFrameParser mavlinkParser;
+	MavlinkFrame_t frame;
 	mavlink_message_t msg;
-	int chan = MAVLINK_COMM_0;
-	RingBuf<mavlink_message_t, FIFO_SIZE> serialRxFIFO;
+	
+	// Per msgid policy (forward / rate limit / drop) applied before batching:
+	static MavlinkFilter mavlinkFilter;
+	if(filterFile != NULL){
+		if(mavlinkFilter.loadPolicyFile(filterFile)){
+			fprintf(stderr, "tx_raw: Error in Mavlink filter file %s, Terminate program.\n", filterFile);
+			exit(EXIT_FAILURE);
+		}
+		fprintf(stderr, "tx_raw: using Mavlink filter file (%s).\n", filterFile);
+	}
 
 	// For Serial:
-	char configCmd[64];
-	sprintf(configCmd,"stty -F %s %d raw -echo",serialDevice,SERIAL_BAUDRATE);
-	system("stty -F /dev/serial0 57600 raw -echo");
-	int Serialfd = open_port(serialDevice);
+	static SerialPort serialPort; // static, the ring buffer is 64KB.
+	if(serialPort.openPort(serialDevice, serialBaudrate)){
+		fprintf(stderr, "tx_raw: Serial Port %s Failed to Open, exit\n", serialDevice);
+		exit(EXIT_FAILURE);
+	}
+	fprintf(stderr, "tx_raw: using serial port %s at %u baud.\n", serialDevice, serialPort.getBaudrate());
+	int Serialfd = serialPort.getFD();
 	telematryFrame_t telemetryData;
 	bzero(&telemetryData, sizeof(telemetryData));
 		
-	uint16_t totalSize = 0; // number of bytes in mavlink fifo
-	uint8_t serialBuffer[MAX_SERIAL_BUFFER_SIZE];
-	uint16_t serialBufferSize = 0;
-	bool serialDataToSend=false; // Indicates when serial data are to be transmitted and also blocking video streaming.
+	// Live metrics for tools/metricsReader:
+	static ShmMetrics metrics; // static, the block is too large for the stack.
+	initTXMetrics(metrics);
+	if(metrics.open(TX_METRICS_NAME)){
+		fprintf(stderr, "tx_raw: Warning! metrics are not published.\n");
+	}
+
+	serialBatch_t serialBatch;
+	initSerialBatch(serialBatch);
+	serialBatch.metrics = &metrics;
+	static MavlinkCompressor mavlinkCompressor;
+	if(dictionaryFile != NULL){
+		if(mavlinkCompressor.loadDictionary(dictionaryFile)){
+			fprintf(stderr, "tx_raw: Error in Mavlink dictionary file %s, Terminate program.\n", dictionaryFile);
+			exit(EXIT_FAILURE);
+		}
+		fprintf(stderr, "tx_raw: using Mavlink dictionary file (%s) id %04x.\n", dictionaryFile, mavlinkCompressor.getDictionaryID());
+	}
+	if(true == compressMavlink){
+		serialBatch.compressor = &mavlinkCompressor;
+	}
+	bool serialBatchReady=false; // Indicates that the pending Mavlink frames should be sent.
+
+	// All UDP packages towards ground goes through the scheduler:
+	static TXScheduler scheduler; // static, the queues are too large for the stack.
+	if(schedulerFile != NULL){
+		if(scheduler.loadConfigFile(schedulerFile)){
+			fprintf(stderr, "tx_raw: Error in TX scheduler file %s, Terminate program.\n", schedulerFile);
+			exit(EXIT_FAILURE);
+		}
+		fprintf(stderr, "tx_raw: using TX scheduler file (%s).\n", schedulerFile);
+	}
+	scheduler.setRate(rateLimit);
+	Connection *classConnections[TX_CLASS_COUNT];
+	classConnections[TX_CLASS_CONTROL] = &serialToBaseConnection;
+	classConnections[TX_CLASS_MAVLINK] = &serialToBaseConnection;
+	classConnections[TX_CLASS_KEYFRAME] = &videoToBaseConnection;
+	classConnections[TX_CLASS_VIDEO] = &videoToBaseConnection;
+	classConnections[TX_CLASS_TELEMETRY] = &telemetryToBaseConnection;
+	uint32_t videoBurst = 0; // largest number of video bytes written in one go (decays), for the send buffer.
+
+	// The socket / qdisc queues to the modem, the scheduler holds the packages when they get long (a slower uplink).
+	static UplinkQueue uplinkQueue;
+	for(uint32_t a=0;a<sizeof(linkConnections)/sizeof(linkConnections[0]);a++){
+		uplinkQueue.addSocket(linkConnections[a]);
+	}
+	uplinkQueue.findInterface();
+	scheduler.setQueueTarget(uplinkQueueTarget);
 	
 	// For UDP mavlink from ground:
 	uint8_t inputBuffer[MAX_SERIAL_BUFFER_SIZE];
@@ -229,14 +581,49 @@ int main(int argc, char *argv[]) {
 	uint8_t fileNumber = 0;
 	char filename[30];
 	bool newFile=false;
-	do{
-		fileNumber++;
-		sprintf(filename,"%s%d.h264",outputFile,fileNumber);
-		fprintf(stderr, "tx_raw: using video output file (%s).\n",filename);
-	}while(checkExists(filename));
-		
-	std::ofstream* videoRecordFile = new std::ofstream(filename,std::ofstream::binary);
+	std::ofstream* videoRecordFile = NULL;
+	static Mp4Recorder mp4Recorder; // with -M, the file is opened on the first keyframe when armed.
+	static RecordIndex recordIndex; // keyframe index and telemetry sidecar next to the recording.
+	if(recordMp4){
+		if(mp4Recorder.setFileName(outputFile, false)){
+			exit(1);
+		}
+		mp4Recorder.setIndex(&recordIndex);
+		mp4Recorder.setMaxFileSize(maxFileSize);
+		if(mp4Recorder.setPreRecord(preRecordSeconds, preRecordMB*1024*1024)){
+			exit(1);
+		}
+		fprintf(stderr, "tx_raw: recording to %sN.mp4 when armed", outputFile);
+		if(preRecordSeconds > 0){
+			fprintf(stderr, ", starting %us (max %uMB) before arming", preRecordSeconds, preRecordMB);
+		}
+		fprintf(stderr, ".\n");
+	}else{
+		if(preRecordSeconds > 0){
+			fprintf(stderr, "tx_raw: -P needs -M, the raw H.264 recording starts when armed.\n");
+		}
+		do{
+			fileNumber++;
+			sprintf(filename,"%s%d.h264",outputFile,fileNumber);
+			fprintf(stderr, "tx_raw: using video output file (%s).\n",filename);
+		}while(checkExists(filename));
+
+		videoRecordFile = new std::ofstream(filename,std::ofstream::binary);
+		recordIndex.create(filename, RECORD_INDEX_H264, timeMillisec()*1000);
+	}
 	bool armed=false; // Only recored when armed!.
+
+	// Mavlink flight log, frames are copied to mapped segments and the files are finished when stopped.
+	static MavlinkLog mavlinkLog;
+	if(logFile != NULL){
+		if(mavlinkLog.create(logFile, MAVLINK_LOG_SEGMENT_SIZE)){
+			fprintf(stderr, "tx_raw: Unable to log Mavlink to %s, Terminate program.\n", logFile);
+			exit(EXIT_FAILURE);
+		}
+		fprintf(stderr, "tx_raw: logging Mavlink to %s-NNNN.tlog.\n", logFile);
+		signal(SIGINT, stopHandler);
+		signal(SIGTERM, stopHandler);
+	}
 
 	// TX video:
 	uint8_t videoStreamFromCamera[MAXLINE];
@@ -244,6 +631,14 @@ int main(int argc, char *argv[]) {
 	bzero(&videoStreamFromCamera, sizeof(videoStreamFromCamera));
 	bzero(&videoPackagesForTX, sizeof(videoPackagesForTX));
 	static H264TXFraming TXpackageManager; // Needs to be static so it is not allocated on the stack, because it uses 8MB.
+	metrics.set(TX_METRIC_VIDEO_PACKAGE_SIZE, TXpackageManager.getPackageMaxSize());
+
+	// With -u the video package size follows the path MTU, the acks come back on the video socket.
+	static PathMtu pathMtu;
+	uint8_t pathMtuAck[64];
+	if(probePathMtu){
+		fprintf(stderr, "tx_raw: probing the path MTU, video packages up to %u bytes.\n", PathMtu::getMaxPackageSize(videoToBaseConnection));
+	}
 
 	// For select usages.
 	fd_set read_set;
@@ -256,7 +651,6 @@ int main(int argc, char *argv[]) {
 	time_t nextPrintTime = time(NULL) + LOG_INTERVAL_SEC;
 	
 	// For Telemetry (CPU temp / load)
-	Connection telemetryToBaseConnection(targetIp,telemetryPort, SOCK_DGRAM, O_NONBLOCK); // UDP None blocking
 	long double a[4], b[4]; // for Cpuload calculations
 	air_status_t data;
 	
@@ -272,130 +666,149 @@ int main(int argc, char *argv[]) {
 		// finding the max filedescriptor
 		maxfdp1 = max(STDIN_FILENO, Serialfd);
 		maxfdp1 = max(serialToBaseConnection.getFD(), maxfdp1);
+		maxfdp1 = max(linkMonitor.getFD(), maxfdp1);
+		if(probePathMtu){
+			maxfdp1 = max(videoToBaseConnection.getFD(), maxfdp1);
+		}
 
 		// Set the FD_SET on the filedesscriptors.
 		FD_SET(Serialfd, &read_set);
 		FD_SET(STDIN_FILENO, &read_set);
 		serialToBaseConnection.setFD_SET(&read_set);
+		linkMonitor.setFD_SET(&read_set);
+		if(probePathMtu){
+			videoToBaseConnection.setFD_SET(&read_set);
+		}
 
 		timeout.tv_sec = 0;
 		timeout.tv_usec = 1000; // 1ms	
 		
 	    nready = select(maxfdp1+1, &read_set, NULL, NULL, &timeout);  // blocking
+		if(nready < 0){
+			continue; // interrupted by a signal (-L stop), the sets are not valid.
+		}
 
+		// Address or default route changed (modem reconnected), recreate sockets now. 
+		if ((linkMonitor.getFD() > 0) && FD_ISSET(linkMonitor.getFD(), &read_set)) {
+			if(linkMonitor.readEvents()){
+				linkRecoveryPending=true;
+				nextLinkRecoveryTime=0; // don't wait.
+			}
+		}
 		
+		if(true == linkRecoveryPending){
+			uint64_t now = timeMillisec();
+			if(now >= nextLinkRecoveryTime){
+				linkRecoveryPending = !recoverConnections(linkConnections, sizeof(linkConnections)/sizeof(linkConnections[0]));
+				nextLinkRecoveryTime = now + LINK_RECOVERY_INTERVAL_MS; // if the network is still down, sending will fail and trigger a new attempt after this.
+				linkstatus.linkrecoveries++;
+				metrics.add(TX_METRIC_LINK_RECOVERIES, 1);
+				nextRelayHelloTime=0; // the new sockets have a new address at the relay.
+				pathMtu.start(); // a new IP can be a new path.
+				uplinkQueue.findInterface(); // and a new interface.
+			}
+		}
+
+		if(relaySession != 0 && timeMillisec() >= nextRelayHelloTime){
+			for(uint32_t a=0;a<sizeof(linkConnections)/sizeof(linkConnections[0]);a++){
+				RelayHello::send(*linkConnections[a], RELAY_ROLE_AIR, relaySession, relayKey);
+			}
+			nextRelayHelloTime = timeMillisec() + RELAY_HELLO_INTERVAL_MS;
+		}
+		
+		
+		// Path MTU probe acks from rx_raw:
+		if(probePathMtu){
+			if(videoToBaseConnection.isFD_SET(&read_set)){
+				int result;
+				while((result = videoToBaseConnection.readData(pathMtuAck, sizeof(pathMtuAck))) > 0){
+					pathMtu.input(pathMtuAck, result, timeMillisec());
+				}
+			}
+			uint16_t packageSize = pathMtu.service(videoToBaseConnection, timeMillisec());
+			if(packageSize != TXpackageManager.getPackageMaxSize()){
+				TXpackageManager.setPackageMaxSize(packageSize);
+				metrics.set(TX_METRIC_VIDEO_PACKAGE_SIZE, packageSize);
+			}
+		}
+
 		if (FD_ISSET(Serialfd, &read_set)) { // Data from serial port.
 //			printf("Data from Serial port!\n\r");
-			int result=0;
-			int err;
-			
-			result = read(Serialfd, rxBuffer, sizeof(rxBuffer));  // read up to 100 characters if ready to read	
-			err = errno; // save off errno, because because the printf statement might reset it
-			
-			//printf("Read result:%d\n\r", n);
-			if (result < 0 || result > sizeof(rxBuffer)) {
-				if ((err == EAGAIN) || (err == EWOULDBLOCK))
-				{
-					fprintf(stderr, "tx_raw: None blocking  - nothing to read?.\n"); // ?
-				}else{
-					 if(err == EBADF){
-						 fprintf(stderr, "tx_raw: The argument sockfd is an invalid file descriptor.\n\r");	 
-					 }else if(err == ECONNREFUSED){
-						 fprintf(stderr, "tx_raw: A remote host refused to allow the network connection.\n\r");
-					 }else if(err == EFAULT){
-						 fprintf(stderr, "tx_raw: The receive buffer pointer(s) point outside the process's address space.\n\r");
-					 }else if(err == EINTR){
-						 fprintf(stderr, "tx_raw: The receive was interrupted by delivery of a signal before any data was available.\n\r");
-					 }else if(err == EINVAL){
-						 fprintf(stderr, "tx_raw: Invalid argument passed.\n\r");
-					 }else if(err == ENOMEM){
-						 fprintf(stderr, "tx_raw: Could not allocate memory for recvmsg().\n\r");
-					 }else if(err == ENOTCONN){
-						 fprintf(stderr, "tx_raw: The socket is associated with a connection-oriented protocol and has not been connected.\n\r");
-					 }else if(err == ENOTSOCK){
-						 fprintf(stderr, "tx_raw: The file descriptor sockfd does not refer to a socket.\n\r");
-					 }else if(err == -1){
-						 fprintf(stderr, "tx_raw: Socket invalid, thus closing file descriptor.\n\r");
-					 }else{
-						 fprintf(stderr, "tx_raw: Unknown error - reading with result=%d and errno=%d, thus closing\n",result,err);
-					 }	 			
-				}
-				fprintf(stderr,"tx_raw: failed in file %s at line # %d - ", __FILE__,__LINE__);
+			// Take all the driver has in one go, at high baud rates there can be several KB per select().
+			if(serialPort.readAvailable() < 0){
+				fprintf(stderr,"tx_raw: failed in file %s at line # %d - reading serial port, Terminate program.\n", __FILE__,__LINE__);
 				exit(EXIT_FAILURE);
-			}else if(result == 0){
-				// None blocking, nothing to read.
-			}else {
-				uint16_t index=0;
-				while(result>0){
-					result--;
-					uint8_t byte=rxBuffer[index];
-					index++;
-					if (mavlink_parse_char(chan, byte, &msg, &status)){
-						// printf("MSG ID#%d\n\r",msg.msgid);
-						// MSG ID 30 (HUD 10HZ) mean transmit now!
-						
-						// if fifo is larger than 1024 bytes or MSG 30 har ben received, then transmit.
-						if(!serialRxFIFO.isFull()){
-							serialRxFIFO.push(msg);
-							totalSize = totalSize + msg.len;
-						}else{
-							uint16_t fifoSize=serialRxFIFO.size();
-							printf("tx_raw: serialRxFIFO (Mavlink msg) size:%d is full!\n",fifoSize);
-						}
-						
-						if(msg.msgid == 30 || totalSize > 1400){ // time to send UDP frame if MSG 30 (HUD) or 1400 bytes has been reached!
-							uint8_t fifoSize = serialRxFIFO.size();
-							//	printf("\n\r \n\r \n\rTime to transmit! - mavlink FIFO has %d elements with total size of %d\n\r", fifoSize, totalSize);
-							mavlink_message_t data;
-							
-							if(true == serialDataToSend){
-								//printf("tx_raw: Discharding %d bytes of serial data\n\r",serialBufferSize);
-								linkstatus.mavlinkdropped += serialBufferSize;
-							}
-							
-							serialBufferSize=0;
-							
-							for(int a=0;a<fifoSize;a++){
-								if(!serialRxFIFO.isEmpty()){
-									serialRxFIFO.pop(data);
-									//printf("FIFO index %d has MSG ID %d\n\r",a,data.msgid);
-									serialBufferSize += mavlink_msg_to_send_buffer(&serialBuffer[serialBufferSize], &data);
-									//memcpy(&serialBuffer[serialBufferSize], &data., result); // copy input to buffer.
-								}
-							}
-
-							//						printf("Done reading, FIFO size is now %d\n\r",serialRxFIFO.size());
-							totalSize = 0; // clear the MSG FIFO
-							serialDataToSend = true;
-						}
-						
-						// Keep track on ARM / DISARMED for recording purporse. Status can be found in HEARTBEAT (MSG=0) from FC:
-						if(msg.msgid == 0){
-							mavlink_heartbeat_t newmsg;
-							mavlink_msg_heartbeat_decode(&msg, &newmsg);
-							armed = newmsg.base_mode & MAV_MODE_FLAG_SAFETY_ARMED;
+			}
+			while(serialPort.getBufferedSize() > 0){
+				uint32_t result = serialPort.read(mavlinkParser.getInputBuffer(), mavlinkParser.getInputBufferFreeSize());
+				mavlinkParser.setData(result);
+				while(mavlinkParser.nextFrame(frame)){
+					// printf("MSG ID#%d\n\r",frame.msgid);
+					if(logFile != NULL){
+						mavlinkLog.logFrame(frame.data, frame.length, timeMillisec()*1000);
+					}
+					
+					// Keep track on ARM / DISARMED for recording purporse. Status can be found in HEARTBEAT (MSG=0) from FC:
+					if(frame.msgid == MAVLINK_MSG_ID_HEARTBEAT){
+						mavlink_heartbeat_t newmsg;
+						MavlinkFrameParser::decode(frame, &msg);
+						mavlink_msg_heartbeat_decode(&msg, &newmsg);
+						armed = newmsg.base_mode & MAV_MODE_FLAG_SAFETY_ARMED;
+						recordIndex.setArmed(timeMillisec()*1000, armed);
+					}else if(frame.msgid == MAVLINK_MSG_ID_GLOBAL_POSITION_INT){
+						mavlink_global_position_int_t newmsg;
+						MavlinkFrameParser::decode(frame, &msg);
+						mavlink_msg_global_position_int_decode(&msg, &newmsg);
+						recordIndex.position(timeMillisec()*1000, newmsg.lat, newmsg.lon, newmsg.alt, newmsg.relative_alt, newmsg.hdg);
+					}
+					
+					// Apply the per msgid policy before the frame is batched.
+					if(MAVLINK_FILTER_FORWARD == mavlinkFilter.input(frame, timeMillisec())){
+						if(addSerialBatchFrame(serialBatch, frame, linkMavlinkVersion, scheduler, linkstatus)){ // MSG ID 30 (HUD 10HZ) or a command / mission reply mean transmit now!
+							serialBatchReady=true;
 						}
-						
 					}
 				}
 			}
+		}
+		
+		// Release frames held back by the rate limit (latest-value-wins) when their slot is due:
+		while(mavlinkFilter.getDueFrame(frame, timeMillisec())){
+			if(addSerialBatchFrame(serialBatch, frame, linkMavlinkVersion, scheduler, linkstatus)){
+				serialBatchReady=true;
+			}
+		}
+		
+		// Don't let frames wait forever if HUD (MSG 30) is rate limited or dropped by the filter:
+		if(serialBatch.frames.getFrames() > 0 && (timeMillisec() - serialBatch.frames.getFrame(0)->timeMs) >= SERIAL_BATCH_MAX_AGE_MS){
+			serialBatchReady=true;
+		}
+		
+		if(true == serialBatchReady){ // time to build the UDP frames, the last one as it is.
+			finishSerialBatch(serialBatch, scheduler, true);
+			serialBatchReady = false;
+		}else if(serialBatch.frames.getBytes() > MAX_SERIAL_BUFFER_SIZE){ // only the full UDP frames.
+			finishSerialBatch(serialBatch, scheduler, false);
 		}
 		
 	
 		// Lets see if there are any Mavlink data from ground to Flight controller:	
-		if (FD_ISSET(serialToBaseConnection.getFD(), &read_set)) { // Data from serial port.
+		if (serialToBaseConnection.isFD_SET(&read_set)) { // Data from serial port.
 //			printf("Data from Ground (Mavlink)!\n\r");
 			int result = 0;
 			result = serialToBaseConnection.readData(inputBuffer, MAX_SERIAL_BUFFER_SIZE);
 			if (result < 0 || result > MAX_SERIAL_BUFFER_SIZE){
-				fprintf(stderr,"tx_raw: failed in file %s at line # %d - read UDP serial data (UDP from ground) to Flight Computer... Terminate program.\n", __FILE__,__LINE__);
-				exit(EXIT_FAILURE);
+				fprintf(stderr,"tx_raw: failed in file %s at line # %d - read UDP serial data (UDP from ground) to Flight Computer... Recreating socket.\n", __FILE__,__LINE__);
+				linkRecoveryPending=true;
 			}else  if(result == 0){
 				// None blocking, nothing to read.
 			}else{
 				// printf("Data from ground!\n\r");
 				int res = 0;
-				res = write(Serialfd, inputBuffer, result);	
+				if(logFile != NULL){
+					mavlinkLog.logFrames(inputBuffer, result, timeMillisec()*1000);
+				}
+				res = serialPort.write(inputBuffer, result);
 				if (res < 0 || res > MAXLINE) {
 					fprintf(stderr, "tx_raw: Error! sending serial to flight controller (UDP from ground)... Terminate program.\n");
 					exit(EXIT_FAILURE);
@@ -449,12 +862,19 @@ int main(int argc, char *argv[]) {
 				//printf("Writing %d bytes to Videobuffer\n\r", result);
 				// write to outfile
 				uint16_t length = ((uint16_t)result);
+				metrics.add(TX_METRIC_VIDEO_IN_BYTES, length);
 				
 				//input data to h264 class (TX):
 				TXpackageManager.inputStream(videoStreamFromCamera, length);		
 //				fprintf(stderr, "tx_raw: Number of Bytes added to inputstream(%u), FIFO has(%u) number of packages ready for TX\n", length,TXpackageManager.getTXFifoSize());
 				
-				memcpy(&videoBuffer[videoBufferSize], videoStreamFromCamera, result); // copy input to buffer for disk write.
+				if(recordMp4){
+					mp4Recorder.setRecording(armed);
+					mp4Recorder.inputData(videoStreamFromCamera, length, timeMillisec()*1000);
+				}else{
+					memcpy(&videoBuffer[videoBufferSize], videoStreamFromCamera, result); // copy input to buffer for disk write.
+					videoBufferSize += result;
+				}
 
 /*
 				if(!videoBufferTx.isFull()){
@@ -467,12 +887,12 @@ int main(int argc, char *argv[]) {
 					linkstatus.videodropped += VIDEO_TX_BUFFER_SIZE;					
 				}
 	*/			
-				videoBufferSize += result;
 				//printf("adding %d bytes to Videofile\n\r", videoBufferSize);				
 			
 				if(videoBufferSize > VIDEO_BUFFER_WRITE_THRESHOLD){ // Time to write video buffer to file
 	//				printf("Writing %d bytes to Videofile\n\r", videoBufferSize);	
 					if(true==armed){ // only record when armed.
+						recordIndex.scanH264((uint8_t *)videoBuffer, videoBufferSize, videoRecordFileSize, timeMillisec()*1000);
 						videoRecordFile->write(videoBuffer,videoBufferSize);
 						videoRecordFileSize += videoBufferSize;				
 					}
@@ -486,6 +906,7 @@ int main(int argc, char *argv[]) {
 						videoRecordFile->close();
 						delete videoRecordFile;
 						videoRecordFile = new std::ofstream(filename,std::ofstream::binary);
+						recordIndex.create(filename, RECORD_INDEX_H264, timeMillisec()*1000);
 						videoRecordFileSize=0;
 					}
 				}					
@@ -494,71 +915,78 @@ int main(int argc, char *argv[]) {
 		
 		// All below this line is checked every time and timeout will force program to come by.
 
-		// Here we shall handle Transmit of Serial...
-		if(true == serialDataToSend){
-			//			printf("Sending %d bytes back to base...",serialBufferSize);
-			int result=0;
-			result = serialToBaseConnection.writeData(serialBuffer,serialBufferSize);
-			if(result < 0){ // Error
-				fprintf(stderr, "tx_raw: Error! on UDP serial socket write... Terminate program.\n");
-				exit(1);
-			}else if(result == 0){
-				//printf("Unable to send video\n\r", videoBufferTx.size());
-			}else{	
-				// We where able to send UDP data, thus clear buffer and flag
-				linkstatus.mavlinktx += serialBufferSize;
-				serialBufferSize=0;
-				serialDataToSend=false;
+		// Here we shall handle Transmit of Mavlink, video and telemetry, the scheduler decides the order:
+		uplinkQueue.sample(timeMicrosec());
+		scheduler.setQueueDelay(uplinkQueue.getDelayMs());
+		bool sending=true;
+		uint32_t videoBytesWritten=0;
+		while(sending){
+			// The H264 output FIFO is the video queue (it drops old GOPs), move one package at a time so the video stays in order.
+			if(scheduler.getQueueSize(TX_CLASS_KEYFRAME) == 0 && scheduler.getQueueSize(TX_CLASS_VIDEO) == 0){
+				uint8_t *videoData;
+				uint16_t videoSize = TXpackageManager.getTXPackage(videoData);
+				if(videoSize > 0){
+					scheduler.enqueue(TXpackageManager.isTXPackageKeyFrame() ? TX_CLASS_KEYFRAME : TX_CLASS_VIDEO, videoData, videoSize, TXpackageManager.getTXPackageQueuedTime());
+					TXpackageManager.nextTXPackage();
+				}
 			}
-		}else{
-			// No serial data is pending, lets try and send some video frame if needed:
 
-			
-			
-			
-			// Get TX packages from h264 (TX):
-			bool SendVideo=true;
-			uint8_t *data;
-			uint16_t size=0;TXpackageManager.getTXPackage(data);	
-			int result = 0;			
-			//fprintf(stderr, "tx_raw: Number of Packages ready in TX FIFO(%u)\n",size);
-			
-			do{				
-				size = TXpackageManager.getTXPackage(data);						
-				
-				if(size>0){
-					//bzero(&videoPackagesForTX, sizeof(videoPackagesForTX));
-					
-
-					//uint16_t frameID = (uint16_t)((uint16_t)data[0] +  (uint16_t)(data[1] << 8));	
-					//uint16_t packageID = (uint16_t)((uint16_t)data[2] +  (uint16_t)(data[3] << 8));
-					//fprintf(stderr, "tx_raw: Transmitting Package with FrameID(%u) and PackageID(%u) with size(%u)...",frameID, packageID, size);
-					result = videoToBaseConnection.writeData(data, size);
-					
-					if(result == size){
-						//fprintf(stderr, "Ok!\n");
-						TXpackageManager.nextTXPackage();	
-					}else{
-						fprintf(stderr, "Error! result(%u) != size(%u)\n", result, size);
-						SendVideo=false;
-						if(result > 0){ // not all was transmitted, this is not good for UDP
-							fprintf(stderr, "tx_raw: Error! on video tx. Bytes to be sent(%u) is lower than bytes transmitted(%u).\n",size, result);
-						}
-					}
-				}else{
-					SendVideo=false;
-				}
-			}while(SendVideo);
+			TXClass_t txClass;
+			uint16_t size=0;
+			const uint8_t *data = scheduler.nextPacket(timeMillisec(), txClass, size);
+			if(data == NULL){
+				break; // nothing to send or rate limited.
+			}
+			int result = classConnections[txClass]->writeData((void *)data, size);
+			if(result > 0 && classConnections[txClass] == &videoToBaseConnection){
+				videoBytesWritten += result;
+			}
+			if(result > 0){
+				uplinkQueue.sent(timeMicrosec(), result);
+				scheduler.setQueueDelay(uplinkQueue.getDelayMs());
+			}
+			if(result == size){
+				metrics.record(TX_HISTOGRAM_CLASS_DELAY + txClass, scheduler.packetSent(timeMillisec()));
+			}else if(result < 0){ // socket error (IP change?), keep the package until the socket is back.
+				fprintf(stderr, "tx_raw: Error! on %s socket write... Recreating socket.\n", TXScheduler::getClassName(txClass));
+				linkRecoveryPending=true;
+				sending=false;
+			}else if(result == 0){
+				sending=false; // socket buffer full, try again next time.
+			}else{ // not all was transmitted, this is not good for UDP
+				fprintf(stderr, "tx_raw: Error! on %s tx. Bytes to be sent(%u) is lower than bytes transmitted(%u).\n", TXScheduler::getClassName(txClass), size, result);
+				metrics.record(TX_HISTOGRAM_CLASS_DELAY + txClass, scheduler.packetSent(timeMillisec()));
+			}
+		}
+		if(videoBytesWritten > videoBurst){
+			videoBurst = videoBytesWritten;
 		}
 		
 		
+		if(metrics.isPublishDue(timeMillisec())){
+			updateTXMetrics(metrics, serialPort, mavlinkParser, TXpackageManager, scheduler, uplinkQueue, linkstatus);
+			metrics.publish(timeMillisec());
+		}
+		
 		//Only run on timeout
 		if(nready == 0){	
 			// check if it is time to log the status:
 			if(time(NULL) >= nextPrintTime){		
-				linkstatus.videodropped=TXpackageManager.getBytesDropped();
-				linkstatus.videotx=TXpackageManager.getBytesOutputted();
+				// the interval counters are cleared below, add them to the metrics totals first.
+				updateTXMetrics(metrics, serialPort, mavlinkParser, TXpackageManager, scheduler, uplinkQueue, linkstatus);
+				metrics.setInterval(TX_METRIC_SERIAL_UART_OVERRUNS, serialPort.getUartOverruns());
+				metrics.setInterval(TX_METRIC_SERIAL_UART_ERRORS, serialPort.getUartErrors());
+				metrics.endInterval();
+				linkstatus.videodropped=TXpackageManager.getBytesDropped() + scheduler.getBytesDropped(TX_CLASS_KEYFRAME) + scheduler.getBytesDropped(TX_CLASS_VIDEO);
+				linkstatus.videotx=scheduler.getBytesSent(TX_CLASS_KEYFRAME) + scheduler.getBytesSent(TX_CLASS_VIDEO);
+				linkstatus.mavlinktx=scheduler.getBytesSent(TX_CLASS_CONTROL) + scheduler.getBytesSent(TX_CLASS_MAVLINK);
+				linkstatus.mavlinkdropped=scheduler.getBytesDropped(TX_CLASS_CONTROL) + scheduler.getBytesDropped(TX_CLASS_MAVLINK);
 				TXpackageManager.clearIOstatus();
+				// A keyframe leaves in one burst, the send buffer holds it but not more, the queueing stays in the scheduler.
+				if(linkstatus.videotx > 0){
+					videoToBaseConnection.tuneBuffer(SO_SNDBUF, (uint32_t)(linkstatus.videotx / LOG_INTERVAL_SEC), videoBurst, TX_VIDEO_SEND_BUFFER_MS);
+				}
+				videoBurst -= videoBurst / 8; // a burst is forgotten over ~15 status intervals.
 				printf("%d tx_raw: Status:            Mavlink: (tx|rx|dropped):  %*.2fKB  |  %*.0fB  | %*.2fKB            Video: (tx|dropped)  %*.2fMB  | %*.2fMB ", time(NULL), 6, linkstatus.mavlinktx/1024 , 6, linkstatus.mavlinkrx , 6 , linkstatus.mavlinkdropped/1024, 6, linkstatus.videotx/(1024*1024), 6 ,linkstatus.videodropped/(1024*1024));
 //				printf("%llu tx_raw: Status:            Mavlink: (tx|rx|dropped):  %*.2fKB  |  %*.0fB  | %*.2fKB            Video: (tx|dropped)  %*.2fMB  | %*.2fKB ", timeMillisec(), 6, linkstatus.mavlinktx/1024 , 6, linkstatus.mavlinkrx , 6 , linkstatus.mavlinkdropped/1024, 6, linkstatus.videotx/(1024*1024), 8 ,linkstatus.videodropped/1024);
 				if(true==armed){			
@@ -566,6 +994,16 @@ int main(int argc, char *argv[]) {
 				}else{
 					printf("   FC=DISARMED");							
 				}																																				 
+				if(linkstatus.linkrecoveries > 0){
+					printf("   Link recoveries: %.0f", linkstatus.linkrecoveries);
+				}
+				if(linkMavlinkVersion == 2){
+					printf("   Mavlink2 saved: %.0fB", linkstatus.mavlinksaved);
+				}
+				if(true == compressMavlink){
+					printf("   Compression: %.2f:1 %.0fus/batch", mavlinkCompressor.getRatio(), mavlinkCompressor.getMicrosecPerBatch());
+					mavlinkCompressor.clearIOstatus();
+				}
 				bzero(&linkstatus, sizeof(linkstatus));
 				nextPrintTime = time(NULL) + LOG_INTERVAL_SEC;
 				
@@ -589,15 +1027,29 @@ int main(int argc, char *argv[]) {
 				
 				telemetryData.cpuTemp=getCpuTemp();
 				printf("   CPU Load: %3d%%     CPU Temp: %3dC\n",telemetryData.cpuLoad,telemetryData.cpuTemp);			
+				printf("Serial: %.2fKB/s  buffered max %uB  overruns (ring|uart) %u|%u  uart errors %u  Mavlink: frames %u  crc errors %u  header errors %u  unknown msgids %u  skipped %uB\n", serialPort.getBytesRead()/1024.0f, serialPort.getMaxBuffered(), serialPort.getRingOverruns(), serialPort.getUartOverruns(), serialPort.getUartErrors(), mavlinkParser.getFramesParsed(), mavlinkParser.getCRCErrors(), mavlinkParser.getHeaderErrors(), mavlinkParser.getUnknownMessages(), mavlinkParser.getBytesSkipped());
+				serialPort.clearIOstatus();
+				mavlinkParser.clearIOstatus();
+				mavlinkFilter.printStatus(stdout);
+				mavlinkFilter.clearStatus();
+				scheduler.printStatus(stdout);
+				scheduler.clearStatus();
+				uplinkQueue.printStatus(stdout);
+				uplinkQueue.clearStatus();
 			//	fprintf(stderr, "tx_raw: CPU load:%d CPU temperatur:%d\n",telemetryData.cpuLoad,telemetryData.cpuTemp);
 				
 				//telemetryData
 				// Send telemetry on port:
-				telemetryToBaseConnection.writeData(&telemetryData,sizeof(telemetryData));		
+				scheduler.enqueue(TX_CLASS_TELEMETRY, (uint8_t *)&telemetryData, sizeof(telemetryData), timeMillisec());		
 			}
 		}
-	}while(1);
+	}while(!stopRequested);
 
+	if(stopRequested){
+		mavlinkLog.close();
+		fprintf(stderr, "tx_raw: Stopped, Mavlink log %s has %u frames (%u dropped, disk too slow).\n", logFile, mavlinkLog.getFrames(), mavlinkLog.getDroppedFrames());
+		return 0;
+	}
 	fprintf(stderr, "tx_raw: Panic!!!\n\n");
 	exit(EXIT_FAILURE);	
 }
@@ -28,6 +28,7 @@
 #include <chrono> // Crone time measure
 #include <sys/mman.h>
 #include "connection.h"
+#include "linkMonitor.h"
 
 //Video record to file
 #include <fstream>
@@ -36,9 +37,19 @@
 #include "c_library_v1-master/common/mavlink.h"
 #include "c_library_v1-master/ardupilotmega/mavlink.h"
 
-//FIFO
-#include "RingBuf.h"
-#define FIFO_SIZE 256 // Mavlink messages
+#include "mavlinkFilter.h"
+#include "mavlinkFrameRing.h"
+#include "mavlinkCompression.h"
+#include "txScheduler.h"
+#include "serialPort.h"
+#include "shmMetrics.h"
+#include "mp4Recorder.h"
+#include "recordIndex.h"
+#include "mavlinkLog.h"
+#include "relayHello.h"
+#include "pathMtu.h"
+#include "uplinkQueue.h"
+#include <signal.h>
 //#include "h264.h"
 #include "h264TXFraming.h"
 
@@ -50,10 +61,12 @@
 #define VIDEO_BUFFER_WRITE_THRESHOLD 1024*1024*1 // 1MB
 #define VIDEO_TX_BUFFER_SIZE 1024 // 1024 of the struct with 1024 in each, so 1024*1024=1MB
 
-#define SERIAL_BAUDRATE 57600 //**** TODO also implement it in open_port
 #define LOG_INTERVAL_SEC 1 // log every minute
 
 #define VIDEO_RETRY_ATTEMPTS 3
+#define LINK_RECOVERY_INTERVAL_MS 100 // retry interval for recreating sockets while the network is down.
+#define TX_VIDEO_SEND_BUFFER_MS 50 // the video socket send buffer holds this much at the sent rate (and two of the largest bursts).
+#define TX_UPLINK_QUEUE_TARGET_MS 50 // the scheduler holds the packages while the socket / qdisc queue is longer (-Q).
 
 
 int max(int x, int y)
@@ -65,6 +78,54 @@ int max(int x, int y)
 }
 
 #define MAX_SERIAL_BUFFER_SIZE 1024 // fit inside one UDP, this could perhaps be 1024 or 1508, but if we transmitt everytime MSG30 (HUD) is received will will never get more than ~500bytes.
+#define SERIAL_BATCH_MAX_AGE_MS 100 // send the Mavlink batch when the oldest message is this old, normally MSG 30 (HUD 10Hz) triggers it before.
+
+// Mavlink frames are copied straight from the parser buffer into the frame ring, the oldest frames are
+// gathered into the TX scheduler as UDP packages of up to MAX_SERIAL_BUFFER_SIZE bytes.
+typedef struct {
+	MavlinkFrameRing frames;       // frames waiting for a UDP package, as on the wire (or converted to Mavlink 2).
+	MavlinkCompressor *compressor; // NULL when the batches are sent uncompressed.
+	uint8_t packed[MAX_SERIAL_BUFFER_SIZE]; // compressor input, when the frames of a batch wrap in the ring.
+	ShmMetrics *metrics;
+	uint8_t compressed[MAVLINK_COMPRESSION_MAX_OUTPUT(MAX_SERIAL_BUFFER_SIZE)];
+} serialBatch_t;
+
+// Live metrics in /dev/shm/openhd-lte-tx (tools/metricsReader -n tx).
+#define TX_METRICS_NAME "tx"
+enum TXMetric_t{
+	TX_METRIC_SERIAL_BYTES=0,
+	TX_METRIC_SERIAL_RING_OVERRUNS,
+	TX_METRIC_SERIAL_UART_OVERRUNS,     // updated once per status interval (ioctl).
+	TX_METRIC_SERIAL_UART_ERRORS,
+	TX_METRIC_SERIAL_BUFFERED,
+	TX_METRIC_MAVLINK_FRAMES,
+	TX_METRIC_MAVLINK_CRC_ERRORS,
+	TX_METRIC_MAVLINK_HEADER_ERRORS,
+	TX_METRIC_MAVLINK_UNKNOWN_MESSAGES,
+	TX_METRIC_MAVLINK_SKIPPED_BYTES,
+	TX_METRIC_MAVLINK_BATCHES,
+	TX_METRIC_MAVLINK_FROM_GROUND_BYTES,
+	TX_METRIC_VIDEO_IN_BYTES,
+	TX_METRIC_VIDEO_FIFO,
+	TX_METRIC_VIDEO_FIFO_DROPPED_BYTES,
+	TX_METRIC_LINK_RECOVERIES,
+	TX_METRIC_VIDEO_PACKAGE_SIZE,       // bytes, changes with tx_raw -u.
+	TX_METRIC_UPLINK_SOCKET_QUEUE,      // SIOCOUTQ of the sockets (kernel accounting, with the buffer overhead).
+	TX_METRIC_UPLINK_QDISC_BACKLOG,
+	TX_METRIC_UPLINK_QUEUE_DELAY,
+	TX_METRIC_UPLINK_HELD,              // ms the scheduler held the packages for the local queue.
+	TX_METRIC_CLASS_SENT_BYTES,         // one per TXClass_t.
+	TX_METRIC_CLASS_FULL_DROPPED_BYTES = TX_METRIC_CLASS_SENT_BYTES + TX_CLASS_COUNT,
+	TX_METRIC_CLASS_EXPIRED_BYTES = TX_METRIC_CLASS_FULL_DROPPED_BYTES + TX_CLASS_COUNT,
+	TX_METRIC_CLASS_QUEUE = TX_METRIC_CLASS_EXPIRED_BYTES + TX_CLASS_COUNT,
+	TX_METRIC_COUNT = TX_METRIC_CLASS_QUEUE + TX_CLASS_COUNT
+};
+enum TXHistogram_t{
+	TX_HISTOGRAM_CLASS_DELAY=0,         // scheduler queueing delay (ms), one per TXClass_t.
+	TX_HISTOGRAM_MAVLINK_BATCH_AGE = TX_HISTOGRAM_CLASS_DELAY + TX_CLASS_COUNT, // first frame to queued (ms).
+	TX_HISTOGRAM_COUNT
+};
+
 #define TELEMETRY_HEADER 0xFC
 #define TELEMETRY_HEADER_SIZE 5
 
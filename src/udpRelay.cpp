@@ -0,0 +1,521 @@
+/*
+	udpRelay.cpp
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+#include "udpRelay.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <chrono>
+
+#define RELAY_EXPIRE_INTERVAL_MS 1000
+
+static uint64_t timeMillisec(void){
+	using namespace std::chrono;
+	return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+UdpRelay::UdpRelay(){
+	bzero(this->sessions, sizeof(this->sessions));
+	for(uint32_t a=0;a<RELAY_MAX_THREADS;a++){
+		this->workers[a] = NULL;
+		this->workerThreads[a] = NULL;
+	}
+	this->threads = 0;
+	this->running = false;
+	this->tableFullReported = false;
+	this->expiredPackages = 0;
+	this->expiredBytes = 0;
+	this->expiredDropped = 0;
+	bzero(this->expiredRefused, sizeof(this->expiredRefused));
+	this->key[0] = 0;
+	this->sessionRate = RELAY_SESSION_RATE;
+}
+
+UdpRelay::~UdpRelay(){
+	this->stop();
+}
+
+bool UdpRelay::setKey(const char *key){
+	uint32_t length = strlen(key);
+	if(length < RELAY_KEY_MIN_LENGTH || length > RELAY_KEY_MAX_LENGTH){
+		fprintf(stderr, "UdpRelay: The key must be %d to %d characters\n", RELAY_KEY_MIN_LENGTH, RELAY_KEY_MAX_LENGTH);
+		return true;
+	}
+	strcpy(this->key, key);
+	return false;
+}
+
+void UdpRelay::setSessionRate(uint32_t perMinute){
+	this->sessionRate = perMinute;
+}
+
+bool UdpRelay::start(const uint16_t *ports, uint32_t threads){
+	if(this->key[0] == 0){
+		fprintf(stderr, "UdpRelay: No key set, hellos can't be checked\n");
+		return true;
+	}
+	if(threads == 0 || threads > RELAY_MAX_THREADS){
+		fprintf(stderr, "UdpRelay: Invalid number of threads %u, max %d\n", threads, RELAY_MAX_THREADS);
+		return true;
+	}
+	this->stop();
+
+	// All sockets are bound before a worker starts, so a used port is reported and the kernel spreads over all of them.
+	for(uint32_t a=0;a<threads;a++){
+		RelayWorker_t *worker = new RelayWorker_t();
+		worker->index = a;
+		worker->nextExpireMs = 0;
+		worker->unknown = 0;
+		bzero(worker->refused, sizeof(worker->refused));
+		for(uint32_t b=0;b<RELAY_BATCH;b++){
+			worker->receivedIov[b].iov_base = worker->buffers[b];
+			worker->receivedIov[b].iov_len = RELAY_MAX_PACKAGE;
+			bzero(&worker->received[b], sizeof(worker->received[b]));
+			worker->received[b].msg_hdr.msg_name = &worker->sources[b];
+			worker->received[b].msg_hdr.msg_iov = &worker->receivedIov[b];
+			worker->received[b].msg_hdr.msg_iovlen = 1;
+			bzero(&worker->sent[b], sizeof(worker->sent[b]));
+			worker->sent[b].msg_hdr.msg_name = &worker->destinations[b];
+			worker->sent[b].msg_hdr.msg_namelen = sizeof(worker->destinations[b]);
+			worker->sent[b].msg_hdr.msg_iov = &worker->sentIov[b];
+			worker->sent[b].msg_hdr.msg_iovlen = 1;
+		}
+		this->workers[a] = worker;
+		this->threads = a+1;
+		for(uint32_t channel=0;channel<RELAY_CHANNEL_COUNT;channel++){
+			worker->fds[channel] = -1;
+			if(ports[channel] != 0){
+				worker->fds[channel] = this->openSocket(ports[channel]);
+				if(worker->fds[channel] < 0){
+					this->stop();
+					return true;
+				}
+			}
+		}
+	}
+
+	__atomic_store_n(&this->running, true, __ATOMIC_RELEASE);
+	for(uint32_t a=0;a<this->threads;a++){
+		this->workerThreads[a] = new std::thread(&UdpRelay::run, this, this->workers[a]);
+	}
+	return false;
+}
+
+void UdpRelay::stop(void){
+	__atomic_store_n(&this->running, false, __ATOMIC_RELEASE);
+	for(uint32_t a=0;a<this->threads;a++){
+		if(this->workerThreads[a] != NULL){
+			this->workerThreads[a]->join();
+			delete this->workerThreads[a];
+			this->workerThreads[a] = NULL;
+		}
+		if(this->workers[a] != NULL){
+			this->expiredDropped += this->workers[a]->unknown;
+			for(uint32_t reason=0;reason<RELAY_REFUSED_COUNT;reason++){
+				this->expiredRefused[reason] += this->workers[a]->refused[reason];
+			}
+			for(uint32_t channel=0;channel<RELAY_CHANNEL_COUNT;channel++){
+				if(this->workers[a]->fds[channel] >= 0){
+					::close(this->workers[a]->fds[channel]);
+				}
+			}
+			delete this->workers[a];
+			this->workers[a] = NULL;
+		}
+	}
+	this->threads = 0;
+}
+
+void UdpRelay::expireSessions(uint64_t nowMs){
+	std::lock_guard<std::mutex> lock(this->sessionLock);
+	for(uint32_t a=0;a<RELAY_MAX_SESSIONS;a++){
+		RelaySession_t &slot = this->sessions[a];
+		uint32_t session = __atomic_load_n(&slot.session, __ATOMIC_ACQUIRE);
+		if(session == 0){
+			continue;
+		}
+		uint64_t lastHello = __atomic_load_n(&slot.lastHelloMs[RELAY_ROLE_AIR], __ATOMIC_RELAXED);
+		uint64_t lastGroundHello = __atomic_load_n(&slot.lastHelloMs[RELAY_ROLE_GROUND], __ATOMIC_RELAXED);
+		if(lastGroundHello > lastHello){
+			lastHello = lastGroundHello;
+		}
+		if(nowMs < lastHello + RELAY_SESSION_TIMEOUT_MS){
+			continue;
+		}
+		// The workers check the session of a slot for every package, and the slot is not reused for a while,
+		// so a package in flight is dropped and never sent to the next session in the slot.
+		__atomic_store_n(&slot.session, 0, __ATOMIC_RELEASE);
+		slot.releasedMs = nowMs;
+		for(uint32_t role=0;role<RELAY_ROLE_COUNT;role++){
+			this->expiredPackages += __atomic_load_n(&slot.packages[role], __ATOMIC_RELAXED);
+			this->expiredBytes += __atomic_load_n(&slot.bytes[role], __ATOMIC_RELAXED);
+			this->expiredDropped += __atomic_load_n(&slot.noPeer[role], __ATOMIC_RELAXED);
+		}
+		this->expiredDropped += __atomic_load_n(&slot.sendErrors, __ATOMIC_RELAXED);
+		this->sessionSlots.erase(session);
+		this->tableFullReported = false;
+		fprintf(stderr, "UdpRelay: Session %u expired, no hello for %us\n", session, RELAY_SESSION_TIMEOUT_MS/1000);
+	}
+
+	std::unordered_map<uint32_t, RelayAddressRate_t>::iterator rate = this->newSessions.begin();
+	while(rate != this->newSessions.end()){
+		if(nowMs >= rate->second.windowMs + RELAY_SESSION_RATE_WINDOW_MS){
+			rate = this->newSessions.erase(rate);
+		}else{
+			++rate;
+		}
+	}
+}
+
+uint32_t UdpRelay::getThreads(void){
+	return this->threads;
+}
+
+uint32_t UdpRelay::getSessions(void){
+	uint32_t count=0;
+	for(uint32_t a=0;a<RELAY_MAX_SESSIONS;a++){
+		if(__atomic_load_n(&this->sessions[a].session, __ATOMIC_RELAXED) != 0){
+			count++;
+		}
+	}
+	return count;
+}
+
+bool UdpRelay::getSession(uint32_t slot, RelaySessionStats_t &stats){
+	if(slot >= RELAY_MAX_SESSIONS){
+		return false;
+	}
+	RelaySession_t &session = this->sessions[slot];
+	stats.session = __atomic_load_n(&session.session, __ATOMIC_ACQUIRE);
+	if(stats.session == 0){
+		return false;
+	}
+	for(uint32_t role=0;role<RELAY_ROLE_COUNT;role++){
+		for(uint32_t channel=0;channel<RELAY_CHANNEL_COUNT;channel++){
+			stats.endpoints[channel][role] = __atomic_load_n(&session.endpoints[channel][role], __ATOMIC_RELAXED);
+		}
+		stats.lastHelloMs[role] = __atomic_load_n(&session.lastHelloMs[role], __ATOMIC_RELAXED);
+		stats.packages[role] = __atomic_load_n(&session.packages[role], __ATOMIC_RELAXED);
+		stats.bytes[role] = __atomic_load_n(&session.bytes[role], __ATOMIC_RELAXED);
+		stats.noPeer[role] = __atomic_load_n(&session.noPeer[role], __ATOMIC_RELAXED);
+	}
+	stats.sendErrors = __atomic_load_n(&session.sendErrors, __ATOMIC_RELAXED);
+	return true;
+}
+
+uint64_t UdpRelay::getPackagesForwarded(void){
+	uint64_t packages = this->expiredPackages;
+	RelaySessionStats_t stats;
+	for(uint32_t a=0;a<RELAY_MAX_SESSIONS;a++){
+		if(this->getSession(a, stats)){
+			packages += stats.packages[RELAY_ROLE_AIR] + stats.packages[RELAY_ROLE_GROUND];
+		}
+	}
+	return packages;
+}
+
+uint64_t UdpRelay::getBytesForwarded(void){
+	uint64_t bytes = this->expiredBytes;
+	RelaySessionStats_t stats;
+	for(uint32_t a=0;a<RELAY_MAX_SESSIONS;a++){
+		if(this->getSession(a, stats)){
+			bytes += stats.bytes[RELAY_ROLE_AIR] + stats.bytes[RELAY_ROLE_GROUND];
+		}
+	}
+	return bytes;
+}
+
+uint64_t UdpRelay::getPackagesDropped(void){
+	uint64_t dropped = this->expiredDropped;
+	RelaySessionStats_t stats;
+	for(uint32_t a=0;a<RELAY_MAX_SESSIONS;a++){
+		if(this->getSession(a, stats)){
+			dropped += stats.noPeer[RELAY_ROLE_AIR] + stats.noPeer[RELAY_ROLE_GROUND] + stats.sendErrors;
+		}
+	}
+	for(uint32_t a=0;a<this->threads;a++){
+		dropped += __atomic_load_n(&this->workers[a]->unknown, __ATOMIC_RELAXED);
+	}
+	return dropped;
+}
+
+uint64_t UdpRelay::getHellosRefused(RelayRefused_t reason){
+	uint64_t refused = this->expiredRefused[reason];
+	for(uint32_t a=0;a<this->threads;a++){
+		refused += __atomic_load_n(&this->workers[a]->refused[reason], __ATOMIC_RELAXED);
+	}
+	return refused;
+}
+
+const char* UdpRelay::getChannelName(uint32_t channel){
+	switch(channel){
+		case RELAY_CHANNEL_VIDEO:
+			return "video";
+		case RELAY_CHANNEL_MAVLINK:
+			return "mavlink";
+		case RELAY_CHANNEL_TELEMETRY:
+			return "telemetry";
+		default:
+			return "unknown";
+	}
+}
+
+void UdpRelay::printEndpoint(FILE *file, uint64_t endpoint){
+	if(endpoint == 0){
+		fprintf(file, "-");
+		return;
+	}
+	uint32_t address = (uint32_t)(endpoint >> 16);
+	fprintf(file, "%u.%u.%u.%u:%u", (address >> 24) & 0xFF, (address >> 16) & 0xFF, (address >> 8) & 0xFF, address & 0xFF, (uint32_t)(endpoint & 0xFFFF));
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+////////// Private Helper functions //////////
+////////////////////////////////////////////////////////////////////////////////////
+
+int UdpRelay::openSocket(uint16_t port){
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if(fd < 0){
+		perror("UdpRelay: UDP socket creation failed");
+		return -1;
+	}
+	int enable = 1;
+	if(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0){
+		fprintf(stderr, "UdpRelay: SO_REUSEPORT not supported ERNO:%d\n", errno);
+		::close(fd);
+		return -1;
+	}
+	int size = RELAY_SOCKET_BUFFER;
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+
+	struct sockaddr_in address;
+	bzero(&address, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = INADDR_ANY;
+	address.sin_port = htons(port);
+	if(bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0){
+		fprintf(stderr, "UdpRelay: Unable to bind port %u ERNO:%d\n", port, errno);
+		::close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+void UdpRelay::run(RelayWorker_t *worker){
+	struct pollfd fds[RELAY_CHANNEL_COUNT];
+	uint32_t channels[RELAY_CHANNEL_COUNT];
+	uint32_t count=0;
+	for(uint32_t channel=0;channel<RELAY_CHANNEL_COUNT;channel++){
+		if(worker->fds[channel] >= 0){
+			fds[count].fd = worker->fds[channel];
+			fds[count].events = POLLIN;
+			channels[count] = channel;
+			count++;
+		}
+	}
+
+	while(__atomic_load_n(&this->running, __ATOMIC_ACQUIRE)){
+		int ready = poll(fds, count, RELAY_POLL_MS);
+		uint64_t nowMs = timeMillisec();
+		if(ready > 0){
+			for(uint32_t a=0;a<count;a++){
+				if(fds[a].revents & POLLIN){
+					this->receive(*worker, channels[a], nowMs);
+				}
+			}
+		}
+		if(nowMs >= worker->nextExpireMs){
+			this->expireFlows(*worker, nowMs);
+			worker->nextExpireMs = nowMs + RELAY_EXPIRE_INTERVAL_MS;
+		}
+	}
+}
+
+void UdpRelay::receive(RelayWorker_t &worker, uint32_t channel, uint64_t nowMs){
+	int fd = worker.fds[channel];
+	int received;
+	do{
+		for(uint32_t a=0;a<RELAY_BATCH;a++){
+			worker.received[a].msg_hdr.msg_namelen = sizeof(worker.sources[a]);
+		}
+		received = recvmmsg(fd, worker.received, RELAY_BATCH, MSG_DONTWAIT, NULL);
+		if(received <= 0){
+			return;
+		}
+
+		uint32_t sending=0;
+		for(int a=0;a<received;a++){
+			const struct sockaddr_in &source = worker.sources[a];
+			uint64_t endpoint = ((uint64_t)ntohl(source.sin_addr.s_addr) << 16) | ntohs(source.sin_port);
+			uint64_t key = ((uint64_t)channel << 48) | endpoint;
+			uint32_t length = worker.received[a].msg_len;
+
+			if(length == sizeof(RelayHello_t) && ((const RelayHello_t*)worker.buffers[a])->magic == RELAY_HELLO_MAGIC){
+				this->handleHello(worker, channel, key, worker.buffers[a], endpoint, nowMs);
+				continue;
+			}
+
+			std::unordered_map<uint64_t, RelayFlow_t>::iterator flow = worker.flows.find(key);
+			if(flow == worker.flows.end()){
+				__atomic_store_n(&worker.unknown, worker.unknown+1, __ATOMIC_RELAXED);
+				continue;
+			}
+			RelaySession_t &slot = this->sessions[flow->second.slot];
+			if(__atomic_load_n(&slot.session, __ATOMIC_ACQUIRE) != flow->second.session){ // the session expired.
+				worker.flows.erase(flow);
+				__atomic_store_n(&worker.unknown, worker.unknown+1, __ATOMIC_RELAXED);
+				continue;
+			}
+			flow->second.lastMs = nowMs;
+			uint8_t from = flow->second.role;
+			uint64_t peer = __atomic_load_n(&slot.endpoints[channel][(from == RELAY_ROLE_AIR) ? RELAY_ROLE_GROUND : RELAY_ROLE_AIR], __ATOMIC_RELAXED);
+			if(peer == 0){
+				__atomic_fetch_add(&slot.noPeer[from], 1, __ATOMIC_RELAXED);
+				continue;
+			}
+			struct sockaddr_in &destination = worker.destinations[sending];
+			destination.sin_family = AF_INET;
+			destination.sin_addr.s_addr = htonl((uint32_t)(peer >> 16));
+			destination.sin_port = htons((uint16_t)(peer & 0xFFFF));
+			worker.sentIov[sending].iov_base = worker.buffers[a];
+			worker.sentIov[sending].iov_len = length;
+			worker.sentSlots[sending] = (flow->second.slot << 1) | from;
+			sending++;
+		}
+
+		uint32_t done=0;
+		while(done < sending){
+			int sent = sendmmsg(fd, &worker.sent[done], sending-done, MSG_DONTWAIT);
+			if(sent <= 0){ // the first one failed (full send buffer or an unreachable peer), drop it and go on.
+				RelaySession_t &slot = this->sessions[worker.sentSlots[done] >> 1];
+				__atomic_fetch_add(&slot.sendErrors, 1, __ATOMIC_RELAXED);
+				done++;
+				continue;
+			}
+			for(int a=0;a<sent;a++){
+				RelaySession_t &slot = this->sessions[worker.sentSlots[done+a] >> 1];
+				uint8_t from = worker.sentSlots[done+a] & 1;
+				__atomic_fetch_add(&slot.packages[from], 1, __ATOMIC_RELAXED);
+				__atomic_fetch_add(&slot.bytes[from], worker.sent[done+a].msg_len, __ATOMIC_RELAXED);
+			}
+			done += sent;
+		}
+	}while(received == RELAY_BATCH);
+}
+
+void UdpRelay::handleHello(RelayWorker_t &worker, uint32_t channel, uint64_t key, const uint8_t *data, uint64_t endpoint, uint64_t nowMs){
+	// Nothing is changed before the hello is known to come from a user of the relay, and it is not a copy.
+	RelayRole_t role;
+	uint32_t session;
+	uint64_t timeMs;
+	if(false == RelayHello::parse(data, sizeof(RelayHello_t), role, session, timeMs) || false == RelayHello::verify(data, this->key)){
+		__atomic_store_n(&worker.refused[RELAY_REFUSED_KEY], worker.refused[RELAY_REFUSED_KEY]+1, __ATOMIC_RELAXED);
+		return;
+	}
+	uint64_t realtimeMs = RelayHello::realtimeMs();
+	if(timeMs + RELAY_HELLO_MAX_SKEW_MS < realtimeMs || timeMs > realtimeMs + RELAY_HELLO_MAX_SKEW_MS){
+		__atomic_store_n(&worker.refused[RELAY_REFUSED_TIME], worker.refused[RELAY_REFUSED_TIME]+1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	int32_t slot = -1;
+	std::unordered_map<uint64_t, RelayFlow_t>::iterator flow = worker.flows.find(key);
+	if(flow != worker.flows.end() && flow->second.session == session && __atomic_load_n(&this->sessions[flow->second.slot].session, __ATOMIC_ACQUIRE) == session){
+		slot = flow->second.slot; // the hello every second, no lock.
+	}else{
+		bool rateLimited = false;
+		slot = this->addSession(session, (uint32_t)(endpoint >> 16), nowMs, rateLimited);
+		if(slot < 0){
+			if(rateLimited){
+				__atomic_store_n(&worker.refused[RELAY_REFUSED_RATE], worker.refused[RELAY_REFUSED_RATE]+1, __ATOMIC_RELAXED);
+			}else{ // the table is full.
+				__atomic_store_n(&worker.unknown, worker.unknown+1, __ATOMIC_RELAXED);
+			}
+			return;
+		}
+	}
+
+	// Each hello on a port must be newer than the last one taken, so a copy of a hello can't move the session
+	// to another address. Other workers may take hellos of the same port (another source address), hence the CAS.
+	RelaySession_t &target = this->sessions[slot];
+	uint64_t lastTimeMs = __atomic_load_n(&target.helloTimeMs[channel][role], __ATOMIC_RELAXED);
+	do{
+		if(timeMs <= lastTimeMs){
+			__atomic_store_n(&worker.refused[RELAY_REFUSED_REPLAY], worker.refused[RELAY_REFUSED_REPLAY]+1, __ATOMIC_RELAXED);
+			return;
+		}
+	}while(false == __atomic_compare_exchange_n(&target.helloTimeMs[channel][role], &lastTimeMs, timeMs, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	RelayFlow_t &entry = worker.flows[key];
+	entry.slot = (uint32_t)slot;
+	entry.session = session;
+	entry.role = (uint8_t)role;
+	entry.lastMs = nowMs;
+
+	// The latest signed hello wins, a drone which got a new address from the LTE network continues right away.
+	if(__atomic_exchange_n(&target.endpoints[channel][role], endpoint, __ATOMIC_RELEASE) != endpoint){
+		fprintf(stderr, "UdpRelay: Session %u %s %s from ", session, (role == RELAY_ROLE_AIR) ? "air" : "ground", UdpRelay::getChannelName(channel));
+		UdpRelay::printEndpoint(stderr, endpoint);
+		fprintf(stderr, "\n");
+	}
+	__atomic_store_n(&target.lastHelloMs[role], nowMs, __ATOMIC_RELAXED);
+}
+
+int32_t UdpRelay::addSession(uint32_t session, uint32_t address, uint64_t nowMs, bool &rateLimited){
+	std::lock_guard<std::mutex> lock(this->sessionLock);
+	std::unordered_map<uint32_t, uint32_t>::iterator found = this->sessionSlots.find(session);
+	if(found != this->sessionSlots.end()){
+		return (int32_t)found->second;
+	}
+	RelayAddressRate_t *rate = NULL;
+	if(this->sessionRate != 0){
+		rate = &this->newSessions[address];
+		if(rate->count != 0 && nowMs >= rate->windowMs + RELAY_SESSION_RATE_WINDOW_MS){
+			rate->count = 0;
+		}
+		if(rate->count >= this->sessionRate){
+			rateLimited = true;
+			return -1;
+		}
+	}
+	for(uint32_t a=0;a<RELAY_MAX_SESSIONS;a++){
+		RelaySession_t &slot = this->sessions[a];
+		if(__atomic_load_n(&slot.session, __ATOMIC_ACQUIRE) != 0 || (slot.releasedMs != 0 && nowMs < slot.releasedMs + RELAY_SLOT_REUSE_MS)){
+			continue;
+		}
+		bzero(&slot, sizeof(slot));
+		slot.lastHelloMs[RELAY_ROLE_AIR] = nowMs;
+		slot.lastHelloMs[RELAY_ROLE_GROUND] = nowMs;
+		__atomic_store_n(&slot.session, session, __ATOMIC_RELEASE);
+		this->sessionSlots[session] = a;
+		if(rate != NULL){
+			if(rate->count == 0){
+				rate->windowMs = nowMs;
+			}
+			rate->count++;
+		}
+		return (int32_t)a;
+	}
+	if(false == this->tableFullReported){
+		fprintf(stderr, "UdpRelay: No room for session %u, max %d sessions\n", session, RELAY_MAX_SESSIONS);
+		this->tableFullReported = true;
+	}
+	return -1;
+}
+
+void UdpRelay::expireFlows(RelayWorker_t &worker, uint64_t nowMs){
+	std::unordered_map<uint64_t, RelayFlow_t>::iterator flow = worker.flows.begin();
+	while(flow != worker.flows.end()){
+		if(nowMs >= flow->second.lastMs + RELAY_FLOW_TIMEOUT_MS){
+			flow = worker.flows.erase(flow);
+		}else{
+			++flow;
+		}
+	}
+}
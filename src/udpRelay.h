@@ -0,0 +1,163 @@
+/*
+	udpRelay.h
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+
+#ifndef UDPRELAY_H_
+#define UDPRELAY_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h> // bzero
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include "relayHello.h"
+
+#define RELAY_MAX_SESSIONS 1024
+#define RELAY_MAX_THREADS 64
+#define RELAY_BATCH 64                     // packages per recvmmsg() / sendmmsg().
+#define RELAY_MAX_PACKAGE 2048             // larger than the H264 (1400) and Mavlink batch packages.
+#define RELAY_SOCKET_BUFFER (4*1024*1024)  // per socket, capped by net.core.rmem_max / wmem_max.
+#define RELAY_POLL_MS 100
+#define RELAY_FLOW_TIMEOUT_MS 30000        // an address without packages is forgotten (LTE NAT mappings live ~60s).
+#define RELAY_SESSION_TIMEOUT_MS 60000     // a session without hello from either side is freed.
+#define RELAY_SLOT_REUSE_MS 1000           // a freed session slot is not given to a new session before this.
+#define RELAY_SESSION_RATE 10              // default new sessions per minute from one IP address.
+#define RELAY_SESSION_RATE_WINDOW_MS 60000
+
+enum RelayChannel_t{
+	RELAY_CHANNEL_VIDEO=0,
+	RELAY_CHANNEL_MAVLINK,
+	RELAY_CHANNEL_TELEMETRY,
+	RELAY_CHANNEL_COUNT
+};
+
+// Why a hello was not taken.
+enum RelayRefused_t{
+	RELAY_REFUSED_KEY=0,                 // not signed with the relay key.
+	RELAY_REFUSED_TIME,                  // sent more than RELAY_HELLO_MAX_SKEW_MS from the relay clock.
+	RELAY_REFUSED_REPLAY,                // not newer than the last hello on that port, a copy.
+	RELAY_REFUSED_RATE,                  // too many new sessions from the address.
+	RELAY_REFUSED_COUNT
+};
+
+// One drone and its ground station. Written by the worker threads with __atomic builtins, the forwarding
+// path takes no lock. An endpoint is the IPv4 address << 16 | port, 0 until a hello came from that side.
+typedef struct {
+	uint32_t session;                                    // 0 = free.
+	uint64_t endpoints[RELAY_CHANNEL_COUNT][RELAY_ROLE_COUNT];
+	uint64_t lastHelloMs[RELAY_ROLE_COUNT];
+	uint64_t helloTimeMs[RELAY_CHANNEL_COUNT][RELAY_ROLE_COUNT]; // sender time of the last hello taken, the next must be newer.
+	uint64_t releasedMs;
+	uint64_t packages[RELAY_ROLE_COUNT];                 // forwarded, from air (down) and from ground (up).
+	uint64_t bytes[RELAY_ROLE_COUNT];
+	uint64_t noPeer[RELAY_ROLE_COUNT];                   // dropped, the other side has not sent a hello on that port.
+	uint64_t sendErrors;                                 // dropped, the socket send buffer was full.
+} RelaySession_t;
+
+// A copy of a session for printing.
+typedef struct {
+	uint32_t session;
+	uint64_t endpoints[RELAY_CHANNEL_COUNT][RELAY_ROLE_COUNT];
+	uint64_t lastHelloMs[RELAY_ROLE_COUNT];
+	uint64_t packages[RELAY_ROLE_COUNT];
+	uint64_t bytes[RELAY_ROLE_COUNT];
+	uint64_t noPeer[RELAY_ROLE_COUNT];
+	uint64_t sendErrors;
+} RelaySessionStats_t;
+
+// New sessions from one address in the current window.
+typedef struct {
+	uint64_t windowMs;
+	uint32_t count;
+} RelayAddressRate_t;
+
+// Source address a worker has seen a hello from.
+typedef struct {
+	uint32_t slot;
+	uint32_t session;
+	uint8_t role;
+	uint64_t lastMs;
+} RelayFlow_t;
+
+typedef struct {
+	uint32_t index;
+	int fds[RELAY_CHANNEL_COUNT];                        // -1 for a port not relayed.
+	std::unordered_map<uint64_t, RelayFlow_t> flows;     // channel << 48 | address << 16 | port.
+	uint64_t nextExpireMs;
+	uint64_t unknown;                                    // packages from addresses without a hello.
+	uint64_t refused[RELAY_REFUSED_COUNT];               // hellos.
+	uint8_t buffers[RELAY_BATCH][RELAY_MAX_PACKAGE];
+	struct mmsghdr received[RELAY_BATCH];
+	struct iovec receivedIov[RELAY_BATCH];
+	struct sockaddr_in sources[RELAY_BATCH];
+	struct mmsghdr sent[RELAY_BATCH];                    // points into buffers, packages are not copied.
+	struct iovec sentIov[RELAY_BATCH];
+	struct sockaddr_in destinations[RELAY_BATCH];
+	uint32_t sentSlots[RELAY_BATCH];
+} RelayWorker_t;
+
+// Relay for drones behind carrier-grade NAT (LTE), which can only reach a ground station with a public IP.
+// tx_raw (-k) and rx_raw (-G -k) both send a hello with the same session number from each of their sockets,
+// the relay pairs the two addresses per port and forwards everything else between them as it is.
+// Only hellos signed with the relay key (-K) are taken, each newer than the last on its port, so an address of a
+// session only changes with a hello from its owner. New sessions per IP address are limited, the table stays free.
+// Each worker thread has its own socket per port (SO_REUSEPORT), the kernel spreads the drones over them by
+// address. Packages are received with recvmmsg() and sent to the other side from the same buffers with sendmmsg().
+class UdpRelay
+{
+	// Public functions
+	public:
+	UdpRelay();
+	virtual ~UdpRelay(); //destructor
+
+	bool setKey(const char *key); // before start(), returns true on error.
+	void setSessionRate(uint32_t perMinute); // new sessions per minute from one IP address, 0 = no limit.
+	bool start(const uint16_t *ports, uint32_t threads); // ports[RELAY_CHANNEL_COUNT] (0 = not relayed), returns true on error.
+	void stop(void);
+	void expireSessions(uint64_t nowMs); // frees sessions without hello, called by the owner thread.
+
+	uint32_t getThreads(void);
+	uint32_t getSessions(void);
+	bool getSession(uint32_t slot, RelaySessionStats_t &stats); // returns false if the slot is free.
+	uint64_t getPackagesForwarded(void);
+	uint64_t getBytesForwarded(void);
+	uint64_t getPackagesDropped(void); // no peer, send errors and unknown addresses.
+	uint64_t getHellosRefused(RelayRefused_t reason);
+
+	static const char* getChannelName(uint32_t channel);
+	static void printEndpoint(FILE *file, uint64_t endpoint);
+
+	private:
+	RelaySession_t sessions[RELAY_MAX_SESSIONS];
+	std::unordered_map<uint32_t, uint32_t> sessionSlots; // session -> slot, only used with the lock.
+	std::unordered_map<uint32_t, RelayAddressRate_t> newSessions; // IPv4 address -> sessions it added, only used with the lock.
+	std::mutex sessionLock;                               // taken when a session is added or freed.
+	char key[RELAY_KEY_MAX_LENGTH+1];
+	uint32_t sessionRate;
+	RelayWorker_t *workers[RELAY_MAX_THREADS];
+	std::thread *workerThreads[RELAY_MAX_THREADS];
+	uint32_t threads;
+	bool running;                                         // __atomic, read by the workers.
+	bool tableFullReported;
+	uint64_t expiredPackages;
+	uint64_t expiredBytes;
+	uint64_t expiredDropped;
+	uint64_t expiredRefused[RELAY_REFUSED_COUNT];
+
+	int openSocket(uint16_t port);
+	void run(RelayWorker_t *worker);
+	void receive(RelayWorker_t &worker, uint32_t channel, uint64_t nowMs);
+	void handleHello(RelayWorker_t &worker, uint32_t channel, uint64_t key, const uint8_t *data, uint64_t endpoint, uint64_t nowMs);
+	int32_t addSession(uint32_t session, uint32_t address, uint64_t nowMs, bool &rateLimited); // returns the slot, -1 if full or rate limited.
+	void expireFlows(RelayWorker_t &worker, uint64_t nowMs);
+};
+
+#endif /* UDPRELAY_H_ */
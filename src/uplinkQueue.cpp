@@ -0,0 +1,337 @@
+/*
+	uplinkQueue.cpp
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+#include "uplinkQueue.h"
+
+UplinkQueue::UplinkQueue(){
+	this->socketCount=0;
+	bzero(&this->socketQueue, sizeof(this->socketQueue));
+	bzero(&this->qdiscQueue, sizeof(this->qdiscQueue));
+	this->delayMs=0;
+	this->sequence=0;
+	this->ifIndex=0;
+	this->ifName[0]=0;
+	this->nextQdiscUs=0;
+	this->qdiscSentBytes=0;
+	this->qdiscWritten=0;
+	this->clearStatus();
+	this->_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if(this->_fd < 0){
+		perror("UplinkQueue: netlink socket creation failed");
+		this->_fd=0; // only the socket queues then.
+	}
+}
+
+UplinkQueue::~UplinkQueue(){
+	if(this->_fd > 0){
+		close(this->_fd);
+	}
+}
+
+void UplinkQueue::addSocket(Connection *connection){
+	if(this->socketCount >= UPLINK_QUEUE_MAX_SOCKETS){
+		fprintf(stderr, "UplinkQueue: Max %d sockets, FD=%d is not sampled\n", UPLINK_QUEUE_MAX_SOCKETS, connection->getFD());
+		return;
+	}
+	this->sockets[this->socketCount++] = connection;
+}
+
+bool UplinkQueue::findInterface(void){
+	this->ifIndex=0;
+	bzero(&this->qdiscQueue, sizeof(this->qdiscQueue));
+	if(this->_fd <= 0 || this->socketCount == 0){
+		return true;
+	}
+	socklen_t length;
+	const struct sockaddr *destination = this->sockets[0]->getDestination(length);
+	if(destination == NULL){
+		return true;
+	}
+
+	struct {
+		struct nlmsghdr header;
+		struct rtmsg message;
+		uint8_t attributes[64];
+	} request;
+	bzero(&request, sizeof(request));
+	const void *address = &((const struct sockaddr_in *)destination)->sin_addr;
+	int family = AF_INET;
+	int addressLength = 4;
+	if(destination->sa_family == AF_INET6){
+		const struct sockaddr_in6 *ipv6 = (const struct sockaddr_in6 *)destination;
+		if(IN6_IS_ADDR_V4MAPPED(&ipv6->sin6_addr)){
+			address = &ipv6->sin6_addr.s6_addr[12];
+		}else{
+			family = AF_INET6;
+			address = &ipv6->sin6_addr;
+			addressLength = 16;
+		}
+	}
+	request.header.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+	request.header.nlmsg_type = RTM_GETROUTE;
+	request.header.nlmsg_flags = NLM_F_REQUEST;
+	request.message.rtm_family = family;
+	request.message.rtm_dst_len = addressLength * 8;
+	struct rtattr *attribute = (struct rtattr *)((uint8_t *)&request + NLMSG_ALIGN(request.header.nlmsg_len));
+	attribute->rta_type = RTA_DST;
+	attribute->rta_len = RTA_LENGTH(addressLength);
+	memcpy(RTA_DATA(attribute), address, addressLength);
+	request.header.nlmsg_len = NLMSG_ALIGN(request.header.nlmsg_len) + RTA_ALIGN(attribute->rta_len);
+
+	int replyLength = this->request(&request, request.header.nlmsg_len);
+	int index = 0;
+	for(struct nlmsghdr *nh = (struct nlmsghdr *)this->buffer; replyLength > 0 && NLMSG_OK(nh, (uint32_t)replyLength); nh = NLMSG_NEXT(nh, replyLength)){
+		if(nh->nlmsg_type != RTM_NEWROUTE){
+			continue;
+		}
+		struct rtmsg *route = (struct rtmsg *)NLMSG_DATA(nh);
+		int attributesLength = RTM_PAYLOAD(nh);
+		for(struct rtattr *a = RTM_RTA(route); RTA_OK(a, attributesLength); a = RTA_NEXT(a, attributesLength)){
+			if(a->rta_type == RTA_OIF){
+				memcpy(&index, RTA_DATA(a), sizeof(index));
+			}
+		}
+	}
+	if(index <= 0){
+		fprintf(stderr, "UplinkQueue: No route to the receiver, only the socket queues are sampled.\n");
+		return true;
+	}
+	if(if_indextoname(index, this->ifName) == NULL){
+		snprintf(this->ifName, sizeof(this->ifName), "%d", index);
+	}
+
+	// Virtual interfaces (lo, tun of a VPN) have no queue, the packages go straight through.
+	this->ifIndex = index;
+	uint32_t backlog;
+	if(false == this->readQdisc(backlog, this->qdiscSentBytes)){
+		fprintf(stderr, "UplinkQueue: No qdisc on %s, only the socket queues are sampled.\n", this->ifName);
+		this->ifIndex=0;
+		return true;
+	}
+	fprintf(stderr, "UplinkQueue: Sampling the socket queues and the qdisc backlog of %s.\n", this->ifName);
+	return false;
+}
+
+void UplinkQueue::sample(uint64_t nowUs){
+	uint32_t bytes = this->readSocketQueues();
+	uint64_t drained = (this->socketQueue.bytes > bytes) ? this->socketQueue.bytes - bytes : 0; // nothing written since the last sample.
+	this->measure(&this->socketQueue, bytes, drained, nowUs);
+
+	if(this->ifIndex > 0 && nowUs >= this->nextQdiscUs){
+		uint32_t backlog;
+		uint64_t sentBytes;
+		if(this->readQdisc(backlog, sentBytes)){
+			drained = (sentBytes > this->qdiscSentBytes) ? sentBytes - this->qdiscSentBytes : 0;
+			this->qdiscSentBytes = sentBytes;
+			this->qdiscWritten = 0;
+			this->measure(&this->qdiscQueue, backlog, drained, nowUs);
+		}
+		this->nextQdiscUs = nowUs + UPLINK_QUEUE_QDISC_INTERVAL_US;
+	}
+	this->update(nowUs);
+	this->delaySum += this->delayMs;
+	this->samples++;
+}
+
+// A keyframe is many packages in one go, so the delay is updated after each of them and not only once per tick.
+void UplinkQueue::sent(uint64_t nowUs, uint32_t bytes){
+	// The drain until the next sample is measured from here, the qdisc has its own counter.
+	this->socketQueue.bytes = this->readSocketQueues();
+	this->socketQueue.timeUs = nowUs;
+	this->qdiscWritten += bytes;
+	this->update(nowUs);
+}
+
+uint32_t UplinkQueue::getDelayMs(void){
+	return this->delayMs;
+}
+
+uint32_t UplinkQueue::getSocketBytes(void){
+	return this->socketQueue.bytes;
+}
+
+uint32_t UplinkQueue::getQdiscBytes(void){
+	return this->qdiscQueue.bytes;
+}
+
+uint32_t UplinkQueue::getDrainRate(void){
+	return (this->ifIndex > 0 && this->qdiscQueue.rateTimeUs != 0) ? this->qdiscQueue.rate : 0;
+}
+
+void UplinkQueue::printStatus(FILE *out){
+	uint32_t average = (this->samples > 0) ? (uint32_t)(this->delaySum / this->samples) : 0;
+	fprintf(out, "Uplink queue: socket max %.1fKB", this->maxSocketBytes/1024.0f);
+	if(this->ifIndex > 0){
+		fprintf(out, "  qdisc (%s) max %.1fKB", this->ifName, this->maxQdiscBytes/1024.0f);
+	}
+	if(this->getDrainRate() > 0){
+		fprintf(out, "  drain %ukbit/s", this->getDrainRate()*8/1000);
+	}
+	fprintf(out, "  delay avg/max %u/%ums\n", average, this->maxDelayMs);
+}
+
+void UplinkQueue::clearStatus(void){
+	this->maxSocketBytes=0;
+	this->maxQdiscBytes=0;
+	this->maxDelayMs=0;
+	this->delaySum=0;
+	this->samples=0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+////////////////////////// Private Helper functions //////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+uint32_t UplinkQueue::readSocketQueues(void){
+	uint32_t bytes = 0;
+	for(uint32_t a=0;a<this->socketCount;a++){
+		int queued = this->sockets[a]->getSendQueue();
+		if(queued > 0){ // -1 while a socket is being recreated.
+			bytes += queued;
+		}
+	}
+	return bytes;
+}
+
+bool UplinkQueue::readQdisc(uint32_t &backlog, uint64_t &sentBytes){
+	struct {
+		struct nlmsghdr header;
+		struct tcmsg message;
+	} request;
+	bzero(&request, sizeof(request));
+	request.header.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg));
+	request.header.nlmsg_type = RTM_GETQDISC;
+	request.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_ECHO; // older kernels only answer a get of one qdisc with the echo.
+	request.message.tcm_family = AF_UNSPEC;
+	request.message.tcm_ifindex = this->ifIndex;
+	request.message.tcm_parent = TC_H_ROOT; // with several TX queues (mq) the root has the sum of them.
+
+	int replyLength = this->request(&request, request.header.nlmsg_len);
+	bool found = false;
+	for(struct nlmsghdr *nh = (struct nlmsghdr *)this->buffer; replyLength > 0 && NLMSG_OK(nh, (uint32_t)replyLength); nh = NLMSG_NEXT(nh, replyLength)){
+		if(nh->nlmsg_type != RTM_NEWQDISC){
+			continue;
+		}
+		struct tcmsg *qdisc = (struct tcmsg *)NLMSG_DATA(nh);
+		int attributesLength = TCA_PAYLOAD(nh);
+		for(struct rtattr *a = TCA_RTA(qdisc); RTA_OK(a, attributesLength); a = RTA_NEXT(a, attributesLength)){
+			if(a->rta_type == TCA_STATS2){
+				int statsLength = RTA_PAYLOAD(a);
+				for(struct rtattr *s = (struct rtattr *)RTA_DATA(a); RTA_OK(s, statsLength); s = RTA_NEXT(s, statsLength)){
+					if(s->rta_type == TCA_STATS_BASIC && RTA_PAYLOAD(s) >= sizeof(uint64_t)){
+						memcpy(&sentBytes, RTA_DATA(s), sizeof(uint64_t)); // gnet_stats_basic.bytes
+					}else if(s->rta_type == TCA_STATS_QUEUE && RTA_PAYLOAD(s) >= sizeof(struct gnet_stats_queue)){
+						struct gnet_stats_queue queue;
+						memcpy(&queue, RTA_DATA(s), sizeof(queue));
+						backlog = queue.backlog;
+						found = true;
+					}
+				}
+				return found;
+			}else if(a->rta_type == TCA_STATS && RTA_PAYLOAD(a) >= sizeof(struct tc_stats)){ // older kernels, TCA_STATS2 comes after it if there.
+				struct tc_stats stats;
+				memcpy(&stats, RTA_DATA(a), sizeof(stats));
+				sentBytes = stats.bytes;
+				backlog = stats.backlog;
+				found = true;
+			}
+		}
+	}
+	return found;
+}
+
+// The kernel answers within send(), the reply is waiting when it returns.
+int UplinkQueue::request(void *message, uint32_t length){
+	struct nlmsghdr *header = (struct nlmsghdr *)message;
+	header->nlmsg_seq = ++this->sequence;
+	if(send(this->_fd, message, length, 0) < 0){
+		return -1;
+	}
+	while(true){
+		ssize_t n = recv(this->_fd, this->buffer, sizeof(this->buffer), 0);
+		if(n < 0){
+			return -1;
+		}
+		struct nlmsghdr *reply = (struct nlmsghdr *)this->buffer;
+		if(false == NLMSG_OK(reply, (uint32_t)n)){
+			return -1;
+		}
+		if(reply->nlmsg_seq != this->sequence){
+			continue; // late reply to an earlier request.
+		}
+		if(reply->nlmsg_type == NLMSG_ERROR){
+			return -1; // e.g. no qdisc (noqueue) on the interface.
+		}
+		return (int)n;
+	}
+}
+
+// Only the time both ends of the interval had a queue counts, then the link was busy (or stalled) all of it.
+void UplinkQueue::measure(QueueEstimate *queue, uint32_t bytes, uint64_t drained, uint64_t nowUs){
+	if(queue->bytes > 0 && bytes > 0 && nowUs > queue->timeUs && queue->timeUs != 0){
+		queue->busyUs += nowUs - queue->timeUs;
+		queue->drained += drained;
+		if(queue->busyUs >= UPLINK_QUEUE_RATE_WINDOW_US && queue->drained >= UPLINK_QUEUE_RATE_MIN_BYTES){
+			uint32_t rate = (uint32_t)(queue->drained * 1000000 / queue->busyUs);
+			if(queue->rateTimeUs == 0){
+				queue->rate = rate;
+			}else if(rate < queue->rate){
+				queue->rate -= (queue->rate - rate) / 2; // a drop counts fast, the uplink may have collapsed ...
+			}else{
+				queue->rate += (rate - queue->rate) / 4; // ... a rise slower, the driver frees packages in bursts.
+			}
+			queue->rateTimeUs = nowUs;
+			queue->busyUs = 0;
+			queue->drained = 0;
+		}
+	}
+	queue->bytes = bytes;
+	queue->timeUs = nowUs;
+}
+
+// While the window is open the rate is at most what it drained so far and the next few packages, a link which
+// collapsed or stalled is seen from that right away instead of when the window is done.
+uint32_t UplinkQueue::estimate(QueueEstimate *queue, uint32_t bytes, uint64_t nowUs){
+	if(queue->rateTimeUs != 0 && nowUs - queue->rateTimeUs > UPLINK_QUEUE_RATE_MAX_AGE_US){
+		queue->rateTimeUs = 0;
+	}
+	if(bytes == 0){
+		return 0;
+	}
+	uint64_t rate = queue->rate;
+	if(queue->busyUs >= UPLINK_QUEUE_RATE_WINDOW_US){
+		uint64_t bound = (queue->drained + UPLINK_QUEUE_RATE_MIN_BYTES) * 1000000 / queue->busyUs;
+		if(queue->rateTimeUs == 0 || bound < rate){
+			rate = bound;
+		}
+	}else if(queue->rateTimeUs == 0){
+		return 0; // not known yet.
+	}
+	if(rate == 0){
+		return UPLINK_QUEUE_MAX_DELAY_MS;
+	}
+	uint64_t delay = (uint64_t)bytes * 1000 / rate;
+	return (delay > UPLINK_QUEUE_MAX_DELAY_MS) ? UPLINK_QUEUE_MAX_DELAY_MS : (uint32_t)delay;
+}
+
+void UplinkQueue::update(uint64_t nowUs){
+	uint32_t socketDelay = this->estimate(&this->socketQueue, this->socketQueue.bytes, nowUs);
+	uint32_t qdiscDelay = 0;
+	if(this->ifIndex > 0){
+		qdiscDelay = this->estimate(&this->qdiscQueue, this->qdiscQueue.bytes + this->qdiscWritten, nowUs);
+	}
+	this->delayMs = (socketDelay > qdiscDelay) ? socketDelay : qdiscDelay;
+
+	if(this->socketQueue.bytes > this->maxSocketBytes){
+		this->maxSocketBytes = this->socketQueue.bytes;
+	}
+	if(this->qdiscQueue.bytes > this->maxQdiscBytes){
+		this->maxQdiscBytes = this->qdiscQueue.bytes;
+	}
+	if(this->delayMs > this->maxDelayMs){
+		this->maxDelayMs = this->delayMs;
+	}
+}
@@ -0,0 +1,97 @@
+/*
+	uplinkQueue.h
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+
+#ifndef UPLINKQUEUE_H_
+#define UPLINKQUEUE_H_
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h> // bzero
+#include <unistd.h>
+#include <net/if.h> // if_indextoname
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/pkt_sched.h> // TC_H_ROOT, struct tc_stats
+#include <linux/gen_stats.h> // TCA_STATS_QUEUE
+#include "connection.h"
+
+#define UPLINK_QUEUE_MAX_SOCKETS 4
+#define UPLINK_QUEUE_BUFFER_SIZE 4096         // netlink replies.
+#define UPLINK_QUEUE_QDISC_INTERVAL_US 1000   // the qdisc backlog is a netlink round trip, asked once per pacing tick.
+#define UPLINK_QUEUE_RATE_WINDOW_US 10000     // busy time (queue never empty) per drain rate sample ...
+#define UPLINK_QUEUE_RATE_MIN_BYTES 8192      // ... with at least this drained, a slow link frees a package now and then.
+#define UPLINK_QUEUE_RATE_MAX_AGE_US 1000000  // a drain rate not measured for this long is forgotten, the link may be back.
+#define UPLINK_QUEUE_MAX_DELAY_MS 10000
+
+// The queues in the air unit in front of the LTE uplink: what the kernel holds for our sockets (SIOCOUTQ, the socket,
+// qdisc and driver part of our packages) and the backlog of the root qdisc of the outgoing interface (all traffic).
+// While a queue stays non empty the link is busy and the bytes it drains per second is the uplink rate (the socket
+// queue only shrinks between our writes, the qdisc counts the bytes it sent), the delay is the queue divided by that
+// rate. This needs no feedback from the ground, a collapse of the uplink shows after a rate window or two.
+// The modem's own buffer is not seen, but once it is full the driver and qdisc queues grow.
+class UplinkQueue
+{
+	// Public functions
+	public:
+	UplinkQueue();
+	virtual ~UplinkQueue(); //destructor
+
+	void addSocket(Connection *connection); // all sockets on the uplink, their queues are summed.
+	bool findInterface(void); // of the route to the receiver of the first socket, again when the link changed. Returns true on error.
+	void sample(uint64_t nowUs); // before sending, every pass of the main loop.
+	void sent(uint64_t nowUs, uint32_t bytes); // after each package written, the delay grows with it.
+
+	uint32_t getDelayMs(void); // local queue delay estimate, 0 while the queues are empty or the rate is not known.
+	uint32_t getSocketBytes(void); // SIOCOUTQ sum, in the kernel accounting (with the buffer overhead of each package).
+	uint32_t getQdiscBytes(void);
+	uint32_t getDrainRate(void); // bytes/s the qdisc drains, 0 if not known (or no qdisc, the socket rate is in the kernel accounting).
+	void printStatus(FILE *out); // queue sizes and delay for this interval.
+	void clearStatus(void);
+
+	private:
+	struct QueueEstimate{
+		uint32_t bytes;        // at timeUs.
+		uint64_t timeUs;
+		uint64_t busyUs;       // of the rate window.
+		uint64_t drained;
+		uint32_t rate;         // bytes/s.
+		uint64_t rateTimeUs;   // 0 = not known.
+	};
+	Connection *sockets[UPLINK_QUEUE_MAX_SOCKETS];
+	uint32_t socketCount;
+	QueueEstimate socketQueue;
+	QueueEstimate qdiscQueue;
+	uint32_t delayMs;
+
+	int _fd;               // netlink, 0 if not available.
+	uint32_t sequence;
+	int ifIndex;           // 0 = no qdisc backlog.
+	char ifName[IF_NAMESIZE];
+	uint64_t nextQdiscUs;
+	uint64_t qdiscSentBytes; // counter of the qdisc at the last sample.
+	uint32_t qdiscWritten;   // by us since the last sample, in its delay until the next.
+	uint8_t buffer[UPLINK_QUEUE_BUFFER_SIZE];
+
+	// counters for this status interval.
+	uint32_t maxSocketBytes;
+	uint32_t maxQdiscBytes;
+	uint32_t maxDelayMs;
+	uint64_t delaySum;
+	uint32_t samples;
+
+	uint32_t readSocketQueues(void);
+	bool readQdisc(uint32_t &backlog, uint64_t &sentBytes); // root qdisc of ifIndex, returns true if ok.
+	int request(void *message, uint32_t length); // netlink request, returns the reply length (in buffer) or -1.
+	void measure(QueueEstimate *queue, uint32_t bytes, uint64_t drained, uint64_t nowUs);
+	uint32_t estimate(QueueEstimate *queue, uint32_t bytes, uint64_t nowUs); // delay of bytes in the queue in ms.
+	void update(uint64_t nowUs); // delayMs.
+};
+
+#endif /* UPLINKQUEUE_H_ */
@@ -0,0 +1,553 @@
+/*
+	videoFanout.cpp
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+#include "videoFanout.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define VIDEO_FANOUT_PIPE_SIZE (1024*1024) // the maximum without root (/proc/sys/fs/pipe-max-size).
+#define NAL_TYPE_SPS 7
+#define NAL_TYPE_PPS 8
+
+VideoFanout::VideoFanout(){
+	for(uint32_t a=0;a<VIDEO_FANOUT_MAX_SUBSCRIBERS;a++){
+		this->subscribers[a].type = VIDEO_SUBSCRIBER_FREE;
+		this->subscribers[a].fd = -1;
+	}
+	this->headerSize = 0;
+	this->buildingSize = 0;
+	this->headerOpen = false;
+	this->closedDrops = 0;
+	this->closedPackagesDropped = 0;
+	this->closedPackagesSent = 0;
+}
+
+VideoFanout::~VideoFanout(){
+	this->close();
+}
+
+bool VideoFanout::addSubscriber(const char *destination){
+	VideoSubscriber_t *subscriber = this->getFreeSubscriber();
+	if(subscriber == NULL){
+		fprintf(stderr, "VideoFanout: No room for %s, max %u subscribers\n", destination, VIDEO_FANOUT_MAX_SUBSCRIBERS);
+		return true;
+	}
+	bzero(subscriber, sizeof(VideoSubscriber_t));
+	subscriber->fd = -1;
+	subscriber->waitingKeyFrame = true;
+
+	if(strncmp(destination, "fifo:", 5) == 0 || strncmp(destination, "unix:", 5) == 0){
+		const char *path = destination + 5;
+		if(strlen(path) == 0 || strlen(path) >= VIDEO_FANOUT_MAX_PATH){
+			fprintf(stderr, "VideoFanout: Invalid path in %s\n", destination);
+			return true;
+		}
+		strcpy(subscriber->path, path);
+	}
+
+	if(strncmp(destination, "fifo:", 5) == 0){
+		struct stat status;
+		if(stat(subscriber->path, &status) == 0){
+			if(!S_ISFIFO(status.st_mode)){
+				fprintf(stderr, "VideoFanout: %s exists and is not a FIFO\n", subscriber->path);
+				return true;
+			}
+		}else if(mkfifo(subscriber->path, 0666) < 0){
+			fprintf(stderr, "VideoFanout: Unable to create FIFO %s (%s)\n", subscriber->path, strerror(errno));
+			return true;
+		}
+		signal(SIGPIPE, SIG_IGN); // a reader closing the FIFO is a write error, not the end of rx_raw.
+		subscriber->type = VIDEO_SUBSCRIBER_FIFO;
+		this->openFifo(*subscriber); // no reader yet is fine, it is tried again.
+		return false;
+	}
+
+	if(strncmp(destination, "udp:", 4) == 0){
+		char ip[INET_ADDRSTRLEN];
+		const char *port = strrchr(destination + 4, ':');
+		uint32_t ipLength = (port != NULL) ? (uint32_t)(port - (destination + 4)) : 0;
+		if(port == NULL || ipLength == 0 || ipLength >= sizeof(ip) || atoi(port + 1) <= 0 || atoi(port + 1) > 65535){
+			fprintf(stderr, "VideoFanout: Invalid destination %s, use udp:<ip>:<port>\n", destination);
+			return true;
+		}
+		memcpy(ip, destination + 4, ipLength);
+		ip[ipLength] = 0;
+		subscriber->address.sin_family = AF_INET;
+		subscriber->address.sin_port = htons((uint16_t)atoi(port + 1));
+		if(inet_pton(AF_INET, ip, &subscriber->address.sin_addr) != 1){
+			fprintf(stderr, "VideoFanout: Invalid IP in %s\n", destination);
+			return true;
+		}
+		int fd = socket(AF_INET, SOCK_DGRAM, 0);
+		if(fd < 0){
+			fprintf(stderr, "VideoFanout: Unable to create socket (%s)\n", strerror(errno));
+			return true;
+		}
+		if(IN_MULTICAST(ntohl(subscriber->address.sin_addr.s_addr))){
+			int ttl = VIDEO_FANOUT_MULTICAST_TTL;
+			setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+		}
+		// Not connected, an ICMP port unreachable from a unicast destination without a receiver is not an error.
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		subscriber->fd = fd;
+		subscriber->type = VIDEO_SUBSCRIBER_UDP;
+		return false;
+	}
+
+	if(strncmp(destination, "unix:", 5) == 0){
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(fd < 0){
+			fprintf(stderr, "VideoFanout: Unable to create socket (%s)\n", strerror(errno));
+			return true;
+		}
+		struct sockaddr_un address;
+		bzero(&address, sizeof(address));
+		address.sun_family = AF_UNIX;
+		strcpy(address.sun_path, subscriber->path);
+		unlink(subscriber->path); // left by the last run.
+		if(bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(fd, VIDEO_FANOUT_MAX_SUBSCRIBERS) < 0){
+			fprintf(stderr, "VideoFanout: Unable to listen on %s (%s)\n", subscriber->path, strerror(errno));
+			::close(fd);
+			return true;
+		}
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		subscriber->fd = fd;
+		subscriber->type = VIDEO_SUBSCRIBER_UNIX_LISTEN;
+		return false;
+	}
+
+	fprintf(stderr, "VideoFanout: Unknown destination %s, use fifo:<path>, udp:<ip>:<port> or unix:<path>\n", destination);
+	return true;
+}
+
+int VideoFanout::setFD_SET(fd_set *readSet, fd_set *writeSet){
+	int maxFd = 0;
+	for(uint32_t a=0;a<VIDEO_FANOUT_MAX_SUBSCRIBERS;a++){
+		VideoSubscriber_t &subscriber = this->subscribers[a];
+		if(subscriber.type == VIDEO_SUBSCRIBER_FREE || subscriber.fd < 0){
+			continue;
+		}
+		if(subscriber.type == VIDEO_SUBSCRIBER_UNIX_LISTEN || subscriber.type == VIDEO_SUBSCRIBER_UNIX){
+			FD_SET(subscriber.fd, readSet); // new connections, and a closed connection reads 0.
+		}
+		if(subscriber.queueSize > 0 || subscriber.headerOffset < subscriber.headerSize){
+			FD_SET(subscriber.fd, writeSet);
+		}
+		maxFd = (subscriber.fd > maxFd) ? subscriber.fd : maxFd;
+	}
+	return maxFd;
+}
+
+void VideoFanout::service(fd_set *readSet, fd_set *writeSet, uint64_t nowMs){
+	for(uint32_t a=0;a<VIDEO_FANOUT_MAX_SUBSCRIBERS;a++){
+		VideoSubscriber_t &subscriber = this->subscribers[a];
+		if(subscriber.type == VIDEO_SUBSCRIBER_FIFO && subscriber.fd < 0 && nowMs >= subscriber.nextOpenMs){
+			if(this->openFifo(subscriber)){
+				subscriber.nextOpenMs = nowMs + VIDEO_FANOUT_RETRY_MS;
+			}
+			continue;
+		}
+		if(subscriber.fd < 0){
+			continue;
+		}
+		if(FD_ISSET(subscriber.fd, readSet)){
+			if(subscriber.type == VIDEO_SUBSCRIBER_UNIX_LISTEN){
+				this->acceptUnix(subscriber);
+				continue;
+			}else if(subscriber.type == VIDEO_SUBSCRIBER_UNIX){
+				uint8_t buffer[256];
+				int result = recv(subscriber.fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+				if(result == 0 || (result < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)){
+					this->disconnect(subscriber);
+					continue;
+				}
+			}
+		}
+		if(FD_ISSET(subscriber.fd, writeSet)){ // room again for the queue left by flush().
+			this->flushSubscriber(subscriber);
+		}
+	}
+}
+
+void VideoFanout::inputPackage(H264UDPPackage *package){
+	this->updateHeader(package);
+	for(uint32_t a=0;a<VIDEO_FANOUT_MAX_SUBSCRIBERS;a++){
+		VideoSubscriber_t &subscriber = this->subscribers[a];
+		if(subscriber.fd < 0 || subscriber.type == VIDEO_SUBSCRIBER_FREE || subscriber.type == VIDEO_SUBSCRIBER_UNIX_LISTEN){
+			continue;
+		}
+		this->queuePackage(subscriber, package);
+	}
+}
+
+void VideoFanout::flush(void){
+	for(uint32_t a=0;a<VIDEO_FANOUT_MAX_SUBSCRIBERS;a++){
+		this->flushSubscriber(this->subscribers[a]);
+	}
+}
+
+void VideoFanout::close(void){
+	for(uint32_t a=0;a<VIDEO_FANOUT_MAX_SUBSCRIBERS;a++){
+		VideoSubscriber_t &subscriber = this->subscribers[a];
+		if(subscriber.type == VIDEO_SUBSCRIBER_FREE){
+			continue;
+		}
+		this->dropQueue(subscriber);
+		if(subscriber.fd >= 0){
+			::close(subscriber.fd);
+		}
+		if(subscriber.type == VIDEO_SUBSCRIBER_UNIX_LISTEN){
+			unlink(subscriber.path);
+		}
+		subscriber.fd = -1;
+		subscriber.type = VIDEO_SUBSCRIBER_FREE;
+	}
+}
+
+uint32_t VideoFanout::getSubscribers(void){
+	uint32_t count=0;
+	for(uint32_t a=0;a<VIDEO_FANOUT_MAX_SUBSCRIBERS;a++){
+		if(this->subscribers[a].type != VIDEO_SUBSCRIBER_FREE && this->subscribers[a].type != VIDEO_SUBSCRIBER_UNIX_LISTEN){
+			count++;
+		}
+	}
+	return count;
+}
+
+uint32_t VideoFanout::getConnected(void){
+	uint32_t count=0;
+	for(uint32_t a=0;a<VIDEO_FANOUT_MAX_SUBSCRIBERS;a++){
+		if(this->subscribers[a].type != VIDEO_SUBSCRIBER_FREE && this->subscribers[a].type != VIDEO_SUBSCRIBER_UNIX_LISTEN && this->subscribers[a].fd >= 0){
+			count++;
+		}
+	}
+	return count;
+}
+
+uint64_t VideoFanout::getPackagesSent(void){
+	uint64_t count=this->closedPackagesSent;
+	for(uint32_t a=0;a<VIDEO_FANOUT_MAX_SUBSCRIBERS;a++){
+		count += this->subscribers[a].packagesSent;
+	}
+	return count;
+}
+
+uint32_t VideoFanout::getDrops(void){
+	uint32_t count=this->closedDrops;
+	for(uint32_t a=0;a<VIDEO_FANOUT_MAX_SUBSCRIBERS;a++){
+		count += this->subscribers[a].drops;
+	}
+	return count;
+}
+
+uint32_t VideoFanout::getPackagesDropped(void){
+	uint32_t count=this->closedPackagesDropped;
+	for(uint32_t a=0;a<VIDEO_FANOUT_MAX_SUBSCRIBERS;a++){
+		count += this->subscribers[a].packagesDropped;
+	}
+	return count;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+////////////////////////// Private Helper functions //////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+VideoSubscriber_t* VideoFanout::getFreeSubscriber(void){
+	for(uint32_t a=0;a<VIDEO_FANOUT_MAX_SUBSCRIBERS;a++){
+		if(this->subscribers[a].type == VIDEO_SUBSCRIBER_FREE){
+			return &this->subscribers[a];
+		}
+	}
+	return NULL;
+}
+
+// Without a reader open() fails with ENXIO, rx_raw never waits for one.
+bool VideoFanout::openFifo(VideoSubscriber_t &subscriber){
+	int fd = open(subscriber.path, O_WRONLY | O_NONBLOCK);
+	if(fd < 0){
+		if(errno != ENXIO){
+			fprintf(stderr, "VideoFanout: Unable to open FIFO %s (%s)\n", subscriber.path, strerror(errno));
+		}
+		return true;
+	}
+	fcntl(fd, F_SETPIPE_SZ, VIDEO_FANOUT_PIPE_SIZE);
+	subscriber.fd = fd;
+	subscriber.waitingKeyFrame = true;
+	fprintf(stderr, "VideoFanout: reader on %s, starting at the next keyframe\n", subscriber.path);
+	return false;
+}
+
+void VideoFanout::acceptUnix(VideoSubscriber_t &listener){
+	int fd = accept(listener.fd, NULL, NULL);
+	if(fd < 0){
+		return;
+	}
+	VideoSubscriber_t *subscriber = this->getFreeSubscriber();
+	if(subscriber == NULL){
+		fprintf(stderr, "VideoFanout: Connection to %s refused, max %u subscribers\n", listener.path, VIDEO_FANOUT_MAX_SUBSCRIBERS);
+		::close(fd);
+		return;
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	bzero(subscriber, sizeof(VideoSubscriber_t));
+	subscriber->type = VIDEO_SUBSCRIBER_UNIX;
+	subscriber->fd = fd;
+	strcpy(subscriber->path, listener.path);
+	subscriber->waitingKeyFrame = true;
+	fprintf(stderr, "VideoFanout: connection on %s, starting at the next keyframe\n", listener.path);
+}
+
+void VideoFanout::queuePackage(VideoSubscriber_t &subscriber, H264UDPPackage *package){
+	if(subscriber.queueSize >= VIDEO_FANOUT_QUEUE_PACKAGES){
+		// Too slow (or stopped reading), what is queued is too old to catch up on.
+		subscriber.drops++;
+		subscriber.packagesDropped += subscriber.queueSize;
+		this->dropQueue(subscriber);
+		subscriber.waitingKeyFrame = true;
+		fprintf(stderr, "VideoFanout: %s is %u packages behind, continues at the next keyframe\n",
+			(subscriber.type == VIDEO_SUBSCRIBER_UDP) ? inet_ntoa(subscriber.address.sin_addr) : subscriber.path, VIDEO_FANOUT_QUEUE_PACKAGES);
+	}
+	if(subscriber.waitingKeyFrame){
+		if(!package->isNewKeyFrame()){
+			return;
+		}
+		subscriber.waitingKeyFrame = false;
+		memcpy(subscriber.header, this->header, this->headerSize);
+		subscriber.headerSize = this->headerSize;
+		subscriber.headerOffset = 0;
+	}
+	package->retain();
+	subscriber.queue[(subscriber.queueHead + subscriber.queueSize) % VIDEO_FANOUT_QUEUE_PACKAGES] = package;
+	subscriber.queueSize++;
+}
+
+// A package being written is dropped too, the SPS that follows starts with a start code so the reader resyncs.
+void VideoFanout::dropQueue(VideoSubscriber_t &subscriber){
+	for(uint32_t a=0;a<subscriber.queueSize;a++){
+		subscriber.queue[(subscriber.queueHead + a) % VIDEO_FANOUT_QUEUE_PACKAGES]->release();
+	}
+	subscriber.queueHead = 0;
+	subscriber.queueSize = 0;
+	subscriber.offset = 0;
+	subscriber.headerSize = 0;
+	subscriber.headerOffset = 0;
+}
+
+void VideoFanout::flushSubscriber(VideoSubscriber_t &subscriber){
+	if(subscriber.fd < 0 || (subscriber.queueSize == 0 && subscriber.headerOffset == subscriber.headerSize)){
+		return;
+	}
+	if(subscriber.type == VIDEO_SUBSCRIBER_UDP){
+		this->sendDatagrams(subscriber);
+	}else if(subscriber.type == VIDEO_SUBSCRIBER_FIFO || subscriber.type == VIDEO_SUBSCRIBER_UNIX){
+		this->sendStream(subscriber);
+	}
+}
+
+// FIFO and unix socket: the header and the queued payloads in one writev / sendmsg, straight from the pool.
+void VideoFanout::sendStream(VideoSubscriber_t &subscriber){
+	while(subscriber.queueSize > 0 || subscriber.headerOffset < subscriber.headerSize){
+		struct iovec iov[VIDEO_FANOUT_BATCH + 1];
+		uint32_t count = 0;
+		uint32_t headerLeft = subscriber.headerSize - subscriber.headerOffset;
+		if(headerLeft > 0){
+			iov[count].iov_base = &subscriber.header[subscriber.headerOffset];
+			iov[count].iov_len = headerLeft;
+			count++;
+		}
+		uint32_t packages = (subscriber.queueSize < VIDEO_FANOUT_BATCH) ? subscriber.queueSize : VIDEO_FANOUT_BATCH;
+		for(uint32_t a=0;a<packages;a++){
+			H264UDPPackage *package = subscriber.queue[(subscriber.queueHead + a) % VIDEO_FANOUT_QUEUE_PACKAGES];
+			uint32_t skip = (a == 0) ? subscriber.offset : 0;
+			iov[count].iov_base = package->getPayload() + skip;
+			iov[count].iov_len = package->getPayloadSize() - skip;
+			count++;
+		}
+		ssize_t result;
+		if(subscriber.type == VIDEO_SUBSCRIBER_UNIX){
+			struct msghdr message;
+			bzero(&message, sizeof(message));
+			message.msg_iov = iov;
+			message.msg_iovlen = count;
+			result = sendmsg(subscriber.fd, &message, MSG_NOSIGNAL | MSG_DONTWAIT);
+		}else{
+			result = writev(subscriber.fd, iov, count);
+		}
+		if(result < 0){
+			if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR){
+				this->disconnect(subscriber);
+			}
+			return;
+		}
+		subscriber.bytesSent += result;
+		uint32_t written = (uint32_t)result;
+		if(headerLeft > 0){
+			uint32_t used = (written < headerLeft) ? written : headerLeft;
+			subscriber.headerOffset += used;
+			written -= used;
+		}
+		while(written > 0 && subscriber.queueSize > 0){
+			H264UDPPackage *package = subscriber.queue[subscriber.queueHead];
+			uint32_t left = package->getPayloadSize() - subscriber.offset;
+			if(written < left){
+				subscriber.offset += written;
+				return; // the pipe / socket is full.
+			}
+			written -= left;
+			package->release();
+			subscriber.offset = 0;
+			subscriber.queueHead = (subscriber.queueHead + 1) % VIDEO_FANOUT_QUEUE_PACKAGES;
+			subscriber.queueSize--;
+			subscriber.packagesSent++;
+		}
+	}
+}
+
+// UDP: a datagram per package like the video port to QOpenHD, up to VIDEO_FANOUT_BATCH in one sendmmsg.
+void VideoFanout::sendDatagrams(VideoSubscriber_t &subscriber){
+	if(subscriber.headerOffset < subscriber.headerSize){
+		if(sendto(subscriber.fd, subscriber.header, subscriber.headerSize, MSG_DONTWAIT, (struct sockaddr *)&subscriber.address, sizeof(subscriber.address)) < 0){
+			if(errno == EAGAIN || errno == EWOULDBLOCK){
+				return;
+			}
+		}
+		subscriber.headerOffset = subscriber.headerSize;
+	}
+	while(subscriber.queueSize > 0){
+		struct mmsghdr messages[VIDEO_FANOUT_BATCH];
+		struct iovec iov[VIDEO_FANOUT_BATCH];
+		uint32_t count = (subscriber.queueSize < VIDEO_FANOUT_BATCH) ? subscriber.queueSize : VIDEO_FANOUT_BATCH;
+		bzero(messages, sizeof(struct mmsghdr) * count);
+		for(uint32_t a=0;a<count;a++){
+			H264UDPPackage *package = subscriber.queue[(subscriber.queueHead + a) % VIDEO_FANOUT_QUEUE_PACKAGES];
+			iov[a].iov_base = package->getPayload();
+			iov[a].iov_len = package->getPayloadSize();
+			messages[a].msg_hdr.msg_iov = &iov[a];
+			messages[a].msg_hdr.msg_iovlen = 1;
+			messages[a].msg_hdr.msg_name = &subscriber.address;
+			messages[a].msg_hdr.msg_namelen = sizeof(subscriber.address);
+		}
+		int sent = sendmmsg(subscriber.fd, messages, count, MSG_DONTWAIT);
+		if(sent < 0){
+			if(errno == EAGAIN || errno == EWOULDBLOCK){
+				return; // the socket buffer is full, select() tells when there is room.
+			}
+			sent = 1; // e.g. no route to the destination, the package is lost like on the link.
+		}else{
+			for(int a=0;a<sent;a++){
+				subscriber.bytesSent += messages[a].msg_len;
+			}
+			subscriber.packagesSent += sent;
+		}
+		for(int a=0;a<sent;a++){
+			subscriber.queue[subscriber.queueHead]->release();
+			subscriber.queueHead = (subscriber.queueHead + 1) % VIDEO_FANOUT_QUEUE_PACKAGES;
+			subscriber.queueSize--;
+		}
+	}
+}
+
+// The FIFO is opened again when there is a new reader, a unix connection is gone.
+void VideoFanout::disconnect(VideoSubscriber_t &subscriber){
+	fprintf(stderr, "VideoFanout: reader on %s is gone\n", subscriber.path);
+	this->dropQueue(subscriber);
+	::close(subscriber.fd);
+	subscriber.fd = -1;
+	subscriber.waitingKeyFrame = true;
+	if(subscriber.type == VIDEO_SUBSCRIBER_UNIX){
+		this->closedDrops += subscriber.drops;
+		this->closedPackagesDropped += subscriber.packagesDropped;
+		this->closedPackagesSent += subscriber.packagesSent;
+		bzero(&subscriber, sizeof(VideoSubscriber_t));
+		subscriber.type = VIDEO_SUBSCRIBER_FREE;
+		subscriber.fd = -1;
+	}else{
+		subscriber.nextOpenMs = 0;
+	}
+}
+
+// Keeps the latest SPS / PPS, a subscriber starting on a keyframe gets them first. tx_raw puts them at the end of the
+// package before the keyframe, when they do not fit they continue in the next package.
+void VideoFanout::updateHeader(H264UDPPackage *package){
+	const uint8_t *data = package->getPayload();
+	uint32_t length = package->getPayloadSize();
+	bool copying = this->headerOpen;
+	uint32_t copyFrom = 0;
+
+	if(copying && length > 0){
+		// The start code after the PPS can be split between the packages.
+		uint32_t zeros = 0;
+		while(zeros < this->buildingSize && zeros < 3 && this->building[this->buildingSize - 1 - zeros] == 0x00){
+			zeros++;
+		}
+		uint32_t lead = 0;
+		while(lead < length && lead < 3 && data[lead] == 0x00){
+			lead++;
+		}
+		if(zeros > 0 && zeros + lead >= 2 && lead + 1 < length && data[lead] == 0x01){
+			uint8_t type = data[lead + 1] & 0x1F;
+			if(type != NAL_TYPE_SPS && type != NAL_TYPE_PPS){
+				this->buildingSize -= zeros;
+				this->finishHeader();
+				copying = false;
+			}
+		}
+	}
+
+	const uint8_t *position = data;
+	const uint8_t *end = data + length;
+	while(position < end){
+		const uint8_t *startCode = (const uint8_t *)memmem(position, end - position, "\x00\x00\x01", 3);
+		if(startCode == NULL || startCode + 3 >= end){
+			break;
+		}
+		uint8_t type = startCode[3] & 0x1F;
+		uint32_t at = (uint32_t)(startCode - data);
+		uint32_t nalStart = (at > 0 && data[at - 1] == 0x00) ? at - 1 : at; // 4 byte start code.
+		if(type == NAL_TYPE_SPS || type == NAL_TYPE_PPS){
+			if(!copying && type == NAL_TYPE_SPS){
+				copying = true;
+				copyFrom = nalStart;
+				this->buildingSize = 0;
+			}
+		}else if(copying){
+			this->appendHeader(&data[copyFrom], nalStart - copyFrom);
+			this->finishHeader();
+			copying = false;
+		}
+		position = startCode + 3;
+	}
+	if(copying){
+		copying = !this->appendHeader(&data[copyFrom], length - copyFrom);
+	}
+	this->headerOpen = copying;
+}
+
+bool VideoFanout::appendHeader(const uint8_t *data, uint32_t length){
+	if(this->buildingSize + length > VIDEO_FANOUT_MAX_HEADER){
+		this->buildingSize = 0; // not a parameter set, keep the last one.
+		return true;
+	}
+	memcpy(&this->building[this->buildingSize], data, length);
+	this->buildingSize += length;
+	return false;
+}
+
+void VideoFanout::finishHeader(void){
+	if(this->buildingSize > 0){
+		memcpy(this->header, this->building, this->buildingSize);
+		this->headerSize = this->buildingSize;
+	}
+	this->buildingSize = 0;
+}
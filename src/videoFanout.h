@@ -0,0 +1,108 @@
+/*
+	videoFanout.h
+
+	Copyright (c) 2021 Lagoni
+	Not for commercial use
+ */
+
+#ifndef VIDEOFANOUT_H_
+#define VIDEOFANOUT_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h> // bzero
+#include <netinet/in.h>
+#include <sys/select.h>
+#include "h264UDPPackage.h"
+
+#define VIDEO_FANOUT_MAX_SUBSCRIBERS 8
+#define VIDEO_FANOUT_QUEUE_PACKAGES 1024   // per subscriber, ~0.5s of a 20Mbit/s stream held from the H264 pool.
+#define VIDEO_FANOUT_BATCH 64              // packages per writev() / sendmmsg().
+#define VIDEO_FANOUT_MAX_HEADER 256        // SPS / PPS sent before the keyframe a subscriber starts on.
+#define VIDEO_FANOUT_RETRY_MS 1000         // a FIFO without reader is opened again after this time.
+#define VIDEO_FANOUT_MAX_PATH 108          // sun_path.
+#define VIDEO_FANOUT_MULTICAST_TTL 1       // multicast stays on the ground station LAN.
+
+enum VideoSubscriberType_t{
+	VIDEO_SUBSCRIBER_FREE=0,
+	VIDEO_SUBSCRIBER_FIFO,        // fifo:<path>, created if missing, the reader can come and go.
+	VIDEO_SUBSCRIBER_UDP,         // udp:<ip>:<port>, unicast or multicast, a datagram per package.
+	VIDEO_SUBSCRIBER_UNIX_LISTEN, // unix:<path>, not a subscriber itself, every connection to it is one.
+	VIDEO_SUBSCRIBER_UNIX
+};
+
+typedef struct {
+	VideoSubscriberType_t type;
+	int fd;                                         // -1 while a FIFO has no reader.
+	char path[VIDEO_FANOUT_MAX_PATH];
+	struct sockaddr_in address;                     // UDP.
+	H264UDPPackage *queue[VIDEO_FANOUT_QUEUE_PACKAGES]; // retained packages from the H264 pool, not copies.
+	uint32_t queueHead;                             // oldest package.
+	uint32_t queueSize;
+	uint32_t offset;                                // bytes of the oldest package already written (FIFO / unix).
+	bool waitingKeyFrame;                           // started (or fell behind), takes packages from the next keyframe.
+	uint8_t header[VIDEO_FANOUT_MAX_HEADER];        // SPS / PPS to send first.
+	uint16_t headerSize;
+	uint16_t headerOffset;
+	uint64_t nextOpenMs;
+	uint64_t packagesSent;
+	uint64_t bytesSent;
+	uint32_t drops;                                 // times it was moved to the next keyframe.
+	uint32_t packagesDropped;
+} VideoSubscriber_t;
+
+// Subscribers of the video rx_raw receives, next to stdout: FIFOs, UDP unicast / multicast destinations and local
+// (unix) sockets, instead of chaining tee / cat processes which each copy every byte. The packages are not copied,
+// every subscriber retains the H264UDPPackage from the H264RXFraming pool in its own bounded queue, and it goes
+// back to the pool when the last subscriber has sent it. Single threaded, rx_raw adds the sockets to its select().
+// A subscriber starts on a keyframe, and when its queue is full (the reader is too slow or gone) the queue is
+// dropped and it continues on the next keyframe, without holding back the other subscribers or stdout.
+class VideoFanout
+{
+	// Public functions
+	public:
+	VideoFanout();
+	virtual ~VideoFanout(); //destructor
+
+	bool addSubscriber(const char *destination); // fifo:<path>, udp:<ip>:<port> or unix:<path>, returns true on error.
+	int setFD_SET(fd_set *readSet, fd_set *writeSet); // returns the highest fd added.
+	void service(fd_set *readSet, fd_set *writeSet, uint64_t nowMs); // after select().
+
+	void inputPackage(H264UDPPackage *package); // whole frames in order, as H264RXFraming outputs them.
+	void flush(void); // send what the subscribers can take now.
+	void close(void);
+
+	uint32_t getSubscribers(void);   // FIFOs, UDP destinations and connected unix sockets.
+	uint32_t getConnected(void);     // of these, the ones with a reader.
+	uint64_t getPackagesSent(void);  // to all subscribers.
+	uint32_t getDrops(void);         // times a subscriber was moved to the next keyframe.
+	uint32_t getPackagesDropped(void);
+
+	private:
+	VideoSubscriber_t subscribers[VIDEO_FANOUT_MAX_SUBSCRIBERS];
+	uint8_t header[VIDEO_FANOUT_MAX_HEADER]; // latest SPS / PPS in the stream.
+	uint16_t headerSize;
+	uint8_t building[VIDEO_FANOUT_MAX_HEADER]; // SPS / PPS being found, can span two packages.
+	uint32_t buildingSize;
+	bool headerOpen;
+	uint32_t closedDrops;            // counters of unix subscribers which are gone.
+	uint32_t closedPackagesDropped;
+	uint64_t closedPackagesSent;
+
+	VideoSubscriber_t* getFreeSubscriber(void);
+	bool openFifo(VideoSubscriber_t &subscriber);
+	void acceptUnix(VideoSubscriber_t &listener);
+	void queuePackage(VideoSubscriber_t &subscriber, H264UDPPackage *package);
+	void dropQueue(VideoSubscriber_t &subscriber); // releases the queued packages.
+	void flushSubscriber(VideoSubscriber_t &subscriber); // sends what it can take now.
+	void sendStream(VideoSubscriber_t &subscriber);
+	void sendDatagrams(VideoSubscriber_t &subscriber);
+	void disconnect(VideoSubscriber_t &subscriber);
+	void updateHeader(H264UDPPackage *package);
+	bool appendHeader(const uint8_t *data, uint32_t length); // returns true if too large.
+	void finishHeader(void);
+};
+
+#endif /* VIDEOFANOUT_H_ */
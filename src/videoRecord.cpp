@@ -19,6 +19,9 @@
 #include <chrono> // Crone time measure
 #include <ctime>
 #include "connection.h"
+#include "mavlinkFrameParser.h"
+#include "mp4Recorder.h"
+#include "recordIndex.h"
 
 //Video record to file
 #include <fstream>
@@ -30,26 +33,11 @@
 
 #define LOG_INTERVAL_SEC 30
 
-#define BUFFER_SIZE 1024
+#define BUFFER_SIZE 65536
 
 #define MAX_FILE_SIZE 2136997888 //(2GB-10MB)
 //#define MAX_FILE_SIZE 1024*1024 // (1MB) for testing.
 
-#define SPS_HEADER_SIZE 15
-#define SPS_HEADER_CODE 0x27
-#define PPS_HEADER_SIZE 4
-#define PPS_HEADER_CODE 0x28
-#define P_HEADER_CODE 0x25 // Keyframe
-
-typedef struct { // 27, 28, 25 (keyframe) 21 (I-frame)
-	char SPSHeader[SPS_HEADER_SIZE];
-	bool SPSHeaderFound;
-	char PPSHeader[PPS_HEADER_SIZE];
-	bool PPSHeaderFound;
-	uint32_t bytesRecorded;
-	bool fileCreated;
-} videoStream_t;
-
 
 int max(int x, int y)
 {
@@ -61,16 +49,26 @@ int max(int x, int y)
 
 int flagHelp = 0;
 
+uint64_t timeMicrosec() {
+	using namespace std::chrono;
+	return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
 void usage(void) {
 	printf("\nUsage: videoRecord [options]\n"
 	"\n"
 	"Options:\n"
 	"-p  <port>     Port for input Mavlink data (only record when armed).\n"
-	"-f  <filename> Path+Filename to record.\n"
+	"-f  <filename> Path+Filename to record, files are named <UTC date>_<filename>.mp4 (fragmented MP4).\n"
+	"               Each file gets a <UTC date>_<filename>.idx with the keyframe offsets and the position / armed track.\n"
+	"-r  <fps>      Fixed frame rate for the MP4 timestamps (default from the stream, else the arrival times).\n"
+	"-P  <s>[,<MB>] Keep the last <s> seconds of video (max <MB>, default 16) while disarmed, written first when armed.\n"
 	"\n"
 	"Example:\n"
-	"[video pipe] | ./videoRecord -p 6000 -f demo.h264 (record when armed) \n"
-	"[video pipe] | ./videoRecord -f demo.h264 (record all)\n"
+	"[video pipe] | ./videoRecord -p 6000 -f demo (record when armed) \n"
+	"[video pipe] | ./videoRecord -f demo (record all)\n"
+	"[video pipe] | ./videoRecord -f demo -r 30\n"
+	"[video pipe] | ./videoRecord -p 6000 -f demo -P 10,32 (recording starts 10s before arming)\n"
 	"\n");
 	exit(1);
 }
@@ -80,6 +78,9 @@ int main(int argc, char *argv[])
 	char *p;
 	int mavlinkPort= 0; 
 	char *filename;
+	uint32_t frameRate=0;
+	uint32_t preRecordSeconds=0;
+	uint32_t preRecordMB=MP4_DEFAULT_PRE_RECORD_MB;
 		
     while (1) {
 	    int nOptionIndex;
@@ -87,7 +88,7 @@ int main(int argc, char *argv[])
 		    { "help", no_argument, &flagHelp, 1 },
 		    {      0,           0,         0, 0 }
 	    };
-	    int c = getopt_long(argc, argv, "h:p:f:", optiona, &nOptionIndex);
+	    int c = getopt_long(argc, argv, "h:p:f:r:P:", optiona, &nOptionIndex);
 	    if (c == -1) {
 		    break;
 	    }
@@ -115,6 +116,19 @@ int main(int argc, char *argv[])
 				break;
 			}
 
+			case 'r': {
+				frameRate = (uint32_t)atoi(optarg);
+				break;
+			}
+
+			case 'P': {
+				preRecordSeconds = (uint32_t)atoi(optarg);
+				if(strchr(optarg, ',') != NULL){
+					preRecordMB = (uint32_t)atoi(strchr(optarg, ',') + 1);
+				}
+				break;
+			}
+
 		    default: {
 			    fprintf(stderr, "Video Record: unknown input parameter switch %c\n", c);
 			    usage();
@@ -143,9 +157,9 @@ int main(int argc, char *argv[])
 	int nready;
 
 	//Mavlink parser and serial:
-	mavlink_status_t status;
+	static MavlinkFrameParser mavlinkParser;
+	MavlinkFrame_t frame;
 	mavlink_message_t msg;
-	int chan = MAVLINK_COMM_0;
 
 	bool armed=false;
 	//Mavlink log
@@ -158,16 +172,23 @@ int main(int argc, char *argv[])
 		armed=true;
 	}
 
-	videoStream_t recordStream; // 0x27 First header in h.264 stream
-	bzero(&recordStream, sizeof(recordStream));
-
-	// Record file:
-	uint8_t fileNumber = 0;
-	char recordename[50];
-	char mp4name[50];
-
-//	sprintf(recordename,"%s%d.h264",filename,fileNumber);
-	std::ofstream* videoRecordFile = NULL;// new std::ofstream(recordename,std::ofstream::binary);
+	// Record file, fragmented MP4 written directly (no ffmpeg afterwards):
+	static Mp4Recorder recorder;
+	if(recorder.setFileName(filename, true)){
+		exit(1);
+	}
+	recorder.setFrameRate(frameRate);
+	recorder.setMaxFileSize(MAX_FILE_SIZE);
+	recorder.setSyncFragments(true); // every GOP is on the SD card, a power loss only costs the last one.
+	static RecordIndex recordIndex; // keyframe index and telemetry sidecar next to every file.
+	recordIndex.setArmed(timeMicrosec(), armed);
+	recorder.setIndex(&recordIndex);
+	if(recorder.setPreRecord(preRecordSeconds, preRecordMB*1024*1024)){
+		exit(1);
+	}
+	if(preRecordSeconds > 0){
+		fprintf(stderr, "Video Record: Keeping %us (max %uMB) of video before arming\n", preRecordSeconds, preRecordMB);
+	}
 
 	// Make FIFO for video
 	// Creating the named file(FIFO)
@@ -210,7 +231,6 @@ int main(int argc, char *argv[])
 	*/
 	// start G-streamer record from /dev/video0 (CSI-HDMI) to FIFO
 	// gst-launch-1.0 v4l2src ! "video/x-raw,framerate=30/1,format=UYVY" ! v4l2h264enc extra-controls="controls,h264_profile=4,h264_level=13,video_bitrate=5000000;" ! video/x-h264,profile=high ! h264parse ! filesink location=/run/videofifo
-	char command[500];
 //	snprintf(command, 300, "gst-launch-1.0 v4l2src device=/dev/video0 ! \"video/x-raw,framerate=30/1,format=UYVY\" ! v4l2h264enc extra-controls=\"controls,h264_profile=4,h264_level=13,video_bitrate=5000000;\" ! video/x-h264,profile=high ! h264parse ! filesink location=%s &", videofifo);
 //	snprintf(command, 500, "gst-launch-1.0 v4l2src device=/dev/video0 ! \"video/x-raw,framerate=30/1,format=UYVY\" ! v4l2h264enc extra-controls=\"controls,h264_profile=4,h264_level=13,video_bitrate=5000000;\" ! video/x-h264,profile=high ! h264parse ! tee name=t ! queue ! rtspclientsink location=rtsp://192.168.0.200:8554/mystream t. ! queue ! filesink location=%s &", videofifo);
 
@@ -248,53 +268,53 @@ int main(int argc, char *argv[])
 		
 		
 			
-		if (FD_ISSET(mavlinkConnection.getFD(), &read_set)) { // Data from Mavlink UDP.
+		if (mavlinkConnection.isFD_SET(&read_set)) { // Data from Mavlink UDP.
 			//			printf("Data from Ground (Mavlink)!\n\r");
 			int result = 0;
-			result = mavlinkConnection.readData(inputBuffer, BUFFER_SIZE);
-			if (result < 0 || result > BUFFER_SIZE) {
+			uint32_t freeSize = mavlinkParser.getInputBufferFreeSize();
+			result = mavlinkConnection.readData(mavlinkParser.getInputBuffer(), freeSize);
+			if (result < 0 || (uint32_t)result > freeSize) {
 				fprintf(stderr, "Video Record: Error! on reading STD_IN (pipe input)... Terminate program.\n");
 				exit(1);
 			}else  if(result == 0){
 				// None blocking, nothing to read.
 			}else {
 				// Parse mavlink and get armed state.
-				uint16_t index=0;
-				while(result>0){
-					result--;
-					uint8_t byte=inputBuffer[index];
-					index++;
-					if (mavlink_parse_char(chan, byte, &msg, &status)){
-						// Keep track on ARM / DISARMED for recording purporse. Status can be found in HEARTBEAT (MSG=0) from FC:
-						if(msg.msgid == 0){
-							mavlink_heartbeat_t newmsg;
-							mavlink_msg_heartbeat_decode(&msg, &newmsg);
-
-							if(true==armed && !(newmsg.base_mode & MAV_MODE_FLAG_SAFETY_ARMED)){
-								fprintf(stderr, "Video Record: Drone no longer armed, stop recording on next key frame.\n");
-							}else if(false==armed && (newmsg.base_mode & MAV_MODE_FLAG_SAFETY_ARMED)){
-								fprintf(stderr, "Video Record: Drone is now armed!\n");
-							}
-							armed = newmsg.base_mode & MAV_MODE_FLAG_SAFETY_ARMED;
-						}
-						//fprintf(stderr, "Mavlink MSG: %d\n", msg.msgid);
-						if(msg.msgid == MAVLINK_MSG_ID_GLOBAL_POSITION_INT){ //#33
-							//fprintf(stderr, "Mavlink MSG: %d\n", msg.msgid);
-							mavlink_global_position_int_t newmsg;
-							mavlink_msg_global_position_int_decode(&msg, &newmsg);
-							latitude =  ((float)newmsg.lat)/10000000;
-							longitude = ((float)newmsg.lon)/10000000;
-							altitudeMSL = ((float)newmsg.alt)/1000;
-							altitude = ((float)newmsg.alt)/1000;
-							fprintf(stderr, "Last known drone position: (%.6f;%.6f) Altitude (MSL):%.0f [meters] Altitude (above ground):%.0f [meters]",latitude,longitude, altitudeMSL, altitude);
-							//fprintf(stderr, "Last known drone position: %.6f",latitude);
-							if(true==armed){			
-								fprintf(stderr, " FC=ARMED\n");							
-							}else{
-								fprintf(stderr, " FC=DISARMED\n");							
-							}	
+				mavlinkParser.setData(result);
+				while(mavlinkParser.nextFrame(frame)){
+					// Keep track on ARM / DISARMED for recording purporse. Status can be found in HEARTBEAT (MSG=0) from FC:
+					if(frame.msgid == MAVLINK_MSG_ID_HEARTBEAT){
+						mavlink_heartbeat_t newmsg;
+						MavlinkFrameParser::decode(frame, &msg);
+						mavlink_msg_heartbeat_decode(&msg, &newmsg);
+
+						if(true==armed && !(newmsg.base_mode & MAV_MODE_FLAG_SAFETY_ARMED)){
+							fprintf(stderr, "Video Record: Drone no longer armed, stop recording on next key frame.\n");
+						}else if(false==armed && (newmsg.base_mode & MAV_MODE_FLAG_SAFETY_ARMED)){
+							fprintf(stderr, "Video Record: Drone is now armed!\n");
 						}
-					}				
+						armed = newmsg.base_mode & MAV_MODE_FLAG_SAFETY_ARMED;
+						recordIndex.setArmed(timeMicrosec(), armed);
+					}
+					//fprintf(stderr, "Mavlink MSG: %d\n", frame.msgid);
+					if(frame.msgid == MAVLINK_MSG_ID_GLOBAL_POSITION_INT){ //#33
+						//fprintf(stderr, "Mavlink MSG: %d\n", frame.msgid);
+						mavlink_global_position_int_t newmsg;
+						MavlinkFrameParser::decode(frame, &msg);
+						mavlink_msg_global_position_int_decode(&msg, &newmsg);
+						recordIndex.position(timeMicrosec(), newmsg.lat, newmsg.lon, newmsg.alt, newmsg.relative_alt, newmsg.hdg);
+						latitude =  ((float)newmsg.lat)/10000000;
+						longitude = ((float)newmsg.lon)/10000000;
+						altitudeMSL = ((float)newmsg.alt)/1000;
+						altitude = ((float)newmsg.alt)/1000;
+						fprintf(stderr, "Last known drone position: (%.6f;%.6f) Altitude (MSL):%.0f [meters] Altitude (above ground):%.0f [meters]",latitude,longitude, altitudeMSL, altitude);
+						//fprintf(stderr, "Last known drone position: %.6f",latitude);
+						if(true==armed){			
+							fprintf(stderr, " FC=ARMED\n");							
+						}else{
+							fprintf(stderr, " FC=DISARMED\n");							
+						}	
+					}
 				}
 			}
 		}
@@ -314,154 +334,14 @@ int main(int argc, char *argv[])
 				fprintf(stderr, "Video Record: Error! on reading STD_IN (pipe input)... Terminate program.\n");
 				exit(1);
 			}else  if(result == 0){
-				// EOF
-				// printf(stderr, "Video Record: Warning! Lost connection to stdin. Please make sure that a data source is connected\n");
+				// EOF, the video pipe is closed. Finish the file so it has the last GOP.
+				fprintf(stderr, "Video Record: End of video pipe, stopping.\n");
+				recorder.close();
+				exit(0);
 			}else { // Data from video pipe.
-				// Write data to STDOUT.
-				//write(STDOUT_FILENO, inputBuffer, result);
-
-				// Record: Scan all data while file is not created, (looking for header and P frame)
-				if( (false==recordStream.SPSHeaderFound) || (false==recordStream.PPSHeaderFound) || (false==recordStream.fileCreated) ){
-					int index=0;
-					for(index=0;index<result-5;index++){
-						if(inputBuffer[index] == 0x00 && inputBuffer[index+1] == 0x00 && inputBuffer[index+2] == 0x00 && inputBuffer[index+3] == 0x01){ // Header code found
-							if(inputBuffer[index+4] == SPS_HEADER_CODE){
-								fprintf(stderr, "Video Record: Video SPS 0x27 header found!");
-								for(int b=0; b<SPS_HEADER_SIZE; b++){
-									if(index+SPS_HEADER_SIZE < result){
-										recordStream.SPSHeader[b]=inputBuffer[index+5+b];
-										fprintf(stderr, "%02x ",recordStream.SPSHeader[b]);
-									}
-								}
-								recordStream.SPSHeaderFound = true;
-								fprintf(stderr, "\n");
-							}else if(inputBuffer[index+4] == PPS_HEADER_CODE){
-								fprintf(stderr, "Video Record: Video PPS 0x28 header found!: ");
-								for(int b=0; b<PPS_HEADER_SIZE; b++){
-									if(index+PPS_HEADER_SIZE < result){
-										recordStream.PPSHeader[b]=inputBuffer[index+5+b];
-										fprintf(stderr, "%02x ",recordStream.PPSHeader[b]);
-									}
-								}
-								recordStream.PPSHeaderFound = true;
-								fprintf(stderr, "\n");
-							}else if( (inputBuffer[index+4] == P_HEADER_CODE) && (true==armed)){
-								fprintf(stderr, "Video Record: Video P   0x25 header (keyframe) found! - SPS=%d PPS=%d armed=%d\n",recordStream.SPSHeaderFound, recordStream.PPSHeaderFound, armed);
-								
-								if((true==recordStream.SPSHeaderFound) && (true==recordStream.PPSHeaderFound)){ // If we have found headers, then start the file.
-									if(false==recordStream.fileCreated){ // create the file
-										char buf[34]; // size of header: 34
-										buf[0]=0x00;
-										buf[1]=0x00;
-										buf[2]=0x00;
-										buf[3]=0x01;										
-										buf[4]=SPS_HEADER_CODE;										
-										for(int a=0;a<SPS_HEADER_SIZE;a++){
-											buf[5+a]=recordStream.SPSHeader[a];											
-										}	
-																
-										buf[SPS_HEADER_SIZE+5]=0x00;
-										buf[SPS_HEADER_SIZE+6]=0x00;
-										buf[SPS_HEADER_SIZE+7]=0x00;
-										buf[SPS_HEADER_SIZE+8]=0x01;
-										buf[SPS_HEADER_SIZE+9]=PPS_HEADER_CODE;		
-										for(int a=0;a<PPS_HEADER_SIZE;a++){
-											buf[SPS_HEADER_SIZE+10+a]=recordStream.PPSHeader[a];
-										}
-										
-										buf[SPS_HEADER_SIZE+PPS_HEADER_SIZE+10]=0x00;
-										buf[SPS_HEADER_SIZE+PPS_HEADER_SIZE+11]=0x00;
-										buf[SPS_HEADER_SIZE+PPS_HEADER_SIZE+12]=0x00;
-										buf[SPS_HEADER_SIZE+PPS_HEADER_SIZE+13]=0x01;
-										buf[SPS_HEADER_SIZE+PPS_HEADER_SIZE+14]=P_HEADER_CODE;
-						
-										
-										fprintf(stderr, "Writing header: ");
-										for(int a=0;a<sizeof(buf);a++){
-											fprintf(stderr, "%02x ",(uint8_t)buf[a]);
-										}
-										fprintf(stderr, "\n");
-											
-										delete videoRecordFile; // lets make a new one.
-										// current date/time based on current system
-										time_t now = time(0);	
-									    // convert now to tm struct for UTC
-									    tm *gmtm = gmtime(&now);
-										
-										sprintf(recordename,"%02d-%02d-%04d_%02d-%02d-%02d_%s.h264",gmtm->tm_mday,gmtm->tm_mon,gmtm->tm_year+1900,gmtm->tm_hour,gmtm->tm_min,gmtm->tm_sec,filename);
-										sprintf(mp4name,"%02d-%02d-%04d_%02d-%02d-%02d_%s.mp4",gmtm->tm_mday,gmtm->tm_mon,gmtm->tm_year+1900,gmtm->tm_hour,gmtm->tm_min,gmtm->tm_sec,filename);																				
-										videoRecordFile = new std::ofstream(recordename,std::ofstream::binary);
-																														
-										videoRecordFile->write(buf,sizeof(buf));	 // write header to output file									
-										/*
-										fprintf(stderr, "Writing rest: ");
-										for(int a=0;a<=(sizeof(inputBuffer)-index-5);a++){
-											fprintf(stderr, "%02x ",(uint8_t)inputBuffer[index+5+a]);
-										}
-										fprintf(stderr, "\n");
-										*/
-										
-										// Write the rest of the result buffer:
-										videoRecordFile->write(&inputBuffer[index+5],sizeof(inputBuffer)-index-5);	 // write header to output file									
-
-										recordStream.fileCreated=true;
-										
-										fprintf(stderr, "Video Record: Output file %s created and ready for recording\n",recordename);
-									
-										recordStream.bytesRecorded=34+sizeof(inputBuffer)-index-5;
-
-										// debug stop here.
-										//write(STDOUT_FILENO, inputBuffer, result);	
-										//videoRecordFile->close();
-										//exit(0);
-									}
-								}
-							}else{
-								// fprintf(stderr, "Unknown header: %02x found with first data: %02x\n", inputBuffer[index+4],inputBuffer[index+5]);
-							}
-						}
-					}
-				}else{
-					if( (true==armed) && (recordStream.bytesRecorded < MAX_FILE_SIZE) ){
-						videoRecordFile->write(inputBuffer,result);
-						recordStream.bytesRecorded+=result; // count how much we have recoreded. if to large (2GB on fat 32) we must then change file.				
-					}else{ // not armed or file to large
-						if(true==recordStream.fileCreated){ // file has been created, thus we are active. 
-							// record until next Key frame:
-							int index=0;
-							bool keyFrameFound = false;
-							for(index=0;index<result-5;index++){
-								if(inputBuffer[index] == 0x00 && inputBuffer[index+1] == 0x00 && inputBuffer[index+2] == 0x00 && inputBuffer[index+3] == 0x01 && inputBuffer[index+4] == P_HEADER_CODE){ // look for key frame
-									// key frame found 
-									fprintf(stderr, "Video Record: Keyframe found on index %d\n", index);
-									keyFrameFound=true;
-									break;
-								}
-							}
-							
-							if(keyFrameFound){ // write all data upto keyframe
-								fprintf(stderr, "Video Record: writing %d bytes up to keyframe, then closing file\n", index);
-								videoRecordFile->write(inputBuffer,index);							
-								videoRecordFile->close();
-								fprintf(stderr, "Video Record: Record file: %s closed, total bytes written: %u\n", recordename, recordStream.bytesRecorded+index);
-								recordStream.fileCreated=false;	
-								
-								// convert to mp4:
-								fprintf(stderr, "Video Record: Converting h264 file %s to mp4 file %s\n", recordename, mp4name);
-								sprintf(command, "ffmpeg -r 30 -i %s -c copy %s &",recordename, mp4name);
-								system(command);
-
-//								fileNumber++; // increase file for next recording.
-//								sprintf(recordename,"%s%d.h264",filename,fileNumber);
-//								delete videoRecordFile;
-//								videoRecordFile = new std::ofstream(recordename,std::ofstream::binary);
-							}else{ // keep writing:
-								videoRecordFile->write(inputBuffer,result);
-								recordStream.bytesRecorded+=result;			
-							}						
-						}						
-					}
-				}								
+				// The recorder starts and stops the file on keyframes, and splits it at MAX_FILE_SIZE.
+				recorder.setRecording(armed);
+				recorder.inputData((uint8_t *)inputBuffer, result, timeMicrosec());
 			}
 		}		
 		
@@ -483,6 +363,11 @@ int main(int argc, char *argv[])
 				}																																				 
 				bzero(&linkstatus, sizeof(linkstatus));
 				*/
+				if(recorder.isRecording()){
+					fprintf(stderr, "Video Record: Recording %s %u frames %.1fMB\n", recorder.getFileName(), recorder.getFrames(), recorder.getFileSize()/(1024.0*1024.0));
+				}else if(preRecordSeconds > 0){
+					fprintf(stderr, "Video Record: Pre-arm ring %.1fs %.1fMB\n", recorder.getPreRecordSeconds(), recorder.getPreRecordBytes()/(1024.0*1024.0));
+				}
 				nextPrintTime = time(NULL) + LOG_INTERVAL_SEC;
 			}
 		}